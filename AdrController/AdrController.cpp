@@ -0,0 +1,157 @@
+#include "AdrController.h"
+
+#include <string.h>
+
+AdrController::AdrController(uint8_t spreadingFactor) : currentSF(spreadingFactor), targetSF(spreadingFactor) {}
+
+float AdrController::snrFloor(uint8_t spreadingFactor) {
+  // SX1280 datasheet, -2.5 dB at SF5 and 2.5 dB lower for every step up to -20 dB at SF12
+  return -2.5f * (spreadingFactor - 4);
+}
+
+uint8_t AdrController::requiredSF(float snr) {
+  for (uint8_t sf = ADR_MIN_SF; sf < ADR_MAX_SF; sf++) {
+    if (snr - snrFloor(sf) >= ADR_MARGIN_DB) {
+      return sf;
+    }
+  }
+  return ADR_MAX_SF;
+}
+
+void AdrController::reportChild(const uint8_t* childAddr, uint8_t spreadingFactor, unsigned long now) {
+  if (spreadingFactor < ADR_MIN_SF || spreadingFactor > ADR_MAX_SF) {
+    spreadingFactor = ADR_MAX_SF;
+  }
+  // the child's own entry, else a free one, else the one heard from least recently
+  Child* child = NULL;
+  Child* oldest = &children[0];
+  for (int i = 0; i < ADR_CHILDREN; i++) {
+    if (children[i].used == true && memcmp(children[i].MACaddr, childAddr, MAC_ADDR_LENGTH) == 0) {
+      child = &children[i];
+      break;
+    }
+    if (children[i].used == false) {
+      if (child == NULL) {
+        child = &children[i];
+      }
+    } else if (oldest->used == true && now - children[i].lastHeard > now - oldest->lastHeard) {
+      oldest = &children[i];
+    }
+  }
+  if (child == NULL) {
+    child = oldest;
+  }
+  memcpy(child->MACaddr, childAddr, MAC_ADDR_LENGTH);
+  child->spreadingFactor = spreadingFactor;
+  child->lastHeard = now;
+  child->used = true;
+}  // reportChild
+
+void AdrController::reportUplink(float snr) {
+  uplinkSF = requiredSF(snr);
+  uplinkTimeouts = 0;
+}
+
+void AdrController::uplinkTimeout() {
+  // a single lost frame is no reason to slow the whole network down
+  if (++uplinkTimeouts < ADR_TIMEOUTS_PER_STEP) {
+    return;
+  }
+  uplinkTimeouts = 0;
+  uint8_t base = uplinkSF > currentSF ? uplinkSF : currentSF;
+  uplinkSF = base < ADR_MAX_SF ? base + 1 : ADR_MAX_SF;
+}
+
+uint8_t AdrController::childrenSF(unsigned long now) {
+  uint8_t highest = 0;
+  for (int i = 0; i < ADR_CHILDREN; i++) {
+    Child& child = children[i];
+    if (child.used == false) {
+      continue;
+    }
+    unsigned long age = now - child.lastHeard;
+    if (age >= ADR_CHILD_TIMEOUT + ADR_LOST_HOLD) {
+      child.used = false;
+      continue;
+    }
+    // a child gone quiet may have lost us at this SF, make room for it at the slowest one
+    uint8_t sf = age >= ADR_CHILD_TIMEOUT ? ADR_MAX_SF : child.spreadingFactor;
+    if (sf > highest) {
+      highest = sf;
+    }
+  }
+  return highest;
+}  // childrenSF
+
+uint8_t AdrController::subtreeSF(unsigned long now) {
+  uint8_t sf = childrenSF(now);
+  return sf > uplinkSF ? sf : uplinkSF;
+}
+
+void AdrController::announce(uint8_t spreadingFactor, unsigned long switchIn, unsigned long now) {
+  if (spreadingFactor < ADR_MIN_SF || spreadingFactor > ADR_MAX_SF) {
+    return;
+  }
+  if (spreadingFactor == targetSF) {
+    return;
+  }
+  setTarget(spreadingFactor, now + switchIn);
+}
+
+void AdrController::decide(unsigned long now) {
+  uint8_t wanted = childrenSF(now);
+  if (wanted == 0) {
+    // nobody joined yet, listen where new nodes start
+    wanted = ADR_MAX_SF;
+  }
+  if (wanted > targetSF) {
+    lowering = false;
+    setTarget(wanted, now + ADR_SWITCH_DELAY);
+  } else if (wanted < targetSF) {
+    if (lowering == false) {
+      lowering = true;
+      lowerSince = now;
+    } else if (now - lowerSince >= ADR_LOWER_HOLD) {
+      lowering = false;
+      setTarget(wanted, now + ADR_SWITCH_DELAY);
+    }
+  } else {
+    lowering = false;
+  }
+}  // decide
+
+unsigned long AdrController::switchIn(unsigned long now) const {
+  if (targetSF == currentSF || (long)(switchTime - now) <= 0) {
+    return 0;
+  }
+  return switchTime - now;
+}
+
+uint8_t AdrController::switchDue(unsigned long now) {
+  if (targetSF == currentSF || (long)(now - switchTime) < 0) {
+    return 0;
+  }
+  currentSF = targetSF;
+  scanAttempts = 0;
+  return currentSF;
+}
+
+uint8_t AdrController::discoveryFailed() {
+  if (++scanAttempts < (currentSF >= ADR_MAX_SF ? ADR_SCAN_HOME_ATTEMPTS : ADR_SCAN_ATTEMPTS)) {
+    return 0;
+  }
+  scanAttempts = 0;
+  currentSF = currentSF >= ADR_MAX_SF ? ADR_MIN_SF : currentSF + 1;
+  targetSF = currentSF;
+  // the next parent's link is unknown until its first reply
+  uplinkSF = ADR_MAX_SF;
+  return currentSF;
+}  // discoveryFailed
+
+void AdrController::setTarget(uint8_t spreadingFactor, unsigned long switchAt) {
+  if (spreadingFactor == targetSF) {
+    return;
+  }
+  targetSF = spreadingFactor;
+  switchTime = switchAt;
+}
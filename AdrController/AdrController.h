@@ -0,0 +1,119 @@
+/** ADR Controller
+ *  Adaptive data rate for the LoRa mesh: runs the network at the lowest
+ *  spreading factor that every link of the tree still decodes with
+ *  ADR_MARGIN_DB to spare.
+ *
+ *  SX1280 LoRa frames at different spreading factors do not demodulate each
+ *  other, so a parent and its children have to agree on one operating SF.
+ *  Replies carry the SNR the replier measured on the frame they answer, and
+ *  every DATA_MESSAGE carries the SF the sender's subtree needs: the highest
+ *  of its own uplink's and of those its children reported. The master picks
+ *  the operating SF from its children's reports and announces it in its
+ *  replies together with the time left until it applies, ADR_SWITCH_DELAY
+ *  after the decision. Relays pass both on in their replies, so the whole
+ *  tree switches at about the same moment.
+ *
+ *  Raising the SF is decided at once, lowering it only once the reports have
+ *  allowed it for ADR_LOWER_HOLD. Lost acks form the fallback ladder: every
+ *  ADR_TIMEOUTS_PER_STEP timeouts of the oldest data packet without a reply
+ *  in between ask for one SF more, and a child that goes quiet counts as needing ADR_MAX_SF for a
+ *  while, so a node cut off by a too fast SF is found again at SF12. An
+ *  isolated node steps its SF upward every ADR_SCAN_ATTEMPTS unanswered
+ *  discovery messages. It dwells longer at ADR_MAX_SF, where the network
+ *  comes looking for it, before wrapping to ADR_MIN_SF to find a network
+ *  that already runs at a lower SF.
+ *
+ *  Times are in ms and passed in, SFs are 5..12 as for setSpreadingFactor.
+ */
+
+#ifndef ADR_CONTROLLER_H
+#define ADR_CONTROLLER_H
+
+#include <stdint.h>
+#include "LoraPacket.h"
+
+#define ADR_MIN_SF 5
+#define ADR_MAX_SF 12
+#define ADR_MARGIN_DB 10.0f        // SNR kept above the demodulation floor
+#define ADR_CHILDREN 16            // children whose reports are remembered
+#define ADR_CHILD_TIMEOUT 60000    // a child not heard for this long counts as lost
+#define ADR_LOST_HOLD 120000       // a lost child asks for ADR_MAX_SF this long, then is forgotten
+#define ADR_LOWER_HOLD 60000       // reports must allow a lower SF this long before it is used
+#define ADR_SWITCH_DELAY 30000     // from deciding a new SF to switching, at most LORA_MAX_SWITCH_IN s
+#define ADR_TIMEOUTS_PER_STEP 2    // ack timeouts in a row that ask for one SF more
+#define ADR_SCAN_ATTEMPTS 2        // unanswered discovery messages per SF while isolated
+#define ADR_SCAN_HOME_ATTEMPTS 16  // the same at ADR_MAX_SF, where a lost node is looked for
+
+class AdrController {
+public:
+  explicit AdrController(uint8_t spreadingFactor);
+
+  // SNR in dB below which the SX1280 can no longer demodulate the SF
+  static float snrFloor(uint8_t spreadingFactor);
+
+  // lowest SF that keeps ADR_MARGIN_DB above its floor at the given SNR in dB
+  static uint8_t requiredSF(float snr);
+
+  // a child's DATA_MESSAGE arrived with the SF its subtree needs
+  void reportChild(const uint8_t* childAddr, uint8_t spreadingFactor, unsigned long now);
+
+  // a reply from the parent arrived, SNR in dB of the worse direction
+  void reportUplink(float snr);
+
+  // the oldest data packet went unanswered, ask for a more robust SF
+  void uplinkTimeout();
+
+  // highest SF any child needs, 0 without children
+  uint8_t childrenSF(unsigned long now);
+
+  // SF this node and everything below it needs, sent in its DATA_MESSAGEs
+  uint8_t subtreeSF(unsigned long now);
+
+  // the parent announced the operating SF, applying in switchIn ms
+  void announce(uint8_t spreadingFactor, unsigned long switchIn, unsigned long now);
+
+  // master only, picks the operating SF from the children's reports
+  void decide(unsigned long now);
+
+  // SF to switch the radio to now, 0 if it stays
+  uint8_t switchDue(unsigned long now);
+
+  // a discovery message went unanswered, returns the SF to switch the
+  // radio to, 0 if it stays
+  uint8_t discoveryFailed();
+
+  // SF the radio runs at
+  uint8_t current() const {
+    return currentSF;
+  }
+
+  // operating SF announced in replies
+  uint8_t target() const {
+    return targetSF;
+  }
+
+  // ms until the announced SF applies, 0 if it already does
+  unsigned long switchIn(unsigned long now) const;
+
+private:
+  typedef struct Child {
+    uint8_t MACaddr[MAC_ADDR_LENGTH];
+    uint8_t spreadingFactor;
+    unsigned long lastHeard;
+    bool used;
+  } Child;
+
+  Child children[ADR_CHILDREN] = {};
+  uint8_t currentSF;
+  uint8_t targetSF;
+  uint8_t uplinkSF = ADR_MAX_SF;  // unknown until the first reply
+  uint8_t uplinkTimeouts = 0;
+  unsigned long switchTime = 0;
+  unsigned long lowerSince = 0;
+  bool lowering = false;
+  uint8_t scanAttempts = 0;
+
+  void setTarget(uint8_t spreadingFactor, unsigned long switchAt);
+};
+
+#endif  // ADR_CONTROLLER_H
@@ -0,0 +1,66 @@
+#include "AirtimeMeter.h"
+
+#include <string.h>
+#include <math.h>
+
+AirtimeMeter::AirtimeMeter(uint8_t spreadingFactor, float bandwidth, uint8_t codingRate, uint16_t preambleLength)
+  : spreadingFactor(spreadingFactor), bandwidth(bandwidth), codingRate(codingRate), preambleLength(preambleLength) {}
+
+void AirtimeMeter::setSpreadingFactor(uint8_t spreadingFactor) {
+  this->spreadingFactor = spreadingFactor;
+}
+
+uint32_t AirtimeMeter::timeOnAir(uint8_t length) const {
+  // SX1280 datasheet, the low data rate spreading factors use a longer header
+  float c1 = 6.25f;
+  int c2 = 4 * spreadingFactor;
+  int c3 = 4 * spreadingFactor;
+  if (spreadingFactor >= 11) {
+    c1 = 4.25f;
+    c2 = 4 * spreadingFactor + 8;
+    c3 = 4 * (spreadingFactor - 2);
+  }
+  // payload bits plus 16 bit CRC and 20 bit header
+  int bits = 8 * length + 16 - c2 + 20;
+  if (bits < 0) {
+    bits = 0;
+  }
+  float symbols = preambleLength + c1 + 8 + ((bits + c3 - 1) / c3) * codingRate;
+  float symbolTime = (float)(1UL << spreadingFactor) / bandwidth;  // ms
+  return (uint32_t)lroundf(symbols * symbolTime * 1000.0f);
+}  // timeOnAir
+
+float AirtimeMeter::transmitCharge(uint8_t length) const {
+  return timeOnAir(length) / 1000.0f * ENERGY_TX_CURRENT_MA;
+}
+
+void AirtimeMeter::addTransmit(uint8_t length) {
+  txTime += timeOnAir(length);
+}
+
+void AirtimeMeter::addReceive(uint8_t length) {
+  rxTime += timeOnAir(length);
+}
+
+void AirtimeMeter::addReading() {
+  if (readings < UINT16_MAX) {
+    readings++;
+  }
+}
+
+uint32_t AirtimeMeter::charge(unsigned long uptime) const {
+  // mA * ms / 3600 = uAh
+  float idle = ENERGY_IDLE_CURRENT_MA * uptime;
+  float rx = ENERGY_RX_CURRENT_MA * (rxTime / 1000.0f);
+  float tx = ENERGY_TX_CURRENT_MA * (txTime / 1000.0f);
+  return (uint32_t)((idle + rx + tx) / 3600.0f);
+}
+
+void AirtimeMeter::fillRecord(LoraStatsRecord* record, const uint8_t* macAddr, unsigned long uptime) const {
+  memcpy(record->MACaddr, macAddr, MAC_ADDR_LENGTH);
+  record->uptime = uptime / 1000;
+  record->txTime = txTime / 1000;
+  record->rxTime = rxTime / 1000;
+  record->readings = readings;
+  record->charge = charge(uptime);
+}
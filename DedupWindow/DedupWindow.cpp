@@ -0,0 +1,97 @@
+#include "DedupWindow.h"
+
+#include <string.h>
+
+DedupResult DedupWindow::check(const uint8_t* origin, uint16_t seq) {
+  Origin* entry = find(origin);
+  if (entry == NULL) {
+    entry = add(origin);
+    anchor(entry, seq);
+    return DEDUP_NEW;
+  }
+
+  int16_t ahead = (int16_t)(seq - entry->highestSeq);
+  if (ahead > 0) {
+    slide(entry, ahead);
+    entry->highestSeq = seq;
+    entry->seen[0] |= 1;
+    entry->behindRun = 0;
+    return DEDUP_NEW;
+  }
+
+  uint16_t behind = -ahead;
+  if (behind >= DEDUP_HISTORY_BITS) {
+    if (++entry->behindRun >= DEDUP_RESTART_RUN) {
+      // the origin has most likely restarted, its recent seqs lie behind
+      anchor(entry, seq);
+      return DEDUP_NEW;
+    }
+    unchecked++;
+    return DEDUP_UNCHECKED;
+  }
+  entry->behindRun = 0;
+
+  uint32_t& word = entry->seen[behind / 32];
+  uint32_t bit = (uint32_t)1 << (behind % 32);
+  if (word & bit) {
+    duplicates++;
+    return DEDUP_DUPLICATE;
+  }
+  word |= bit;
+  return DEDUP_NEW;
+}  // check
+
+DedupWindow::Origin* DedupWindow::find(const uint8_t* origin) {
+  for (int i = 0; i < DEDUP_ORIGINS; i++) {
+    if (origins[i].used == true && memcmp(origins[i].MACaddr, origin, MAC_ADDR_LENGTH) == 0) {
+      origins[i].lastHeard = ++clock;
+      return &origins[i];
+    }
+  }
+  return NULL;
+}
+
+// a free entry, or the one heard from least recently
+DedupWindow::Origin* DedupWindow::add(const uint8_t* origin) {
+  Origin* entry = &origins[0];
+  for (int i = 0; i < DEDUP_ORIGINS; i++) {
+    if (origins[i].used == false) {
+      entry = &origins[i];
+      break;
+    }
+    if (origins[i].lastHeard < entry->lastHeard) {
+      entry = &origins[i];
+    }
+  }
+  if (entry->used == true) {
+    evicted++;
+  }
+  memcpy(entry->MACaddr, origin, MAC_ADDR_LENGTH);
+  entry->lastHeard = ++clock;
+  entry->used = true;
+  return entry;
+}
+
+void DedupWindow::anchor(Origin* entry, uint16_t seq) {
+  memset(entry->seen, 0, sizeof(entry->seen));
+  entry->seen[0] = 1;
+  entry->highestSeq = seq;
+  entry->behindRun = 0;
+}
+
+// move bit i of the history to bit i + ahead
+void DedupWindow::slide(Origin* entry, uint16_t ahead) {
+  if (ahead >= DEDUP_HISTORY_BITS) {
+    memset(entry->seen, 0, sizeof(entry->seen));
+    return;
+  }
+  int words = ahead / 32;
+  int bits = ahead % 32;
+  for (int i = DEDUP_HISTORY_WORDS - 1; i >= 0; i--) {
+    uint32_t value = i >= words ? entry->seen[i - words] << bits : 0;
+    if (bits > 0 && i > words) {
+      value |= entry->seen[i - words - 1] >> (32 - bits);
+    }
+    entry->seen[i] = value;
+  }
+}  // slide
@@ -0,0 +1,77 @@
+/** Dedup Window
+ *  Passes each reading on once at the master, however many copies of it
+ *  arrive: retransmissions of a LoRa batch whose reply was lost, copies
+ *  sent to two ESP-NOW parents, or a reading that went over both
+ *  protocols around a switch. Readings are told apart by origin MAC and
+ *  the origin seq both protocols carry.
+ *
+ *  Each origin keeps a DEDUP_HISTORY_BITS seq bitmap behind the highest
+ *  seq seen, which slides forward as newer seqs arrive. Origins are looked
+ *  up by MAC in a table of DEDUP_ORIGINS; when it is full the least
+ *  recently heard origin is forgotten, so memory stays fixed at about
+ *  2 KB.
+ *
+ *  A reading further behind than the bitmap, e.g. backlog sent after a
+ *  long outage, cannot be checked and is passed on. A run of
+ *  DEDUP_RESTART_RUN such readings in a row means the origin restarted
+ *  with a new seq, and the bitmap moves to it.
+ */
+
+#ifndef DEDUP_WINDOW_H
+#define DEDUP_WINDOW_H
+
+#include <stdint.h>
+#include "LoraPacket.h"
+
+#define DEDUP_ORIGINS 64
+#define DEDUP_HISTORY_WORDS 4  // 128 seqs, about 10 min of readings at 5 s
+#define DEDUP_HISTORY_BITS (32 * DEDUP_HISTORY_WORDS)
+#define DEDUP_RESTART_RUN 32
+
+enum DedupResult : uint8_t {
+  DEDUP_NEW,
+  DEDUP_DUPLICATE,
+  DEDUP_UNCHECKED  // too far behind to tell, passed on
+};
+
+class DedupWindow {
+public:
+  // record the reading and tell whether it has been seen before
+  DedupResult check(const uint8_t* origin, uint16_t seq);
+
+  uint32_t getDuplicates() const {
+    return duplicates;
+  }
+
+  uint32_t getUnchecked() const {
+    return unchecked;
+  }
+
+  // origins forgotten to make room for others
+  uint32_t getEvicted() const {
+    return evicted;
+  }
+
+private:
+  typedef struct Origin {
+    uint8_t MACaddr[MAC_ADDR_LENGTH];
+    uint16_t highestSeq;
+    uint8_t behindRun;                      // readings in a row too far behind
+    bool used;
+    uint32_t lastHeard;
+    uint32_t seen[DEDUP_HISTORY_WORDS];     // bit i set if highestSeq - i was seen
+  } Origin;
+
+  Origin origins[DEDUP_ORIGINS] = {};
+  uint32_t clock = 0;
+  uint32_t duplicates = 0;
+  uint32_t unchecked = 0;
+  uint32_t evicted = 0;
+
+  Origin* find(const uint8_t* origin);
+  Origin* add(const uint8_t* origin);
+  void anchor(Origin* entry, uint16_t seq);
+  void slide(Origin* entry, uint16_t ahead);
+};
+
+#endif  // DEDUP_WINDOW_H
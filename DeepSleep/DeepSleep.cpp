@@ -0,0 +1,74 @@
+#include "DeepSleep.h"
+#include "Log.h"
+
+#include <esp_sleep.h>
+
+RTC_DATA_ATTR DeepSleepState sleepState;
+
+// set in deepSleepRestore(), a route the last wake ended with
+static bool cachedLora = false;
+static bool cachedEspnow = false;
+
+bool deepSleepWoke() {
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && sleepState.magic == DEEP_SLEEP_MAGIC) {
+    return true;
+  }
+  // power on or reset, the counters start afresh
+  sleepState = {};
+  return false;
+}
+
+void deepSleepRestore(unsigned long now) {
+  setReadingSeq(sleepState.readingSeq);
+  protocolManager.begin(sleepState.protocol, now);
+  loraRestoreState(sleepState.lora);
+  espnowRestoreState(sleepState.espnow);
+  cachedLora = sleepState.lora.parentCount > 0;
+  cachedEspnow = sleepState.espnow.parentCount > 0;
+}
+
+bool deepSleepReady(unsigned long now) {
+  if (now >= DEEP_SLEEP_MAX_AWAKE) {
+    return true;
+  }
+  return sensorScheduler.getReadings() > 0 && loraIdle() && espnowIdle() && readingBacklog.isEmpty();
+}
+
+void deepSleepStart(unsigned long ms, unsigned long now) {
+  if (now >= DEEP_SLEEP_MAX_AWAKE) {
+    // nothing of the backlog may be lost, flash keeps it across the sleep
+    loraSaveUnsent(now);
+    readingBacklog.spillAll();
+    sleepState.gaveUp++;
+  }
+
+  sleepState.magic = DEEP_SLEEP_MAGIC;
+  sleepState.readingSeq = getReadingSeq();
+  sleepState.protocol = protocolManager.current();
+  loraSaveState(&sleepState.lora);
+  espnowSaveState(&sleepState.espnow);
+  if ((cachedLora && sleepState.lora.parentCount == 0) || (cachedEspnow && sleepState.espnow.parentCount == 0)) {
+    sleepState.rediscovered++;
+  }
+
+  uint32_t awake = millis();
+  sleepState.wakes++;
+  sleepState.lastAwake = awake;
+  if (awake > sleepState.maxAwake) {
+    sleepState.maxAwake = awake;
+  }
+  sleepState.totalAwake += awake;
+  LOG_INFO("Deep sleep for %lu ms after %lu ms awake, mean %lu ms, max %lu ms over %lu wakes, "
+           "awake %.2f %%, %lu rediscovered, %lu gave up",
+           ms, (unsigned long)awake, (unsigned long)(sleepState.totalAwake / sleepState.wakes),
+           (unsigned long)sleepState.maxAwake, (unsigned long)sleepState.wakes,
+           sleepState.totalAwake * 100.0f / (sleepState.totalAwake + sleepState.totalSlept),
+           (unsigned long)sleepState.rediscovered, (unsigned long)sleepState.gaveUp);
+  sleepState.totalSlept += ms;
+  logFlush();
+  Serial.flush();
+
+  loraSleep();
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+  esp_deep_sleep_start();
+}  // deepSleepStart
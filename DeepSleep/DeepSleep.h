@@ -0,0 +1,73 @@
+/** Deep Sleep
+ *  Duty cycled leaf mode: the node wakes, takes a reading, sends it and
+ *  powers down until the next one, instead of staying up between them.
+ *
+ *  RAM is lost in deep sleep, so what a leaf needs to send right away is
+ *  kept in RTC memory, which is not:
+ *
+ *    LoRa      parents with their round trip estimates, level, seq, SF
+ *    ESP-NOW   best parents with their hop counts and delivery ratios
+ *    readings  the origin seq, so the master's DedupWindow sees no restart
+ *    link      the protocol the readings went over
+ *
+ *  A wake restores that state after the stacks are set up and sends to
+ *  the cached parents as if it had never slept. Discovery only starts
+ *  once they fail: LoRa drops a parent after MAX_RETRY timeouts, ESP-NOW
+ *  in leaf mode on the first failed send. A leaf answers no discovery,
+ *  so no node picks a parent that is asleep most of the time.
+ *
+ *  The node sleeps once a reading is taken and neither stack has data
+ *  outstanding. A wake that takes longer than DEEP_SLEEP_MAX_AWAKE, e.g.
+ *  without any route, gives up: unacknowledged readings go back to the
+ *  backlog, which spills to flash, and the node sleeps anyway.
+ *
+ *  Every wake's time from boot to sleep is measured, deepSleepStart()
+ *  prints it with the mean, the maximum and the duty cycle over all wakes
+ *  since power on, and how many wakes had to rediscover a cached route.
+ *
+ *  Times are in ms.
+ */
+
+#ifndef DEEP_SLEEP_H
+#define DEEP_SLEEP_H
+
+#include <stdint.h>
+#include "MACaddr.h"
+#include "LoraCommunication.h"
+#include "ESPNowCommunication.h"
+#include "ProtocolManager.h"
+
+#define DEEP_SLEEP_MAGIC 0x44534C32  // "DSL2", RTC memory holds garbage after power on or another layout
+#define DEEP_SLEEP_MAX_AWAKE 10000   // a wake gives up on sending after this long
+#define DEEP_SLEEP_MIN 1000          // shorter sleeps are not worth a boot, the node stays up
+
+typedef struct DeepSleepState {
+  uint32_t magic;
+  uint16_t readingSeq;
+  Protocol protocol;
+  LoraSleepState lora;
+  EspNowSleepState espnow;
+
+  uint32_t wakes;        // since power on
+  uint32_t rediscovered; // wakes whose cached route failed
+  uint32_t gaveUp;       // wakes that hit DEEP_SLEEP_MAX_AWAKE
+  uint32_t lastAwake;    // ms from boot to sleep
+  uint32_t maxAwake;
+  uint64_t totalAwake;
+  uint64_t totalSlept;
+} DeepSleepState;
+
+// true if this boot is a timer wake from deepSleepStart(), call it first in setup()
+bool deepSleepWoke();
+
+// take the cached routes and seq up again, after the stacks are set up
+void deepSleepRestore(unsigned long now);
+
+// a reading was taken this wake and nothing waits to be sent, or the wake took too long
+bool deepSleepReady(unsigned long now);
+
+// save the state, power the radio down and sleep for ms. Does not return,
+// the node boots into setup() again.
+void deepSleepStart(unsigned long ms, unsigned long now);
+
+#endif  // DEEP_SLEEP_H
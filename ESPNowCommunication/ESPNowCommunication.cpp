@@ -3,94 +3,314 @@
 #include "MACaddr.h"
 
 esp_now_peer_info_t peerInfo = {};
-esp_now_peer_num_t peer_num;
+PeerTable peerTable;
 uint8_t isConnectedToMaster = 0;
 uint8_t numberOfHopsToMaster = 0;
 SensorData sensorData;
 Handshake msg;
 
-void addPeerToPeerList(const uint8_t *macAddr)
+// readings that recently passed through, oldest first
+RingQueue<SeenReading, SEEN_CACHE_CAPACITY> seenReadings;
+
+// events from the Wi-Fi task, drained by the worker. Both callbacks run in
+// the Wi-Fi task, so the ring has a single producer.
+SpscRing<EspNowEvent, ESPNOW_EVENT_RING_SIZE> eventRing;
+TaskHandle_t workerTask = NULL;
+
+// held by the worker and by the loop task while they touch the routing state
+SemaphoreHandle_t espnowMutex = NULL;
+
+// callback instrumentation, written by the Wi-Fi task only
+volatile uint32_t callbackCount = 0;
+volatile uint32_t callbackTotalUs = 0;
+volatile uint32_t callbackMaxUs = 0;
+volatile uint32_t eventsDropped = 0;
+
+// route maintenance, backlog draining and stats printing, run from espnowPoll()
+JobScheduler espnowScheduler;
+
+// when sendToParents() last handed a frame to the driver, for the link latency
+unsigned long lastSentTime = 0;
+
+// when any frame was last handed to the driver, light sleep waits until it is out
+unsigned long lastFrameTime = 0;
+
+// offers no route to others, see espnowSetLeaf()
+bool espnowLeaf = false;
+
+// registered with the driver once in espnowSetup()
+static const uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+void forgetPeer(const uint8_t *macAddr)
+// Drop a peer from the table and from the driver's peer list
 {
+  // removing moves table entries around, so keep a copy of the address
+  uint8_t addr[6];
+  memcpy(addr, macAddr, 6);
+
   char macStr[18];
-  formatMacAddress(macAddr, macStr, 18);
+  formatMacAddress(addr, macStr, 18);
+  LOG_INFO("Forgetting peer: %s", macStr);
+
+  esp_now_del_peer(addr);
+  peerTable.remove(addr);
+}
 
-  Serial.printf("Received peer address: %s\n", macStr);
+PeerEntry *touchPeer(const uint8_t *macAddr)
+// Table entry of the address, the driver learns about it only the first time
+{
+  PeerEntry *peer = peerTable.find(macAddr);
+  if (peer == NULL)
+  {
+    if (peerTable.isFull())
+    {
+      forgetPeer(peerTable.victim()->MACaddr);
+    }
+
+    memcpy(peerInfo.peer_addr, macAddr, 6);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+    esp_err_t result = esp_now_add_peer(&peerInfo);
+    if (result != ESP_OK && result != ESP_ERR_ESPNOW_EXIST)
+    {
+      LOG_WARN("Could not add peer to the list");
+      return NULL;
+    }
+    peer = peerTable.add(macAddr, millis());
+  }
+  peer->lastSeen = millis();
+  return peer;
+}
+
+void updateRoute()
+// Follow the cheapest parent closer to the master than this node. The hop
+// count never grows while connected: without such a parent the route is
+// lost and has to be discovered again, so a node never picks its own
+// descendants as parents.
+{
+  const PeerEntry *parent;
+  uint8_t below = isConnectedToMaster ? numberOfHopsToMaster : ESPNOW_MAX_HOPS;
+  uint8_t connected = peerTable.bestParents(&parent, 1, below, millis()) > 0;
+  uint8_t hops = connected ? parent->hops + 1 : 0;
+  if (connected == isConnectedToMaster && hops == numberOfHopsToMaster)
+  {
+    return;
+  }
 
-  memcpy(peerInfo.peer_addr, macAddr, 6); 
-  peerInfo.channel = 0;                   
-  peerInfo.encrypt = false;              
-  if (!esp_now_is_peer_exist(macAddr))
+  if (connected)
   {
-    esp_now_add_peer(&peerInfo);
-    Serial.println("Added peer to the list");
+    LOG_INFO("Route to the master over %d hops", hops);
   }
   else
   {
-    Serial.println("Peer already exists in the list");
+    LOG_INFO("Lost the route to the master");
+    // whatever we heard about routes may lead back through us
+    peerTable.forgetRoutes();
   }
+  isConnectedToMaster = connected;
+  numberOfHopsToMaster = hops;
+  protocolManager.setAvailable(PROTOCOL_ESPNOW, connected);
+
+  // neighbours follow the change right away instead of at the next advertisement
+  advertiseRoute();
 }
 
-void sendToAllPeers(const SensorData &sensorData)
-// Send the message to each peer in the peer list
+void addPeerToPeerList(const uint8_t *macAddr, uint8_t hops)
+// Remember a node that replied with a route to the master
 {
-  esp_now_get_peer_num(&peer_num);
-  Serial.println("Sending....");
-  for (int i = 0; i < peer_num.total_num; i++)
+  if (LOG_ENABLED(LOG_LEVEL_DEBUG))
   {
-    // Format the MAC address
     char macStr[18];
-    formatMacAddress(peerInfo.peer_addr, macStr, 18);
-    Serial.printf("Peer address to send: %s\n", macStr);
-    if (esp_now_fetch_peer(1, &peerInfo) == ESP_OK)
-    {
-      esp_err_t result = esp_now_send(peerInfo.peer_addr, (const uint8_t *)&sensorData, sizeof(SensorData));
+    formatMacAddress(macAddr, macStr, 18);
+    LOG_DEBUG("Received peer address: %s", macStr);
+  }
 
-      // Print results to serial monitor
-      if (result == ESP_OK)
-      {
-        Serial.printf("Forwarded message to: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                      peerInfo.peer_addr[0], peerInfo.peer_addr[1], peerInfo.peer_addr[2],
-                      peerInfo.peer_addr[3], peerInfo.peer_addr[4], peerInfo.peer_addr[5]);
-      }
-      else
+  PeerEntry *peer = touchPeer(macAddr);
+  if (peer != NULL)
+  {
+    peer->hops = hops;
+  }
+}
+
+bool markSeen(const SensorData &sensorData)
+// Remember a reading on its way up, false if it has passed through here already
+{
+  SeenReading reading;
+  reading.origin = ringQueueHashBytes(sensorData.MACaddr, strnlen(sensorData.MACaddr, MAX_MAC_LENGTH));
+  reading.seq = sensorData.seq;
+
+  // the oldest reading has long been forwarded, its copies are no longer around
+  if (seenReadings.isFull())
+  {
+    seenReadings.removeFromFirst();
+  }
+  return seenReadings.addToLast(reading);
+}
+
+void sendToParents(const SensorData &sensorData)
+// Send the message to the best parent, and to the next best one while the best link is weak
+{
+  // only upwards, towards peers with fewer hops to the master
+  const PeerEntry *parents[MAX_PARENTS];
+  int count = peerTable.bestParents(parents, MAX_PARENTS, numberOfHopsToMaster, millis());
+  if (count > 1 && parents[0]->deliveryRatio >= PEER_BACKUP_RATIO)
+  {
+    count = 1;
+  }
+
+  if (count == 0)
+  {
+    LOG_WARN("No parent to send to");
+  }
+  for (int i = 0; i < count; i++)
+  {
+    esp_err_t result = esp_now_send(parents[i]->MACaddr, (const uint8_t *)&sensorData, sizeof(SensorData));
+
+    // Print results to serial monitor
+    if (result == ESP_OK)
+    {
+      lastSentTime = millis();
+      lastFrameTime = lastSentTime;
+      protocolManager.recordSend(PROTOCOL_ESPNOW, 1, ESPNOW_FRAME_CHARGE);
+      if (LOG_ENABLED(LOG_LEVEL_DEBUG))
       {
-        Serial.println("Error sending message to peer");
+        char macStr[18];
+        formatMacAddress(parents[i]->MACaddr, macStr, 18);
+        LOG_DEBUG("Forwarded message to: %s, %d hops, delivery %d/255", macStr, parents[i]->hops, parents[i]->deliveryRatio);
       }
     }
     else
     {
-      Serial.println("Peer not found");
+      LOG_WARN("Error sending message to peer");
     }
   }
 }
 
+void queueEvent(EspNowEventType type, const uint8_t *macAddr, uint8_t status, const uint8_t *data, int dataLen)
+// Runs in the Wi-Fi task: copy the event into the ring and wake the worker, nothing else
+{
+  uint32_t start = micros();
+
+  EspNowEvent *event = eventRing.reserve();
+  if (event == NULL)
+  {
+    eventsDropped++;
+  }
+  else
+  {
+    event->type = type;
+    memcpy(event->MACaddr, macAddr, 6);
+    event->status = status;
+    event->length = dataLen;
+    memcpy(event->data, data, dataLen < ESPNOW_FRAME_CAPACITY ? dataLen : ESPNOW_FRAME_CAPACITY);
+    eventRing.commit();
+    xTaskNotifyGive(workerTask);
+  }
+
+  uint32_t duration = micros() - start;
+  callbackCount++;
+  callbackTotalUs += duration;
+  if (duration > callbackMaxUs)
+  {
+    callbackMaxUs = duration;
+  }
+}
+
 void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen)
-// Called when data is received
+// Called in the Wi-Fi task when data is received
 {
-  // Format the MAC address
+  queueEvent(ESPNOW_EVENT_RECEIVED, macAddr, 0, data, dataLen);
+}
+
+void sentCallback(const uint8_t *macAddr, esp_now_send_status_t status)
+// Called in the Wi-Fi task with the outcome of a send
+{
+  queueEvent(ESPNOW_EVENT_SENT, macAddr, status, NULL, 0);
+}
+
+void espnowDrainEvents()
+// Decodes, routes and forwards everything the callbacks queued
+{
+  EspNowEvent *event;
+  while ((event = eventRing.front()) != NULL)
+  {
+    xSemaphoreTake(espnowMutex, portMAX_DELAY);
+    if (event->type == ESPNOW_EVENT_RECEIVED)
+    {
+      handleReceived(event->MACaddr, event->data, event->length);
+    }
+    else
+    {
+      handleSent(event->MACaddr, (esp_now_send_status_t)event->status);
+    }
+    xSemaphoreGive(espnowMutex);
+    eventRing.pop();
+  }
+}
+
+void espnowWorker(void *parameter)
+// Sleeps until the callbacks queued something
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    espnowDrainEvents();
+  }
+}
+
+void printEspNowStats()
+// Print how long the callbacks took and how full the event ring got
+{
+  uint32_t count = callbackCount;
+  LOG_INFO("ESP-NOW callbacks: %u, mean %u us, max %u us, ring %u/%u (high water %u), dropped %u",
+           count, count > 0 ? callbackTotalUs / count : 0, callbackMaxUs,
+           (unsigned)eventRing.size(), (unsigned)eventRing.capacity(), (unsigned)eventRing.highWaterMark(), eventsDropped);
+}
+
+void handleReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen)
+// Called by the worker for every received frame
+{
+  // Format the MAC address, only the debug messages print it
   char macStr[18];
-  formatMacAddress(macAddr, macStr, 18);
+  if (LOG_ENABLED(LOG_LEVEL_DEBUG))
+  {
+    formatMacAddress(macAddr, macStr, 18);
+  }
 
   // when sensor data received
   if (dataLen == sizeof(SensorData))
   {
-    Serial.println("Sensor Data received");
     // Message is sensor data from peer nodes
     SensorData receivedData;
     memcpy(&receivedData, data, sizeof(SensorData));
 
     // Print the received sensor data
-    Serial.printf("Received sensor data from: %s\n", macStr);
-    // Serial.printf("Root Node Address: %d\n", receivedData.rootNodeAddress);
-    Serial.printf("CO2 Data: %.2f\n", receivedData.c02Data);
-    Serial.printf("Temperature Data: %.2f\n", receivedData.temperatureData);
-    Serial.printf("Humidity Data: %.2f\n", receivedData.humidityData);
+    LOG_DEBUG("Sensor data from %s: CO2 %.2f, temperature %.2f, humidity %.2f", macStr,
+              receivedData.c02Data, receivedData.temperatureData, receivedData.humidityData);
 
-    sendToAllPeers(receivedData);
+    PeerEntry *sender = peerTable.find(macAddr);
+    if (sender != NULL)
+    {
+      sender->lastSeen = millis();
+    }
+
+    if (receivedData.hops >= ESPNOW_MAX_HOPS)
+    {
+      LOG_WARN("Reading is looping, dropped");
+      return;
+    }
+    // a second parent or a routing loop can bring the same reading here twice
+    if (!markSeen(receivedData))
+    {
+      LOG_DEBUG("Duplicate reading %u from %s dropped", receivedData.seq, receivedData.MACaddr);
+      return;
+    }
+    receivedData.hops++;
+    sendToParents(receivedData);
   }
   else if (dataLen == sizeof(Handshake))
   {
-    Serial.println("Handshake received");
+    LOG_DEBUG("Handshake received");
     // Message is a handshake message
     Handshake receivedMsg;
     memcpy(&receivedMsg, data, sizeof(Handshake));
@@ -98,161 +318,216 @@ void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen)
     // handle requests
     if (receivedMsg.requestType == 0)
     {
-      Serial.println("Request received");
+      LOG_DEBUG("Request received");
+      // a parent asking for a route has lost its own
+      PeerEntry *peer = peerTable.find(macAddr);
+      if (peer != NULL && peer->hops != PEER_NO_ROUTE)
+      {
+        peer->hops = PEER_NO_ROUTE;
+        updateRoute();
+      }
+
       // Request type is 0, it's a request for connection status
       // Reply with the current connection status
       Handshake replyMsg;
       replyMsg.requestType = 1;
-      replyMsg.isConnectedToMaster = isConnectedToMaster;
+      replyMsg.isConnectedToMaster = espnowLeaf ? 0 : isConnectedToMaster;
       replyMsg.numberOfHopsToMaster = numberOfHopsToMaster;
 
-      memcpy(peerInfo.peer_addr, macAddr, 6);
-      if (!esp_now_is_peer_exist(macAddr))
+      // the requester stays registered, its next request or data needs no new entry
+      if (touchPeer(macAddr) == NULL)
       {
-        esp_now_add_peer(&peerInfo);
+        return;
       }
 
       esp_err_t result = esp_now_send(macAddr, (const uint8_t *)&replyMsg, sizeof(Handshake));
 
-      // Remove the broadcast address from the peer list
-      esp_now_del_peer(macAddr);
-
       // Print results to serial monitor
       if (result == ESP_OK)
       {
-        Serial.println("Reply message success");
+        LOG_DEBUG("Reply message success");
       }
       else if (result == ESP_ERR_ESPNOW_NOT_INIT)
       {
-        Serial.println("ESP-NOW not Init.");
+        LOG_WARN("ESP-NOW not Init.");
       }
       else if (result == ESP_ERR_ESPNOW_ARG)
       {
-        Serial.println("Invalid Argument");
+        LOG_WARN("Invalid Argument");
       }
       else if (result == ESP_ERR_ESPNOW_INTERNAL)
       {
-        Serial.println("Internal Error");
+        LOG_WARN("Internal Error");
       }
       else if (result == ESP_ERR_ESPNOW_NO_MEM)
       {
-        Serial.println("ESP_ERR_ESPNOW_NO_MEM");
+        LOG_WARN("ESP_ERR_ESPNOW_NO_MEM");
       }
       else if (result == ESP_ERR_ESPNOW_NOT_FOUND)
       {
-        Serial.println("Peer not found.");
+        LOG_WARN("Peer not found.");
       }
       else
       {
-        Serial.println("Unknown error");
+        LOG_WARN("Unknown error");
       }
     }
-    // handle replies
+    // handle replies, sent directly to us or broadcast as route advertisements
     else if (receivedMsg.requestType == 1)
     {
-      Serial.println("Reply received");
+      LOG_DEBUG("Reply received");
       // Reply type is 1, it's a reply containing connection status
       if (receivedMsg.isConnectedToMaster)
       {
-        Serial.printf("Node %s is CONNECTED to the master\n", macStr);
+        LOG_DEBUG("Node %s is CONNECTED to the master", macStr);
         // Add this node to peer list
-        addPeerToPeerList(macAddr);
-        isConnectedToMaster = receivedMsg.isConnectedToMaster;
-        numberOfHopsToMaster = receivedMsg.numberOfHopsToMaster + 1;
+        addPeerToPeerList(macAddr, receivedMsg.numberOfHopsToMaster);
+        updateRoute();
 
-        Serial.printf("Hop Count: %d\n", numberOfHopsToMaster);
+        LOG_DEBUG("Hop Count: %d", numberOfHopsToMaster);
       }
       else
       {
-        Serial.printf("Node %s is NOT CONNECTED to master\n", macStr);
+        LOG_DEBUG("Node %s is NOT CONNECTED to master", macStr);
+        // a parent that lost its route is no parent any more
+        PeerEntry *peer = peerTable.find(macAddr);
+        if (peer != NULL)
+        {
+          peer->hops = PEER_NO_ROUTE;
+          updateRoute();
+        }
       }
     }
   }
   else
   {
-    Serial.println("Received data length does not match expected formats");
+    LOG_WARN("Received data length does not match expected formats");
   }
 }
 
 // Health Check function
 
-void sentCallback(const uint8_t *macAddr, esp_now_send_status_t status) {
+void handleSent(const uint8_t *macAddr, esp_now_send_status_t status) {
+  unsigned long now = millis();
+  peerTable.recordSend(macAddr, status == ESP_NOW_SEND_SUCCESS, now);
+  // broadcasts are never acknowledged, they tell nothing about the link
+  if (memcmp(macAddr, broadcastAddress, 6) == 0) {
+    return;
+  }
   if (status == ESP_NOW_SEND_SUCCESS) {
-    Serial.println("Message sent successfully");
-    failedMessageCount = 0; // Reset on success
-    // failedMessageCount++; // Reset on success
+    LOG_DEBUG("Message sent successfully");
   } else {
-    Serial.println("Failed to send message");
-    failedMessageCount++; // Increment on failure
+    LOG_DEBUG("Failed to send message");
+  }
+  // callbacks come in sending order, so this is the frame sent last at the latest
+  protocolManager.recordResult(PROTOCOL_ESPNOW, status == ESP_NOW_SEND_SUCCESS, now - lastSentTime);
+
+  // a leaf sends too rarely for the delivery ratio to fall, its route is
+  // discovered again instead
+  if (espnowLeaf && status != ESP_NOW_SEND_SUCCESS)
+  {
+    PeerEntry *peer = peerTable.find(macAddr);
+    if (peer != NULL && peer->hops != PEER_NO_ROUTE)
+    {
+      forgetPeer(macAddr);
+      updateRoute();
+    }
   }
 }
 
-void broadcast(const Handshake &msg)
-// Emulates a broadcast
-{
-  // Broadcast a message to every device in range
-  uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+unsigned long lastAdvertised = 0;
 
-  memcpy(&peerInfo.peer_addr, broadcastAddress, 6);
-  if (!esp_now_is_peer_exist(broadcastAddress))
+void advertiseRoute()
+// Broadcast our connection status and hop count as an unsolicited reply
+{
+  if (espnowLeaf)
   {
-    esp_now_add_peer(&peerInfo);
+    return;
   }
+  Handshake advert;
+  advert.requestType = 1;
+  advert.isConnectedToMaster = isConnectedToMaster;
+  advert.numberOfHopsToMaster = numberOfHopsToMaster;
+  broadcast(advert);
+  lastAdvertised = millis();
+}
 
-  // Send message
+void broadcast(const Handshake &msg)
+// Emulates a broadcast
+{
+  // Broadcast a message to every device in range
   esp_err_t result = esp_now_send(broadcastAddress, (const uint8_t *)&msg, sizeof(Handshake));
 
-  // Remove the broadcast address from the peer list
-  esp_now_del_peer(broadcastAddress);
-
   // Print results to serial monitor
   if (result == ESP_OK)
   {
-    Serial.println("Broadcast message success");
+    lastFrameTime = millis();
+    LOG_DEBUG("Broadcast message success");
   }
   else if (result == ESP_ERR_ESPNOW_NOT_INIT)
   {
-    Serial.println("ESP-NOW not Init.");
+    LOG_WARN("ESP-NOW not Init.");
   }
   else if (result == ESP_ERR_ESPNOW_ARG)
   {
-    Serial.println("Invalid Argument");
+    LOG_WARN("Invalid Argument");
   }
   else if (result == ESP_ERR_ESPNOW_INTERNAL)
   {
-    Serial.println("Internal Error");
+    LOG_WARN("Internal Error");
   }
   else if (result == ESP_ERR_ESPNOW_NO_MEM)
   {
-    Serial.println("ESP_ERR_ESPNOW_NO_MEM");
+    LOG_WARN("ESP_ERR_ESPNOW_NO_MEM");
   }
   else if (result == ESP_ERR_ESPNOW_NOT_FOUND)
   {
-    Serial.println("Peer not found.");
+    LOG_WARN("Peer not found.");
   }
   else
   {
-    Serial.println("Unknown error");
+    LOG_WARN("Unknown error");
   }
 }
 
 void espnowSetup()
 {
+  // the callbacks wake the worker, so it has to exist first. It outlives
+  // espnowUninit(), a later espnowSetup() reuses it.
+  if (workerTask == NULL)
+  {
+    espnowMutex = xSemaphoreCreateMutex();
+    xTaskCreate(espnowWorker, "espnow", ESPNOW_WORKER_STACK, NULL, ESPNOW_WORKER_PRIORITY, &workerTask);
+  }
+
   // Initialize ESP-NOW
   if (esp_now_init() == ESP_OK)
   {
-    Serial.println("ESP-NOW Init Success");
+    LOG_INFO("ESP-NOW Init Success");
     esp_now_register_recv_cb(receiveCallback);
     esp_now_register_send_cb(sentCallback);
     // esp_now_register_send_cb(onDataSent);
   }
   else
   {
-    Serial.println("ESP-NOW Init Failed");
+    LOG_ERROR("ESP-NOW Init Failed");
     delay(3000);
+    logFlush();
     ESP.restart();
   }
 
+  unsigned long now = millis();
+  espnowScheduler.clear();
+  espnowScheduler.add(maintainRoute, now);
+  espnowScheduler.add(drainBacklog, now);
+  espnowScheduler.add(printStatsJob, now + ESPNOW_STATS_INTERVAL);
+
+  // The broadcast address stays in the peer list for route discovery
+  memcpy(peerInfo.peer_addr, broadcastAddress, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  esp_now_add_peer(&peerInfo);
+
   // esp_wifi_set_promiscuous(true);
   // esp_wifi_set_channel(13, WIFI_SECOND_CHAN_NONE);
   // esp_wifi_set_promiscuous(false);
@@ -298,90 +573,147 @@ void espnowUninit()
   esp_now_deinit();
   esp_now_unregister_recv_cb();
   esp_now_unregister_send_cb();
+
+  // the driver has forgotten every peer
+  peerTable.clear();
+  isConnectedToMaster = 0;
+  protocolManager.setAvailable(PROTOCOL_ESPNOW, false);
 }
 
-void espnowLoop()
+void sendOwnReading(const TimeSeriesSample &reading)
+// Send one of our readings upwards, the caller holds espnowMutex
 {
-  SensorData sensorData;
-
-  // Read sensor data
-  uint16_t error;
-  char errorMessage[256];
-  uint16_t co2 = 0;
-  float temperature = 0.0f;
-  float humidity = 0.0f;
-  bool isDataReady = false;
-
-  uint8_t macAddressBytes[6];
-  parseMacAddress(WiFi.macAddress(), macAddressBytes);
-
-  // Format the MAC address and store it in sensorData.MACaddr
-  formatMacAddress(macAddressBytes, sensorData.MACaddr, MAX_MAC_LENGTH);
+  // the address was parsed once in setupMACaddr()
+  memcpy(sensorData.MACaddr, MACaddrG, MAX_MAC_LENGTH);
+  sensorData.seq = reading.seq;
+  sensorData.hops = 0;
+  sensorData.c02Data = reading.c02Data;
+  sensorData.temperatureData = reading.temperatureData;
+  sensorData.humidityData = reading.humidityData;
+  sendToParents(sensorData);
+}
 
-  error = scd4x.getDataReadyFlag(isDataReady);
-  if (error)
+void espnowSendReading(const TimeSeriesSample &reading)
+// Send a fresh reading, or keep it in the backlog while there is no route
+{
+  xSemaphoreTake(espnowMutex, portMAX_DELAY);
+  if (isConnectedToMaster)
   {
-    Serial.print("Error trying to execute getDataReadyFlag(): ");
-    errorToString(error, errorMessage, 256);
-    Serial.println(errorMessage);
-    // If error, use random data
-    sensorData.c02Data = getRandomFloat(100.0, 1000.0);
-    sensorData.temperatureData = getRandomFloat(0.0, 40.0);
-    sensorData.humidityData = getRandomFloat(90.0, 1030.0);
-  }
-  else if (!isDataReady)
-  {
-    // If data not ready, return
-    return;
+    LOG_DEBUG("Sending data to the best parent");
+    sendOwnReading(reading);
   }
   else
   {
-    // Read sensor measurement
-    error = scd4x.readMeasurement(co2, temperature, humidity);
-    if (error)
-    {
-      Serial.print("Error trying to execute readMeasurement(): ");
-      errorToString(error, errorMessage, 256);
-      Serial.println(errorMessage);
-      // If error, use random data
-      sensorData.c02Data = getRandomFloat(100.0, 1000.0);
-      sensorData.temperatureData = getRandomFloat(0.0, 40.0);
-      sensorData.humidityData = getRandomFloat(90.0, 1030.0);
-    }
-    else if (co2 == 0)
-    {
-      Serial.println("Invalid sample detected, skipping.");
-      // If invalid sample, use random data
-      sensorData.c02Data = getRandomFloat(100.0, 1000.0);
-      sensorData.temperatureData = getRandomFloat(0.0, 40.0);
-      sensorData.humidityData = getRandomFloat(90.0, 1030.0);
-    }
-    else
-    {
-      // Assign sensor data to sensorData structure
-      sensorData.c02Data = co2;
-      sensorData.temperatureData = temperature;
-      sensorData.humidityData = humidity;
-    }
+    readingBacklog.append(reading);
   }
+  xSemaphoreGive(espnowMutex);
+}
 
-  // Handle ESP-NOW communication
-  // uint8_t peer_num;
-  esp_now_get_peer_num(&peer_num);
-  Serial.printf("Peer num: %d\n", peer_num);
+unsigned long maintainRoute(unsigned long now)
+// Job: expire peers, follow the best parent, discover or advertise the route
+{
+  // the worker must not change routes meanwhile
+  xSemaphoreTake(espnowMutex, portMAX_DELAY);
+  const PeerEntry *expired;
+  while ((expired = peerTable.expired(now)) != NULL)
+  {
+    forgetPeer(expired->MACaddr);
+  }
+  updateRoute();
 
-  if (peer_num.total_num == 0)
+  if (isConnectedToMaster == 0)
   {
-    Serial.println("Commencing route discovery");
+    LOG_DEBUG("Commencing route discovery");
     // Set message header to request
     msg.requestType = 0;
     broadcast(msg);
   }
-  else
+  else if (now - lastAdvertised >= ROUTE_ADVERTISE_INTERVAL)
   {
-    Serial.println("Sending data to all peers");
-    sendToAllPeers(sensorData);
+    advertiseRoute();
   }
+  xSemaphoreGive(espnowMutex);
 
-  delay(1000);
-}
\ No newline at end of file
+  return ROUTE_MAINTENANCE_INTERVAL;
+}
+
+unsigned long drainBacklog(unsigned long now)
+// Job: send backlogged readings in quick bursts once there is a route again
+{
+  xSemaphoreTake(espnowMutex, portMAX_DELAY);
+  int sent = 0;
+  TimeSeriesSample sample;
+  // the backlog goes out over the link the protocol manager prefers
+  while (isConnectedToMaster && protocolManager.current() == PROTOCOL_ESPNOW
+         && sent < BACKLOG_BURST && popBacklog(&sample))
+  {
+    sendOwnReading(sample);
+    sent++;
+  }
+  xSemaphoreGive(espnowMutex);
+
+  // look again with the route maintenance once the backlog is sent or cannot be
+  return sent == BACKLOG_BURST ? BACKLOG_DRAIN_INTERVAL : ROUTE_MAINTENANCE_INTERVAL;
+}
+
+unsigned long printStatsJob(unsigned long now)
+// Job: print the peer count and the callback timings
+{
+  LOG_INFO("Peer num: %d", peerTable.count());
+  printEspNowStats();
+  return ESPNOW_STATS_INTERVAL;
+}
+
+bool espnowIdle()
+{
+  return eventRing.size() == 0 && millis() - lastFrameTime >= ESPNOW_SLEEP_GUARD;
+}
+
+bool espnowCanSleep()
+// Frames arriving in light sleep are lost, so only a leaf with a route and nothing to send may sleep
+{
+  return isConnectedToMaster && espnowIdle() && readingBacklog.isEmpty() && flashBacklog.isEmpty()
+         && peerTable.hasChildren(numberOfHopsToMaster, millis()) == false;
+}
+
+void espnowSetLeaf(bool leaf)
+{
+  espnowLeaf = leaf;
+}
+
+void espnowSaveState(EspNowSleepState *state)
+{
+  const PeerEntry *parents[MAX_PARENTS];
+  xSemaphoreTake(espnowMutex, portMAX_DELAY);
+  state->parentCount = isConnectedToMaster
+                         ? peerTable.bestParents(parents, MAX_PARENTS, numberOfHopsToMaster, millis())
+                         : 0;
+  for (int i = 0; i < state->parentCount; i++)
+  {
+    state->parents[i] = *parents[i];
+  }
+  xSemaphoreGive(espnowMutex);
+}
+
+void espnowRestoreState(const EspNowSleepState &state)
+{
+  xSemaphoreTake(espnowMutex, portMAX_DELAY);
+  for (int i = 0; i < state.parentCount && i < MAX_PARENTS; i++)
+  {
+    PeerEntry *peer = touchPeer(state.parents[i].MACaddr);
+    if (peer != NULL)
+    {
+      peer->hops = state.parents[i].hops;
+      peer->deliveryRatio = state.parents[i].deliveryRatio;
+    }
+  }
+  updateRoute();
+  xSemaphoreGive(espnowMutex);
+}
+
+unsigned long espnowPoll()
+{
+  // forwarding happens in the worker as frames arrive, the caller may sleep
+  // until the next deadline as long as nothing else needs polling
+  return espnowScheduler.poll(millis(), ROUTE_MAINTENANCE_INTERVAL);
+}
@@ -4,6 +4,10 @@
 
 #include <esp_now.h>
 #include <PubSubClient.h>
+#include "PeerTable.h"
+#include "SpscRing.h"
+#include "JobScheduler.h"
+#include "Log.h"
 
 #ifndef Arduino_h
 #define Arduino_h
@@ -18,6 +22,22 @@
 #endif
 
 #define MAX_NODES 10
+#define MAX_PARENTS 2  // a weak best parent gets a copy of the data to the next best one
+#define SEEN_CACHE_CAPACITY 64  // readings remembered after forwarding, to drop copies arriving later
+#define ESPNOW_MAX_HOPS 16      // a reading forwarded this often is looping and gets dropped
+#define ROUTE_ADVERTISE_INTERVAL 10000  // how often a connected node broadcasts its hop count
+#define ROUTE_MAINTENANCE_INTERVAL 1000 // peer expiry, and discovery while there is no route
+#define BACKLOG_BURST 4                 // backlogged readings sent per drain round
+#define BACKLOG_DRAIN_INTERVAL 20       // between drain rounds, up to 200 readings/s after a reconnect
+#define ESPNOW_FRAME_CHARGE 100.0f      // uC, ~0.8 ms on air at 1 Mbps with ~120 mA extra at 5 V
+#define ESPNOW_SLEEP_GUARD 10           // ms after the last frame before light sleep, it is sent by then
+
+// receive path, the Wi-Fi task only queues events for the worker task
+#define ESPNOW_FRAME_CAPACITY 64     // bytes kept of a received frame, ours are at most sizeof(SensorData)
+#define ESPNOW_EVENT_RING_SIZE 16    // events in flight to the worker, a power of two
+#define ESPNOW_WORKER_STACK 4096
+#define ESPNOW_WORKER_PRIORITY 2     // above loop(), far below the Wi-Fi task
+#define ESPNOW_STATS_INTERVAL 10000  // how often the callback timings are printed
 // Liligo
 // #define I2C_SDA 46
 // #define I2C_SCL 45
@@ -31,11 +51,47 @@
 struct SensorData {
   // uint8_t rootNodeAddress;
   char MACaddr[MAX_MAC_LENGTH];  // Use a char array to store the MAC address
+  uint16_t seq;                  // counted per origin, together with MACaddr identifies the reading
+  uint8_t hops;                  // times the reading has been forwarded
   float c02Data;
   float temperatureData;
   float humidityData;
 };
 
+// A received frame or a send status on its way from the Wi-Fi task to the worker
+enum EspNowEventType : uint8_t {
+  ESPNOW_EVENT_RECEIVED,
+  ESPNOW_EVENT_SENT
+};
+
+struct EspNowEvent {
+  EspNowEventType type;
+  uint8_t MACaddr[6];
+  uint8_t status;                       // esp_now_send_status_t of a send
+  int length;                           // as received, may exceed ESPNOW_FRAME_CAPACITY
+  uint8_t data[ESPNOW_FRAME_CAPACITY];
+};
+
+// Identifies a reading in the seen cache, origin is the hash of SensorData.MACaddr
+struct SeenReading {
+  uint32_t origin;
+  uint16_t seq;
+};
+
+inline bool operator==(const SeenReading &a, const SeenReading &b) {
+  return a.origin == b.origin && a.seq == b.seq;
+}
+
+inline uint32_t ringQueueHash(const SeenReading &reading) {
+  return reading.origin ^ reading.seq * 2654435761u;
+}
+
+// The parents a leaf sends to right after a deep sleep
+struct EspNowSleepState {
+  uint8_t parentCount;  // 0 without a route
+  PeerEntry parents[MAX_PARENTS];
+};
+
 // Connection Request Struct
 struct Handshake {
   // 0 for request, 1 for reply
@@ -49,28 +105,49 @@ struct Handshake {
 
 // Extern variables
 extern esp_now_peer_info_t peerInfo;
-extern esp_now_peer_num_t peer_num;
+extern PeerTable peerTable;
 extern uint8_t isConnectedToMaster;
 extern uint8_t numberOfHopsToMaster;
 //extern SensirionI2CScd4x scd4x;
 extern SensorData sensorData;
 extern Handshake msg;
-extern unsigned int failedMessageCount; 
-//extern const unsigned int MAX_FAILED_MESSAGES; 
 
 
 
-void addPeerToPeerList(const uint8_t *macAddr);
-void sendToAllPeers(const SensorData &sensorData);
+void addPeerToPeerList(const uint8_t *macAddr, uint8_t hops);
+void sendToParents(const SensorData &sensorData);
 void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen);
 void sentCallback(const uint8_t *macAddr, esp_now_send_status_t status);
+void handleReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen);
+void handleSent(const uint8_t *macAddr, esp_now_send_status_t status);
+// the worker task's body: handle every event queued by the callbacks
+void espnowDrainEvents();
+void printEspNowStats();
 void broadcast(const Handshake &msg);
+void advertiseRoute();
 float getRandomFloat(float min, float max);
 String getRandomFloatAsString(float min, float max);
 void printUint16Hex(uint16_t value);
 void printSerialNumber(uint16_t serial0, uint16_t serial1, uint16_t serial2);
 void espnowSetup();
 void espnowUninit();
-void espnowLoop();
+// run the ESP-NOW jobs that are due, returns ms until the next one
+unsigned long espnowPoll();
+// nothing to receive or send, see the light sleep in Main.ino
+bool espnowCanSleep();
+// no frame on its way in or out
+bool espnowIdle();
+// a leaf offers no route, and drops a cached parent the first time a send to it fails
+void espnowSetLeaf(bool leaf);
+void espnowSaveState(EspNowSleepState *state);
+// after espnowSetup(), the parents are taken as they were
+void espnowRestoreState(const EspNowSleepState &state);
+void espnowSendReading(const TimeSeriesSample &reading);
+void sendOwnReading(const TimeSeriesSample &reading);
+
+// jobs of the ESP-NOW scheduler, each returns ms until it runs again
+unsigned long maintainRoute(unsigned long now);
+unsigned long drainBacklog(unsigned long now);
+unsigned long printStatsJob(unsigned long now);
 
 #endif
\ No newline at end of file
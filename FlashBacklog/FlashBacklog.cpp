@@ -0,0 +1,277 @@
+#include "FlashBacklog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CURSOR_PATH FLASH_BACKLOG_DIR "/cursor"
+#define PATH_LENGTH 24
+
+static void segmentPath(char* path, uint32_t number) {
+  snprintf(path, PATH_LENGTH, FLASH_BACKLOG_DIR "/%08lu", (unsigned long)number);
+}
+
+// CRC-16/CCITT, continuing from crc
+static uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static uint16_t recordCrc(const uint8_t* header, const uint8_t* block) {
+  static const uint8_t format = FLASH_BACKLOG_FORMAT;
+  return crc16(block, TS_BLOCK_SIZE, crc16(header, 2, crc16(&format, 1, 0xFFFF)));
+}
+
+bool FlashBacklog::begin(fs::FS& filesystem, BacklogReplay order) {
+  fs = &filesystem;
+  replay = order;
+  segments.clear();
+  nextNumber = 0;
+  stored = 0;
+  draining = false;
+  reader.begin(block, 0);
+
+  if (fs->exists(FLASH_BACKLOG_DIR) == false && fs->mkdir(FLASH_BACKLOG_DIR) == false) {
+    fs = NULL;
+    return false;
+  }
+
+  // the directory lists in no particular order, keep the segments sorted
+  File dir = fs->open(FLASH_BACKLOG_DIR);
+  File file;
+  while ((file = dir.openNextFile())) {
+    const char* name = strrchr(file.name(), '/');
+    name = name != NULL ? name + 1 : file.name();
+    char* end;
+    uint32_t number = strtoul(name, &end, 10);
+    if (*end != '\0' || end == name) {
+      continue;  // the cursor
+    }
+    Segment segment = { number, (uint8_t)(file.size() / FLASH_BACKLOG_RECORD_LENGTH), true, 0 };
+    for (int i = 0; i < segment.blocks; i++) {
+      uint8_t header[FLASH_BACKLOG_RECORD_HEADER];
+      file.seek(i * FLASH_BACKLOG_RECORD_LENGTH);
+      file.read(header, sizeof(header));
+      segment.samples += header[0] | header[1] << 8;
+    }
+    file.close();
+
+    if (segment.blocks == 0 || segments.isFull()) {
+      // torn on creation, or left from a larger configuration
+      char path[PATH_LENGTH];
+      segmentPath(path, number);
+      fs->remove(path);
+      continue;
+    }
+    segments.addToLast(segment);
+    for (int i = segments.count - 1; i > 0 && segments.at(i - 1).number > number; i--) {
+      Segment later = segments.at(i - 1);
+      segments.at(i - 1) = segments.at(i);
+      segments.at(i) = later;
+    }
+    stored += segment.samples;
+    if (number >= nextNumber) {
+      nextNumber = number + 1;
+    }
+  }
+  dir.close();
+
+  loadCursor();
+  return true;
+}  // begin
+
+bool FlashBacklog::append(const uint8_t* data, uint16_t samples) {
+  if (fs == NULL) {
+    return false;
+  }
+  Segment* tail = segments.isEmpty() ? NULL : &segments.at(segments.count - 1);
+  if (tail == NULL || tail->sealed || tail->blocks >= FLASH_BACKLOG_SEGMENT_BLOCKS) {
+    if (tail != NULL) {
+      tail->sealed = true;
+    }
+    if (segments.isFull()) {
+      // keep the recent history, like the RAM buffer does
+      dropped += segments.front().samples;
+      removeSegment(segments.front().number);
+    }
+    Segment segment = { nextNumber++, 0, false, 0 };
+    segments.addToLast(segment);
+    tail = &segments.at(segments.count - 1);
+  }
+
+  uint8_t header[FLASH_BACKLOG_RECORD_HEADER];
+  header[0] = samples & 0xFF;
+  header[1] = samples >> 8;
+  uint16_t crc = recordCrc(header, data);
+  header[2] = crc & 0xFF;
+  header[3] = crc >> 8;
+
+  char path[PATH_LENGTH];
+  segmentPath(path, tail->number);
+  File file = fs->open(path, FILE_APPEND);
+  bool written = file && file.write(header, sizeof(header)) == sizeof(header)
+                 && file.write(data, TS_BLOCK_SIZE) == TS_BLOCK_SIZE;
+  if (file) {
+    file.close();
+  }
+  if (written == false) {
+    // flash is full or failing, a torn record is cut off by sealing the segment
+    tail->sealed = true;
+    if (tail->blocks == 0) {
+      removeSegment(tail->number);
+    }
+    return false;
+  }
+  tail->blocks++;
+  tail->samples += samples;
+  stored += samples;
+  return true;
+}  // append
+
+bool FlashBacklog::pop(TimeSeriesSample* sample) {
+  while (reader.next(sample) == false) {
+    if (loadBlock() == false) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool FlashBacklog::loadBlock() {
+  while (fs != NULL && segments.isEmpty() == false) {
+    Segment* segment = draining ? findSegment(drainNumber) : NULL;
+    if (segment == NULL) {
+      // choose the next segment to drain to its end
+      segment = replay == BACKLOG_OLDEST_FIRST ? &segments.front() : &segments.at(segments.count - 1);
+      if (replay == BACKLOG_NEWEST_FIRST) {
+        // read back to front, so its records must stay where they are
+        segment->sealed = true;
+      }
+      draining = true;
+      drainNumber = segment->number;
+      drainTaken = 0;
+    }
+    if (drainTaken >= segment->blocks) {
+      // left by a reboot right after its last record was taken
+      removeSegment(segment->number);
+      continue;
+    }
+
+    int index = replay == BACKLOG_OLDEST_FIRST ? drainTaken : segment->blocks - 1 - drainTaken;
+    uint8_t header[FLASH_BACKLOG_RECORD_HEADER] = {};
+    char path[PATH_LENGTH];
+    segmentPath(path, segment->number);
+    File file = fs->open(path, FILE_READ);
+    bool loaded = file && file.seek(index * FLASH_BACKLOG_RECORD_LENGTH)
+                  && file.read(header, sizeof(header)) == sizeof(header)
+                  && file.read(block, TS_BLOCK_SIZE) == TS_BLOCK_SIZE;
+    if (file) {
+      file.close();
+    }
+    uint16_t samples = header[0] | header[1] << 8;
+    loaded = loaded && recordCrc(header, block) == (uint16_t)(header[2] | header[3] << 8);
+
+    drainTaken++;
+    samples = samples < segment->samples ? samples : segment->samples;
+    segment->samples -= samples;
+    stored -= samples;
+    if (drainTaken >= segment->blocks) {
+      // also an open segment, the next block spilled starts a new one
+      removeSegment(segment->number);
+    } else {
+      saveCursor();
+    }
+    if (loaded) {
+      reader.begin(block, samples);
+      return true;
+    }
+    dropped += samples;
+  }
+  return false;
+}  // loadBlock
+
+FlashBacklog::Segment* FlashBacklog::findSegment(uint32_t number) {
+  for (int i = 0; i < segments.count; i++) {
+    if (segments.at(i).number == number) {
+      return &segments.at(i);
+    }
+  }
+  return NULL;
+}
+
+void FlashBacklog::removeSegment(uint32_t number) {
+  char path[PATH_LENGTH];
+  segmentPath(path, number);
+  fs->remove(path);
+  Segment* segment = findSegment(number);
+  if (segment != NULL) {
+    stored -= segment->samples;
+    segments.removeIfMatches([number](const Segment& s) {
+      return s.number == number;
+    });
+  }
+  if (draining && drainNumber == number) {
+    draining = false;
+    fs->remove(CURSOR_PATH);
+  }
+}
+
+void FlashBacklog::saveCursor() {
+  uint8_t cursor[6] = {
+    (uint8_t)drainNumber, (uint8_t)(drainNumber >> 8), (uint8_t)(drainNumber >> 16), (uint8_t)(drainNumber >> 24),
+    drainTaken, replay
+  };
+  File file = fs->open(CURSOR_PATH, FILE_WRITE);
+  if (file) {
+    file.write(cursor, sizeof(cursor));
+    file.close();
+  }
+}
+
+void FlashBacklog::loadCursor() {
+  // opening a missing file is logged as an error by the ESP32 core
+  if (fs->exists(CURSOR_PATH) == false) {
+    return;
+  }
+  uint8_t cursor[6];
+  File file = fs->open(CURSOR_PATH, FILE_READ);
+  if (!file) {
+    return;
+  }
+  bool valid = file.read(cursor, sizeof(cursor)) == sizeof(cursor);
+  file.close();
+
+  uint32_t number = cursor[0] | cursor[1] << 8 | cursor[2] << 16 | (uint32_t)cursor[3] << 24;
+  Segment* segment = findSegment(number);
+  // records counted from the other end would be the wrong ones
+  if (valid == false || segment == NULL || cursor[5] != replay || cursor[4] > segment->blocks) {
+    fs->remove(CURSOR_PATH);
+    return;
+  }
+  draining = true;
+  drainNumber = number;
+  drainTaken = cursor[4];
+
+  // the samples of the records already taken are gone
+  char path[PATH_LENGTH];
+  segmentPath(path, number);
+  file = fs->open(path, FILE_READ);
+  for (int i = 0; file && i < drainTaken; i++) {
+    int index = replay == BACKLOG_OLDEST_FIRST ? i : segment->blocks - 1 - i;
+    uint8_t header[FLASH_BACKLOG_RECORD_HEADER];
+    file.seek(index * FLASH_BACKLOG_RECORD_LENGTH);
+    file.read(header, sizeof(header));
+    uint16_t samples = header[0] | header[1] << 8;
+    samples = samples < segment->samples ? samples : segment->samples;
+    segment->samples -= samples;
+    stored -= samples;
+  }
+  if (file) {
+    file.close();
+  }
+}  // loadCursor
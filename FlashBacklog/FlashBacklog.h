@@ -0,0 +1,116 @@
+/** Flash Backlog
+ *  Keeps the history of an isolated node in flash once the RAM
+ *  TimeSeriesBuffer is full, so it survives a reboot and outgrows the heap.
+ *
+ *  Full compressed blocks spilled by the buffer are appended as records
+ *  to segment files in FLASH_BACKLOG_DIR, named by a running number:
+ *
+ *    record   samples (u16), CRC-16/CCITT of the block format, samples
+ *             and block (u16), block (TS_BLOCK_SIZE)
+ *
+ *  The format byte is not stored, FLASH_BACKLOG_FORMAT changes with the
+ *  TimeSeriesBuffer encoding, so records written by older firmware fail
+ *  the CRC and are dropped instead of decoded wrongly.
+ *
+ *  A segment takes FLASH_BACKLOG_SEGMENT_BLOCKS records, so it fits one
+ *  4 KB flash block, and is only ever appended to and then deleted as a
+ *  whole. LittleFS spreads those writes over the partition. Once
+ *  FLASH_BACKLOG_SEGMENTS are stored the oldest segment is deleted.
+ *
+ *  Records are read back one at a time into a single RAM block, oldest or
+ *  newest first. A segment is drained to its end before the next one is
+ *  chosen; newest first drains it back to front, samples within a block
+ *  come out oldest first either way. The segment being drained and how
+ *  many of its records are taken is kept in a cursor file, so a reboot
+ *  continues where draining left off. A block counts as taken once it is
+ *  loaded, a reboot loses its remaining samples instead of repeating them.
+ */
+
+#ifndef FLASH_BACKLOG_H
+#define FLASH_BACKLOG_H
+
+#include <FS.h>
+#include "TimeSeriesBuffer.h"
+#include "RingQueue.h"
+
+#define FLASH_BACKLOG_DIR "/backlog"
+#define FLASH_BACKLOG_SEGMENT_BLOCKS 15  // 15 records of 260 bytes fill most of a 4 KB flash block
+#define FLASH_BACKLOG_SEGMENTS 64        // at most 250 KB of flash, about 90 h of indoor readings at 5 s
+
+#define FLASH_BACKLOG_FORMAT 2  // blocks carry the origin seq
+#define FLASH_BACKLOG_RECORD_HEADER 4
+#define FLASH_BACKLOG_RECORD_LENGTH (FLASH_BACKLOG_RECORD_HEADER + TS_BLOCK_SIZE)
+
+enum BacklogReplay : uint8_t {
+  BACKLOG_OLDEST_FIRST,
+  BACKLOG_NEWEST_FIRST
+};
+
+class FlashBacklog {
+public:
+  // pick up the segments and cursor left in the directory, false if it cannot be created
+  bool begin(fs::FS& fs, BacklogReplay order);
+
+  // store a full block, false if it could not be written
+  bool append(const uint8_t* block, uint16_t samples);
+
+  // take the next sample, false once flash holds no more
+  bool pop(TimeSeriesSample* sample);
+
+  // samples in flash and in the block being read
+  uint32_t count() const {
+    return stored + reader.remaining();
+  }
+
+  bool isEmpty() const {
+    return count() == 0;
+  }
+
+  BacklogReplay getReplay() const {
+    return replay;
+  }
+
+  // samples lost to the size limit or to damaged records since boot
+  uint32_t getDropped() const {
+    return dropped;
+  }
+
+private:
+  typedef struct Segment {
+    uint32_t number;
+    uint8_t blocks;    // records written
+    bool sealed;       // no longer appended to
+    uint32_t samples;  // in records not taken yet
+  } Segment;
+
+  friend bool operator==(const Segment& a, const Segment& b) {
+    return a.number == b.number;
+  }
+
+  friend uint32_t ringQueueHash(const Segment& segment) {
+    return segment.number;
+  }
+
+  fs::FS* fs = NULL;
+  BacklogReplay replay = BACKLOG_OLDEST_FIRST;
+  RingQueue<Segment, FLASH_BACKLOG_SEGMENTS, false> segments;  // oldest first
+  uint32_t nextNumber = 0;
+  uint32_t stored = 0;
+  uint32_t dropped = 0;
+
+  // the segment being drained and the records taken from it
+  bool draining = false;
+  uint32_t drainNumber = 0;
+  uint8_t drainTaken = 0;
+
+  uint8_t block[TS_BLOCK_SIZE];
+  TimeSeriesBlockReader reader;
+
+  bool loadBlock();
+  Segment* findSegment(uint32_t number);
+  void removeSegment(uint32_t number);
+  void saveCursor();
+  void loadCursor();
+};
+
+#endif  // FLASH_BACKLOG_H
@@ -0,0 +1,34 @@
+#include "JobScheduler.h"
+
+bool JobScheduler::add(SchedulerJob job, unsigned long due) {
+  if (count >= JOB_SCHEDULER_CAPACITY) {
+    return false;
+  }
+  jobs[count].run = job;
+  jobs[count].due = due;
+  count++;
+  return true;
+}
+
+unsigned long JobScheduler::poll(unsigned long now, unsigned long maxWait) {
+  unsigned long wait = maxWait;
+  for (int i = 0; i < count; i++) {
+    Job& job = jobs[i];
+    // signed difference, so the deadlines survive the millis() wrap
+    if ((long)(now - job.due) >= 0) {
+      job.due = now + job.run(now);
+    }
+    unsigned long left = job.due - now;
+    if ((long)left < 0) {
+      left = 0;
+    }
+    if (left < wait) {
+      wait = left;
+    }
+  }
+  return wait;
+}  // poll
+
+void JobScheduler::clear() {
+  count = 0;
+}
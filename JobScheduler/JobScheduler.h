@@ -0,0 +1,41 @@
+/** Job Scheduler
+ *  Cooperative timer scheduler for loop(). Each job is a plain function
+ *  with its own deadline; poll() runs the jobs whose deadline has passed
+ *  and tells how long the caller may sleep before the next one is due.
+ *
+ *  A job returns the delay in ms until it wants to run again. Jobs must
+ *  not block, they run one after the other on the caller's task.
+ *
+ *  Times are in ms and passed in.
+ */
+
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include <stdint.h>
+
+#define JOB_SCHEDULER_CAPACITY 8
+
+typedef unsigned long (*SchedulerJob)(unsigned long now);
+
+class JobScheduler {
+public:
+  // add a job first due at the given time, false if the table is full
+  bool add(SchedulerJob job, unsigned long due);
+
+  // run the jobs that are due, returns ms until the next deadline, at most maxWait
+  unsigned long poll(unsigned long now, unsigned long maxWait);
+
+  void clear();
+
+private:
+  typedef struct Job {
+    SchedulerJob run;
+    unsigned long due;
+  } Job;
+
+  Job jobs[JOB_SCHEDULER_CAPACITY] = {};
+  int count = 0;
+};
+
+#endif  // JOB_SCHEDULER_H
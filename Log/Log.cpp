@@ -0,0 +1,123 @@
+#include "Log.h"
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+
+#define RING_MASK (LOG_RING_SIZE - 1)
+
+static_assert((LOG_RING_SIZE & RING_MASK) == 0, "LOG_RING_SIZE must be a power of two");
+
+// Every slot carries a sequence number, stored relative to its index so
+// the zeroed ring is already valid: a slot is free for the line at position
+// pos when its sequence is pos, and holds that line once it is pos + 1.
+typedef struct LogLine {
+  std::atomic<uint32_t> sequence;
+  uint32_t time;
+  uint8_t level;
+  char text[LOG_LINE_LENGTH];
+} LogLine;
+
+static LogLine lines[LOG_RING_SIZE];
+static std::atomic<uint32_t> writePosition{0};
+static uint32_t readPosition = 0;           // owned by whoever holds draining
+static std::atomic_flag draining = ATOMIC_FLAG_INIT;
+static std::atomic<uint32_t> dropped{0};
+static uint32_t droppedReported = 0;
+static TaskHandle_t drainTask = NULL;
+static void printLine(uint8_t level, uint32_t time, const char* text);
+static std::atomic<LogOutput> output{printLine};
+
+static uint32_t sequenceOf(uint32_t slot) {
+  return lines[slot].sequence.load(std::memory_order_acquire) + slot;
+}
+
+static void setSequence(uint32_t slot, uint32_t sequence) {
+  lines[slot].sequence.store(sequence - slot, std::memory_order_release);
+}
+
+void logWrite(uint8_t level, const char* format, ...) {
+  // claim a position, other writers may race for the same one
+  uint32_t position = writePosition.load(std::memory_order_relaxed);
+  for (;;) {
+    int32_t lag = (int32_t)(sequenceOf(position & RING_MASK) - position);
+    if (lag == 0) {
+      if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (lag < 0) {
+      // the slot still holds the line from the previous lap
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = writePosition.load(std::memory_order_relaxed);
+    }
+  }
+
+  LogLine& line = lines[position & RING_MASK];
+  line.time = millis();
+  line.level = level;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line.text, LOG_LINE_LENGTH, format, args);
+  va_end(args);
+  setSequence(position & RING_MASK, position + 1);
+}  // logWrite
+
+static void printLine(uint8_t level, uint32_t time, const char* text) {
+  Serial.printf("%lu %c %s\n", (unsigned long)time, " EWID"[level], text);
+}
+
+void logSetOutput(LogOutput writer) {
+  output.store(writer != NULL ? writer : printLine);
+}
+
+bool logDrain() {
+  if (draining.test_and_set(std::memory_order_acquire)) {
+    return false;
+  }
+  LogOutput write = output.load();
+  bool printed = false;
+  uint32_t lost = dropped.load(std::memory_order_relaxed);
+  if (lost != droppedReported) {
+    char text[32];
+    snprintf(text, sizeof(text), "%u log lines dropped", (unsigned)(lost - droppedReported));
+    write(LOG_LEVEL_WARN, millis(), text);
+    droppedReported = lost;
+    printed = true;
+  }
+  // a line that is still being written holds up the ones behind it
+  uint32_t slot = readPosition & RING_MASK;
+  if (sequenceOf(slot) == readPosition + 1) {
+    write(lines[slot].level, lines[slot].time, lines[slot].text);
+    setSequence(slot, readPosition + LOG_RING_SIZE);
+    readPosition++;
+    printed = true;
+  }
+  draining.clear(std::memory_order_release);
+  return printed;
+}  // logDrain
+
+void logFlush() {
+  while (logDrain()) {
+  }
+}
+
+uint32_t logDropped() {
+  return dropped.load(std::memory_order_relaxed);
+}
+
+static void drainLoop(void*) {
+  for (;;) {
+    if (logDrain() == false) {
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+    }
+  }
+}
+
+void logSetup() {
+  if (drainTask == NULL) {
+    xTaskCreate(drainLoop, "log", LOG_DRAIN_STACK, NULL, LOG_DRAIN_PRIORITY, &drainTask);
+  }
+}
@@ -0,0 +1,68 @@
+/** Log
+ *  Leveled logging that keeps the UART out of the radio paths.
+ *
+ *  The level of every message is checked against LOG_LEVEL at compile
+ *  time, so a disabled LOG_DEBUG() leaves neither code nor format string
+ *  in the image. Set LOG_LEVEL before this header is first included, e.g.
+ *  -DLOG_LEVEL=LOG_LEVEL_DEBUG in the build flags.
+ *
+ *  Enabled messages are formatted into a fixed ring of LOG_RING_SIZE lines
+ *  without taking a lock, from any task but not from interrupts. A low
+ *  priority task started by logSetup() drains the ring to Serial. When the
+ *  ring is full new lines are dropped and counted, the caller never waits
+ *  for the UART.
+ *
+ *  Lines are printed as text by default. logSetOutput() hands them to
+ *  another writer instead, e.g. the master's framed serial uplink.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 32       // lines, a power of two
+#define LOG_LINE_LENGTH 120    // longer messages are cut off
+#define LOG_DRAIN_INTERVAL 20  // ms the drain task sleeps once the ring is empty
+#define LOG_DRAIN_STACK 3072
+#define LOG_DRAIN_PRIORITY 1   // just above idle, below the radio workers
+
+#define LOG_ENABLED(level) (LOG_LEVEL >= (level))
+
+#define LOG_ERROR(...) do { if (LOG_ENABLED(LOG_LEVEL_ERROR)) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+#define LOG_WARN(...) do { if (LOG_ENABLED(LOG_LEVEL_WARN)) logWrite(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#define LOG_INFO(...) do { if (LOG_ENABLED(LOG_LEVEL_INFO)) logWrite(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) do { if (LOG_ENABLED(LOG_LEVEL_DEBUG)) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+// writes one drained line, time in ms
+typedef void (*LogOutput)(uint8_t level, uint32_t time, const char* text);
+
+// start the drain task, Serial must be running already
+void logSetup();
+
+// where drained lines go from now on, NULL for Serial
+void logSetOutput(LogOutput output);
+
+// format a line into the ring, use the LOG_ macros instead
+void logWrite(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// print the oldest queued line, returns false if there was none
+bool logDrain();
+
+// print everything queued so far, e.g. before a restart
+void logFlush();
+
+// lines lost to a full ring since boot
+uint32_t logDropped();
+
+#endif  // LOG_H
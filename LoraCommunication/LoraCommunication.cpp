@@ -2,414 +2,534 @@
 
 SX1280 radio = new Module(RADIO_CS_PIN, RADIO_DIO1_PIN, RADIO_RST_PIN, RADIO_BUSY_PIN);
 volatile uint8_t retry_fail_count = 0;
-volatile unsigned long replyTimer;
-volatile bool replyTimerFlag = false;
+volatile unsigned long discoveryTimer;
+volatile bool discoveryTimerFlag = false;
 volatile bool isolated = true;
 volatile bool txStart = false;
 volatile bool txDone = false;
 volatile bool enableInterrupt = true;
 volatile bool rxFlag = false;
 volatile int selfLevel = 2147483647;
-LoraSensorData loraSensorData = {.requestType = DATA_MESSAGE};
-SensorDataReply sensorDataReply = {.requestType = DATA_REPLY_MESSAGE};
-DiscoveryMessage discoveryMessage = {.requestType = DISCOVERY_MESSAGE};
-DiscoveryReplyMessage discoveryReplyMessage = {.requestType = DISCOVERY_REPLY_MESSAGE};
-
-
-template<typename T>
-class Queue {
-public:
-  struct Node {
-    T data;
-    Node* next;
-  };
-
-  int count = 0;
-
-  Node* head = NULL;
-
-  void addToLast(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
-
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = NULL;
-
-    if (head == NULL) {
-      head = newNode;
-      count = 1;
-      return;
-    }
+AirtimeMeter airtimeMeter(LORA_SPREADING_FACTOR, LORA_BANDWIDTH, LORA_CODING_RATE, LORA_PREAMBLE_LENGTH);
+AdrController adr(LORA_SPREADING_FACTOR);
+TrickleTimer discoveryTrickle(DISCOVERY_IMIN, DISCOVERY_DOUBLINGS, DISCOVERY_REDUNDANCY);
+TrickleTimer advertTrickle(ADVERT_IMIN, ADVERT_DOUBLINGS, ADVERT_REDUNDANCY);
+
+// a message of the given type with every other field zeroed
+template <typename Message> static Message emptyMessage(uint8_t requestType) {
+  Message message = {};
+  message.requestType = requestType;
+  return message;
+}
 
-    Node* last = head;
-    while (last->next != NULL) {
-      last = last->next;
-    }
+LoraSensorData loraSensorData = emptyMessage<LoraSensorData>(DATA_MESSAGE);
+LoraStatsData loraStatsData = emptyMessage<LoraStatsData>(STATS_MESSAGE);
+SensorDataReply sensorDataReply = emptyMessage<SensorDataReply>(DATA_REPLY_MESSAGE);
+DiscoveryMessage discoveryMessage = emptyMessage<DiscoveryMessage>(DISCOVERY_MESSAGE);
+DiscoveryReplyMessage discoveryReplyMessage = emptyMessage<DiscoveryReplyMessage>(DISCOVERY_REPLY_MESSAGE);
 
-    last->next = newNode;
-    count++;
-  }
 
-  void addToFirst(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
+RingQueue<LoraPacket, DATA_TO_SEND_CAPACITY> dataToSend;
+RingQueue<LoraPacket, DATA_RECEIVED_CAPACITY> dataReceived;
 
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = head;
-    head = newNode;
-    count++;
-  }
+// a parent one level closer to the master, with its own round trip estimate
+typedef struct ParentLink {
+  MacAddress address;
+  RttEstimator rtt;
+} ParentLink;
 
-  void removeFromFirst() {
-    if (head == NULL) {
-      // The list is already empty
-      return;
-    }
-    Node* tempNode = head;
-    head = head->next;
-    delete tempNode;
-    count--;
-  }
+bool operator==(const ParentLink& a, const ParentLink& b) {
+  return a.address == b.address;
+}
 
-  bool isEmpty() {
-    return head == NULL;
-  }
+uint32_t ringQueueHash(const ParentLink& parent) {
+  return ringQueueHash(parent.address);
+}
 
-  void clear() {
-    while (head != NULL) {
-      removeFromFirst();
-    }
-    count = 0;
-  }
+// known parents, data goes to the one at the head
+RingQueue<ParentLink, ADDR_LIST_CAPACITY> addrList;
 
-  bool removeIfMatches(std::function<bool(T)> condition) {
-    Node* current = head;
-    Node* prev = NULL;
-    while (current != NULL) {
-      if (condition(current->data)) {
-        if (prev == NULL) {
-          head = current->next;
-        } else {
-          prev->next = current->next;
-        }
-        delete current;
-        count--;
-        return true;
-      }
-      prev = current;
-      current = current->next;
+// the known parent with that address, NULL if it has been dropped
+ParentLink* findParent(const uint8_t* address) {
+  for (int i = 0; i < addrList.count; i++) {
+    if (memcmp(addrList.at(i).address.bytes, address, MAC_ADDR_LENGTH) == 0) {
+      return &addrList.at(i);
     }
-    return false;
   }
-};
-
-Queue<String> dataToSend;
-Queue<String> dataReceived;
-Queue<String> dataSending;
-Queue<String> addrList;
-
-uint16_t error;
-char errorMessage[256];
-uint16_t co2 = 0;
-float temperature = 0.0f;
-float humidity = 0.0f;
-bool isDataReady = false;
-
-bool getSensorReading() {
-  error = scd4x.getDataReadyFlag(isDataReady);
-  if (error) {
-    Serial.print("Error trying to execute getDataReadyFlag(): ");
-    errorToString(error, errorMessage, 256);
-    Serial.println(errorMessage);
-    // If error, use random data
-    loraSensorData.c02Data = getRandomFloat(100.0, 1000.0);
-    loraSensorData.temperatureData = getRandomFloat(0.0, 40.0);
-    loraSensorData.humidityData = getRandomFloat(90.0, 1030.0);
-  } else if (!isDataReady) {
-    // If data not ready, return
-    return false;
-  } else {
-    // Read sensor measurement
-    error = scd4x.readMeasurement(co2, temperature, humidity);
-    if (error) {
-      Serial.print("Error trying to execute readMeasurement(): ");
-      errorToString(error, errorMessage, 256);
-      Serial.println(errorMessage);
-      // If error, use random data
-      loraSensorData.c02Data = getRandomFloat(100.0, 1000.0);
-      loraSensorData.temperatureData = getRandomFloat(0.0, 40.0);
-      loraSensorData.humidityData = getRandomFloat(90.0, 1030.0);
-    } else if (co2 == 0) {
-      Serial.println("Invalid sample detected, skipping.");
-      // If invalid sample, use random data
-      loraSensorData.c02Data = getRandomFloat(100.0, 1000.0);
-      loraSensorData.temperatureData = getRandomFloat(0.0, 40.0);
-      loraSensorData.humidityData = getRandomFloat(90.0, 1030.0);
-    } else {
-      // Assign sensor data to loraSensorData structure
-      loraSensorData.c02Data = co2;
-      loraSensorData.temperatureData = temperature;
-      loraSensorData.humidityData = humidity;
-    }
-  }
-  return true;
+  return NULL;
 }
 
-String serializeSDRToString() {
-  String result;
-
-  result.concat(sensorDataReply.requestType);
-  result += ",";
-  result.concat(sensorDataReply.randomNumber);
+// a data packet waiting for its reply, each with its own retransmission timer
+typedef struct InFlightPacket {
+  LoraPacket packet;
+  uint8_t seq;
+  unsigned long sentTime;
+  uint8_t retries;  // times resent
+} InFlightPacket;
 
-  return result;
+bool operator==(const InFlightPacket& a, const InFlightPacket& b) {
+  return a.seq == b.seq;
 }
 
-SensorDataReply deserializeStringToSDR(String* serialized) {
-  SensorDataReply sensorDataReply;
-  int firstCommaIndex = serialized->indexOf(',');
+uint32_t ringQueueHash(const InFlightPacket& inFlight) {
+  return inFlight.seq;
+}
 
-  // Convert and assign requestType
-  sensorDataReply.requestType = (uint8_t)serialized->substring(0, firstCommaIndex).toInt();
+// sliding window of unacknowledged data packets
+RingQueue<InFlightPacket, LORA_WINDOW_SIZE> dataSending;
+uint8_t nextSeq = 0;
+uint16_t bootEpoch = 0;  // tells the receivers our seqs started over
 
-  // Convert and assign randomNumber
-  sensorDataReply.randomNumber = serialized->substring(firstCommaIndex + 1).toInt();
+// seqs already accepted from each child
+ReceiveWindow receiveWindow;
 
-  return sensorDataReply;
-}
+// own and relayed readings waiting to be batched into a DATA_MESSAGE
+RingQueue<LoraReading, PENDING_READINGS_CAPACITY, false> pendingReadings;
+unsigned long batchStartTime = 0;
+unsigned long readingInterval = 0;
+bool loraLeaf = false;
 
-String serializeDMToString() {
-  String result;
+// worst link of the DISCOVERY_MESSAGEs the next advert answers, unknown
+// while nobody asked so the receiver goes by its own measurement
+const LinkQuality ADVERT_QUALITY_UNKNOWN = {INT8_MAX, 0};
+LinkQuality advertQuality = ADVERT_QUALITY_UNKNOWN;
 
-  result.concat(discoveryMessage.requestType);
-  result += ",";  // add for substring to work
+// own and relayed stats records waiting for the next STATS_MESSAGE
+RingQueue<LoraStatsRecord, PENDING_STATS_CAPACITY, false> pendingStats;
 
-  return result;
+void addPendingReading(const LoraReading& reading) {
+  if (pendingReadings.isEmpty() == true) {
+    batchStartTime = millis();
+  }
+  // keep the newest readings if the node has been cut off for a while
+  if (pendingReadings.isFull() == true) {
+    pendingReadings.removeFromFirst();
+  }
+  pendingReadings.addToLast(reading);
 }
 
-String serializeDRMToString() {
-  String result;
-
-  result.concat(discoveryReplyMessage.requestType);
-  result += ",";
-  result.concat(discoveryReplyMessage.level);
-  result += ",";
-  result += MACaddrG;
+// queue one of our readings for the next batch, or keep it in the backlog
+// while there is nobody to send to
+void loraSendReading(const TimeSeriesSample& sample) {
+  airtimeMeter.addReading();
+  if (isolated == true) {
+    readingBacklog.append(sample);
+    return;
+  }
+  LoraReading reading;
+  memcpy(reading.SMACaddr, MACbytesG, MAC_ADDR_LENGTH);
+  reading.seq = sample.seq;
+  reading.c02Data = sample.c02Data;
+  reading.temperatureData = sample.temperatureData;
+  reading.humidityData = sample.humidityData;
+  addPendingReading(reading);
+}
 
-  return result;
+// move backlogged own readings into the batch, a frame's worth at a time.
+// Only as many as the send queue takes leave the backlog, so after a
+// reconnect history goes out at the rate of the link.
+static void drainLoraBacklog() {
+  TimeSeriesSample sample;
+  while (pendingReadings.count < BATCH_MAX_READINGS && popBacklog(&sample) == true) {
+    LoraReading reading;
+    memcpy(reading.SMACaddr, MACbytesG, MAC_ADDR_LENGTH);
+    reading.seq = sample.seq;
+    reading.c02Data = sample.c02Data;
+    reading.temperatureData = sample.temperatureData;
+    reading.humidityData = sample.humidityData;
+    addPendingReading(reading);
+  }
 }
 
-DiscoveryReplyMessage deserializeStringToDRM(String* serialized) {
-  DiscoveryReplyMessage discoveryReplyMessage;
-  int firstCommaIndex = serialized->indexOf(',');
-  int secondCommaIndex = serialized->indexOf(',', firstCommaIndex + 1);
+// true once any of the batch thresholds is reached
+bool isBatchReady(unsigned long timeNow) {
+  if (pendingReadings.isEmpty() == true) {
+    return false;
+  }
+  return pendingReadings.count >= BATCH_MAX_READINGS
+         || DATA_MESSAGE_LENGTH(pendingReadings.count + 1) > BATCH_MAX_BYTES
+         || timeNow - batchStartTime >= BATCH_MAX_AGE
+         || readingInterval >= BATCH_MAX_AGE;
+}
 
-  // Convert and assign requestType
-  discoveryReplyMessage.requestType = (uint8_t)serialized->substring(0, firstCommaIndex).toInt();
+// pack pending readings into one DATA_MESSAGE at the tail of dataToSend
+void flushBatch(unsigned long timeNow) {
+  LoraPacket* packet = dataToSend.reserveLast();
+  if (packet == NULL) {
+    return;
+  }
+  // the seq is assigned once the packet enters the window
+  memcpy(loraSensorData.senderMACaddr, MACbytesG, MAC_ADDR_LENGTH);
+  loraSensorData.seq = 0;
+  loraSensorData.readingCount = 0;
+  serializeSensorData(&loraSensorData, packet);
+
+  int readings = 0;
+  while (pendingReadings.isEmpty() == false && readings < BATCH_MAX_READINGS
+         && DATA_MESSAGE_LENGTH(readings + 1) <= BATCH_MAX_BYTES
+         && appendReading(packet, &pendingReadings.front()) == true) {
+    pendingReadings.removeFromFirst();
+    readings++;
+  }
+  dataToSend.commitLast();
+  batchStartTime = timeNow;
+}  // flushBatch
+
+void addPendingStats(const LoraStatsRecord& record) {
+  // a newer record of the same node supersedes the queued one
+  pendingStats.removeIfMatches([&record](const LoraStatsRecord& queued) {
+    return memcmp(queued.MACaddr, record.MACaddr, MAC_ADDR_LENGTH) == 0;
+  });
+  if (pendingStats.isFull() == true) {
+    pendingStats.removeFromFirst();
+  }
+  pendingStats.addToLast(record);
+}
 
-  // Convert and assign level
-  discoveryReplyMessage.level = serialized->substring(firstCommaIndex + 1, secondCommaIndex).toInt();
+// pack pending stats records into one STATS_MESSAGE at the tail of dataToSend
+void flushStats() {
+  LoraPacket* packet = dataToSend.reserveLast();
+  if (packet == NULL) {
+    return;
+  }
+  memcpy(loraStatsData.senderMACaddr, MACbytesG, MAC_ADDR_LENGTH);
+  loraStatsData.seq = 0;
+  loraStatsData.recordCount = 0;
+  while (pendingStats.isEmpty() == false && loraStatsData.recordCount < LORA_MAX_STATS_RECORDS) {
+    loraStatsData.records[loraStatsData.recordCount++] = pendingStats.front();
+    pendingStats.removeFromFirst();
+  }
+  serializeStats(&loraStatsData, packet);
+  dataToSend.commitLast();
+}  // flushStats
 
-  // Assign MACaddr
-  String macAddrString = serialized->substring(secondCommaIndex + 1);
-  macAddrString.toCharArray(discoveryReplyMessage.MACaddr, MAX_MAC_LENGTH);
+void transmitData(LoraPacket& packet) {
+  int type = getPacketType(&packet);
 
-  return discoveryReplyMessage;
-}
+  // the previous frame is still on air
+  if (txStart == true) {
+    return;
+  }
 
-String serializeSensorDataToString(LoraSensorData* data) {
-  String result;
-
-  // Concatenate integer and float values directly.
-  // Use String constructor or concat() for conversion from numeric to String.
-  result.concat(data->requestType);
-  result += ",";  // Adding a separator for readability, can be omitted.
-  result += data->MACaddr;
-  result += ",";
-  result += data->SMACaddr;
-  result += ",",
-  result.concat(data->c02Data);
-  result += ",";
-  result.concat(data->temperatureData);
-  result += ",";
-  result.concat(data->humidityData);
-  result += ",";
-  result.concat(data->randomNumber);
-
-  return result;
-}  // serializeSensorDataToString
-
-LoraSensorData deserializeStringToSensorData(String* serialized) {
-  LoraSensorData loraSensorData;
-  int firstCommaIndex = serialized->indexOf(',');
-  int secondCommaIndex = serialized->indexOf(',', firstCommaIndex + 1);
-  int thirdCommaIndex = serialized->indexOf(',', secondCommaIndex + 1);
-  int fourthCommaIndex = serialized->indexOf(',', thirdCommaIndex + 1);
-  int fifthCommaIndex = serialized->indexOf(',', fourthCommaIndex + 1);
-  int sixthCommaIndex = serialized->indexOf(',', fifthCommaIndex + 1);
-
-  // Convert and assign requestType
-  loraSensorData.requestType = (uint8_t)serialized->substring(0, firstCommaIndex).toInt();
-
-  // Assign MACaddr (receiver)
-  String macAddrString = serialized->substring(firstCommaIndex + 1, secondCommaIndex);
-  macAddrString.toCharArray(loraSensorData.MACaddr, MAX_MAC_LENGTH);
-
-  // sender's mac addr
-  String sMacAddrString = serialized->substring(secondCommaIndex + 1, thirdCommaIndex);
-  sMacAddrString.toCharArray(loraSensorData.SMACaddr, MAX_MAC_LENGTH);
-
-  // Convert and assign c02Data
-  loraSensorData.c02Data = serialized->substring(thirdCommaIndex + 1, fourthCommaIndex).toFloat();
-
-  // Convert and assign temperatureData
-  loraSensorData.temperatureData = serialized->substring(fourthCommaIndex + 1, fifthCommaIndex).toFloat();
-
-  // Convert and assign humidityData
-  loraSensorData.humidityData = serialized->substring(fifthCommaIndex + 1, sixthCommaIndex).toFloat();
-
-  loraSensorData.randomNumber = serialized->substring(sixthCommaIndex + 1).toFloat();
-
-  return loraSensorData;
-}  // deserializeStringToSensorData
-
-void transmitData(String* data) {
   // if its isolated and not sending the discovery message
-  if (isolated == true && data->charAt(0) != String(DISCOVERY_MESSAGE).charAt(0)) {
+  if (isolated == true && type != DISCOVERY_MESSAGE) {
     return;
   }
 
-  // if waiting for reply, and data is Data message, do nothing
-  if (replyTimerFlag == true && data->charAt(0) == String(DATA_MESSAGE).charAt(0)) {
+  // if the window is full, data waits for a reply to free a slot
+  if (isSequencedType(type) == true && dataSending.isFull() == true) {
     return;
   }
 
-  // if message is DataMessage, add first addr
-  if (data->charAt(0) == String(DATA_MESSAGE).charAt(0)) {
-    const char* addrChar = addrList.head->data.c_str();
-    LoraSensorData sd = deserializeStringToSensorData(data);
-    strncpy(sd.MACaddr, addrChar, MAX_MAC_LENGTH);
-    *data = serializeSensorDataToString(&sd);
+  // if message is DataMessage, add first addr, the next seq and the SF our subtree needs
+  if (isSequencedType(type) == true) {
+    setSensorDataReceiver(&packet, addrList.front().address.bytes);
+    setSensorDataSeq(&packet, nextSeq);
+    setSensorDataEpoch(&packet, bootEpoch);
+    setSensorDataSF(&packet, adr.subtreeSF(millis()));
   }
 
   // switch to transmit mode and send data
-  int state = radio.startTransmit(*data);
+  int state = radio.startTransmit(packet.data, packet.length);
 
   if (state == RADIOLIB_ERR_NONE) {
     txStart = true;
-    // if data is of type SensorData or DiscoveryMessage, add to dataSending
-    if (data->charAt(0) == String(DATA_MESSAGE).charAt(0) || data->charAt(0) == String(DISCOVERY_MESSAGE).charAt(0)) {
-      dataSending.addToLast(*data);
-
-      // set replyTimer to current time if not set
-      if (replyTimerFlag == false) {
-        replyTimer = millis();
-        replyTimerFlag = true;
-      }
+    airtimeMeter.addTransmit(packet.length);
+    if (type == DATA_MESSAGE) {
+      // relayed readings ride along, the manager prices the link for our own
+      int readings = countReadingsFrom(&packet, MACbytesG);
+      protocolManager.recordSend(PROTOCOL_LORA, readings, airtimeMeter.transmitCharge(packet.length));
+    }
+    if (isSequencedType(type) == true) {
+      // keep it in the window until its seq is acknowledged
+      InFlightPacket* inFlight = dataSending.reserveLast();
+      inFlight->packet = packet;
+      inFlight->seq = nextSeq;
+      inFlight->sentTime = millis();
+      inFlight->retries = 0;
+      dataSending.commitLast();
+      nextSeq++;
+    } else if (type == DISCOVERY_MESSAGE) {
+      discoveryTimer = millis();
+      discoveryTimerFlag = true;
     }
     // successfully sent
     dataToSend.removeFromFirst();
   }
 }  // transmitData
 
-void processStringReceived(String* str) {
-  failedMessageCount = 0;
-  // check msg type by spliting the str and check the first int
-  int commaIndex = str->indexOf(',');              // Find the index of the first comma
-  String msgType = str->substring(0, commaIndex);  // Extract the substring from the beginning to the comma
-  if (msgType == String(DISCOVERY_MESSAGE)) {
-    // reply with DISCOVERY_REPLY_MESSAGE if self isolated is false, else do nothing
-    if (isolated == false) {
-      discoveryReplyMessage.level = selfLevel;
-      dataToSend.addToFirst(serializeDRMToString());
+// resend the first in-flight packet whose reply is overdue,
+// returns true if one was due
+bool retransmitExpired(unsigned long timeNow) {
+  if (isolated == true || txStart == true) {
+    return false;
+  }
+
+  for (int i = 0; i < dataSending.count; i++) {
+    InFlightPacket& inFlight = dataSending.at(i);
+    unsigned long timeout = LORA_FIXED_TIMEOUT > 0 ? LORA_FIXED_TIMEOUT : addrList.front().rtt.rto();
+    if (timeNow - inFlight.sentTime < timeout) {
+      continue;
     }
-    dataReceived.removeFromFirst();
 
-  } else if (msgType == String(DISCOVERY_REPLY_MESSAGE)) {
-    // Serial.println("Message is DISCOVERY_REPLY_MESSAGE");
-    // if self isolated is true, update addrList and level
-    DiscoveryReplyMessage received = deserializeStringToDRM(str);
+    // only the oldest packet going unanswered counts against the parent,
+    // so a full window timing out at once is a single failure
+    if (i == 0) {
+      addrList.front().rtt.backoff();
+      adr.uplinkTimeout();
+      retry_fail_count++;
+      protocolManager.recordResult(PROTOCOL_LORA, false, 0);
+      if (retry_fail_count >= MAX_RETRY) {
+        addrList.removeFromFirst();
+        retry_fail_count = 0;
+        if (addrList.isEmpty() == true) {
+          return true;
+        }
+      }
+    }
 
-    // for debugging
-    // if (strcmp(received.MACaddr, "dc:54:75:e4:6d:50") == 0) {
-    //   dataReceived.removeFromFirst();
-    //   Serial.println("DEBUG: ignore this device");
-    //   return;
-    // }
+    // resend to the current parent, keeping the seq
+    setSensorDataReceiver(&inFlight.packet, addrList.front().address.bytes);
+    setSensorDataSF(&inFlight.packet, adr.subtreeSF(timeNow));
+    if (radio.startTransmit(inFlight.packet.data, inFlight.packet.length) == RADIOLIB_ERR_NONE) {
+      txStart = true;
+      airtimeMeter.addTransmit(inFlight.packet.length);
+      inFlight.retries++;
+    }
+    inFlight.sentTime = timeNow;
+    return true;
+  }
+  return false;
+}  // retransmitExpired
 
+// move the radio to another SF, the round trips to the parents change with it
+void applySpreadingFactor(uint8_t spreadingFactor) {
+  if (radio.setSpreadingFactor(spreadingFactor) != RADIOLIB_ERR_NONE) {
+    LOG_WARN("[LoRa] SF%u rejected", spreadingFactor);
+    return;
+  }
+  airtimeMeter.setSpreadingFactor(spreadingFactor);
+  for (int i = 0; i < addrList.count; i++) {
+    addrList.at(i).rtt = RttEstimator();
+  }
+  radio.startReceive();
+  LOG_INFO("[LoRa] switched to SF%u", spreadingFactor);
+}  // applySpreadingFactor
+
+// SNR in dB of the link to a parent, the worse of both directions
+float uplinkSnr(const LinkQuality& reported, const LinkQuality& measured) {
+  float up = getLinkSnr(&reported);
+  float down = getLinkSnr(&measured);
+  return up < down ? up : down;
+}
 
-    // if received level is lower than selfLevel-1, update selfLevel
-    if (received.level <= selfLevel - 1) {
-      if (received.level < selfLevel - 1) {
-        selfLevel = received.level + 1;
-        addrList.clear();
-      }
-      addrList.addToLast(String(received.MACaddr));
-      isolated = false;
-      replyTimerFlag = false;
+// queue a DISCOVERY_REPLY_MESSAGE, the answer to discovery and the level advert alike
+void queueAdvert() {
+  LoraPacket* reply = dataToSend.reserveLast();
+  if (reply == NULL) {
+    return;
+  }
+  discoveryReplyMessage.level = selfLevel;
+  memcpy(discoveryReplyMessage.MACaddr, MACbytesG, MAC_ADDR_LENGTH);
+  discoveryReplyMessage.spreadingFactor = adr.target();
+  discoveryReplyMessage.switchIn = (adr.switchIn(millis()) + 500) / 1000;
+  discoveryReplyMessage.quality = advertQuality;
+  serializeDRM(&discoveryReplyMessage, reply);
+  dataToSend.commitLast();
+  advertQuality = ADVERT_QUALITY_UNKNOWN;
+}  // queueAdvert
+
+void handleDiscoveryMessage(const LinkQuality& quality) {
+  // another isolated node nearby, the replies it gets are broadcast and reach us as well
+  if (isolated == true) {
+    discoveryTrickle.hearConsistent();
+    return;
+  }
+  if (loraLeaf == true) {
+    return;
+  }
+  // one advert answers every node that asked since the last, with the worst link among them
+  if (quality.snr < advertQuality.snr) {
+    advertQuality = quality;
+  }
+  advertTrickle.answer(millis());
+}  // handleDiscoveryMessage
 
-      dataSending.removeIfMatches([](String data) {
-        return data.charAt(0) == '0';
-      });
+void handleDiscoveryReplyMessage(const DiscoveryReplyMessage& received, const LinkQuality& quality) {
+  // a neighbour as close to the master already told the nodes around what we would
+  if (received.level <= selfLevel) {
+    advertTrickle.hearConsistent();
+  }
+  // if received level is lower than selfLevel-1, update selfLevel
+  if (received.level <= selfLevel - 1) {
+    if (received.level < selfLevel - 1) {
+      selfLevel = received.level + 1;
+      addrList.clear();
+      advertTrickle.hearInconsistent(millis());
     }
+    // adverts repeat, a known parent is not added again
+    ParentLink* parent = addrList.reserveLast();
+    if (parent != NULL) {
+      *parent = ParentLink();
+      memcpy(parent->address.bytes, received.MACaddr, MAC_ADDR_LENGTH);
+      addrList.commitLast();
+    }
+    // data goes to the first parent, its link sets our own SF need
+    if (memcmp(addrList.front().address.bytes, received.MACaddr, MAC_ADDR_LENGTH) == 0) {
+      adr.reportUplink(uplinkSnr(received.quality, quality));
+    }
+    adr.announce(received.spreadingFactor, received.switchIn * 1000UL, millis());
+    isolated = false;
+    discoveryTimerFlag = false;
+  }
+}  // handleDiscoveryReplyMessage
 
-    dataReceived.removeFromFirst();
-
-  } else if (msgType == String(DATA_MESSAGE)) {
-    // if not isolated, forward the data message to the first addr in addrList
-    LoraSensorData sd = deserializeStringToSensorData(str);
-    // check if the MACaddr is self
-    if (strcmp(sd.MACaddr, MACaddrG) != 0) {
-      dataReceived.removeFromFirst();
+void handleSensorData(const LoraSensorData& sd, const LinkQuality& quality) {
+  // only relay data messages addressed to self
+  if (memcmp(sd.MACaddr, MACbytesG, MAC_ADDR_LENGTH) != 0) {
+    return;
+  }
+  adr.reportChild(sd.senderMACaddr, sd.spreadingFactor, millis());
+  // a retransmission whose reply was lost is acknowledged again, not merged again
+  if (receiveWindow.isReceived(sd.senderMACaddr, sd.epoch, sd.seq) == false) {
+    // without room for the whole batch, stay silent so the sender retries
+    if (pendingReadings.freeSlots() < sd.readingCount) {
       return;
     }
-    // forward data msg
-    dataToSend.addToLast(serializeSensorDataToString(&sd));
+    // merge the readings with our own, they go out in the next batch
+    for (uint8_t i = 0; i < sd.readingCount; i++) {
+      addPendingReading(sd.readings[i]);
+    }
+    receiveWindow.record(sd.senderMACaddr, sd.epoch, sd.seq);
+  }
 
-    // reply data msg
-    sensorDataReply.randomNumber = sd.randomNumber;
-    dataToSend.addToFirst(serializeSDRToString());
+  // reply data msg, replies go out before queued data
+  LoraPacket reply;
+  memcpy(sensorDataReply.MACaddr, sd.senderMACaddr, MAC_ADDR_LENGTH);
+  sensorDataReply.seq = sd.seq;
+  sensorDataReply.ackBitmap = receiveWindow.ackBitmap(sd.senderMACaddr, sd.epoch, sd.seq);
+  sensorDataReply.spreadingFactor = adr.target();
+  sensorDataReply.switchIn = (adr.switchIn(millis()) + 500) / 1000;
+  sensorDataReply.quality = quality;
+  serializeSDR(&sensorDataReply, &reply);
+  dataToSend.addToFirst(reply);
+}  // handleSensorData
+
+void handleStats(const LoraStatsData& stats, const LinkQuality& quality) {
+  // only relay stats addressed to self
+  if (memcmp(stats.MACaddr, MACbytesG, MAC_ADDR_LENGTH) != 0) {
+    return;
+  }
+  adr.reportChild(stats.senderMACaddr, stats.spreadingFactor, millis());
+  if (receiveWindow.isReceived(stats.senderMACaddr, stats.epoch, stats.seq) == false) {
+    for (uint8_t i = 0; i < stats.recordCount; i++) {
+      addPendingStats(stats.records[i]);
+    }
+    receiveWindow.record(stats.senderMACaddr, stats.epoch, stats.seq);
+  }
 
-    dataReceived.removeFromFirst();
+  // acknowledged like a data message
+  LoraPacket reply;
+  memcpy(sensorDataReply.MACaddr, stats.senderMACaddr, MAC_ADDR_LENGTH);
+  sensorDataReply.seq = stats.seq;
+  sensorDataReply.ackBitmap = receiveWindow.ackBitmap(stats.senderMACaddr, stats.epoch, stats.seq);
+  sensorDataReply.spreadingFactor = adr.target();
+  sensorDataReply.switchIn = (adr.switchIn(millis()) + 500) / 1000;
+  sensorDataReply.quality = quality;
+  serializeSDR(&sensorDataReply, &reply);
+  dataToSend.addToFirst(reply);
+}  // handleStats
+
+void handleSensorDataReply(const SensorDataReply& received, const LinkQuality& quality) {
+  // replies to other nodes' data are overheard, ignore them
+  if (memcmp(received.MACaddr, MACbytesG, MAC_ADDR_LENGTH) != 0) {
+    return;
+  }
 
-  } else if (msgType == String(DATA_REPLY_MESSAGE)) {
-    SensorDataReply received = deserializeStringToSDR(str);
-    // loop through dataSending to find the corresponding data
-    // if found, remove from dataSending
-    if (dataSending.isEmpty() == false) {
-      bool state = dataSending.removeIfMatches([received](String data) {
-        LoraSensorData sd = deserializeStringToSensorData(&data);
-        return sd.randomNumber == received.randomNumber;
-      });
-
-      if (state == true) {
-        replyTimerFlag = false;
-        retry_fail_count = 0;
+  // the reply tells how well the parent hears us and which SF to run at
+  unsigned long timeNow = millis();
+  adr.reportUplink(uplinkSnr(received.quality, quality));
+  adr.announce(received.spreadingFactor, received.switchIn * 1000UL, timeNow);
+
+  // remove every in-flight packet the reply acknowledges, sampling the
+  // round trip of those sent only once into the parent they went to. The
+  // head of addrList may have changed since, and a dropped parent is not sampled.
+  bool acked = false;
+  while (dataSending.removeIfMatches([&received, timeNow](const InFlightPacket& inFlight) {
+    if (isSeqAcked(&received, inFlight.seq) == false) {
+      return false;
+    }
+    ParentLink* parent = findParent(getSensorDataReceiver(&inFlight.packet));
+    if (parent != NULL && inFlight.retries == 0) {
+      parent->rtt.addSample(timeNow - inFlight.sentTime);
+    }
+    protocolManager.recordResult(PROTOCOL_LORA, true, timeNow - inFlight.sentTime);
+    return true;
+  }) == true) {
+    acked = true;
+  }
+
+  if (acked == true) {
+    retry_fail_count = 0;
+  }
+}  // handleSensorDataReply
+
+// decode the packet in place and hand it to the matching handler
+void processPacketReceived(const LoraPacket& packet) {
+  // dispatch on the header byte
+  switch (getPacketType(&packet)) {
+    case DISCOVERY_MESSAGE:
+      handleDiscoveryMessage(packet.quality);
+      break;
+    case DISCOVERY_REPLY_MESSAGE: {
+      DiscoveryReplyMessage received;
+      if (deserializeDRM(&packet, &received) == true) {
+        handleDiscoveryReplyMessage(received, packet.quality);
       }
+      break;
     }
-    dataReceived.removeFromFirst();
-  } else {
-    dataReceived.removeFromFirst();
+    case DATA_MESSAGE: {
+      LoraSensorData sd;
+      if (deserializeSensorData(&packet, &sd) == true) {
+        handleSensorData(sd, packet.quality);
+      }
+      break;
+    }
+    case STATS_MESSAGE: {
+      LoraStatsData stats;
+      if (deserializeStats(&packet, &stats) == true) {
+        handleStats(stats, packet.quality);
+      }
+      break;
+    }
+    case DATA_REPLY_MESSAGE: {
+      SensorDataReply received;
+      if (deserializeSDR(&packet, &received) == true) {
+        handleSensorDataReply(received, packet.quality);
+      }
+      break;
+    }
+    default:
+      // unknown type or frame version, drop it
+      break;
+  }
+}  // processPacketReceived
+
+void printLoraLinkStats() {
+  char macStr[MAX_MAC_LENGTH];
+  for (int i = 0; i < addrList.count; i++) {
+    ParentLink& parent = addrList.at(i);
+    formatMacAddress(parent.address.bytes, macStr, MAX_MAC_LENGTH);
+    LOG_INFO("[LoRa] parent %s srtt %lu rttvar %lu rto %lu samples %u timeouts %u", macStr,
+             (unsigned long)parent.rtt.getSrtt(), (unsigned long)parent.rtt.getRttvar(),
+             (unsigned long)parent.rtt.rto(), parent.rtt.getSamples(), parent.rtt.getTimeouts());
   }
-}  // processStringReceived
+  LOG_INFO("[LoRa] SF %u announced %u subtree needs %u", adr.current(), adr.target(), adr.subtreeSF(millis()));
+  LOG_INFO("[LoRa] discovery sent %lu suppressed %lu, adverts sent %lu suppressed %lu every %lu ms",
+           (unsigned long)discoveryTrickle.getTransmitted(), (unsigned long)discoveryTrickle.getSuppressed(),
+           (unsigned long)advertTrickle.getTransmitted(), (unsigned long)advertTrickle.getSuppressed(),
+           advertTrickle.getInterval());
+}  // printLoraLinkStats
 
 void setFlag(void) {
   // if not transmitting, means triggered by packet receiving
@@ -426,8 +546,120 @@ void setFlag(void) {
   }
 }  // setFlag
 
+void loraSetReadingInterval(unsigned long interval) {
+  readingInterval = interval;
+}
+
+bool loraIdle() {
+  if (rxFlag == true || txStart == true || txDone == true || dataReceived.isEmpty() == false
+      || dataSending.isEmpty() == false || pendingReadings.isEmpty() == false
+      || pendingStats.isEmpty() == false) {
+    return false;
+  }
+  for (int i = 0; i < dataToSend.count; i++) {
+    if (isSequencedType(getPacketType(&dataToSend.at(i))) == true) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool loraCanSleep() {
+  return isolated == false && discoveryTimerFlag == false && dataToSend.isEmpty() && loraIdle()
+         && adr.current() == adr.target();  // a switch must not be slept through
+}
+
+unsigned long loraWait(unsigned long now) {
+  unsigned long discovery = discoveryTrickle.wait(now);
+  unsigned long advert = advertTrickle.wait(now);
+  return discovery < advert ? discovery : advert;
+}
+
+void loraWake() {
+  // the edge went by while the interrupt waited for the level wakeup
+  if (digitalRead(RADIO_DIO1_PIN) == HIGH) {
+    setFlag();
+  }
+}
+
+void loraSetLeaf(bool leaf) {
+  loraLeaf = leaf;
+}
+
+static void backlogReading(const LoraReading& reading, unsigned long now) {
+  TimeSeriesSample sample;
+  sample.time = now;
+  sample.seq = reading.seq;
+  sample.c02Data = reading.c02Data;
+  sample.temperatureData = reading.temperatureData;
+  sample.humidityData = reading.humidityData;
+  readingBacklog.append(sample);
+}
+
+void loraSaveUnsent(unsigned long now) {
+  // in flight first, they are the older ones
+  for (int i = 0; i < dataSending.count; i++) {
+    LoraSensorData sd;
+    if (getPacketType(&dataSending.at(i).packet) != DATA_MESSAGE
+        || deserializeSensorData(&dataSending.at(i).packet, &sd) == false) {
+      continue;
+    }
+    for (uint8_t j = 0; j < sd.readingCount; j++) {
+      if (memcmp(sd.readings[j].SMACaddr, MACbytesG, MAC_ADDR_LENGTH) == 0) {
+        backlogReading(sd.readings[j], now);
+      }
+    }
+  }
+  dataSending.clear();
+  while (pendingReadings.isEmpty() == false) {
+    if (memcmp(pendingReadings.front().SMACaddr, MACbytesG, MAC_ADDR_LENGTH) == 0) {
+      backlogReading(pendingReadings.front(), now);
+    }
+    pendingReadings.removeFromFirst();
+  }
+}  // loraSaveUnsent
+
+void loraSaveState(LoraSleepState* state) {
+  state->parentCount = 0;
+  for (int i = 0; i < addrList.count && i < LORA_SLEEP_PARENTS; i++) {
+    memcpy(state->parents[i], addrList.at(i).address.bytes, MAC_ADDR_LENGTH);
+    state->rtt[i] = addrList.at(i).rtt;
+    state->parentCount++;
+  }
+  state->level = selfLevel;
+  state->nextSeq = nextSeq;
+  state->epoch = bootEpoch;
+  state->spreadingFactor = adr.current();
+}
+
+void loraRestoreState(const LoraSleepState& state) {
+  // the tree announces a pending switch again in its next reply
+  if (state.spreadingFactor != adr.current()) {
+    adr = AdrController(state.spreadingFactor);
+    applySpreadingFactor(state.spreadingFactor);
+  }
+  nextSeq = state.nextSeq;
+  bootEpoch = state.epoch;
+  addrList.clear();
+  for (int i = 0; i < state.parentCount && i < LORA_SLEEP_PARENTS; i++) {
+    ParentLink* parent = addrList.reserveLast();
+    memcpy(parent->address.bytes, state.parents[i], MAC_ADDR_LENGTH);
+    parent->rtt = state.rtt[i];
+    addrList.commitLast();
+  }
+  if (addrList.isEmpty() == false) {
+    selfLevel = state.level;
+    isolated = false;
+    protocolManager.setAvailable(PROTOCOL_LORA, true);
+  }
+}  // loraRestoreState
+
+void loraSleep() {
+  radio.sleep();
+}
+
 void loraSetup() {
-    Serial.print(F("LoRa Initializing ... "));
+    LOG_INFO("LoRa Initializing ...");
 
     SPI.begin(RADIO_SCLK_PIN, RADIO_MISO_PIN, RADIO_MOSI_PIN);
 
@@ -435,10 +667,10 @@ void loraSetup() {
 
     int state = radio.begin();
     if (state == RADIOLIB_ERR_NONE) {
-        Serial.println(F("success!"));
+        LOG_INFO("LoRa Initializing success!");
       } else {
-        Serial.print(F("failed, code "));
-        Serial.println(state);
+        LOG_ERROR("LoRa Initializing failed, code %d", state);
+        logFlush();
         while (true)
           ;
       }
@@ -449,79 +681,115 @@ void loraSetup() {
       // T3 S3 V1.1 with PA Version Set output power to 3 dBm    !!Cannot be greater than 3dbm!!
       int8_t TX_Power = 3;
       if (radio.setOutputPower(TX_Power) == RADIOLIB_ERR_INVALID_OUTPUT_POWER) {
-        Serial.println(F("Selected output power is invalid for this module!"));
+        LOG_ERROR("Selected output power is invalid for this module!");
+        logFlush();
         while (true)
           ;
       }
 
       // set carrier frequency to 2410.5 MHz
-      if (radio.setFrequency(2410.5) == RADIOLIB_ERR_INVALID_FREQUENCY) {
-        Serial.println(F("Selected frequency is invalid for this module!"));
+      if (radio.setFrequency(LORA_FREQUENCY) == RADIOLIB_ERR_INVALID_FREQUENCY) {
+        LOG_ERROR("Selected frequency is invalid for this module!");
+        logFlush();
         while (true)
           ;
       }
 
       // set bandwidth to 203.125 kHz
-      if (radio.setBandwidth(812.5) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
-        Serial.println(F("Selected bandwidth is invalid for this module!"));
+      if (radio.setBandwidth(LORA_BANDWIDTH) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
+        LOG_ERROR("Selected bandwidth is invalid for this module!");
+        logFlush();
         while (true)
           ;
       }
 
       // set spreading factor to 10
-      if (radio.setSpreadingFactor(12) == RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
-        Serial.println(F("Selected spreading factor is invalid for this module!"));
+      if (radio.setSpreadingFactor(LORA_SPREADING_FACTOR) == RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
+        LOG_ERROR("Selected spreading factor is invalid for this module!");
+        logFlush();
         while (true)
           ;
       }
 
       // set coding rate to 6
-      if (radio.setCodingRate(7) == RADIOLIB_ERR_INVALID_CODING_RATE) {
-        Serial.println(F("Selected coding rate is invalid for this module!"));
+      if (radio.setCodingRate(LORA_CODING_RATE) == RADIOLIB_ERR_INVALID_CODING_RATE) {
+        LOG_ERROR("Selected coding rate is invalid for this module!");
+        logFlush();
         while (true)
           ;
       }
       // set the function that will be called
       // when packet transmission is finished
       radio.setDio1Action(setFlag);
+
+      // a new epoch so a restarted node is not taken for a retransmission,
+      // its seqs may start over anywhere
+      bootEpoch = esp_random();
+      nextSeq = 0;
 }
 
 void loraLoop() {
-  Serial.println("loraLoop");
-  // regularly get the sensor data to send
+  LOG_DEBUG("loraLoop");
   unsigned long timeNow = millis();
-  static unsigned long sensorTimer = 0;
-  if (timeNow - sensorTimer >= SENSOR_DATA_INTERVAL) {
-    sensorTimer = timeNow;
-    if (getSensorReading() == true) {
-      loraSensorData.randomNumber = getRandomInt(1000, 9999);
-      strncpy(loraSensorData.SMACaddr, MACaddrG, MAX_MAC_LENGTH);
-      dataToSend.addToLast(serializeSensorDataToString(&loraSensorData));
-    }
+  // the backlog goes out over the link the protocol manager prefers
+  if (isolated == false && protocolManager.current() == PROTOCOL_LORA) {
+    drainLoraBacklog();
   }
 
-  if (rxFlag == true) {
-    Serial.println("rxFlag");
-    String receivedMsg;
-    int state = radio.readData(receivedMsg);
-    if (state == RADIOLIB_ERR_NONE) {
-      // if packet is of type DataReplyMessage or DiscoveryReplyMessage, add to first of dataReceived
-      if (receivedMsg.charAt(0) == String(DATA_REPLY_MESSAGE).charAt(0) || receivedMsg.charAt(0) == String(DISCOVERY_REPLY_MESSAGE).charAt(0)) {
-        dataReceived.addToFirst(receivedMsg);
-      } else {
-        dataReceived.addToLast(receivedMsg);
-      }
+  // report the airtime and energy totals to the master
+  static unsigned long statsTimer = 0;
+  if (timeNow - statsTimer >= STATS_INTERVAL) {
+    statsTimer = timeNow;
+    LoraStatsRecord record;
+    airtimeMeter.fillRecord(&record, MACbytesG, timeNow);
+    addPendingStats(record);
+  }
+  if (isolated == false && pendingStats.isEmpty() == false) {
+    flushStats();
+  }
 
-    } else if (state == RADIOLIB_ERR_CRC_MISMATCH) {
-       // packet was received, but is malformed
-       Serial.println(F("[SX1280] CRC error!"));
+  static unsigned long linkStatsTimer = 0;
+  if (timeNow - linkStatsTimer >= LINK_STATS_INTERVAL) {
+    linkStatsTimer = timeNow;
+    printLoraLinkStats();
+  }
 
+  // pack pending readings into a frame once a batch threshold is reached
+  if (isolated == false && isBatchReady(timeNow) == true) {
+    flushBatch(timeNow);
+  }
+
+  if (rxFlag == true) {
+    LOG_DEBUG("rxFlag");
+    // read straight into a free slot of the receive queue
+    LoraPacket* receivedMsg = dataReceived.reserveLast();
+    if (receivedMsg == NULL) {
+      LOG_WARN("[SX1280] Receive queue full, packet dropped");
     } else {
-       // some other error occurred
-       Serial.print(F("[SX1280] Failed, code "));
-       Serial.println(state);
+      receivedMsg->length = radio.getPacketLength();
+      int state = radio.readData(receivedMsg->data, receivedMsg->length);
+      if (state == RADIOLIB_ERR_NONE) {
+        airtimeMeter.addReceive(receivedMsg->length);
+        receivedMsg->quality = makeLinkQuality(radio.getSNR(), radio.getRSSI());
+        // DataReplyMessage and DiscoveryReplyMessage are handled right away,
+        // everything else waits its turn in dataReceived
+        int type = getPacketType(receivedMsg);
+        if (type == DATA_REPLY_MESSAGE || type == DISCOVERY_REPLY_MESSAGE) {
+          processPacketReceived(*receivedMsg);
+        } else {
+          dataReceived.commitLast();
+        }
+
+      } else if (state == RADIOLIB_ERR_CRC_MISMATCH) {
+        // packet was received, but is malformed
+        LOG_WARN("[SX1280] CRC error!");
+
+      } else {
+        // some other error occurred
+        LOG_WARN("[SX1280] Failed, code %d", state);
+      }
     }
-    state = radio.startReceive();
+    int state = radio.startReceive();
     if (state != RADIOLIB_ERR_NONE) {
       while (true)
         ;
@@ -532,7 +800,7 @@ void loraLoop() {
   }
 
   if (txDone == true) {
-    Serial.println("txDone");
+    LOG_DEBUG("txDone");
     txDone = false;
     int state = radio.startReceive();
     if (state != RADIOLIB_ERR_NONE) {
@@ -541,52 +809,70 @@ void loraLoop() {
     }
   }
 
-  // if timer is set, check if it's time
-  if (replyTimerFlag == true) {
-    if (timeNow - replyTimer >= WAITING_THRESHOLD) {
-      Serial.println("replyTimerFlag");
-      retry_fail_count++;
-      failedMessageCount++;
-      replyTimerFlag = false;
-
-      dataSending.removeIfMatches([](String data) {
-        return data.charAt(0) == '0';
-      });
-
-      while (dataSending.isEmpty() == false) {
-        dataToSend.addToLast(dataSending.head->data);
-        dataSending.removeFromFirst();
+  // if the discovery message went unanswered, count it, discoveryTrickle asks again
+  if (discoveryTimerFlag == true) {
+    if (timeNow - discoveryTimer >= WAITING_THRESHOLD) {
+      LOG_DEBUG("discoveryTimerFlag");
+      discoveryTimerFlag = false;
+      // nobody answers at this SF, the ladder moves on to the next one
+      if (isolated == true && txStart == false) {
+        uint8_t sf = adr.discoveryFailed();
+        if (sf != 0) {
+          applySpreadingFactor(sf);
+          // nobody at the new SF has heard us yet
+          discoveryTrickle.start(timeNow);
+        }
       }
+    }
+  }
 
-      if (retry_fail_count >= MAX_RETRY) {
-        addrList.removeFromFirst();
-        retry_fail_count = 0;
-
-      }
+  // switch together with the rest of the tree once the announced SF applies
+  if (txStart == false) {
+    uint8_t sf = adr.switchDue(timeNow);
+    if (sf != 0) {
+      applySpreadingFactor(sf);
     }
   }
 
-  // check if addrList is empty, if it is, turn off isolated mode
+  // check if addrList is empty, if it is, turn off isolated mode. Isolated
+  // nodes ask for a parent and connected ones advertise their level, each
+  // at the pace of its Trickle timer.
+  protocolManager.setAvailable(PROTOCOL_LORA, addrList.isEmpty() == false);
   if (addrList.isEmpty() == true) {
     isolated = true;
     selfLevel = 2147483647;
-    if (replyTimerFlag == false) {
-      dataToSend.addToFirst(serializeDMToString());
+    advertTrickle.stop();
+    if (discoveryTrickle.isRunning() == false) {
+      discoveryTrickle.start(timeNow);
+    }
+    if (discoveryTrickle.poll(timeNow) == true) {
+      LoraPacket packet;
+      serializeDM(&discoveryMessage, &packet);
+      dataToSend.addToFirst(packet);
     }
   } else if (addrList.isEmpty() == false) {
     isolated = false;
+    discoveryTrickle.stop();
+    if (loraLeaf == false && advertTrickle.isRunning() == false) {
+      advertTrickle.start(timeNow);
+    }
+    if (advertTrickle.poll(timeNow) == true) {
+      queueAdvert();
+    }
   }
 
-  // if is not isolated, attempt to send data in queue
-  if (dataToSend.isEmpty() == false) {
-    String data = dataToSend.head->data;
-    transmitData(&data);
+  // replies and discovery go out first, then overdue data, then new data
+  bool controlFirst = dataToSend.isEmpty() == false && isSequencedType(getPacketType(&dataToSend.front())) == false;
+  if (controlFirst == true || retransmitExpired(timeNow) == false) {
+    if (dataToSend.isEmpty() == false) {
+      transmitData(dataToSend.front());
+    }
   }
 
   // regardless, process the data received in queue
   if (dataReceived.isEmpty() == false) {
-    String data = dataReceived.head->data;
-    processStringReceived(&data);
+    processPacketReceived(dataReceived.front());
+    dataReceived.removeFromFirst();
   }
   delay(2);
 }  // loop
\ No newline at end of file
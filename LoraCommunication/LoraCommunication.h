@@ -6,6 +6,14 @@
 #include <SPI.h>
 #include "MACaddr.h"
 #include "ProtocolManager.h"
+#include "RingQueue.h"
+#include "LoraPacket.h"
+#include "ReceiveWindow.h"
+#include "RttEstimator.h"
+#include "AirtimeMeter.h"
+#include "AdrController.h"
+#include "TrickleTimer.h"
+#include "Log.h"
 
 #ifndef Arduino_h
 #define Arduino_h
@@ -29,21 +37,66 @@
 #define RADIO_RX_PIN                21
 #define RADIO_TX_PIN                10
 
-// LoRa module settings
-#define DISCOVERY_MESSAGE 0
-#define DISCOVERY_REPLY_MESSAGE 1
-#define DATA_MESSAGE 2
-#define DATA_REPLY_MESSAGE 3
+// modem settings, also used for the airtime accounting
+#define LORA_FREQUENCY 2410.5
+#define LORA_BANDWIDTH 812.5
+#define LORA_SPREADING_FACTOR 12    // at boot, AdrController moves it afterwards
+#define LORA_CODING_RATE 7          // 4/7
+#define LORA_PREAMBLE_LENGTH 12     // RadioLib default
 
-#define WAITING_THRESHOLD 1000      // 4 seconds reply waiting time
+// LoRa module settings
+#define WAITING_THRESHOLD 1500      // discovery reply waiting time, replies are held back up to ADVERT_IMIN, data timeouts come from RttEstimator
 #define MAX_RETRY 3                 // 3 retries
-#define SENSOR_DATA_INTERVAL 1000  // 10 seconds update interval
+#define LORA_WINDOW_SIZE 4          // data packets awaiting a reply, at most LORA_ACK_BITMAP_BITS + 1
+#define LINK_STATS_INTERVAL 10000   // how often the parent link stats are printed
+#define STATS_INTERVAL 60000        // how often the airtime and energy totals go to the master
+
+// a fixed data timeout in ms in place of RttEstimator's RTO, 0 for the estimator.
+// The simulator builds a node with the old WAITING_THRESHOLD to compare the two
+#ifndef LORA_FIXED_TIMEOUT
+#define LORA_FIXED_TIMEOUT 0
+#endif
+
+// queue capacities, all storage is allocated statically
+#define DATA_TO_SEND_CAPACITY 32
+#define DATA_RECEIVED_CAPACITY 16
+#define ADDR_LIST_CAPACITY 8
+#define PENDING_READINGS_CAPACITY 64
+#define PENDING_STATS_CAPACITY 8
+
+// readings are batched into one DATA_MESSAGE, which is flushed
+// as soon as any of these limits is reached
+#define BATCH_MAX_READINGS 8    // at most LORA_MAX_BATCH_READINGS
+#define BATCH_MAX_BYTES 255     // encoded frame length
+#define BATCH_MAX_AGE 5000      // ms the oldest pending reading may wait
+
+// discovery and level adverts are paced by TrickleTimer, so a network
+// forming or re-forming after a master reboot does not flood the channel
+#define DISCOVERY_IMIN 2000         // an isolated node asks within 1-2 s at first
+#define DISCOVERY_DOUBLINGS 4       // and backs off to once per 16-32 s
+#define DISCOVERY_REDUNDANCY 1      // another node asking nearby gets broadcast answers we hear too
+#define ADVERT_IMIN 500             // a DISCOVERY_MESSAGE or a new level goes out within 0.25-0.5 s
+#define ADVERT_DOUBLINGS 10         // a settled node repeats its level every 4-8.5 min
+#define ADVERT_REDUNDANCY 2         // left out once two neighbours as close to the master sent one
+
+#define LORA_SLEEP_PARENTS 2    // parents kept across a deep sleep
+
+// what a leaf needs to send to its parent right after a deep sleep
+typedef struct LoraSleepState {
+  uint8_t parentCount;                               // 0 while isolated
+  uint8_t parents[LORA_SLEEP_PARENTS][MAC_ADDR_LENGTH];
+  RttEstimator rtt[LORA_SLEEP_PARENTS];
+  int level;
+  uint8_t nextSeq;
+  uint16_t epoch;                                    // of the boot before the sleep
+  uint8_t spreadingFactor;                           // the radio ran at
+} LoraSleepState;
 
 // global variables
 extern SX1280 radio;
 extern volatile uint8_t retry_fail_count;
-extern volatile unsigned long replyTimer;
-extern volatile bool replyTimerFlag;
+extern volatile unsigned long discoveryTimer;
+extern volatile bool discoveryTimerFlag;
 extern volatile bool isolated;
 extern volatile bool txStart;
 extern volatile bool txDone;
@@ -51,36 +104,53 @@ extern volatile bool enableInterrupt;
 extern volatile bool rxFlag;
 extern volatile int selfLevel;
 
-typedef struct LoraSensorData {
-  uint8_t requestType;
-  char MACaddr[MAX_MAC_LENGTH];  // Use a char array to store the MAC address
-  char SMACaddr[MAX_MAC_LENGTH]; // self mac
-  float c02Data;
-  float temperatureData;
-  float humidityData;
-  uint8_t randomNumber;
-} LoraSensorData;
+extern AirtimeMeter airtimeMeter;
+extern AdrController adr;
+extern TrickleTimer discoveryTrickle;
+extern TrickleTimer advertTrickle;
 extern LoraSensorData loraSensorData;
-
-typedef struct SensorDataReply {
-  uint8_t requestType;
-  uint8_t randomNumber;  // from the data packet
-} SensorDataReply;
 extern SensorDataReply sensorDataReply;
-
-typedef struct DiscoveryMessage {
-  uint8_t requestType;
-} DiscoveryMessage;
 extern DiscoveryMessage discoveryMessage;
-
-typedef struct DiscoveryReplyMessage {
-  uint8_t requestType;
-  int level;
-  char MACaddr[MAX_MAC_LENGTH];  // selfAddr
-} DiscoveryReplyMessage;
 extern DiscoveryReplyMessage discoveryReplyMessage;
 
 void loraSetup();
 void loraLoop();
+void loraSendReading(const TimeSeriesSample& sample);
+
+// own readings come this often, a batch is not held back for a next one
+// that arrives after BATCH_MAX_AGE anyway
+void loraSetReadingInterval(unsigned long interval);
+
+// nothing to send, in flight or received, the MCU may light sleep with
+// the radio listening
+bool loraCanSleep();
+
+// ms until the next discovery message or level advert may be due
+unsigned long loraWait(unsigned long now);
+
+// after a light sleep, DIO1 raised meanwhile is handled like its interrupt
+void loraWake();
+
+// a leaf answers no discovery, so no node picks it as a parent
+void loraSetLeaf(bool leaf);
+
+// no data queued, in flight or received, discovery does not count
+bool loraIdle();
+
+// own readings not acknowledged yet go back to the backlog
+void loraSaveUnsent(unsigned long now);
+
+void loraSaveState(LoraSleepState* state);
+
+// after loraSetup(), the parents are taken as they were, discovery only
+// starts once they fail
+void loraRestoreState(const LoraSleepState& state);
+
+// the radio draws nothing until loraSetup() starts it again
+void loraSleep();
+
+// print the RTT estimate of every known parent, the ADR state and the
+// discovery and advert counts
+void printLoraLinkStats();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include "LoraPacket.h"
+
+#include <string.h>
+#include <math.h>
+
+static uint8_t makeHeader(uint8_t requestType) {
+  return (LORA_FRAME_VERSION << 4) | (requestType & 0x0F);
+}
+
+static void putUint16(uint8_t* buffer, uint16_t value) {
+  buffer[0] = value & 0xFF;
+  buffer[1] = value >> 8;
+}
+
+static uint16_t getUint16(const uint8_t* buffer) {
+  return buffer[0] | (buffer[1] << 8);
+}
+
+static void putUint32(uint8_t* buffer, uint32_t value) {
+  putUint16(buffer, value & 0xFFFF);
+  putUint16(buffer + 2, value >> 16);
+}
+
+static uint32_t getUint32(const uint8_t* buffer) {
+  return getUint16(buffer) | ((uint32_t)getUint16(buffer + 2) << 16);
+}
+
+// scale and round a float into a fixed point field, clamping to its range
+static int32_t toFixed(float value, float scale, int32_t min, int32_t max) {
+  float scaled = roundf(value * scale);
+  if (scaled < min) {
+    return min;
+  }
+  if (scaled > max) {
+    return max;
+  }
+  return (int32_t)scaled;
+}
+
+// announced SF in the low nibble, seconds until it applies in 2 s steps in the high one
+static uint8_t packSwitch(uint8_t spreadingFactor, uint8_t switchIn) {
+  uint8_t steps = (switchIn > LORA_MAX_SWITCH_IN ? LORA_MAX_SWITCH_IN : switchIn + 1) / 2;
+  return (steps << 4) | (spreadingFactor & 0x0F);
+}
+
+bool operator==(const LoraPacket& a, const LoraPacket& b) {
+  return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+}
+
+bool operator==(const MacAddress& a, const MacAddress& b) {
+  return memcmp(a.bytes, b.bytes, MAC_ADDR_LENGTH) == 0;
+}
+
+// a reading is known by its origin and seq, as DedupWindow knows it at the
+// master; two readings with equal values are still different readings
+bool operator==(const LoraReading& a, const LoraReading& b) {
+  return memcmp(a.SMACaddr, b.SMACaddr, MAC_ADDR_LENGTH) == 0 && a.seq == b.seq;
+}
+
+bool operator==(const LoraStatsRecord& a, const LoraStatsRecord& b) {
+  return memcmp(a.MACaddr, b.MACaddr, MAC_ADDR_LENGTH) == 0 && a.uptime == b.uptime;
+}
+
+uint32_t ringQueueHash(const LoraPacket& packet) {
+  return ringQueueHashBytes(packet.data, packet.length);
+}
+
+uint32_t ringQueueHash(const MacAddress& address) {
+  return ringQueueHashBytes(address.bytes, MAC_ADDR_LENGTH);
+}
+
+uint32_t ringQueueHash(const LoraReading& reading) {
+  uint8_t key[MAC_ADDR_LENGTH + 2];
+  memcpy(key, reading.SMACaddr, MAC_ADDR_LENGTH);
+  key[MAC_ADDR_LENGTH] = reading.seq & 0xFF;
+  key[MAC_ADDR_LENGTH + 1] = reading.seq >> 8;
+  return ringQueueHashBytes(key, sizeof(key));
+}
+
+uint32_t ringQueueHash(const LoraStatsRecord& record) {
+  return ringQueueHashBytes(record.MACaddr, MAC_ADDR_LENGTH);
+}
+
+int getPacketType(const LoraPacket* packet) {
+  if (packet->length == 0 || (packet->data[0] >> 4) != LORA_FRAME_VERSION) {
+    return -1;
+  }
+  return packet->data[0] & 0x0F;
+}
+
+LinkQuality makeLinkQuality(float snr, float rssi) {
+  LinkQuality quality;
+  quality.snr = toFixed(snr, 4.0f, INT8_MIN, INT8_MAX);
+  quality.rssi = toFixed(rssi, 1.0f, INT8_MIN, INT8_MAX);
+  return quality;
+}
+
+float getLinkSnr(const LinkQuality* quality) {
+  return quality->snr / 4.0f;
+}
+
+bool isSequencedType(int type) {
+  return type == DATA_MESSAGE || type == STATS_MESSAGE;
+}
+
+void serializeDM(const DiscoveryMessage* message, LoraPacket* packet) {
+  packet->data[0] = makeHeader(message->requestType);
+  packet->length = DISCOVERY_MESSAGE_LENGTH;
+}
+
+void serializeDRM(const DiscoveryReplyMessage* message, LoraPacket* packet) {
+  uint8_t* p = packet->data;
+  p[0] = makeHeader(message->requestType);
+  putUint16(p + 1, message->level > 0xFFFF ? 0xFFFF : message->level);
+  memcpy(p + 3, message->MACaddr, MAC_ADDR_LENGTH);
+  p[9] = packSwitch(message->spreadingFactor, message->switchIn);
+  p[10] = (uint8_t)message->quality.snr;
+  p[11] = (uint8_t)message->quality.rssi;
+  packet->length = DISCOVERY_REPLY_MESSAGE_LENGTH;
+}
+
+bool deserializeDRM(const LoraPacket* packet, DiscoveryReplyMessage* message) {
+  if (packet->length != DISCOVERY_REPLY_MESSAGE_LENGTH) {
+    return false;
+  }
+  const uint8_t* p = packet->data;
+  message->requestType = p[0] & 0x0F;
+  message->level = getUint16(p + 1);
+  memcpy(message->MACaddr, p + 3, MAC_ADDR_LENGTH);
+  message->spreadingFactor = p[9] & 0x0F;
+  message->switchIn = (p[9] >> 4) * 2;
+  message->quality.snr = (int8_t)p[10];
+  message->quality.rssi = (int8_t)p[11];
+  return true;
+}
+
+static void putReading(uint8_t* p, const LoraReading* reading) {
+  memcpy(p, reading->SMACaddr, MAC_ADDR_LENGTH);
+  putUint16(p + 6, reading->seq);
+  putUint16(p + 8, toFixed(reading->c02Data, 1.0f, 0, 0xFFFF));
+  putUint16(p + 10, (uint16_t)(int16_t)toFixed(reading->temperatureData, 100.0f, INT16_MIN, INT16_MAX));
+  putUint16(p + 12, toFixed(reading->humidityData, 100.0f, 0, 0xFFFF));
+}
+
+static void getReading(const uint8_t* p, LoraReading* reading) {
+  memcpy(reading->SMACaddr, p, MAC_ADDR_LENGTH);
+  reading->seq = getUint16(p + 6);
+  reading->c02Data = getUint16(p + 8);
+  reading->temperatureData = (int16_t)getUint16(p + 10) / 100.0f;
+  reading->humidityData = getUint16(p + 12) / 100.0f;
+}
+
+void serializeSensorData(const LoraSensorData* data, LoraPacket* packet) {
+  uint8_t* p = packet->data;
+  p[0] = makeHeader(data->requestType);
+  memcpy(p + 1, data->MACaddr, MAC_ADDR_LENGTH);
+  memcpy(p + 7, data->senderMACaddr, MAC_ADDR_LENGTH);
+  p[13] = data->seq;
+  p[14] = 0;
+  p[15] = data->spreadingFactor;
+  putUint16(p + 16, data->epoch);
+  packet->length = DATA_MESSAGE_HEADER_LENGTH;
+  for (uint8_t i = 0; i < data->readingCount; i++) {
+    if (appendReading(packet, &data->readings[i]) == false) {
+      break;
+    }
+  }
+}  // serializeSensorData
+
+bool deserializeSensorData(const LoraPacket* packet, LoraSensorData* data) {
+  const uint8_t* p = packet->data;
+  if (packet->length < DATA_MESSAGE_HEADER_LENGTH || p[14] > LORA_MAX_BATCH_READINGS
+      || packet->length != DATA_MESSAGE_LENGTH(p[14])) {
+    return false;
+  }
+  data->requestType = p[0] & 0x0F;
+  memcpy(data->MACaddr, p + 1, MAC_ADDR_LENGTH);
+  memcpy(data->senderMACaddr, p + 7, MAC_ADDR_LENGTH);
+  data->seq = p[13];
+  data->readingCount = p[14];
+  data->spreadingFactor = p[15];
+  data->epoch = getUint16(p + 16);
+  for (uint8_t i = 0; i < data->readingCount; i++) {
+    getReading(p + DATA_MESSAGE_LENGTH(i), &data->readings[i]);
+  }
+  return true;
+}  // deserializeSensorData
+
+bool appendReading(LoraPacket* packet, const LoraReading* reading) {
+  uint8_t count = packet->data[14];
+  if (count >= LORA_MAX_BATCH_READINGS) {
+    return false;
+  }
+  putReading(packet->data + DATA_MESSAGE_LENGTH(count), reading);
+  packet->data[14] = count + 1;
+  packet->length = DATA_MESSAGE_LENGTH(count + 1);
+  return true;
+}
+
+int countReadingsFrom(const LoraPacket* packet, const uint8_t* origin) {
+  if (getPacketType(packet) != DATA_MESSAGE || packet->length < DATA_MESSAGE_HEADER_LENGTH) {
+    return 0;
+  }
+  int count = 0;
+  for (uint8_t i = 0; i < packet->data[14] && DATA_MESSAGE_LENGTH(i + 1) <= packet->length; i++) {
+    if (memcmp(packet->data + DATA_MESSAGE_LENGTH(i), origin, MAC_ADDR_LENGTH) == 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void serializeSDR(const SensorDataReply* reply, LoraPacket* packet) {
+  uint8_t* p = packet->data;
+  p[0] = makeHeader(reply->requestType);
+  memcpy(p + 1, reply->MACaddr, MAC_ADDR_LENGTH);
+  p[7] = reply->seq;
+  p[8] = reply->ackBitmap;
+  p[9] = packSwitch(reply->spreadingFactor, reply->switchIn);
+  p[10] = (uint8_t)reply->quality.snr;
+  p[11] = (uint8_t)reply->quality.rssi;
+  packet->length = DATA_REPLY_MESSAGE_LENGTH;
+}
+
+bool deserializeSDR(const LoraPacket* packet, SensorDataReply* reply) {
+  if (packet->length != DATA_REPLY_MESSAGE_LENGTH) {
+    return false;
+  }
+  const uint8_t* p = packet->data;
+  reply->requestType = p[0] & 0x0F;
+  memcpy(reply->MACaddr, p + 1, MAC_ADDR_LENGTH);
+  reply->seq = p[7];
+  reply->ackBitmap = p[8];
+  reply->spreadingFactor = p[9] & 0x0F;
+  reply->switchIn = (p[9] >> 4) * 2;
+  reply->quality.snr = (int8_t)p[10];
+  reply->quality.rssi = (int8_t)p[11];
+  return true;
+}
+
+void serializeStats(const LoraStatsData* stats, LoraPacket* packet) {
+  uint8_t* p = packet->data;
+  uint8_t count = stats->recordCount > LORA_MAX_STATS_RECORDS ? LORA_MAX_STATS_RECORDS : stats->recordCount;
+  p[0] = makeHeader(stats->requestType);
+  memcpy(p + 1, stats->MACaddr, MAC_ADDR_LENGTH);
+  memcpy(p + 7, stats->senderMACaddr, MAC_ADDR_LENGTH);
+  p[13] = stats->seq;
+  p[14] = count;
+  p[15] = stats->spreadingFactor;
+  putUint16(p + 16, stats->epoch);
+  for (uint8_t i = 0; i < count; i++) {
+    const LoraStatsRecord* record = &stats->records[i];
+    uint8_t* r = p + STATS_MESSAGE_LENGTH(i);
+    memcpy(r, record->MACaddr, MAC_ADDR_LENGTH);
+    putUint32(r + 6, record->uptime);
+    putUint32(r + 10, record->txTime);
+    putUint32(r + 14, record->rxTime);
+    putUint16(r + 18, record->readings);
+    putUint32(r + 20, record->charge);
+  }
+  packet->length = STATS_MESSAGE_LENGTH(count);
+}  // serializeStats
+
+bool deserializeStats(const LoraPacket* packet, LoraStatsData* stats) {
+  const uint8_t* p = packet->data;
+  if (packet->length < DATA_MESSAGE_HEADER_LENGTH || p[14] > LORA_MAX_STATS_RECORDS
+      || packet->length != STATS_MESSAGE_LENGTH(p[14])) {
+    return false;
+  }
+  stats->requestType = p[0] & 0x0F;
+  memcpy(stats->MACaddr, p + 1, MAC_ADDR_LENGTH);
+  memcpy(stats->senderMACaddr, p + 7, MAC_ADDR_LENGTH);
+  stats->seq = p[13];
+  stats->recordCount = p[14];
+  stats->spreadingFactor = p[15];
+  stats->epoch = getUint16(p + 16);
+  for (uint8_t i = 0; i < stats->recordCount; i++) {
+    LoraStatsRecord* record = &stats->records[i];
+    const uint8_t* r = p + STATS_MESSAGE_LENGTH(i);
+    memcpy(record->MACaddr, r, MAC_ADDR_LENGTH);
+    record->uptime = getUint32(r + 6);
+    record->txTime = getUint32(r + 10);
+    record->rxTime = getUint32(r + 14);
+    record->readings = getUint16(r + 18);
+    record->charge = getUint32(r + 20);
+  }
+  return true;
+}  // deserializeStats
+
+void setSensorDataReceiver(LoraPacket* packet, const uint8_t* macAddr) {
+  memcpy(packet->data + 1, macAddr, MAC_ADDR_LENGTH);
+}
+
+const uint8_t* getSensorDataReceiver(const LoraPacket* packet) {
+  return packet->data + 1;
+}
+
+void setSensorDataSeq(LoraPacket* packet, uint8_t seq) {
+  packet->data[13] = seq;
+}
+
+void setSensorDataSF(LoraPacket* packet, uint8_t spreadingFactor) {
+  packet->data[15] = spreadingFactor;
+}
+
+void setSensorDataEpoch(LoraPacket* packet, uint16_t epoch) {
+  putUint16(packet->data + 16, epoch);
+}
+
+int getSensorDataSeq(const LoraPacket* packet) {
+  if (isSequencedType(getPacketType(packet)) == false || packet->length < DATA_MESSAGE_HEADER_LENGTH) {
+    return -1;
+  }
+  return packet->data[13];
+}
+
+bool isSeqAcked(const SensorDataReply* reply, uint8_t seq) {
+  // distance behind the acknowledged seq, wrapping like the seq itself
+  uint8_t behind = reply->seq - seq;
+  if (behind == 0) {
+    return true;
+  }
+  return behind <= LORA_ACK_BITMAP_BITS && (reply->ackBitmap >> (behind - 1)) & 1;
+}
@@ -0,0 +1,244 @@
+/** LoRa Packet
+ *  Binary wire format shared by the LoRa leaf/relay nodes and the master.
+ *
+ *  Every frame starts with a header byte: the high nibble holds the frame
+ *  version and the low nibble the message type. Multi-byte fields are little
+ *  endian, MAC addresses are sent as 6 raw bytes and sensor values as fixed
+ *  point integers:
+ *
+ *    DISCOVERY_MESSAGE        header
+ *    DISCOVERY_REPLY_MESSAGE  header, level (u16), MAC (6), SF switch (u8),
+ *                             SNR 0.25 dB (i8), RSSI dBm (i8)
+ *    DATA_MESSAGE             header, receiver MAC (6), sender MAC (6),
+ *                             seq (u8), reading count (u8), SF (u8),
+ *                             boot epoch (u16), then per reading:
+ *                             origin MAC (6), origin seq (u16),
+ *                             CO2 ppm (u16), temperature 0.01 C (i16),
+ *                             humidity 0.01 %RH (u16)
+ *    DATA_REPLY_MESSAGE       header, receiver MAC (6), seq (u8), ack bitmap (u8),
+ *                             SF switch (u8), SNR 0.25 dB (i8), RSSI dBm (i8)
+ *    STATS_MESSAGE            same header as DATA_MESSAGE, then per record:
+ *                             origin MAC (6), uptime s (u32), TX ms (u32),
+ *                             RX ms (u32), readings (u16), charge uAh (u32)
+ *
+ *  A DATA_MESSAGE batches up to LORA_MAX_BATCH_READINGS readings, possibly
+ *  from different nodes, and is acknowledged by a single DATA_REPLY_MESSAGE.
+ *  The seq is counted per sender hop, so several data packets can be in
+ *  flight at once. A reply acknowledges its seq and, in bit i of the ack
+ *  bitmap, whether seq - 1 - i has been received as well, so one reply that
+ *  gets through also covers replies lost earlier. STATS_MESSAGE frames share
+ *  the seq space of DATA_MESSAGE and are relayed and acknowledged the same way.
+ *  The boot epoch is drawn at random when the sender boots and starts its
+ *  seqs over, so a receiver can tell a restarted sender from a retransmission
+ *  even if the new seqs land inside the history it kept of the old ones.
+ *  The origin seq of a reading is counted by the node that took it, the
+ *  same one it would carry over ESP-NOW, so the master can tell copies of
+ *  a reading apart from new ones whichever path they came over.
+ *
+ *  For the adaptive data rate (see AdrController) both replies carry the
+ *  operating SF the replier announces and the SNR and RSSI it measured on the
+ *  frame it answers, while DATA_MESSAGE and STATS_MESSAGE carry the SF the
+ *  sender's subtree needs. The SF switch byte holds the announced SF in its
+ *  low nibble and the seconds until it applies, in 2 s steps, in its high one.
+ *
+ *  Frame size and time on air at SF12 / 812.5 kHz / CR 4/7, compared with
+ *  the previous comma separated text frames:
+ *
+ *    message                  text bytes  airtime   binary bytes  airtime
+ *    DATA_MESSAGE (1 reading)    ~60      545.7 ms       32       334.0 ms
+ *    8 readings                 ~480     4365.7 ms      130      1039.8 ms
+ *    DISCOVERY_REPLY_MESSAGE      21      263.4 ms       12       192.8 ms
+ *    DATA_REPLY_MESSAGE            5      157.5 ms       12       192.8 ms
+ *    DISCOVERY_MESSAGE             2      122.2 ms        1       122.2 ms
+ *
+ *  At SF7 the 8 reading frame takes 46.0 ms and a reply 8.5 ms.
+ */
+
+#ifndef LORA_PACKET_H
+#define LORA_PACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "RingQueue.h"
+
+#define LORA_FRAME_VERSION 6
+
+// SX1280 maximum payload length
+#define LORA_MAX_PACKET_LENGTH 255
+
+#define MAC_ADDR_LENGTH 6
+
+// message types
+#define DISCOVERY_MESSAGE 0
+#define DISCOVERY_REPLY_MESSAGE 1
+#define DATA_MESSAGE 2
+#define DATA_REPLY_MESSAGE 3
+#define STATS_MESSAGE 4
+
+// encoded frame lengths
+#define DISCOVERY_MESSAGE_LENGTH 1
+#define DISCOVERY_REPLY_MESSAGE_LENGTH 12
+#define DATA_MESSAGE_HEADER_LENGTH 18
+#define LORA_READING_LENGTH 14
+#define DATA_REPLY_MESSAGE_LENGTH 12
+#define LORA_STATS_RECORD_LENGTH 24
+
+// longest announced SF switch a reply can carry, in s
+#define LORA_MAX_SWITCH_IN 30
+
+// older seqs a DATA_REPLY_MESSAGE can acknowledge next to its own
+#define LORA_ACK_BITMAP_BITS 8
+
+// readings that fit in one DATA_MESSAGE
+#define LORA_MAX_BATCH_READINGS ((LORA_MAX_PACKET_LENGTH - DATA_MESSAGE_HEADER_LENGTH) / LORA_READING_LENGTH)
+
+// length of a DATA_MESSAGE carrying the given number of readings
+#define DATA_MESSAGE_LENGTH(readings) (DATA_MESSAGE_HEADER_LENGTH + (readings) * LORA_READING_LENGTH)
+
+// stats records that fit in one STATS_MESSAGE
+#define LORA_MAX_STATS_RECORDS ((LORA_MAX_PACKET_LENGTH - DATA_MESSAGE_HEADER_LENGTH) / LORA_STATS_RECORD_LENGTH)
+
+#define STATS_MESSAGE_LENGTH(records) (DATA_MESSAGE_HEADER_LENGTH + (records) * LORA_STATS_RECORD_LENGTH)
+
+// signal of a received frame as the radio measured it
+typedef struct LinkQuality {
+  int8_t snr;   // 0.25 dB
+  int8_t rssi;  // dBm
+} LinkQuality;
+
+// raw frame as sent or received over the air
+typedef struct LoraPacket {
+  uint8_t length;
+  uint8_t data[LORA_MAX_PACKET_LENGTH];
+  LinkQuality quality;  // filled in on receive, not sent
+} LoraPacket;
+
+typedef struct MacAddress {
+  uint8_t bytes[MAC_ADDR_LENGTH];
+} MacAddress;
+
+// one sensor reading inside a DATA_MESSAGE
+typedef struct LoraReading {
+  uint8_t SMACaddr[MAC_ADDR_LENGTH];  // origin mac
+  uint16_t seq;                       // counted per origin, shared with ESP-NOW
+  float c02Data;
+  float temperatureData;
+  float humidityData;
+} LoraReading;
+
+typedef struct LoraSensorData {
+  uint8_t requestType;
+  uint8_t MACaddr[MAC_ADDR_LENGTH];        // receiver mac
+  uint8_t senderMACaddr[MAC_ADDR_LENGTH];  // mac of the transmitting hop
+  uint8_t seq;
+  uint8_t readingCount;
+  uint8_t spreadingFactor;                 // SF the sender's subtree needs
+  uint16_t epoch;                          // of the sender's current boot
+  LoraReading readings[LORA_MAX_BATCH_READINGS];
+} LoraSensorData;
+
+// airtime and energy totals of one node since it booted
+typedef struct LoraStatsRecord {
+  uint8_t MACaddr[MAC_ADDR_LENGTH];  // origin mac
+  uint32_t uptime;                   // s
+  uint32_t txTime;                   // ms on air transmitting
+  uint32_t rxTime;                   // ms on air receiving
+  uint16_t readings;                 // own readings taken
+  uint32_t charge;                   // estimated uAh drawn
+} LoraStatsRecord;
+
+typedef struct LoraStatsData {
+  uint8_t requestType;
+  uint8_t MACaddr[MAC_ADDR_LENGTH];        // receiver mac
+  uint8_t senderMACaddr[MAC_ADDR_LENGTH];  // mac of the transmitting hop
+  uint8_t seq;
+  uint8_t recordCount;
+  uint8_t spreadingFactor;                 // SF the sender's subtree needs
+  uint16_t epoch;                          // of the sender's current boot
+  LoraStatsRecord records[LORA_MAX_STATS_RECORDS];
+} LoraStatsData;
+
+typedef struct SensorDataReply {
+  uint8_t requestType;
+  uint8_t MACaddr[MAC_ADDR_LENGTH];  // sender of the acknowledged data
+  uint8_t seq;                       // from the data packet
+  uint8_t ackBitmap;                 // bit i set if seq - 1 - i was received too
+  uint8_t spreadingFactor;           // operating SF announced by the replier
+  uint8_t switchIn;                  // s until it applies, up to LORA_MAX_SWITCH_IN
+  LinkQuality quality;               // of the acknowledged frame at the replier
+} SensorDataReply;
+
+typedef struct DiscoveryMessage {
+  uint8_t requestType;
+} DiscoveryMessage;
+
+typedef struct DiscoveryReplyMessage {
+  uint8_t requestType;
+  int level;
+  uint8_t MACaddr[MAC_ADDR_LENGTH];  // selfAddr
+  uint8_t spreadingFactor;           // operating SF announced by the replier
+  uint8_t switchIn;                  // s until it applies, up to LORA_MAX_SWITCH_IN
+  LinkQuality quality;               // of the discovery message at the replier
+} DiscoveryReplyMessage;
+
+bool operator==(const LoraPacket& a, const LoraPacket& b);
+bool operator==(const MacAddress& a, const MacAddress& b);
+bool operator==(const LoraReading& a, const LoraReading& b);
+bool operator==(const LoraStatsRecord& a, const LoraStatsRecord& b);
+uint32_t ringQueueHash(const LoraPacket& packet);
+uint32_t ringQueueHash(const MacAddress& address);
+uint32_t ringQueueHash(const LoraReading& reading);
+uint32_t ringQueueHash(const LoraStatsRecord& record);
+
+// message type of a frame, -1 if empty or of another frame version
+int getPacketType(const LoraPacket* packet);
+
+// link quality from the radio's SNR in dB and RSSI in dBm, clamped to the wire range
+LinkQuality makeLinkQuality(float snr, float rssi);
+
+// SNR in dB of a link quality
+float getLinkSnr(const LinkQuality* quality);
+
+// true for the types that carry a seq and wait in the send window for a reply
+bool isSequencedType(int type);
+
+void serializeDM(const DiscoveryMessage* message, LoraPacket* packet);
+void serializeDRM(const DiscoveryReplyMessage* message, LoraPacket* packet);
+bool deserializeDRM(const LoraPacket* packet, DiscoveryReplyMessage* message);
+void serializeSensorData(const LoraSensorData* data, LoraPacket* packet);
+bool deserializeSensorData(const LoraPacket* packet, LoraSensorData* data);
+void serializeSDR(const SensorDataReply* reply, LoraPacket* packet);
+bool deserializeSDR(const LoraPacket* packet, SensorDataReply* reply);
+void serializeStats(const LoraStatsData* stats, LoraPacket* packet);
+bool deserializeStats(const LoraPacket* packet, LoraStatsData* stats);
+
+// the helpers below work on any sequenced frame, DATA_MESSAGE or STATS_MESSAGE
+
+// overwrite the receiver of an encoded DATA_MESSAGE in place
+void setSensorDataReceiver(LoraPacket* packet, const uint8_t* macAddr);
+
+// receiver of an encoded DATA_MESSAGE, MAC_ADDR_LENGTH bytes
+const uint8_t* getSensorDataReceiver(const LoraPacket* packet);
+
+// append a reading to an encoded DATA_MESSAGE, returns false if it is full
+bool appendReading(LoraPacket* packet, const LoraReading* reading);
+
+// readings of an encoded DATA_MESSAGE that the given origin took, 0 for other types
+int countReadingsFrom(const LoraPacket* packet, const uint8_t* origin);
+
+// overwrite the seq of an encoded DATA_MESSAGE in place
+void setSensorDataSeq(LoraPacket* packet, uint8_t seq);
+
+// overwrite the subtree SF of an encoded DATA_MESSAGE in place
+void setSensorDataSF(LoraPacket* packet, uint8_t spreadingFactor);
+
+// overwrite the boot epoch of an encoded DATA_MESSAGE in place
+void setSensorDataEpoch(LoraPacket* packet, uint16_t epoch);
+
+// seq of an encoded DATA_MESSAGE, -1 if the packet is not sequenced
+int getSensorDataSeq(const LoraPacket* packet);
+
+// true if the reply acknowledges the given seq, directly or through its bitmap
+bool isSeqAcked(const SensorDataReply* reply, uint8_t seq);
+
+#endif  // LORA_PACKET_H
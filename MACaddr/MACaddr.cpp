@@ -1,7 +1,17 @@
 #include "MACaddr.h"
+#include <LittleFS.h>
+#include "Log.h"
 
 char MACaddrG[MAX_MAC_LENGTH]; // Define the global variable
+uint8_t MACbytesG[6];
 SensirionI2CScd4x scd4x;
+SensorScheduler sensorScheduler;
+TimeSeriesBuffer readingBacklog;
+FlashBacklog flashBacklog;
+
+// origin seq of the next own reading, whichever link it goes over. Starts at
+// random so a reboot does not repeat recent ones.
+static uint16_t readingSeq = 0;
 
 void formatMacAddress(const uint8_t *macAddr, char *buffer, int maxLength) {
   // Function definition
@@ -22,12 +32,12 @@ void setupMACaddr() {
   Serial.println("Obtaining MAC address...");
 
   Serial.print("MAC Address: ");
-  uint8_t macAddressBytes[6];
-  parseMacAddress(WiFi.macAddress(), macAddressBytes);
-  formatMacAddress(macAddressBytes, MACaddrG, MAX_MAC_LENGTH);
+  parseMacAddress(WiFi.macAddress(), MACbytesG);
+  formatMacAddress(MACbytesG, MACaddrG, MAX_MAC_LENGTH);
   Serial.println(MACaddrG);
 
   WiFi.disconnect();
+  readingSeq = esp_random();
 }
 
 void printUint16Hex(uint16_t value) {
@@ -45,7 +55,7 @@ void printSerialNumber(uint16_t serial0, uint16_t serial1, uint16_t serial2) {
   Serial.println();
 }
 
-void setupSensor() {
+void setupSensor(SensorMode mode, unsigned long interval) {
 Wire.begin(I2C_SDA, I2C_SCL);
 
         uint16_t error;
@@ -74,12 +84,80 @@ Wire.begin(I2C_SDA, I2C_SCL);
         }
 
         // Start Measurement
-        error = scd4x.startPeriodicMeasurement();
-        if (error) {
-          Serial.print("Error trying to execute startPeriodicMeasurement(): ");
-          errorToString(error, errorMessage, 256);
-          Serial.println(errorMessage);
-        }
+        sensorScheduler.begin(scd4x, mode, interval, millis());
+}
+
+// after a deep sleep the sensor still measures, only the bus and the scheduler start again
+void resumeSensor(SensorMode mode, unsigned long interval) {
+  Wire.begin(I2C_SDA, I2C_SCL);
+  scd4x.begin(Wire);
+  sensorScheduler.resume(scd4x, mode, interval, millis());
+}
+
+uint16_t getReadingSeq() {
+  return readingSeq;
+}
+
+// continue the seq of the previous wake instead of a random one
+void setReadingSeq(uint16_t seq) {
+  readingSeq = seq;
+}
+
+// read the sensor once the scheduler has a reading due, false until then. A
+// sensor error is covered with random values so the data path keeps being exercised.
+bool takeReading(TimeSeriesSample* reading, unsigned long now) {
+  uint16_t error;
+  char errorMessage[256];
+  uint16_t co2 = 0;
+  float temperature = 0.0f;
+  float humidity = 0.0f;
+
+  if (sensorScheduler.poll(now) == false) {
+    return false;
+  }
+  reading->time = now;
+  error = scd4x.readMeasurement(co2, temperature, humidity);
+  if (error) {
+    errorToString(error, errorMessage, 256);
+    LOG_ERROR("Error trying to execute readMeasurement(): %s", errorMessage);
+  } else if (co2 == 0) {
+    LOG_WARN("Invalid sample detected, skipping.");
+    error = 1;
+  }
+
+  if (error) {
+    reading->c02Data = getRandomFloat(100.0, 1000.0);
+    reading->temperatureData = getRandomFloat(0.0, 40.0);
+    reading->humidityData = getRandomFloat(90.0, 1030.0);
+  } else {
+    reading->c02Data = co2;
+    reading->temperatureData = temperature;
+    reading->humidityData = humidity;
+  }
+  reading->seq = readingSeq++;
+  return true;
+}  // takeReading
+
+static bool spillToFlash(const uint8_t* block, uint16_t samples) {
+  return flashBacklog.append(block, samples);
+}
+
+void setupBacklog(BacklogReplay replay) {
+  // formatted on the first boot, the partition holds nothing else
+  if (LittleFS.begin(true) == false || flashBacklog.begin(LittleFS, replay) == false) {
+    Serial.println("Flash backlog unavailable, the backlog is kept in RAM only");
+    return;
+  }
+  readingBacklog.setSpill(spillToFlash);
+  Serial.printf("Flash backlog holds %u readings\n", (unsigned)flashBacklog.count());
+}
+
+// the next backlogged reading to send, flash holds the older ones
+bool popBacklog(TimeSeriesSample* sample) {
+  if (flashBacklog.getReplay() == BACKLOG_OLDEST_FIRST) {
+    return flashBacklog.pop(sample) || readingBacklog.pop(sample);
+  }
+  return readingBacklog.pop(sample) || flashBacklog.pop(sample);
 }
 
 float getRandomFloat(float min, float max) {
@@ -3,6 +3,9 @@
 
 #include <WiFi.h>
 #include <SensirionI2CScd4x.h>
+#include "TimeSeriesBuffer.h"
+#include "FlashBacklog.h"
+#include "SensorScheduler.h"
 
 #define MAX_MAC_LENGTH 18
 
@@ -10,12 +13,22 @@
 #define I2C_SCL 45
 
 extern char MACaddrG[MAX_MAC_LENGTH]; // Declare the global variable
+extern uint8_t MACbytesG[6];           // same address in binary form
 extern SensirionI2CScd4x scd4x;
+extern SensorScheduler sensorScheduler;  // when scd4x measures and is read
+extern TimeSeriesBuffer readingBacklog;  // own readings taken while they could not be sent
+extern FlashBacklog flashBacklog;        // where readingBacklog spills once it is full
 
 void formatMacAddress(const uint8_t *macAddr, char *buffer, int maxLength);
 void parseMacAddress(String macAddress, uint8_t *macAddressBytes);
 void setupMACaddr();
-void setupSensor();
+void setupSensor(SensorMode mode, unsigned long interval);
+void resumeSensor(SensorMode mode, unsigned long interval);
+uint16_t getReadingSeq();
+void setReadingSeq(uint16_t seq);
+bool takeReading(TimeSeriesSample* reading, unsigned long now);
+void setupBacklog(BacklogReplay replay);
+bool popBacklog(TimeSeriesSample* sample);
 float getRandomFloat(float min, float max);
 int getRandomInt(int min, int max);
 
@@ -3,53 +3,104 @@
 #include "ESPNowCommunication.h"
 #include "LoraCommunication.h"
 #include "ProtocolManager.h"
+#include "DeepSleep.h"
+#include "Log.h"
 
-unsigned long startMillis;
-unsigned long currentMillis;
-const unsigned long period = 10000;  //the value is a number of milliseconds
-bool isEspnow = true;
+#define READING_INTERVAL 5000  // ms between own readings, sets the sensor mode
+// #define LIGHT_SLEEP         // leaf nodes only, a node that forwards must stay awake
+// #define DEEP_SLEEP          // leaf nodes only, powers down between readings, see DeepSleep.h
+
+unsigned long statsTimer = 0;
+unsigned long sensorStatsTimer = 0;
+unsigned long radioWait = 0;  // ms until the next ESP-NOW job or LoRa advert
 
 void setup() {
+#ifdef DEEP_SLEEP
+  bool woke = deepSleepWoke();
+#else
+  bool woke = false;
+#endif
   // Set up Serial Monitor
   Serial.begin(115200);
-  delay(1000);
+  if (woke == false) {
+    delay(1000);
+  }
+  logSetup();
 
   // Setup code here
   setupMACaddr();
-  setupSensor();
+  if (woke == true) {
+    resumeSensor(sensorModeFor(READING_INTERVAL), READING_INTERVAL);
+  } else {
+    setupSensor(sensorModeFor(READING_INTERVAL), READING_INTERVAL);
+  }
+  loraSetReadingInterval(READING_INTERVAL);
+  setupBacklog(BACKLOG_OLDEST_FIRST);
+  // before the stacks, which report to it as soon as they run
+  protocolManager.begin(PROTOCOL_ESPNOW, millis());
+#ifdef DEEP_SLEEP
+  loraSetLeaf(true);
+  espnowSetLeaf(true);
+#endif
   espnowSetup();
   loraSetup();
-  Serial.println("setup completed");
+  if (woke == true) {
+    deepSleepRestore(millis());
+  }
+  LOG_INFO("setup completed");
+}
 
-  startMillis = millis();  //initial start time
+// hand an own reading to the link the protocol manager picks for it
+void routeReading(const TimeSeriesSample& reading, unsigned long now) {
+  Protocol protocol = protocolManager.route(now);
+  LOG_DEBUG("Reading over %s", protocolName(protocol));
+  if (protocol == PROTOCOL_LORA) {
+    loraSendReading(reading);
+  } else {
+    espnowSendReading(reading);
+  }
 }
 
 void loop() {
-  Serial.println("Ben ben says hi! Failed Message Count: " + String(failedMessageCount));
+  unsigned long now = millis();
+  // the scheduler says when the sensor has a sample for the next reading
+  TimeSeriesSample reading;
+  if (takeReading(&reading, now) == true) {
+    routeReading(reading, now);
+  }
 
-  // Check if it's time to switch from ESP-NOW to LoRa or vice versa.
-  if (failedMessageCount >= MAX_FAILED_MESSAGES) {
-    // Switch protocol
-    isEspnow = !isEspnow; // Toggle between ESP-NOW and LoRa.
+  if (now - statsTimer >= PROTOCOL_STATS_INTERVAL) {
+    statsTimer = now;
+    protocolManager.printStats();
+  }
+  if (now - sensorStatsTimer >= SENSOR_STATS_INTERVAL) {
+    sensorStatsTimer = now;
+    sensorScheduler.printStats(now);
+  }
 
-    // Reset failed message count after switching.
-    failedMessageCount = 0;
+  // both stacks keep their routes up, LoRa is polled so the ESP-NOW jobs
+  // run in between instead of sleeping until their deadline
+  radioWait = espnowPoll();
+  loraLoop();
 
-    // Log the switch.
-    if (isEspnow) {
-      Serial.println("Switched to ESP-NOW");
-    } else {
-      Serial.println("Switched to LoRa");
-    }
+#ifdef DEEP_SLEEP
+  now = millis();
+  if (deepSleepReady(now) && sensorScheduler.untilReading(now) >= DEEP_SLEEP_MIN) {
+    sensorScheduler.prepareDeepSleep();
+    deepSleepStart(sensorScheduler.untilReading(now), now);
   }
+#endif
 
-  // Execute protocol-specific loop.
-  if (isEspnow) {
-    Serial.println("Operating in ESP-NOW mode");
-    espnowLoop();
-  } else {
-    Serial.println("Operating in LoRa mode");
-    loraLoop();
+#ifdef LIGHT_SLEEP
+  // sleep until the sensor, a route job or a LoRa advert is due, the LoRa
+  // radio keeps listening and wakes the MCU through DIO1
+  now = millis();
+  radioWait = min(radioWait, loraWait(now));
+  sensorScheduler.alignTo(now + radioWait);
+  unsigned long wait = min(radioWait, sensorScheduler.wait(now));
+  if (wait >= SENSOR_MIN_SLEEP && loraCanSleep() && espnowCanSleep()) {
+    sensorScheduler.lightSleep(wait, RADIO_DIO1_PIN);
+    loraWake();
   }
+#endif
 }
-
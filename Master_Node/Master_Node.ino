@@ -9,26 +9,31 @@
 #include <RadioLib.h>
 #include "config/boards.h"
 
+#include "Log.h"
 #include "lib/message.h"
+#include "lib/uplink_impl.h"
 #include "lib/lora_impl.h"
 #include "lib/esp_now_impl.h"
 
 void setupWiFi() {
   WiFi.mode(WIFI_AP_STA);
-  Serial.println("ESP-NOW Broadcast Demo");
-  Serial.print("MAC Address: ");
-  Serial.println(WiFi.macAddress());
+  LOG_INFO("ESP-NOW Broadcast Demo");
+  LOG_INFO("MAC Address: %s", WiFi.macAddress().c_str());
+  parseMacAddress(WiFi.macAddress(), selfAddr);
   WiFi.disconnect();
 }
 
 void initESPNow() {
+  startEspNowWorker();
   if (esp_now_init() == ESP_OK) {
-    Serial.println("ESP-NOW Init Success");
+    LOG_INFO("ESP-NOW Init Success");
     esp_now_register_recv_cb(receiveCallback);
     // esp_now_register_send_cb(sentCallback);
+    xTaskNotifyGive(workerTask);
   } else {
-    Serial.println("ESP-NOW Init Failed");
+    LOG_ERROR("ESP-NOW Init Failed");
     delay(3000);
+    logFlush();
     ESP.restart();
   }
 }
@@ -36,12 +41,13 @@ void initESPNow() {
 void initLoRa() {
   initBoard();
   setupLoRa();
+  startLoRaTask();
 }
 
 
 void setup() {
-  // Set up Serial Monitor
-  Serial.begin(115200);
+  // Set up the uplink to the host gateway, its task also prints the log
+  setupUplink();
   delay(1000);
 
   // Set up WiFi
@@ -54,12 +60,13 @@ void setup() {
   initLoRa();
 
   prev_time = millis();
-  Serial.println("Finish Setup");
+  LOG_INFO("Finish Setup");
 }
 
 
 
 
+// LoRa, ESP-NOW and the uplink each run in their own pinned task
 void loop() {
-  loRaLoop();
-}
\ No newline at end of file
+  vTaskDelete(NULL);
+}
@@ -3,6 +3,7 @@
 #include <Wire.h>
 #include <Ticker.h>
 #include "utilities.h"
+#include "Log.h"
 
 SPIClass SDSPI(HSPI);
 #include <U8g2lib.h>
@@ -14,8 +15,8 @@ Ticker ledTicker;
 
 void initBoard()
 {
-    Serial.begin(115200);
-    Serial.println("initBoard");
+    // Serial already runs at the uplink baud rate, see setupUplink()
+    LOG_INFO("initBoard");
     SPI.begin(RADIO_SCLK_PIN, RADIO_MISO_PIN, RADIO_MOSI_PIN);
 
     Wire.begin(I2C_SDA, I2C_SCL);
@@ -34,7 +35,7 @@ void initBoard()
 
     Wire.beginTransmission(0x3C);
     if (Wire.endTransmission() == 0) {
-        Serial.println("Started OLED");
+        LOG_INFO("Started OLED");
         u8g2 = new U8G2_SSD1306_128X64_NONAME_F_HW_I2C(U8G2_R0, U8X8_PIN_NONE);
         u8g2->begin();
         u8g2->clearBuffer();
@@ -2,10 +2,18 @@
 
 import serial
 import argparse
+import ctypes
 import paho.mqtt.client as mqtt
 import json
 import random
 import configparser
+import binascii
+import struct
+import time
+import os
+import queue
+import sys
+import threading
 
 # Load configuration from config file
 config = configparser.ConfigParser()
@@ -16,10 +24,35 @@ DEFAULT_BROKER_HOST = config.get('mqtt', 'broker_host')
 DEFAULT_BROKER_PORT = config.getint('mqtt', 'broker_port')
 username = config.get('mqtt', 'username')
 password = config.get('mqtt', 'password')
+# off for the local Mosquitto of elastic-stack-docker
+use_tls = config.getboolean('mqtt', 'tls', fallback=True)
 
 # Serial Port Settings
 SERIAL_PORT = '/dev/ttyACM0'  # Adjust this to match your serial port
-BAUD_RATE = 115200  # Adjust this to match your baud rate
+BAUD_RATE = 921600  # UPLINK_BAUD of the master
+
+# Gateway settings
+BATCH_SIZE = 1          # readings per MQTT message, above 1 they go to BATCH_TOPIC as a JSON array
+BATCH_DELAY = 0.2       # s the oldest reading may wait for a batch to fill
+QUEUE_SIZE = 1024       # readings between the serial readers and the publisher, readers block when full
+MAX_INFLIGHT = 64       # MQTT messages the client may hold unsent before the publisher waits
+REPORT_INTERVAL = 10.0  # s between throughput reports
+RETRY_DELAY = 0.5       # s before a batch the client refused is offered again, doubling up to RETRY_MAX
+RETRY_MAX = 30.0
+BATCH_TOPIC = "sensor_data_batch"
+
+# Serial uplink frames, see SerialUplink/SerialUplink.h for the layout. They are
+# decoded by UplinkDecoder itself, built as a library by the host build:
+#     cmake -S . -B build && cmake --build build --target uplink_gateway
+UPLINK_FRAME_VERSION = 1
+UPLINK_READINGS = 1
+UPLINK_STATS = 2
+UPLINK_LOG = 3
+UPLINK_MAX_LOG_TEXT = 241
+UPLINK_HEADER = struct.Struct("<BHB")        # header, frame seq, record count
+UPLINK_READING = struct.Struct("<B6sHIHhH")  # protocol, origin, seq, received at, CO2, temperature, humidity
+PROTOCOLS = {0: "espnow", 1: "lora"}
+LOG_LEVELS = " EWID"
 
 # Predefined list of latitude and longitude coordinates
 locations = [
@@ -37,7 +70,177 @@ def on_connect(client, userdata, flags, rc):
         print(f"Connection to MQTT broker failed with result code {rc}")
         
 def publish_data(client, topic, payload):
-    client.publish(topic, payload)
+    return client.publish(topic, payload)
+
+def publish_stats(client, fields):
+    # stats,macStr,uptime s,tx ms,rx ms,idle ms,readings,mAh per reading
+    if len(fields) != 8:
+        print("Unexpected number of stats fields:", len(fields))
+        return
+    try:
+        node_stats = {
+            "macStr": fields[1],
+            "uptime": int(fields[2]),
+            "txTime": int(fields[3]),
+            "rxTime": int(fields[4]),
+            "idleTime": int(fields[5]),
+            "readings": int(fields[6]),
+            "mAhPerReading": float(fields[7])
+        }
+    except ValueError:
+        print("Error parsing stats fields.")
+        return
+
+    payload = json.dumps(node_stats)
+    try:
+        publish_data(client, "node_stats", payload)
+        print("Node stats published:", payload)
+    except Exception as e:
+        print("Error publishing node stats:", e)
+
+def format_mac(origin):
+    return bytes(origin).hex(":")
+
+def cobs_encode(data):
+    out = bytearray()
+    for block in data.split(b"\x00"):
+        while len(block) >= 254:
+            out += b"\xff" + block[:254]
+            block = block[254:]
+        out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+def encode_frame(frame_type, seq, records):
+    # the master's side, only used by the benchmark and the PTY test
+    payload = UPLINK_HEADER.pack((UPLINK_FRAME_VERSION << 4) | frame_type, seq, len(records)) + b"".join(records)
+    return cobs_encode(payload + struct.pack("<H", binascii.crc_hqx(payload, 0xFFFF))) + b"\x00"
+
+class UplinkReading(ctypes.Structure):
+    _fields_ = [("protocol", ctypes.c_uint8), ("origin", ctypes.c_uint8 * 6), ("seq", ctypes.c_uint16),
+                ("receivedAt", ctypes.c_uint32),
+                ("c02Data", ctypes.c_float), ("temperatureData", ctypes.c_float), ("humidityData", ctypes.c_float)]
+
+class LoraStatsRecord(ctypes.Structure):
+    _fields_ = [("MACaddr", ctypes.c_uint8 * 6), ("uptime", ctypes.c_uint32), ("txTime", ctypes.c_uint32),
+                ("rxTime", ctypes.c_uint32), ("readings", ctypes.c_uint16), ("charge", ctypes.c_uint32)]
+
+class UplinkLog(ctypes.Structure):
+    _fields_ = [("level", ctypes.c_uint8), ("time", ctypes.c_uint32), ("text", ctypes.c_char * (UPLINK_MAX_LOG_TEXT + 1))]
+
+native = None
+
+def load_native(path):
+    """The UplinkDecoder of the host build, see test/UplinkGateway.cpp"""
+    global native
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    candidates = [path] if path else [os.environ.get("UPLINK_GATEWAY_LIB")] + [
+        os.path.join(root, build, "test", "libuplink_gateway.so") for build in ("build", "_gate_build")]
+    found = next((candidate for candidate in candidates if candidate and os.path.exists(candidate)), None)
+    if found is None:
+        sys.exit("libuplink_gateway.so not found, build it with\n"
+                 "    cmake -S . -B build && cmake --build build --target uplink_gateway\n"
+                 "or pass its path with --native")
+    native = ctypes.CDLL(found)
+    handle, out, u32 = ctypes.c_void_p, ctypes.POINTER, ctypes.c_uint32
+    prototypes = {
+        "uplinkLayout": (None, [out(ctypes.c_size_t)]),
+        "uplinkDecoderNew": (handle, []),
+        "uplinkDecoderFree": (None, [handle]),
+        "uplinkDecoderPush": (ctypes.c_size_t, [handle, ctypes.c_void_p, ctypes.c_size_t]),
+        "uplinkDecoderType": (ctypes.c_int, [handle]),
+        "uplinkDecoderSeq": (ctypes.c_uint16, [handle]),
+        "uplinkDecoderCount": (ctypes.c_int, [handle]),
+        "uplinkDecoderReading": (ctypes.c_bool, [handle, ctypes.c_int, out(UplinkReading)]),
+        "uplinkDecoderStats": (ctypes.c_bool, [handle, ctypes.c_int, out(LoraStatsRecord)]),
+        "uplinkDecoderLog": (ctypes.c_bool, [handle, out(UplinkLog)]),
+        "uplinkDecoderFrames": (u32, [handle]),
+        "uplinkDecoderErrors": (u32, [handle]),
+    }
+    for name, (restype, argtypes) in prototypes.items():
+        function = getattr(native, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    sizes = (ctypes.c_size_t * 3)()
+    native.uplinkLayout(sizes)
+    expected = [ctypes.sizeof(layout) for layout in (UplinkReading, LoraStatsRecord, UplinkLog)]
+    if list(sizes) != expected:
+        sys.exit(f"{found} lays out its structs as {list(sizes)} bytes, connector.py as {expected}, rebuild it")
+
+class UplinkDecoder:
+    """Reassembles the frames of one master's byte stream"""
+
+    def __init__(self):
+        self.handle = native.uplinkDecoderNew()
+
+    def __del__(self):
+        if native is not None and self.handle:
+            native.uplinkDecoderFree(self.handle)
+
+    @property
+    def errors(self):
+        # frames dropped for their CRC or framing so far
+        return native.uplinkDecoderErrors(self.handle)
+
+    def feed(self, data):
+        """The (type, seq, records) of every frame the data completes"""
+        buffer = (ctypes.c_uint8 * len(data)).from_buffer_copy(data)
+        offset = 0
+        while offset < len(data):
+            frames = native.uplinkDecoderFrames(self.handle)
+            offset += native.uplinkDecoderPush(self.handle, ctypes.addressof(buffer) + offset, len(data) - offset)
+            if native.uplinkDecoderFrames(self.handle) != frames:
+                yield self.frame()
+
+    def frame(self):
+        frame_type = native.uplinkDecoderType(self.handle)
+        seq = native.uplinkDecoderSeq(self.handle)
+        records = []
+        if frame_type == UPLINK_READINGS:
+            reading = UplinkReading()
+            for i in range(native.uplinkDecoderCount(self.handle)):
+                native.uplinkDecoderReading(self.handle, i, reading)
+                records.append({
+                    "macStr": format_mac(reading.origin),
+                    "seq": reading.seq,
+                    "receivedAt": reading.receivedAt,
+                    "c02Data": reading.c02Data,
+                    "temperatureData": round(reading.temperatureData, 2),
+                    "humidityData": round(reading.humidityData, 2),
+                    "protocol": PROTOCOLS.get(reading.protocol, str(reading.protocol)),
+                })
+        elif frame_type == UPLINK_STATS:
+            for i in range(native.uplinkDecoderCount(self.handle)):
+                record = LoraStatsRecord()
+                native.uplinkDecoderStats(self.handle, i, record)
+                records.append(record)
+        elif frame_type == UPLINK_LOG:
+            log = UplinkLog()
+            native.uplinkDecoderLog(self.handle, log)
+            records.append((log.level, log.time, log.text.decode(errors="replace")))
+        return frame_type, seq, records
+
+def stats_fields(record):
+    # the stats line the master used to print, idle time and charge per reading worked out here
+    idle = max(record.uptime * 1000 - record.txTime - record.rxTime, 0)
+    per_reading = record.charge / 1000.0 / record.readings if record.readings > 0 else 0.0
+    return ["stats", format_mac(record.MACaddr), str(record.uptime), str(record.txTime), str(record.rxTime), str(idle),
+            str(record.readings), f"{per_reading:.4f}"]
+
+def benchmark(count):
+    # decode speed of this host, frames of UPLINK_MAX_READINGS readings
+    reading = UPLINK_READING.pack(0, bytes(range(6)), 1, 1000, 412, 2345, 5678)
+    frames = [encode_frame(UPLINK_READINGS, seq & 0xFFFF, [reading] * 12) for seq in range(count)]
+    decoder = UplinkDecoder()
+    start = time.perf_counter()
+    readings = 0
+    # in reads of about the size a busy port returns
+    for i in range(0, count, 16):
+        for frame_type, seq, records in decoder.feed(b"".join(frames[i:i + 16])):
+            readings += len(records)
+    elapsed = time.perf_counter() - start
+    size = sum(len(frame) for frame in frames)
+    print(f"{count} frames in {elapsed:.3f} s: {count / elapsed:.0f} frames/s, {readings / elapsed:.0f} readings/s, "
+          f"{size * 10 / elapsed / 1e6:.2f} Mbaud")
 
 def generate_location_data():
     # Randomly choose a pair of latitude and longitude coordinates from the predefined list
@@ -45,78 +248,327 @@ def generate_location_data():
     
     return latitude, longitude
 
-def main(broker_host, broker_port):
+class GatewayStats:
+    """Counters shared by the reader and publisher threads"""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        self.frames = 0
+        self.bad_frames = 0
+        self.publish_errors = 0
+        self.lost_frames = 0
+        self.readings = 0
+        self.published = 0
+        self.messages = 0
+        self.latencies = []
+        self.blocked = 0.0
+
+    def add(self, **counts):
+        with self.lock:
+            for name, value in counts.items():
+                setattr(self, name, getattr(self, name) + value)
+
+    def add_latencies(self, values):
+        with self.lock:
+            self.latencies.extend(values)
+
+    def take(self):
+        """Counts since the last call"""
+        with self.lock:
+            snapshot = {name: value for name, value in vars(self).items() if name != "lock"}
+            self.reset()
+        return snapshot
+
+def make_reading(reading):
+    # Generate location data
+    latitude, longitude = generate_location_data()
+
+    # Create a dictionary to represent the data
+    return {
+        "macStr": reading["macStr"],
+        "c02Data": reading["c02Data"],
+        "temperatureData": reading["temperatureData"],
+        "humidityData": reading["humidityData"],
+        "latitude": latitude,
+        "longitude": longitude,
+        "protocol": reading["protocol"]
+    }
+
+class PortReader(threading.Thread):
+    """Decodes the frames of one master and queues its readings, blocking while the queue is full"""
+
+    def __init__(self, port, readings, client, stats, verbose):
+        super().__init__(name=f"reader {port.port}", daemon=True)
+        self.port = port
+        self.readings = readings
+        self.client = client
+        self.stats = stats
+        self.verbose = verbose
+        self.expected_seq = None
+        self.decoder = UplinkDecoder()
+
+    def run(self):
+        while True:
+            # whatever arrived, at least one byte
+            data = self.port.read(self.port.in_waiting or 1)
+            if not data:
+                continue
+            received = time.monotonic()
+            errors = self.decoder.errors
+            for frame_type, seq, records in self.decoder.feed(data):
+                self.handle(frame_type, seq, records, received)
+            if self.decoder.errors != errors:
+                self.stats.add(bad_frames=self.decoder.errors - errors)
+                print(f"{self.port.port}: dropped damaged uplink frames:", self.decoder.errors - errors)
+
+    def handle(self, frame_type, seq, records, received):
+        self.stats.add(frames=1)
+
+        # Log lines of the master
+        if frame_type == UPLINK_LOG:
+            level, log_time, text = records[0]
+            print(f"{self.port.port} {log_time} {LOG_LEVELS[level] if level < len(LOG_LEVELS) else '?'} {text}")
+            return
+
+        # readings and stats share the frame seq, a gap means frames were lost
+        if self.expected_seq is not None and seq != self.expected_seq:
+            lost = (seq - self.expected_seq) & 0xFFFF
+            self.stats.add(lost_frames=lost)
+            print(f"{self.port.port}: lost uplink frames:", lost)
+        self.expected_seq = (seq + 1) & 0xFFFF
+
+        # Airtime and energy totals reported by a LoRa node, rare enough to go out directly
+        if frame_type == UPLINK_STATS:
+            for record in records:
+                publish_stats(self.client, stats_fields(record))
+            return
+
+        start = time.monotonic()
+        for reading in records:
+            self.readings.put((received, make_reading(reading)))
+        self.stats.add(readings=len(records), blocked=time.monotonic() - start)
+
+class Publisher(threading.Thread):
+    """Publishes the queued readings in batches of up to batch_size or batch_delay s"""
+
+    def __init__(self, client, readings, stats, batch_size, batch_delay, max_inflight, verbose):
+        super().__init__(name="publisher", daemon=True)
+        self.client = client
+        self.readings = readings
+        self.stats = stats
+        self.batch_size = batch_size
+        self.batch_delay = batch_delay
+        self.max_inflight = max_inflight
+        self.verbose = verbose
+        # receive times of the readings of every message the broker has not acknowledged yet
+        self.inflight = {}
+        self.inflight_lock = threading.Condition()
+
+    def on_publish(self, client, userdata, mid, *args):
+        with self.inflight_lock:
+            received = self.inflight.pop(mid, None)
+            self.inflight_lock.notify()
+        if received is not None:
+            now = time.monotonic()
+            self.stats.add_latencies([now - t for t in received])
+
+    def run(self):
+        while True:
+            received, reading = self.readings.get()
+            batch = [reading]
+            times = [received]
+            deadline = received + self.batch_delay
+            while len(batch) < self.batch_size:
+                try:
+                    received, reading = self.readings.get(timeout=max(deadline - time.monotonic(), 0))
+                except queue.Empty:
+                    break
+                batch.append(reading)
+                times.append(received)
+            self.publish(batch, times)
+
+    def publish(self, batch, times):
+        # a batch the client refuses, say while it reconnects, is offered again until it is taken,
+        # so nothing is lost and the queue fills up behind it as when the broker is slow
+        delay = RETRY_DELAY
+        while not self.try_publish(batch, times):
+            self.stats.add(publish_errors=1)
+            time.sleep(delay)
+            delay = min(delay * 2, RETRY_MAX)
+        self.stats.add(published=len(batch), messages=1)
+        if self.verbose:
+            print("Sensor data published:", len(batch), "readings")
+
+    def try_publish(self, batch, times):
+        # at most max_inflight unacknowledged messages, the queue fills up behind us meanwhile
+        with self.inflight_lock:
+            while len(self.inflight) >= self.max_inflight:
+                self.inflight_lock.wait()
+            if self.batch_size == 1:
+                info = publish_data(self.client, "sensor_data", json.dumps(batch[0]))
+            else:
+                info = publish_data(self.client, BATCH_TOPIC, json.dumps(batch))
+            if info.rc != mqtt.MQTT_ERR_SUCCESS:
+                print("Error publishing sensor data, retrying:", mqtt.error_string(info.rc))
+                return False
+            self.inflight[info.mid] = times
+        return True
+
+class NullClient:
+    """Stands in for the MQTT client with --dry-run, every message is acknowledged right away"""
+
+    class PublishInfo:
+        def __init__(self, mid):
+            self.rc = mqtt.MQTT_ERR_SUCCESS
+            self.mid = mid
+
+    def __init__(self):
+        self.on_publish = None
+        self.mid = 0
+        # acknowledged from another thread, as the network loop of the real client would
+        self.acks = queue.Queue()
+        threading.Thread(target=self.acknowledge, name="acks", daemon=True).start()
+
+    def acknowledge(self):
+        while True:
+            mid = self.acks.get()
+            if self.on_publish:
+                self.on_publish(self, None, mid)
+
+    def publish(self, topic, payload):
+        self.mid += 1
+        self.acks.put(self.mid)
+        return NullClient.PublishInfo(self.mid)
+
+def connect_client(broker_host, broker_port):
     # Initialize MQTT client
     client = mqtt.Client(client_id="", userdata=None, protocol=mqtt.MQTTv5)
     client.on_connect = on_connect
-    client.tls_set(tls_version=mqtt.ssl.PROTOCOL_TLS)
-    client.username_pw_set(username, password)
+    if use_tls:
+        client.tls_set(tls_version=mqtt.ssl.PROTOCOL_TLS)
+    if username:
+        client.username_pw_set(username, password)
 
-    # Connect to MQTT broker
+    # Connect to MQTT broker, the network loop runs in its own thread
     client.connect(broker_host, broker_port)
+    client.loop_start()
+    return client
 
-    # Open serial port
-    ser = serial.Serial(SERIAL_PORT, BAUD_RATE)
+def report(stats, elapsed, depth):
+    snapshot = stats.take()
+    latencies = sorted(snapshot["latencies"])
+    line = (f"frames {snapshot['frames']} ({snapshot['bad_frames']} bad, {snapshot['lost_frames']} lost), "
+            f"ingest {snapshot['readings'] / elapsed:.0f} readings/s, publish {snapshot['published'] / elapsed:.0f} readings/s "
+            f"in {snapshot['messages'] / elapsed:.1f} messages/s ({snapshot['publish_errors']} refused), queue {depth}, readers blocked {snapshot['blocked']:.2f} s")
+    if latencies:
+        p50 = latencies[len(latencies) // 2]
+        p99 = latencies[min(len(latencies) * 99 // 100, len(latencies) - 1)]
+        line += f", latency p50 {p50 * 1000:.1f} ms p99 {p99 * 1000:.1f} ms"
+    print(line)
+    return snapshot
+
+def start_gateway(client, ports, args):
+    stats = GatewayStats()
+    readings = queue.Queue(maxsize=args.queue_size)
+    publisher = Publisher(client, readings, stats, args.batch_size, args.batch_delay, args.max_inflight, args.verbose)
+    client.on_publish = publisher.on_publish
+    publisher.start()
+    for port in ports:
+        PortReader(port, readings, client, stats, args.verbose).start()
+    return stats, readings
+
+def main(args):
+    client = NullClient() if args.dry_run else connect_client(args.host, args.port)
+
+    # Open serial ports
+    ports = [serial.Serial(path, args.baud) for path in args.serial]
+    stats, readings = start_gateway(client, ports, args)
 
     try:
         while True:
-            # Read data from serial port
-            try:
-                data = ser.readline().decode().strip()
-            except UnicodeDecodeError:
-                print("Error decoding data from serial port.")
-                continue
+            time.sleep(args.report_interval)
+            report(stats, args.report_interval, readings.qsize())
+    except KeyboardInterrupt:
+        print("Exiting...")
+        if not args.dry_run:
+            client.loop_stop()
+            client.disconnect()
+        for port in ports:
+            port.close()
 
-            # Split data into fields
-            fields = data.split(',')
+def pty_test(args):
+    """Feeds frames through pseudo-terminals standing in for masters, then reports the gateway's rates"""
+    client = NullClient() if args.dry_run else connect_client(args.host, args.port)
+    reading = UPLINK_READING.pack(0, bytes(range(6)), 1, 1000, 412, 2345, 5678)
+    frames_per_port = args.pty_test // 12
 
-            # Check if the data has the expected number of fields
-            if len(fields) != 5:
-                print("Unexpected number of fields:", len(fields))
-                continue
+    feeders = []
+    ports = []
+    for i in range(args.ptys):
+        master, slave = os.openpty()
+        ports.append(serial.Serial(os.ttyname(slave), args.baud))
 
-            # Assuming fields are in the order: macStr, c02Data, temperatureData, humidityData
-            try:
-                macStr, c02Data, temperatureData, humidityData, protocol = fields
-            except ValueError:
-                print("Error parsing data fields.")
-                continue
+        def feed(master=master):
+            # UPLINK_MAX_READINGS readings per frame, like a master under full load
+            for seq in range(frames_per_port):
+                os.write(master, encode_frame(UPLINK_READINGS, seq & 0xFFFF, [reading] * 12))
+        feeders.append(threading.Thread(target=feed, daemon=True))
 
-            # Generate location data
-            latitude, longitude = generate_location_data()
-
-            # Create a dictionary to represent the data
-            sensor_data = {
-                "macStr": macStr,
-                "c02Data": float(c02Data),
-                "temperatureData": float(temperatureData),
-                "humidityData": float(humidityData),
-                "latitude": latitude,
-                "longitude": longitude,
-                "protocol": protocol
-            }
-
-            # Convert dictionary to JSON string
-            payload = json.dumps(sensor_data)
-
-            # Publish data to MQTT broker
-            topic = "sensor_data"
-            try:
-                publish_data(client, topic, payload)
-                print("Sensor data published:", payload)
-            except Exception as e:
-                print("Error publishing sensor data:", e)
+    stats, readings = start_gateway(client, ports, args)
+    start = time.monotonic()
+    for feeder in feeders:
+        feeder.start()
 
-    except KeyboardInterrupt:
-        print("Exiting...")
-        client.disconnect()
-        ser.close()
+    expected = frames_per_port * 12 * args.ptys
+    published = 0
+    latencies = []
+    while published < expected and time.monotonic() - start < args.timeout:
+        time.sleep(0.5)
+        snapshot = stats.take()
+        published += snapshot["published"]
+        latencies += snapshot["latencies"]
+    elapsed = time.monotonic() - start
+    # everything still unacknowledged counts as late rather than lost
+    time.sleep(0.5)
+    latencies += stats.take()["latencies"]
+    latencies.sort()
+    print(f"{args.ptys} ptys, {published}/{expected} readings in {elapsed:.2f} s: {published / elapsed:.0f} readings/s, "
+          f"batch size {args.batch_size}, queue {args.queue_size}")
+    if latencies:
+        print(f"latency p50 {latencies[len(latencies) // 2] * 1000:.1f} ms, "
+              f"p99 {latencies[min(len(latencies) * 99 // 100, len(latencies) - 1)] * 1000:.1f} ms, "
+              f"max {latencies[-1] * 1000:.1f} ms")
 
 if __name__ == "__main__":
-    parser = argparse.ArgumentParser(description="MQTT Client for publishing sensor data with location data to MQTT broker")
+    parser = argparse.ArgumentParser(description="Gateway from the master's serial uplink to the MQTT broker")
     parser.add_argument("--host", default=DEFAULT_BROKER_HOST, help="MQTT broker host")
     parser.add_argument("--port", default=DEFAULT_BROKER_PORT, type=int, help="MQTT broker port")
+    parser.add_argument("--serial", action="append", metavar="PATH",
+                        help=f"serial port or PTY of a master, repeat for several (default {SERIAL_PORT})")
+    parser.add_argument("--baud", default=BAUD_RATE, type=int, help="serial baud rate")
+    parser.add_argument("--batch-size", default=BATCH_SIZE, type=int, help="readings per MQTT message")
+    parser.add_argument("--batch-delay", default=BATCH_DELAY, type=float, help="s a reading may wait for its batch to fill")
+    parser.add_argument("--queue-size", default=QUEUE_SIZE, type=int, help="readings buffered before the serial readers block")
+    parser.add_argument("--max-inflight", default=MAX_INFLIGHT, type=int, help="unacknowledged MQTT messages before publishing waits")
+    parser.add_argument("--report-interval", default=REPORT_INTERVAL, type=float, help="s between throughput reports")
+    parser.add_argument("--dry-run", action="store_true", help="decode and batch, but publish nowhere")
+    parser.add_argument("--verbose", action="store_true", help="print every published message")
+    parser.add_argument("--pty-test", type=int, metavar="READINGS",
+                        help="feed this many readings through PTYs standing in for masters, report the rates and exit")
+    parser.add_argument("--ptys", default=1, type=int, help="masters simulated by --pty-test")
+    parser.add_argument("--timeout", default=60.0, type=float, help="s --pty-test waits for every reading")
+    parser.add_argument("--native", metavar="PATH", help="libuplink_gateway.so of the host build, found in build/ by default")
+    parser.add_argument("--benchmark", type=int, metavar="FRAMES", help="measure how fast uplink frames decode and exit")
     args = parser.parse_args()
+    args.serial = args.serial or [SERIAL_PORT]
+    load_native(args.native)
 
-    main(args.host, args.port)
-
+    if args.benchmark:
+        benchmark(args.benchmark)
+    elif args.pty_test:
+        pty_test(args)
+    else:
+        main(args)
@@ -3,6 +3,9 @@
 
 #include <Arduino.h>
 #include <esp_now.h>
+#include "PeerTable.h"
+#include "SpscRing.h"
+#include "Log.h"
 
 /*---------------------------ESPNOW Defines-----------------------*/
 
@@ -13,76 +16,67 @@
 SensorData sensorData;
 Handshake msg;
 esp_now_peer_info_t peerInfo = {};
-esp_now_peer_num_t peer_num;
-
-// Maximum number of nodes in the network
-#define MAX_NODES 10
+PeerTable peerTable;
 
 // Global variable to track if the current node is connected to the master
 uint8_t isConnectedToMaster = 1;
 
-void formatMacAddress(const uint8_t *macAddr, char *buffer, int maxLength)
-// Formats MAC Address
-{
-  snprintf(buffer, maxLength, "%02x:%02x:%02x:%02x:%02x:%02x", macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]);
-}
+// how often the master broadcasts itself as the zero hop end of the routes
+#define ROUTE_ADVERTISE_INTERVAL 10000
+unsigned long lastAdvertised = 0;
 
-// Function to parse a String MAC address to uint8_t array
-void parseMacAddress(String macAddress, uint8_t* macAddressBytes) 
-{
-  sscanf(macAddress.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-         &macAddressBytes[0], &macAddressBytes[1], &macAddressBytes[2],
-         &macAddressBytes[3], &macAddressBytes[4], &macAddressBytes[5]);
-}
+// receive path, the Wi-Fi task only queues frames for the worker task
+#define ESPNOW_FRAME_CAPACITY 64     // bytes kept of a received frame, ours are at most sizeof(SensorData)
+#define ESPNOW_FRAME_RING_SIZE 32    // frames in flight to the worker, a power of two
+#define ESPNOW_WORKER_STACK 4096
+#define ESPNOW_WORKER_PRIORITY 2     // above the uplink task, far below the Wi-Fi task
+#define ESPNOW_WORKER_CORE 0         // with the Wi-Fi task, the LoRa task has the other core
+#define ESPNOW_STATS_INTERVAL 60000  // how often the callback timings are printed
 
-void addPeerToPeerList(const uint8_t *macAddr)
-// Add the received MAC address into the peer list if it doesn't exist
-{
-  // Format the MAC address
-  char macStr[18];
-  formatMacAddress(macAddr, macStr, 18);
+typedef struct EspNowFrame {
+  uint8_t MACaddr[MAC_ADDR_LENGTH];
+  int length;                           // as received, may exceed ESPNOW_FRAME_CAPACITY
+  uint8_t data[ESPNOW_FRAME_CAPACITY];
+} EspNowFrame;
 
-  Serial.printf("Received peer address: %s\n", macStr);
+SpscRing<EspNowFrame, ESPNOW_FRAME_RING_SIZE> frameRing;
+TaskHandle_t workerTask = NULL;
 
-  memcpy(peerInfo.peer_addr, macAddr, 6);  // Copy MAC address
-  peerInfo.channel = 0;                    // Use the default channel
-  peerInfo.encrypt = false;                // No encryption for simplicity
-  if (!esp_now_is_peer_exist(macAddr)) {
-    esp_now_add_peer(&peerInfo);
-    Serial.println("Added peer to the list");
-  } else {
-    Serial.println("Peer already exists in the list");
-  }
-}
+// callback instrumentation, written by the Wi-Fi task only
+volatile uint32_t callbackCount = 0;
+volatile uint32_t callbackTotalUs = 0;
+volatile uint32_t callbackMaxUs = 0;
+volatile uint32_t framesDropped = 0;
+unsigned long lastStatsPrint = 0;
 
-void sendToAllPeers(const SensorData &sensorData)
-// Send the message to each peer in the peer list
+PeerEntry *touchPeer(const uint8_t *macAddr)
+// Table entry of the address, the driver learns about it only the first time
 {
-  esp_now_get_peer_num(&peer_num);
-  // Serial.println("Sending....");
-  for (int i = 0; i < peer_num.total_num; i++) {
-    // Format the MAC address
-    char macStr[18];
-    formatMacAddress(peerInfo.peer_addr, macStr, 18);
-    Serial.printf("Peer address to send: %s\n", macStr);
-    if (esp_now_fetch_peer(1, &peerInfo) == ESP_OK) {
-      esp_err_t result = esp_now_send(peerInfo.peer_addr, (const uint8_t *)&sensorData, sizeof(SensorData));
+  PeerEntry *peer = peerTable.find(macAddr);
+  if (peer == NULL) {
+    if (peerTable.isFull()) {
+      // removing moves table entries around, so keep a copy of the address
+      uint8_t victim[MAC_ADDR_LENGTH];
+      memcpy(victim, peerTable.victim()->MACaddr, MAC_ADDR_LENGTH);
+      esp_now_del_peer(victim);
+      peerTable.remove(victim);
+    }
 
-      // Print results to serial monitor
-      if (result == ESP_OK) {
-        Serial.printf("Forwarded message to: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                      peerInfo.peer_addr[0], peerInfo.peer_addr[1], peerInfo.peer_addr[2],
-                      peerInfo.peer_addr[3], peerInfo.peer_addr[4], peerInfo.peer_addr[5]);
-      } else {
-        Serial.println("Error sending message to peer");
-      }
-    } else {
-      Serial.println("Peer not found");
+    memcpy(peerInfo.peer_addr, macAddr, 6);  // Copy MAC address
+    peerInfo.channel = 0;                    // Use the default channel
+    peerInfo.encrypt = false;                // No encryption for simplicity
+    esp_err_t result = esp_now_add_peer(&peerInfo);
+    if (result != ESP_OK && result != ESP_ERR_ESPNOW_EXIST) {
+      LOG_WARN("Could not add peer to the list");
+      return NULL;
     }
+    peer = peerTable.add(macAddr, millis());
   }
+  peer->lastSeen = millis();
+  return peer;
 }
 
-void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen) {
+void handleReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen) {
   // Format the MAC address
   char macStr[18];
   formatMacAddress(macAddr, macStr, 18);
@@ -93,18 +87,34 @@ void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen) {
     SensorData receivedData;
     memcpy(&receivedData, data, sizeof(SensorData));
 
-    // Print the received sensor data including MAC address
-    Serial.printf("%s,%.2f,%.2f,%.2f,%s\n", receivedData.MACaddr, receivedData.c02Data, receivedData.temperatureData, receivedData.humidityData,"espnow");
+    // hand the reading to the host gateway
+    UplinkReading reading;
+    reading.protocol = UPLINK_PROTOCOL_ESPNOW;
+    if (parseMacAddress(receivedData.MACaddr, reading.origin) == true) {
+      reading.seq = receivedData.seq;
+      reading.receivedAt = millis();
+      reading.c02Data = receivedData.c02Data;
+      reading.temperatureData = receivedData.temperatureData;
+      reading.humidityData = receivedData.humidityData;
+      uplinkReading(reading);
+    } else {
+      LOG_WARN("Dropped reading with a malformed origin from %s", macStr);
+    }
+
+    PeerEntry *sender = peerTable.find(macAddr);
+    if (sender != NULL) {
+      sender->lastSeen = millis();
+    }
 
   } else if (dataLen == sizeof(Handshake)) {
-    Serial.println("Handshake received");
+    LOG_DEBUG("Handshake received");
     // Message is a handshake message
     Handshake receivedMsg;
     memcpy(&receivedMsg, data, sizeof(Handshake));
 
     // handle requests
     if (receivedMsg.requestType == 0) {
-      Serial.println("Request received");
+      LOG_DEBUG("Request received");
       // Request type is 0, it's a request for connection status
       // Reply with the current connection status
       Handshake replyMsg;
@@ -112,63 +122,88 @@ void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen) {
       replyMsg.isConnectedToMaster = isConnectedToMaster;
       replyMsg.numberOfHopsToMaster = 0;
 
-      memcpy(peerInfo.peer_addr, macAddr, 6);
-      if (!esp_now_is_peer_exist(macAddr)) {
-        esp_now_add_peer(&peerInfo);
+      // the requester stays registered, a repeated request needs no new entry
+      if (touchPeer(macAddr) == NULL) {
+        return;
       }
 
       // send
       esp_err_t result = esp_now_send(macAddr, (const uint8_t *)&replyMsg, sizeof(Handshake));
 
-      // Remove the broadcast address from the peer list
-      esp_now_del_peer(macAddr);
-
       // Print results to serial monitor
       if (result == ESP_OK) {
-        Serial.println("Reply message success");
+        LOG_DEBUG("Reply message success");
       } else if (result == ESP_ERR_ESPNOW_NOT_INIT) {
-        Serial.println("ESP-NOW not Init.");
+        LOG_WARN("ESP-NOW not Init.");
       } else if (result == ESP_ERR_ESPNOW_ARG) {
-        Serial.println("Invalid Argument");
+        LOG_WARN("Invalid Argument");
       } else if (result == ESP_ERR_ESPNOW_INTERNAL) {
-        Serial.println("Internal Error");
+        LOG_WARN("Internal Error");
       } else if (result == ESP_ERR_ESPNOW_NO_MEM) {
-        Serial.println("ESP_ERR_ESPNOW_NO_MEM");
+        LOG_WARN("ESP_ERR_ESPNOW_NO_MEM");
       } else if (result == ESP_ERR_ESPNOW_NOT_FOUND) {
-        Serial.println("Peer not found.");
+        LOG_WARN("Peer not found.");
       } else {
-        Serial.println("Unknown error");
+        LOG_WARN("Unknown error");
       }
     }
-    // handle replies
+    // replies and route advertisements of the nodes, the master needs no route
     else if (receivedMsg.requestType == 1) {
-      Serial.println("Reply received");
-      // Reply type is 1, it's a reply containing connection status
-      if (receivedMsg.isConnectedToMaster) {
-        Serial.printf("Node %s is CONNECTED to the master\n", macStr);
-        // Add this node to peer list
-        addPeerToPeerList(macAddr);
-      } else {
-        Serial.printf("Node %s is NOT CONNECTED to master\n", macStr);
-      }
+      LOG_DEBUG("Node %s advertises %d hops", macStr, receivedMsg.numberOfHopsToMaster);
     }
   } else {
-    Serial.println("Received data length does not match expected formats");
-    Serial.print("Received data: ");
-    for (int i = 0; i < dataLen; i++) {
-      Serial.print(data[i], HEX);  // Print each byte of data in hexadecimal format
-      Serial.print(" ");
+    LOG_WARN("Received data length does not match expected formats");
+    if (LOG_ENABLED(LOG_LEVEL_DEBUG)) {
+      // each byte of data in hexadecimal format, as much as fits on a log line
+      char hex[LOG_LINE_LENGTH];
+      int length = 0;
+      for (int i = 0; i < dataLen && length + 4 < LOG_LINE_LENGTH; i++) {
+        length += snprintf(hex + length, LOG_LINE_LENGTH - length, "%X ", data[i]);
+      }
+      hex[length] = '\0';
+      LOG_DEBUG("Received data: %s", hex);
     }
-    Serial.println();  // Print a newline after printing all bytes
   }
 }
 
+void receiveCallback(const uint8_t *macAddr, const uint8_t *data, int dataLen)
+// Runs in the Wi-Fi task: copy the frame into the ring and wake the worker, nothing else
+{
+  uint32_t start = micros();
+
+  EspNowFrame *frame = frameRing.reserve();
+  if (frame == NULL) {
+    framesDropped++;
+  } else {
+    memcpy(frame->MACaddr, macAddr, MAC_ADDR_LENGTH);
+    frame->length = dataLen;
+    memcpy(frame->data, data, dataLen < ESPNOW_FRAME_CAPACITY ? dataLen : ESPNOW_FRAME_CAPACITY);
+    frameRing.commit();
+    xTaskNotifyGive(workerTask);
+  }
+
+  uint32_t duration = micros() - start;
+  callbackCount++;
+  callbackTotalUs += duration;
+  if (duration > callbackMaxUs) {
+    callbackMaxUs = duration;
+  }
+}
+
+void printEspNowStats() {
+  uint32_t count = callbackCount;
+  LOG_INFO("ESP-NOW callbacks: %u, mean %u us, max %u us, ring %u/%u (high water %u), dropped %u",
+           count, count > 0 ? callbackTotalUs / count : 0, callbackMaxUs,
+           (unsigned)frameRing.size(), (unsigned)frameRing.capacity(), (unsigned)frameRing.highWaterMark(), framesDropped);
+}
+
 void broadcast(const Handshake &msg)
 // Emulates a broadcast
 {
   // Broadcast a message to every device in range
   uint8_t broadcastAddress[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
+  // registered on first use and kept, like every other peer
   memcpy(&peerInfo.peer_addr, broadcastAddress, 6);
   if (!esp_now_is_peer_exist(broadcastAddress)) {
     esp_now_add_peer(&peerInfo);
@@ -177,27 +212,71 @@ void broadcast(const Handshake &msg)
   // Send message
   esp_err_t result = esp_now_send(broadcastAddress, (const uint8_t *)&msg, sizeof(Handshake));
 
-  // Remove the broadcast address from the peer list
-  esp_now_del_peer(broadcastAddress);
-
   // Print results to serial monitor
   if (result == ESP_OK) {
-    Serial.println("Broadcast message success");
+    LOG_DEBUG("Broadcast message success");
   } else if (result == ESP_ERR_ESPNOW_NOT_INIT) {
-    Serial.println("ESP-NOW not Init.");
+    LOG_WARN("ESP-NOW not Init.");
   } else if (result == ESP_ERR_ESPNOW_ARG) {
-    Serial.println("Invalid Argument");
+    LOG_WARN("Invalid Argument");
   } else if (result == ESP_ERR_ESPNOW_INTERNAL) {
-    Serial.println("Internal Error");
+    LOG_WARN("Internal Error");
   } else if (result == ESP_ERR_ESPNOW_NO_MEM) {
-    Serial.println("ESP_ERR_ESPNOW_NO_MEM");
+    LOG_WARN("ESP_ERR_ESPNOW_NO_MEM");
   } else if (result == ESP_ERR_ESPNOW_NOT_FOUND) {
-    Serial.println("Peer not found.");
+    LOG_WARN("Peer not found.");
   } else {
-    Serial.println("Unknown error");
+    LOG_WARN("Unknown error");
   }
 }
 
+// runs in the worker, the only task that uses the peer list
+void espNowLoop() {
+  // nodes in range learn about the master, and keep their route to it fresh, without asking
+  if (millis() - lastAdvertised >= ROUTE_ADVERTISE_INTERVAL) {
+    Handshake advert;
+    advert.requestType = 1;
+    advert.isConnectedToMaster = 1;
+    advert.numberOfHopsToMaster = 0;
+    broadcast(advert);
+    lastAdvertised = millis();
+  }
+
+  if (millis() - lastStatsPrint >= ESPNOW_STATS_INTERVAL) {
+    printEspNowStats();
+    lastStatsPrint = millis();
+  }
+}
+
+// runs in the worker, handles every frame the callback queued
+void drainFrames() {
+  EspNowFrame *frame;
+  while ((frame = frameRing.front()) != NULL) {
+    handleReceived(frame->MACaddr, frame->data, frame->length);
+    frameRing.pop();
+  }
+}
+
+void espnowWorker(void *parameter)
+// Decodes everything the callback queued, and sleeps until the next frame or advertisement
+{
+  // nothing is sent before initESPNow() registered the callback and woke the worker
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  for (;;) {
+    unsigned long sinceAdvert = millis() - lastAdvertised;
+    unsigned long wait = sinceAdvert < ROUTE_ADVERTISE_INTERVAL ? ROUTE_ADVERTISE_INTERVAL - sinceAdvert : 0;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+    drainFrames();
+    espNowLoop();
+  }
+}
+
+void startEspNowWorker() {
+  // the callback wakes the worker, so it has to exist before ESP-NOW starts
+  xTaskCreatePinnedToCore(espnowWorker, "espnow", ESPNOW_WORKER_STACK, NULL, ESPNOW_WORKER_PRIORITY,
+                          &workerTask, ESPNOW_WORKER_CORE);
+}
+
 String getRandomFloatAsString(float min, float max) {
   // Generate a random floating-point number
   float randomFloat = min + random() / ((float)RAND_MAX / (max - min));
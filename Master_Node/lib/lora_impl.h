@@ -3,108 +3,49 @@
  *  for the T3 S3 V1.1 with PA module.
  */
 
+#include "RingQueue.h"
+#include "ReceiveWindow.h"
+#include "AdrController.h"
+#include "TrickleTimer.h"
+#include "Log.h"
+
 unsigned long curr_time;
 unsigned long prev_time;
 
-template<typename T>
-class Queue {
-public:
-  struct Node {
-    T data;
-    Node* next;
-  };
-
-  Node* head = NULL;
-
-  void addToLast(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
+// queue capacities, all storage is allocated statically
+#define DATA_RECEIVED_CAPACITY 16
+#define DATA_TO_SEND_CAPACITY 16
 
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = NULL;
+// SF at boot, AdrController moves it afterwards
+#define LORA_SPREADING_FACTOR 12
 
-    if (head == NULL) {
-      head = newNode;
-      return;
-    }
+// the LoRa task sleeps until DIO1 fires, or at most this long for the ADR decisions
+#define LORA_TASK_STACK 6144
+#define LORA_TASK_PRIORITY 3  // above the ESP-NOW worker, the radio must be turned around quickly
+#define LORA_TASK_CORE 1      // away from the Wi-Fi task
+#define LORA_IDLE_WAIT 50     // ms
 
-    Node* last = head;
-    while (last->next != NULL) {
-      last = last->next;
-    }
+// DISCOVERY_REPLY_MESSAGEs are paced like the nodes' level adverts, see
+// LoraCommunication.h. Nobody else is at level 0, the master is never suppressed.
+#define ADVERT_IMIN 500
+#define ADVERT_DOUBLINGS 10
 
-    last->next = newNode;
-  }
+RingQueue<LoraPacket, DATA_RECEIVED_CAPACITY> dataReceived;
+RingQueue<LoraPacket, DATA_TO_SEND_CAPACITY> dataToSend;
 
-  void addToFirst(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
+// seqs already accepted from each child
+ReceiveWindow receiveWindow;
 
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = head;
-    head = newNode;
-  }
+// operating SF of the network, chosen from the children's reports
+AdrController adr(LORA_SPREADING_FACTOR);
 
-  void removeFromFirst() {
-    if (head == NULL) {
-      // The list is already empty
-      return;
-    }
-    Node* tempNode = head;
-    head = head->next;
-    delete tempNode;
-  }
-
-  bool isEmpty() {
-    return head == NULL;
-  }
-
-  void clear() {
-    while (head != NULL) {
-      removeFromFirst();
-    }
-  }
+// answers discovery and tells the nodes around that the master is up
+TrickleTimer advertTrickle(ADVERT_IMIN, ADVERT_DOUBLINGS, TRICKLE_NO_SUPPRESSION);
 
-  bool removeIfMatches(std::function<bool(T)> condition) {
-    Node* current = head;
-    Node* prev = NULL;
-    while (current != NULL) {
-      if (condition(current->data)) {
-        if (prev == NULL) {
-          head = current->next;
-        } else {
-          prev->next = current->next;
-        }
-        delete current;
-        return true;
-      }
-      prev = current;
-      current = current->next;
-    }
-    return false;
-  }
-};
-
-Queue<String> dataReceived;
-Queue<String> dataToSend;
+// worst link of the DISCOVERY_MESSAGEs the next advert answers, unknown
+// while nobody asked so the receiver goes by its own measurement
+const LinkQuality ADVERT_QUALITY_UNKNOWN = {INT8_MAX, 0};
+LinkQuality advertQuality = ADVERT_QUALITY_UNKNOWN;
 /*------------------------------------------------------------------*/
 
 /*----------------------LoRa Variables-----------------------------*/
@@ -124,69 +65,16 @@ volatile bool enableInterrupt = true;
 // save transmission state between loops
 int transmissionState = RADIOLIB_ERR_NONE;
 
+// woken by setFlag()
+TaskHandle_t loraTask = NULL;
+
 // Define SX1280 Radio
 SX1280 radio = new Module(RADIO_CS_PIN, RADIO_DIO1_PIN, RADIO_RST_PIN, RADIO_BUSY_PIN);
 
 
-String serializeDRMToString() {
-  String result;
-
-  result += "1";
-  result += ",";
-  result += "0";
-  result += ",";
-  result += selfAddr;
-
-  return result;
-}
-
-String serializeSDRToString() {
-  String result;
-
-  result.concat(sdr.requestType);
-  result += ",";
-  result.concat(sdr.randomNumber);
-
-  return result;
-}
-
-SensorDataLoRa deserializeStringToSensorData(String* serialized) {
-  SensorDataLoRa sensorDataLoRa;
-  int firstCommaIndex = serialized->indexOf(',');
-  int secondCommaIndex = serialized->indexOf(',', firstCommaIndex + 1);
-  int thirdCommaIndex = serialized->indexOf(',', secondCommaIndex + 1);
-  int fourthCommaIndex = serialized->indexOf(',', thirdCommaIndex + 1);
-  int fifthCommaIndex = serialized->indexOf(',', fourthCommaIndex + 1);
-  int sixthCommaIndex = serialized->indexOf(',', fifthCommaIndex + 1);
-
-  // Convert and assign requestType
-  sensorDataLoRa.requestType = (uint8_t)serialized->substring(0, firstCommaIndex).toInt();
-
-  // Assign MACaddr (receiver)
-  String macAddrString = serialized->substring(firstCommaIndex + 1, secondCommaIndex);
-  macAddrString.toCharArray(sensorDataLoRa.MACaddr, MAX_MAC_LENGTH);
-
-  // sender's mac addr
-  String sMacAddrString = serialized->substring(secondCommaIndex + 1, thirdCommaIndex);
-  sMacAddrString.toCharArray(sensorDataLoRa.SMACaddr, MAX_MAC_LENGTH);
-
-  // Convert and assign c02Data
-  sensorDataLoRa.c02Data = serialized->substring(thirdCommaIndex + 1, fourthCommaIndex).toFloat();
-
-  // Convert and assign temperatureData
-  sensorDataLoRa.temperatureData = serialized->substring(fourthCommaIndex + 1, fifthCommaIndex).toFloat();
-
-  // Convert and assign humidityData
-  sensorDataLoRa.humidityData = serialized->substring(fifthCommaIndex + 1, sixthCommaIndex).toFloat();
-
-  sensorDataLoRa.randomNumber = serialized->substring(sixthCommaIndex + 1).toFloat();
-
-  return sensorDataLoRa;
-}  // deserializeStringToSensorData
-
 // this function is called when a complete packet
 // is received or sent by the module
-void setFlag(void) {
+void IRAM_ATTR setFlag(void) {
   // if not transmitting, means triggered by packet receiving
   // if multiple packet is received at the same time when the later one
   // is received before the prior one is read and stored, the later one
@@ -202,78 +90,139 @@ void setFlag(void) {
   } else {
     return;
   }
+  // the first packet is sent before the task exists, it finds the flag set
+  if (loraTask != NULL) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(loraTask, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
 }
 
-String serializeDMToString() {
-  String result;
-
-  result.concat(dm.requestType);
-  result += ",";  // add for substring to work
+// acknowledge a data or stats packet, and in the bitmap the sender's other recent seqs
+void sendSensorDataReply(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq, const LinkQuality& quality) {
+  LoraPacket* reply = dataToSend.reserveLast();
+  if (reply != NULL) {
+    memcpy(sdr.MACaddr, senderAddr, MAC_ADDR_LENGTH);
+    sdr.seq = seq;
+    sdr.ackBitmap = receiveWindow.ackBitmap(senderAddr, epoch, seq);
+    sdr.spreadingFactor = adr.target();
+    sdr.switchIn = (adr.switchIn(millis()) + 500) / 1000;
+    sdr.quality = quality;
+    serializeSDR(&sdr, reply);
+    dataToSend.commitLast();
+  }
+}  // sendSensorDataReply
 
-  return result;
-}
+void handleSensorData(const LoraSensorData& receivedData, const LinkQuality& quality) {
+  // ignore data messages addressed to other nodes
+  if (memcmp(receivedData.MACaddr, selfAddr, MAC_ADDR_LENGTH) != 0) {
+    return;
+  }
+  adr.reportChild(receivedData.senderMACaddr, receivedData.spreadingFactor, millis());
 
-void processStringReceived(String* str) {
-  // Serial.println(F("Master received packet!"));
-
-  // print data of the packet
-  // Serial.print(F("Data:\t\t"));
-  // Serial.println(*str);
-  // check msg type by spliting the str and check the first int
-  int commaIndex = str->indexOf(',');              // Find the index of the first comma
-  String msgType = str->substring(0, commaIndex);  // Extract the substring from the beginning to the comma
-  if (msgType == String(DATA_MESSAGE)) {
-    // Serial.println("Message is DATA_MESSAGE");
-    // print data is dictated format in terminal
-    SensorDataLoRa receivedData = deserializeStringToSensorData(str);
-    if (strcmp(receivedData.MACaddr, selfAddr) != 0) {
-      dataReceived.removeFromFirst();
-      // Serial.println("Data Message received but self is the receiver, remove from dataReceived queue");
-      return;
-    }
+  // a retransmission whose reply was lost is only acknowledged again
+  if (receiveWindow.isReceived(receivedData.senderMACaddr, receivedData.epoch, receivedData.seq) == true) {
+    sendSensorDataReply(receivedData.senderMACaddr, receivedData.epoch, receivedData.seq, quality);
+    return;
+  }
+  receiveWindow.record(receivedData.senderMACaddr, receivedData.epoch, receivedData.seq);
+
+  // hand every reading of the batch to the host gateway
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < receivedData.readingCount; i++) {
+    const LoraReading& reading = receivedData.readings[i];
+    UplinkReading uplinkRecord;
+    uplinkRecord.protocol = UPLINK_PROTOCOL_LORA;
+    memcpy(uplinkRecord.origin, reading.SMACaddr, MAC_ADDR_LENGTH);
+    uplinkRecord.seq = reading.seq;
+    uplinkRecord.receivedAt = now;
+    uplinkRecord.c02Data = reading.c02Data;
+    uplinkRecord.temperatureData = reading.temperatureData;
+    uplinkRecord.humidityData = reading.humidityData;
+    uplinkReading(uplinkRecord);
+  }
 
-    // TODO: send to server?
-    Serial.printf("%s,%.2f,%.2f,%.2f,%s\n", receivedData.SMACaddr, receivedData.c02Data, receivedData.temperatureData, receivedData.humidityData, "lora");
+  // one reply acknowledges the whole batch
+  sendSensorDataReply(receivedData.senderMACaddr, receivedData.epoch, receivedData.seq, quality);
+}  // handleSensorData
 
-    if (u8g2) {
-      u8g2->clearBuffer();
-      u8g2->drawStr(0, 12, (String(receivedData.SMACaddr)).c_str());
-      u8g2->drawStr(0, 24, ("CO2: " + String(receivedData.c02Data)).c_str());
-      u8g2->drawStr(0, 36, ("Temp: " + String(receivedData.temperatureData)).c_str());
-      u8g2->drawStr(0, 48, ("Humidity: " + String(receivedData.humidityData)).c_str());
-      u8g2->sendBuffer();
-    }
+void handleStats(const LoraStatsData& stats, const LinkQuality& quality) {
+  if (memcmp(stats.MACaddr, selfAddr, MAC_ADDR_LENGTH) != 0) {
+    return;
+  }
+  adr.reportChild(stats.senderMACaddr, stats.spreadingFactor, millis());
 
-    // reply data msg
-    sdr.randomNumber = receivedData.randomNumber;
-    dataToSend.addToLast(serializeSDRToString());
+  if (receiveWindow.isReceived(stats.senderMACaddr, stats.epoch, stats.seq) == false) {
+    receiveWindow.record(stats.senderMACaddr, stats.epoch, stats.seq);
 
-    dataReceived.removeFromFirst();
-    // Serial.println("Add to dataToSend queue and remove from dataReceived queue");
-  } else if (msgType == String(DISCOVERY_MESSAGE)) {
-    // Serial.println("Message is DISCOVERY_MESSAGE");
-    dataToSend.addToLast(serializeDRMToString());
-    dataReceived.removeFromFirst();
-    // Serial.println("Add discovery reply message to queue");
-  } else {
-    // remove
-    dataReceived.removeFromFirst();
-    // Serial.println("Received message cannot be recognised: ");
-    // Serial.println(*str);
+    // the host works out the idle time and the charge per reading
+    for (uint8_t i = 0; i < stats.recordCount; i++) {
+      uplinkStats(stats.records[i]);
+    }
   }
+  sendSensorDataReply(stats.senderMACaddr, stats.epoch, stats.seq, quality);
+}  // handleStats
+
+// queue a DISCOVERY_REPLY_MESSAGE, the answer to discovery and the level advert alike
+void queueAdvert() {
+  LoraPacket* reply = dataToSend.reserveLast();
+  if (reply != NULL) {
+    memcpy(drm.MACaddr, selfAddr, MAC_ADDR_LENGTH);
+    drm.spreadingFactor = adr.target();
+    drm.switchIn = (adr.switchIn(millis()) + 500) / 1000;
+    drm.quality = advertQuality;
+    serializeDRM(&drm, reply);
+    dataToSend.commitLast();
+    advertQuality = ADVERT_QUALITY_UNKNOWN;
+  }
+}  // queueAdvert
 
-}  // processStringReceived
+void handleDiscoveryMessage(const LinkQuality& quality) {
+  // one advert answers every node that asked since the last, with the worst link among them
+  if (quality.snr < advertQuality.snr) {
+    advertQuality = quality;
+  }
+  advertTrickle.answer(millis());
+}  // handleDiscoveryMessage
+
+// decode the packet in place and hand it to the matching handler
+void processPacketReceived(const LoraPacket& packet) {
+  // dispatch on the header byte
+  switch (getPacketType(&packet)) {
+    case DATA_MESSAGE: {
+      LoraSensorData receivedData;
+      if (deserializeSensorData(&packet, &receivedData) == true) {
+        handleSensorData(receivedData, packet.quality);
+      }
+      break;
+    }
+    case STATS_MESSAGE: {
+      LoraStatsData stats;
+      if (deserializeStats(&packet, &stats) == true) {
+        handleStats(stats, packet.quality);
+      }
+      break;
+    }
+    case DISCOVERY_MESSAGE:
+      handleDiscoveryMessage(packet.quality);
+      break;
+    default:
+      // the master ignores replies, unknown types and other frame versions
+      break;
+  }
+}  // processPacketReceived
 
-void transmitData(String* data) {
-  // Serial.println(F("Transmitting packet..."));
-  // Serial.println(*data);
+void transmitData(const LoraPacket& packet) {
+  // the previous frame is still on air
+  if (txFlag == true) {
+    return;
+  }
 
   // master node only sends Discovery reply or Data reply message
-  int state = radio.startTransmit(*data);
+  int state = radio.startTransmit(packet.data, packet.length);
   if (state == RADIOLIB_ERR_NONE) {
     txFlag = true;
     dataToSend.removeFromFirst();
-    // Serial.println(F("Transmission init successful! remove from dataToSendQueue"));
 
   } else {
     // failed to send
@@ -283,11 +232,9 @@ void transmitData(String* data) {
 }
 void setupLoRa() {
   // initialize SX1280 with default settings
-  Serial.print(F("LoRa Initializing ... "));
+  LOG_INFO("LoRa Initializing ...");
   int state = radio.begin();
 
-  Serial.println("Here");
-
   if (u8g2) {
     if (state != RADIOLIB_ERR_NONE) {
       u8g2->clearBuffer();
@@ -296,19 +243,15 @@ void setupLoRa() {
     }
   }
 
-  Serial.println("Here");
-
   if (state == RADIOLIB_ERR_NONE) {
-    Serial.println(F("success!"));
+    LOG_INFO("LoRa Initializing success!");
   } else {
-    Serial.print(F("failed, code "));
-    Serial.println(state);
+    LOG_ERROR("LoRa Initializing failed, code %d", state);
+    logFlush();
     while (true)
       ;
   }
 
-  Serial.println("Here");
-
   //Set ANT Control pins
   radio.setRfSwitchPins(RADIO_RX_PIN, RADIO_TX_PIN);
 
@@ -316,35 +259,40 @@ void setupLoRa() {
   // T3 S3 V1.1 with PA Version Set output power to 3 dBm    !!Cannot be greater than 3dbm!!
   int8_t TX_Power = 3;
   if (radio.setOutputPower(TX_Power) == RADIOLIB_ERR_INVALID_OUTPUT_POWER) {
-    Serial.println(F("Selected output power is invalid for this module!"));
+    LOG_ERROR("Selected output power is invalid for this module!");
+    logFlush();
     while (true)
       ;
   }
 
   // set carrier frequency to 2410.5 MHz
   if (radio.setFrequency(2410.5) == RADIOLIB_ERR_INVALID_FREQUENCY) {
-    Serial.println(F("Selected frequency is invalid for this module!"));
+    LOG_ERROR("Selected frequency is invalid for this module!");
+    logFlush();
     while (true)
       ;
   }
 
   // set bandwidth to 203.125 kHz
   if (radio.setBandwidth(812.5) == RADIOLIB_ERR_INVALID_BANDWIDTH) {
-    Serial.println(F("Selected bandwidth is invalid for this module!"));
+    LOG_ERROR("Selected bandwidth is invalid for this module!");
+    logFlush();
     while (true)
       ;
   }
 
   // set spreading factor to 10
-  if (radio.setSpreadingFactor(12) == RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
-    Serial.println(F("Selected spreading factor is invalid for this module!"));
+  if (radio.setSpreadingFactor(LORA_SPREADING_FACTOR) == RADIOLIB_ERR_INVALID_SPREADING_FACTOR) {
+    LOG_ERROR("Selected spreading factor is invalid for this module!");
+    logFlush();
     while (true)
       ;
   }
 
   // set coding rate to 6
   if (radio.setCodingRate(7) == RADIOLIB_ERR_INVALID_CODING_RATE) {
-    Serial.println(F("Selected coding rate is invalid for this module!"));
+    LOG_ERROR("Selected coding rate is invalid for this module!");
+    logFlush();
     while (true)
       ;
   }
@@ -352,8 +300,11 @@ void setupLoRa() {
   // when packet transmission is finished
   radio.setDio1Action(setFlag);
 
+  // after a reboot the adverts bring the tree back without every node asking
+  advertTrickle.start(millis());
+
   // start transmitting the first packet
-  Serial.print(F("[SX1280] Sending first packet ... "));
+  LOG_INFO("[SX1280] Sending first packet ...");
 
   // you can transmit C-string or Arduino string up to
   // 256 characters long
@@ -363,30 +314,35 @@ void setupLoRa() {
 
 void loRaLoop() {
   if (rxFlag == true) {
-    String receivedMsg;
-
-    int state = radio.readData(receivedMsg);
-
-    if (state == RADIOLIB_ERR_NONE) {
-      dataReceived.addToLast(receivedMsg);
-      // Serial.print("Putting msg at the TAIL of dataReceived queue: ");
-      // Serial.println(receivedMsg);
-    } else if (state == RADIOLIB_ERR_CRC_MISMATCH) {
-      // packet was received, but is malformed
-      Serial.println(F("[SX1280] CRC error!"));
+    // read straight into a free slot of the receive queue
+    LoraPacket* receivedMsg = dataReceived.reserveLast();
+    int state = RADIOLIB_ERR_NONE;
 
+    if (receivedMsg == NULL) {
+      LOG_WARN("[SX1280] Receive queue full, packet dropped");
     } else {
-      // some other error occurred
-      Serial.print(F("[SX1280] Failed, code "));
-      Serial.println(state);
+      receivedMsg->length = radio.getPacketLength();
+      state = radio.readData(receivedMsg->data, receivedMsg->length);
+
+      if (state == RADIOLIB_ERR_NONE) {
+        receivedMsg->quality = makeLinkQuality(radio.getSNR(), radio.getRSSI());
+        dataReceived.commitLast();
+      } else if (state == RADIOLIB_ERR_CRC_MISMATCH) {
+        // packet was received, but is malformed
+        LOG_WARN("[SX1280] CRC error!");
+
+      } else {
+        // some other error occurred
+        LOG_WARN("[SX1280] Failed, code %d", state);
+      }
     }
     // start listending again
     state = radio.startReceive();
     if (state == RADIOLIB_ERR_NONE) {
       // Serial.println(F("success!"));
     } else {
-      Serial.print(F("failed, code "));
-      Serial.println(state);
+      LOG_ERROR("[SX1280] startReceive failed, code %d", state);
+      logFlush();
       while (true)
         ;
     }
@@ -402,8 +358,8 @@ void loRaLoop() {
       // Serial.println(F("success!"));
       return;
     } else {
-      Serial.print(F("failed, code "));
-      Serial.println(state);
+      LOG_ERROR("[SX1280] startReceive failed, code %d", state);
+      logFlush();
       while (true)
         ;
     }
@@ -411,16 +367,47 @@ void loRaLoop() {
 
   // regardless, process the data received in queue
   if (dataReceived.isEmpty() == false) {
-    String data = dataReceived.head->data;
-    processStringReceived(&data);
+    processPacketReceived(dataReceived.front());
+    dataReceived.removeFromFirst();
+  }
+
+  // run the network at the SF its slowest link needs, switching once the
+  // children have heard it in the replies
+  adr.decide(millis());
+  if (txFlag == false) {
+    uint8_t sf = adr.switchDue(millis());
+    if (sf != 0 && radio.setSpreadingFactor(sf) == RADIOLIB_ERR_NONE) {
+      radio.startReceive();
+      LOG_INFO("[LoRa] switched to SF%u", sf);
+    }
+  }
+
+  if (advertTrickle.poll(millis()) == true) {
+    queueAdvert();
   }
 
   if (dataToSend.isEmpty() == false) {
-    String data = dataToSend.head->data;
-    transmitData(&data);
+    transmitData(dataToSend.front());
   }
 
-  delay(2);
+  // sleep unless more work is ready, a packet sent or received wakes the task at once
+  if (dataReceived.isEmpty() && (dataToSend.isEmpty() || txFlag == true)) {
+    unsigned long idle = advertTrickle.wait(millis());
+    if (idle > LORA_IDLE_WAIT) {
+      idle = LORA_IDLE_WAIT;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idle));
+  }
+}
+
+void loraWorker(void* parameter) {
+  for (;;) {
+    loRaLoop();
+  }
+}
+
+void startLoRaTask() {
+  xTaskCreatePinnedToCore(loraWorker, "lora", LORA_TASK_STACK, NULL, LORA_TASK_PRIORITY, &loraTask, LORA_TASK_CORE);
 }
 
 
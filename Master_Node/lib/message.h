@@ -1,13 +1,53 @@
 
-// LoRa Defines
-#define DISCOVERY_MESSAGE 0
-#define DISCOVERY_REPLY_MESSAGE 1
-#define DATA_MESSAGE 2
-#define DATA_REPLY_MESSAGE 3
+// LoRa message types and wire format
+#include "LoraPacket.h"
 
 // Self MAC Address
 const int MAX_MAC_LENGTH = 18;
-char selfAddr[MAX_MAC_LENGTH];
+uint8_t selfAddr[MAC_ADDR_LENGTH];
+
+void formatMacAddress(const uint8_t *macAddr, char *buffer, int maxLength)
+// Formats MAC Address
+{
+  snprintf(buffer, maxLength, "%02x:%02x:%02x:%02x:%02x:%02x", macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]);
+}
+
+static int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Parses "xx:xx:xx:xx:xx:xx" straight from a char array, as received in
+// SensorData, without a String. Stops at the first bad character, so it
+// never reads past a shorter string. False if the address is malformed.
+bool parseMacAddress(const char* macAddress, uint8_t* macAddressBytes)
+{
+  for (int i = 0; i < MAC_ADDR_LENGTH; i++) {
+    const char* pair = macAddress + i * 3;
+    int high = hexDigit(pair[0]);
+    int low = high < 0 ? -1 : hexDigit(pair[1]);
+    if (low < 0 || (i < MAC_ADDR_LENGTH - 1 && pair[2] != ':')) {
+      return false;
+    }
+    macAddressBytes[i] = high << 4 | low;
+  }
+  return true;
+}
+
+// Function to parse a String MAC address to uint8_t array
+void parseMacAddress(String macAddress, uint8_t* macAddressBytes) 
+{
+  parseMacAddress(macAddress.c_str(), macAddressBytes);
+}
 
 /*---------------------------ESPNOW Defines-----------------------*/
 
@@ -15,6 +55,8 @@ char selfAddr[MAX_MAC_LENGTH];
 typedef struct SensorData {
   // uint8_t rootNodeAddress;
   char MACaddr[MAX_MAC_LENGTH];  // Use a char array to store the MAC address
+  uint16_t seq;                  // counted per origin, together with MACaddr identifies the reading
+  uint8_t hops;                  // times the reading has been forwarded
   float c02Data;
   float temperatureData;
   float humidityData;
@@ -34,34 +76,11 @@ typedef struct Handshake {
 /*------------------------------------------------------------------*/
 
 /*---------------------------LoRa Defines-----------------------*/
-// Discovery Message
-typedef struct DiscoveryMessage {
-  uint8_t requestType;
-} DiscoveryMessage;
-
-DiscoveryMessage dm = { DISCOVERY_MESSAGE };
-
-// Struc for transmitting sensor data
-typedef struct SensorDataLoRa {
-  // uint8_t rootNodeAddress;
-  uint8_t requestType;
-  char MACaddr[MAX_MAC_LENGTH];  // Use a char array to store the MAC address
-  char SMACaddr[MAX_MAC_LENGTH]; // self mac
-  float c02Data;
-  float temperatureData;
-  float humidityData;
-  uint8_t randomNumber;
-} SensorDataLoRa;
-
-SensorDataLoRa sensorDataLoRa = {
-  .requestType = 2
+DiscoveryReplyMessage drm = {
+  .requestType = DISCOVERY_REPLY_MESSAGE,
+  .level = 0
 };
 
-typedef struct SensorDataReply {
-  uint8_t requestType;
-  int randomNumber;  // from the data packet
-} SensorDataReply;
-
 SensorDataReply sdr = {
   .requestType = DATA_REPLY_MESSAGE
 };
@@ -0,0 +1,234 @@
+/** Serial Uplink Implementation
+ *  Sends the readings, node stats and log lines of the master to the host
+ *  gateway as SerialUplink frames. Readings and stats are batched for up
+ *  to UPLINK_MAX_DELAY ms, log lines go out one per frame.
+ *
+ *  The uplink task is the only one that encodes and writes frames. The
+ *  LoRa and the ESP-NOW task each hand it their readings through their
+ *  own SpscRing, so neither producer waits for the other or for the UART,
+ *  and it drains the log ring itself in place of the log task. Copies of a
+ *  reading, over either path, are dropped there before they are encoded.
+ *
+ *  The display shows the most recent LoRa reading. It is refreshed here
+ *  too, since pushing a frame over I2C would hold up the radio tasks.
+ */
+
+#include "SerialUplink.h"
+#include "SpscRing.h"
+#include "DedupWindow.h"
+#include "Log.h"
+
+#define UPLINK_BAUD 921600
+#define UPLINK_TX_BUFFER 4096      // frames wait here while the UART driver sends them in the background
+#define UPLINK_MAX_DELAY 200       // ms a reading may wait for others to share its frame
+#define UPLINK_READING_RING_SIZE 64  // readings in flight per path, a power of two
+#define UPLINK_STATS_RING_SIZE 16
+#define UPLINK_TASK_STACK 4096
+#define UPLINK_TASK_PRIORITY 1     // below both radio tasks, on the core of the LoRa task
+#define UPLINK_TASK_CORE 1
+#define UPLINK_IDLE_WAIT 20        // ms between looks at the log ring when nothing arrives
+#define INGEST_REPORT_INTERVAL 60000  // how often the per path rates are printed
+#define DISPLAY_REFRESH_INTERVAL 1000 // ms between display refreshes, a full frame takes tens of ms on I2C
+
+// readings received over one path, readings and dropped are written by its producer,
+// the rest by the uplink task
+typedef struct IngestPath {
+  volatile uint32_t readings;
+  volatile uint32_t dropped;    // the ring was full
+  uint32_t duplicates;          // copies of readings passed on before
+  uint32_t reported;            // readings at the last report
+  uint32_t second;              // readings at the start of the current second
+  uint32_t peak;                // most readings in one second since the last report
+} IngestPath;
+
+SpscRing<UplinkReading, UPLINK_READING_RING_SIZE> readingRings[2];  // indexed by UPLINK_PROTOCOL_
+SpscRing<LoraStatsRecord, UPLINK_STATS_RING_SIZE> statsRing;        // filled by the LoRa task
+IngestPath ingestPaths[2];
+volatile uint32_t statsDropped = 0;
+TaskHandle_t uplinkTask = NULL;
+
+UplinkEncoder uplink;
+uint16_t uplinkLogSeq = 0;
+
+// readings already passed on, used by the uplink task only
+DedupWindow dedup;
+
+// the LoRa reading to show next, used by the uplink task only
+UplinkReading displayReading;
+bool displayDue = false;
+unsigned long lastDisplayed = 0;
+
+// send the pending frame, a frame goes out in a single write the UART driver never interleaves
+void flushUplink() {
+  uint8_t frame[UPLINK_MAX_FRAME];
+  size_t length = uplink.finish(frame);
+  if (length > 0) {
+    Serial.write(frame, length);
+  }
+}
+
+// queue a reading for the host, called by the one task that owns its protocol's path
+void uplinkReading(const UplinkReading& reading) {
+  IngestPath& path = ingestPaths[reading.protocol];
+  path.readings++;
+  UplinkReading* slot = readingRings[reading.protocol].reserve();
+  if (slot == NULL) {
+    path.dropped++;
+    return;
+  }
+  *slot = reading;
+  readingRings[reading.protocol].commit();
+  xTaskNotifyGive(uplinkTask);
+}
+
+// queue a node's stats record, called by the LoRa task
+void uplinkStats(const LoraStatsRecord& record) {
+  LoraStatsRecord* slot = statsRing.reserve();
+  if (slot == NULL) {
+    statsDropped++;
+    return;
+  }
+  *slot = record;
+  statsRing.commit();
+  xTaskNotifyGive(uplinkTask);
+}
+
+// Log output, drained lines go to the host framed like everything else
+void uplinkLog(uint8_t level, uint32_t time, const char* text) {
+  uint8_t frame[UPLINK_MAX_FRAME];
+  size_t length = encodeUplinkLog(uplinkLogSeq++, level, time, text, frame);
+  Serial.write(frame, length);
+}
+
+void encodeReadings(SpscRing<UplinkReading, UPLINK_READING_RING_SIZE>& ring, IngestPath& path) {
+  UplinkReading* reading;
+  while ((reading = ring.front()) != NULL) {
+    if (dedup.check(reading->origin, reading->seq) == DEDUP_DUPLICATE) {
+      path.duplicates++;
+    } else {
+      if (uplink.addReading(*reading, millis()) == false) {
+        flushUplink();
+        uplink.addReading(*reading, millis());
+      }
+      if (reading->protocol == UPLINK_PROTOCOL_LORA) {
+        displayReading = *reading;
+        displayDue = true;
+      }
+    }
+    ring.pop();
+  }
+}
+
+void encodeStats() {
+  LoraStatsRecord* record;
+  while ((record = statsRing.front()) != NULL) {
+    if (uplink.addStats(*record, millis()) == false) {
+      flushUplink();
+      uplink.addStats(*record, millis());
+    }
+    statsRing.pop();
+  }
+}
+
+// show the most recent LoRa reading, at most once per DISPLAY_REFRESH_INTERVAL
+void refreshDisplay(unsigned long now) {
+  if (u8g2 == NULL || displayDue == false || now - lastDisplayed < DISPLAY_REFRESH_INTERVAL) {
+    return;
+  }
+  char macStr[MAX_MAC_LENGTH];
+  formatMacAddress(displayReading.origin, macStr, MAX_MAC_LENGTH);
+  char line[32];
+  u8g2->clearBuffer();
+  u8g2->drawStr(0, 12, macStr);
+  snprintf(line, sizeof(line), "CO2: %.2f", displayReading.c02Data);
+  u8g2->drawStr(0, 24, line);
+  snprintf(line, sizeof(line), "Temp: %.2f", displayReading.temperatureData);
+  u8g2->drawStr(0, 36, line);
+  snprintf(line, sizeof(line), "Humidity: %.2f", displayReading.humidityData);
+  u8g2->drawStr(0, 48, line);
+  u8g2->sendBuffer();
+  displayDue = false;
+  lastDisplayed = now;
+}
+
+// readings per second, and the peak of the second just ended
+void countIngest(unsigned long now, unsigned long& secondStart) {
+  if (now - secondStart < 1000) {
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    uint32_t readings = ingestPaths[i].readings;
+    uint32_t inSecond = readings - ingestPaths[i].second;
+    if (inSecond > ingestPaths[i].peak) {
+      ingestPaths[i].peak = inSecond;
+    }
+    ingestPaths[i].second = readings;
+  }
+  secondStart = now;
+}
+
+void printIngestStats(unsigned long elapsed) {
+  static const char* names[2] = { "ESP-NOW", "LoRa" };
+  for (int i = 0; i < 2; i++) {
+    IngestPath& path = ingestPaths[i];
+    uint32_t readings = path.readings;
+    LOG_INFO("%s ingest: %u readings, %.2f/s, peak %u/s, ring high water %u/%u, dropped %u, duplicates %u",
+             names[i], (unsigned)(readings - path.reported), (readings - path.reported) * 1000.0f / elapsed,
+             (unsigned)path.peak, (unsigned)readingRings[i].highWaterMark(), (unsigned)readingRings[i].capacity(),
+             (unsigned)path.dropped, (unsigned)path.duplicates);
+    path.reported = readings;
+    path.peak = 0;
+  }
+  LOG_INFO("Dedup: %u duplicates, %u too old to check, %u origins evicted",
+           (unsigned)dedup.getDuplicates(), (unsigned)dedup.getUnchecked(), (unsigned)dedup.getEvicted());
+  if (statsDropped > 0) {
+    LOG_WARN("Stats records dropped: %u", (unsigned)statsDropped);
+  }
+}
+
+// when the current second and the current report started, used by the uplink task only
+unsigned long ingestSecondStart = 0;
+unsigned long lastIngestReport = 0;
+
+// encodes whatever the radio tasks queued, flushes frames when due and prints the log
+void uplinkPass() {
+  encodeReadings(readingRings[UPLINK_PROTOCOL_LORA], ingestPaths[UPLINK_PROTOCOL_LORA]);
+  encodeReadings(readingRings[UPLINK_PROTOCOL_ESPNOW], ingestPaths[UPLINK_PROTOCOL_ESPNOW]);
+  encodeStats();
+  unsigned long now = millis();
+  if (uplink.isDue(now, UPLINK_MAX_DELAY)) {
+    flushUplink();
+  }
+
+  refreshDisplay(now);
+  countIngest(now, ingestSecondStart);
+  if (now - lastIngestReport >= INGEST_REPORT_INTERVAL) {
+    printIngestStats(now - lastIngestReport);
+    lastIngestReport = now;
+  }
+
+  // a few lines per pass, readings do not wait behind a burst of them
+  for (int i = 0; i < 4 && logDrain(); i++) {
+  }
+}  // uplinkPass
+
+void uplinkWorker(void* parameter)
+// Runs a pass whenever a radio task queued something, or every UPLINK_IDLE_WAIT
+{
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UPLINK_IDLE_WAIT));
+    uplinkPass();
+  }
+}  // uplinkWorker
+
+void setupUplink() {
+  // a buffer large enough for a burst of frames, so write() returns at once
+  Serial.setTxBufferSize(UPLINK_TX_BUFFER);
+  Serial.begin(UPLINK_BAUD);
+  logSetOutput(uplinkLog);
+  ingestSecondStart = millis();
+  lastIngestReport = millis();
+  // the radio tasks wake it, so it has to exist before they start
+  xTaskCreatePinnedToCore(uplinkWorker, "uplink", UPLINK_TASK_STACK, NULL, UPLINK_TASK_PRIORITY,
+                          &uplinkTask, UPLINK_TASK_CORE);
+}
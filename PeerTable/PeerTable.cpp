@@ -0,0 +1,161 @@
+#include "PeerTable.h"
+
+#include <string.h>
+
+#define SLOT_MASK (PEER_TABLE_SLOTS - 1)
+
+size_t PeerTable::home(const uint8_t* macAddr) {
+  return ringQueueHashBytes(macAddr, PEER_MAC_LENGTH) & SLOT_MASK;
+}
+
+PeerEntry* PeerTable::find(const uint8_t* macAddr) {
+  // the table is never full, so the probe always ends on a free slot
+  for (size_t i = home(macAddr);; i = (i + 1) & SLOT_MASK) {
+    if (slots[i].used == false) {
+      return NULL;
+    }
+    if (memcmp(slots[i].MACaddr, macAddr, PEER_MAC_LENGTH) == 0) {
+      return &slots[i];
+    }
+  }
+}
+
+PeerEntry* PeerTable::add(const uint8_t* macAddr, unsigned long now) {
+  if (isFull()) {
+    return NULL;
+  }
+  size_t i = home(macAddr);
+  for (; slots[i].used == true; i = (i + 1) & SLOT_MASK) {
+    if (memcmp(slots[i].MACaddr, macAddr, PEER_MAC_LENGTH) == 0) {
+      return NULL;
+    }
+  }
+  PeerEntry& peer = slots[i];
+  memcpy(peer.MACaddr, macAddr, PEER_MAC_LENGTH);
+  peer.hops = PEER_NO_ROUTE;
+  // untried links start out trusted, the first lost frames bring them down quickly
+  peer.deliveryRatio = PEER_RATIO_MAX;
+  peer.lastSeen = now;
+  peer.used = true;
+  used++;
+  return &peer;
+}
+
+bool PeerTable::remove(const uint8_t* macAddr) {
+  PeerEntry* peer = find(macAddr);
+  if (peer == NULL) {
+    return false;
+  }
+  size_t hole = peer - slots;
+  slots[hole].used = false;
+  used--;
+
+  // pull later entries of the probe run back into the hole, unless that
+  // would move one in front of its home slot
+  for (size_t i = (hole + 1) & SLOT_MASK; slots[i].used == true; i = (i + 1) & SLOT_MASK) {
+    size_t start = home(slots[i].MACaddr);
+    bool reachable = hole <= i ? (start <= hole || start > i) : (start <= hole && start > i);
+    if (reachable) {
+      slots[hole] = slots[i];
+      slots[i].used = false;
+      hole = i;
+    }
+  }
+  return true;
+}  // remove
+
+void PeerTable::clear() {
+  for (int i = 0; i < PEER_TABLE_SLOTS; i++) {
+    slots[i].used = false;
+  }
+  used = 0;
+}
+
+void PeerTable::recordSend(const uint8_t* macAddr, bool delivered, unsigned long now) {
+  PeerEntry* peer = find(macAddr);
+  if (peer == NULL) {
+    return;
+  }
+  peer->deliveryRatio -= peer->deliveryRatio >> PEER_RATIO_GAIN;
+  if (delivered) {
+    peer->deliveryRatio += PEER_RATIO_MAX >> PEER_RATIO_GAIN;
+    // the MAC layer ack is as good as hearing from the peer
+    peer->lastSeen = now;
+  }
+}
+
+const PeerEntry* PeerTable::victim() const {
+  const PeerEntry* neighbour = NULL;
+  const PeerEntry* parent = NULL;
+  for (int i = 0; i < PEER_TABLE_SLOTS; i++) {
+    const PeerEntry& peer = slots[i];
+    if (peer.used == false) {
+      continue;
+    }
+    if (peer.hops == PEER_NO_ROUTE) {
+      // lastSeen only ever lies in the past, so the oldest one is furthest back
+      if (neighbour == NULL || (long)(peer.lastSeen - neighbour->lastSeen) < 0) {
+        neighbour = &peer;
+      }
+    } else if (parent == NULL || cost(peer) > cost(*parent)) {
+      parent = &peer;
+    }
+  }
+  return neighbour != NULL ? neighbour : parent;
+}
+
+bool PeerTable::isExpired(const PeerEntry& peer, unsigned long now) const {
+  return now - peer.lastSeen >= PEER_TIMEOUT || peer.deliveryRatio < PEER_DROP_RATIO;
+}
+
+const PeerEntry* PeerTable::expired(unsigned long now) const {
+  for (int i = 0; i < PEER_TABLE_SLOTS; i++) {
+    if (slots[i].used == true && isExpired(slots[i], now)) {
+      return &slots[i];
+    }
+  }
+  return NULL;
+}
+
+int PeerTable::bestParents(const PeerEntry** parents, int max, uint8_t below, unsigned long now) const {
+  int found = 0;
+  for (int i = 0; i < PEER_TABLE_SLOTS; i++) {
+    const PeerEntry& peer = slots[i];
+    if (peer.used == false || peer.hops == PEER_NO_ROUTE || peer.hops >= below || isExpired(peer, now)) {
+      continue;
+    }
+    // insertion into the short sorted list, dropping whatever falls off its end
+    uint32_t peerCost = cost(peer);
+    int j = found < max ? found++ : max;
+    for (; j > 0 && cost(*parents[j - 1]) > peerCost; j--) {
+      if (j < max) {
+        parents[j] = parents[j - 1];
+      }
+    }
+    if (j < max) {
+      parents[j] = &peer;
+    }
+  }
+  return found;
+}  // bestParents
+
+bool PeerTable::hasChildren(uint8_t hops, unsigned long now) const {
+  for (int i = 0; i < PEER_TABLE_SLOTS; i++) {
+    // PEER_NO_ROUTE is above every hop count
+    if (slots[i].used == true && slots[i].hops > hops && isExpired(slots[i], now) == false) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PeerTable::forgetRoutes() {
+  for (int i = 0; i < PEER_TABLE_SLOTS; i++) {
+    slots[i].hops = PEER_NO_ROUTE;
+  }
+}
+
+uint32_t PeerTable::cost(const PeerEntry& peer) {
+  // 256 per hop beyond the peer, plus 256 / ratio for the link to it
+  return ((uint32_t)peer.hops << 8) + ((uint32_t)(PEER_RATIO_MAX + 1) << 8) / (peer.deliveryRatio + 1);
+}
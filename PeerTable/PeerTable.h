@@ -0,0 +1,101 @@
+/** Peer Table
+ *  ESP-NOW neighbours of a node, kept for as long as they stay usable
+ *  instead of living only in the driver's peer list.
+ *
+ *  Peers are stored in a fixed-size open-addressed hash keyed by the 6 byte
+ *  MAC, with linear probing and backward shift deletion, so lookups from the
+ *  receive and send callbacks take O(1) and no slot is ever left as a
+ *  tombstone. Every entry holds the hop count the peer announced in its
+ *  handshake reply, PEER_NO_ROUTE for neighbours that only asked us for a
+ *  route, when it was last heard and a delivery ratio smoothed over the
+ *  send callbacks.
+ *
+ *  Parents are ranked by cost: the peer's own hops to the master plus the
+ *  expected number of transmissions over the link to it, 1 / delivery
+ *  ratio, in 1/256 hop units. Only peers closer to the master than the
+ *  node itself qualify, so data only ever moves up the hop gradient. A peer
+ *  whose ratio drops below PEER_DROP_RATIO or that is not heard for
+ *  PEER_TIMEOUT expires.
+ *
+ *  Times are in ms and passed in.
+ */
+
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <stdint.h>
+#include "RingQueue.h"
+
+#define PEER_MAC_LENGTH 6
+#define PEER_TABLE_SLOTS 32        // hash slots, a power of two
+#define PEER_TABLE_CAPACITY 16     // peers kept, the driver takes at most ESP_NOW_MAX_TOTAL_PEER_NUM (20)
+#define PEER_NO_ROUTE 0xFF         // hop count of a neighbour without a route to the master
+#define PEER_TIMEOUT 60000         // a peer not heard for this long expires
+#define PEER_RATIO_MAX 255         // delivery ratio of a link that never lost a frame
+#define PEER_RATIO_GAIN 3          // smoothing of the delivery ratio, 1/8 per send
+#define PEER_DROP_RATIO 32         // below this (1/8) the link counts as broken
+#define PEER_BACKUP_RATIO 192      // below this (3/4) data goes to the next best parent as well
+
+typedef struct PeerEntry {
+  uint8_t MACaddr[PEER_MAC_LENGTH];
+  uint8_t hops;                      // the peer's hops to the master
+  uint8_t deliveryRatio;             // of the link to it, PEER_RATIO_MAX is 1
+  unsigned long lastSeen;
+  bool used;
+} PeerEntry;
+
+class PeerTable {
+public:
+  // entry of the MAC, NULL if unknown
+  PeerEntry* find(const uint8_t* macAddr);
+
+  // add an unknown MAC as a neighbour without a route, NULL if it is known or the table is full
+  PeerEntry* add(const uint8_t* macAddr, unsigned long now);
+
+  // forget the MAC, returns false if it was unknown. Entries may move, so
+  // pointers into the table are invalid afterwards.
+  bool remove(const uint8_t* macAddr);
+
+  void clear();
+
+  // outcome of a unicast to the MAC as the send callback reported it
+  void recordSend(const uint8_t* macAddr, bool delivered, unsigned long now);
+
+  // the peer that makes way for a new one when the table is full: the
+  // least recently heard neighbour without a route, else the costliest parent
+  const PeerEntry* victim() const;
+
+  // a peer that has expired, NULL if none
+  const PeerEntry* expired(unsigned long now) const;
+
+  // up to max usable parents with fewer than below hops, cheapest first,
+  // returns how many were written
+  int bestParents(const PeerEntry** parents, int max, uint8_t below, unsigned long now) const;
+
+  // a usable peer further from the master than hops, or without a route,
+  // that may send data to us
+  bool hasChildren(uint8_t hops, unsigned long now) const;
+
+  // every peer loses its route, they have to announce it afresh
+  void forgetRoutes();
+
+  // hops to the master through the peer in 1/256 hop units
+  static uint32_t cost(const PeerEntry& peer);
+
+  int count() const {
+    return used;
+  }
+
+  bool isFull() const {
+    return used >= PEER_TABLE_CAPACITY;
+  }
+
+private:
+  PeerEntry slots[PEER_TABLE_SLOTS] = {};
+  int used = 0;
+
+  static size_t home(const uint8_t* macAddr);
+  bool isExpired(const PeerEntry& peer, unsigned long now) const;
+};
+
+#endif  // PEER_TABLE_H
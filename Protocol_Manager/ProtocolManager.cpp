@@ -1,5 +1,189 @@
 #include "ProtocolManager.h"
+#include "Log.h"
 
-unsigned int failedMessageCount = 0;
+#include <math.h>
 
+ProtocolManager protocolManager;
 
+const char* protocolName(Protocol protocol) {
+  return protocol == PROTOCOL_LORA ? "LoRa" : "ESP-NOW";
+}
+
+static float average(float average, float sample) {
+  return average + PROTOCOL_EWMA_WEIGHT * (sample - average);
+}
+
+// a link with a fresh route starts out trusted, its averages learn from there
+static void resetLink(LinkStats& link) {
+  link.healthy = link.available;
+  link.deliveryRatio = 1.0f;
+  link.latency = 0.0f;
+  link.outcomes = 0;
+}
+
+void ProtocolManager::lock() const {
+  if (mutex != NULL) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+  }
+}
+
+void ProtocolManager::unlock() const {
+  if (mutex != NULL) {
+    xSemaphoreGive(mutex);
+  }
+}
+
+void ProtocolManager::begin(Protocol preferred, unsigned long now) {
+  if (mutex == NULL) {
+    mutex = xSemaphoreCreateMutex();
+  }
+  lock();
+  for (int i = 0; i < PROTOCOL_COUNT; i++) {
+    links[i] = {};
+    resetLink(links[i]);
+    links[i].holdDown = PROTOCOL_HOLD_DOWN;
+    links[i].heldUntil = now;
+  }
+  active = preferred;
+  lastSwitch = now;
+  lastProbe = now;
+  unlock();
+}
+
+void ProtocolManager::setAvailable(Protocol protocol, bool available) {
+  lock();
+  LinkStats& link = links[protocol];
+  if (available != link.available) {
+    link.available = available;
+    resetLink(link);
+  }
+  unlock();
+}
+
+void ProtocolManager::recordSend(Protocol protocol, uint8_t readings, float charge) {
+  if (readings == 0) {
+    return;
+  }
+  lock();
+  LinkStats& link = links[protocol];
+  float perReading = charge / readings;
+  link.charge = link.charge == 0.0f ? perReading : average(link.charge, perReading);
+  link.sent++;
+  unlock();
+}
+
+void ProtocolManager::recordResult(Protocol protocol, bool delivered, unsigned long latency) {
+  lock();
+  LinkStats& link = links[protocol];
+  link.deliveryRatio = average(link.deliveryRatio, delivered ? 1.0f : 0.0f);
+  if (delivered) {
+    link.latency = link.outcomes == 0 ? latency : average(link.latency, latency);
+    link.delivered++;
+  } else {
+    link.failed++;
+  }
+  link.outcomes++;
+  updateHealth(link);
+  unlock();
+}
+
+void ProtocolManager::updateHealth(LinkStats& link) {
+  if (link.available == false) {
+    link.healthy = false;
+  } else if (link.outcomes < PROTOCOL_MIN_SAMPLES) {
+    // too few outcomes to judge, keep what the link was
+  } else if (link.healthy) {
+    link.healthy = link.deliveryRatio >= PROTOCOL_UNHEALTHY_RATIO && link.latency <= PROTOCOL_MAX_LATENCY;
+  } else {
+    link.healthy = link.deliveryRatio >= PROTOCOL_HEALTHY_RATIO && link.latency <= PROTOCOL_MAX_LATENCY;
+  }
+}
+
+// charge per delivered reading, a dead link is priced at 20 attempts
+static float price(const LinkStats& link) {
+  return link.charge / fmaxf(link.deliveryRatio, 0.05f);
+}
+
+float ProtocolManager::cost(Protocol protocol) const {
+  lock();
+  float cost = price(links[protocol]);
+  unlock();
+  return cost;
+}
+
+// a link that has not sent yet has no price and is never the cheaper one
+bool ProtocolManager::isCheaper(Protocol candidate, Protocol than, float margin) const {
+  if (links[candidate].charge == 0.0f || links[than].charge == 0.0f) {
+    return false;
+  }
+  return price(links[candidate]) < margin * price(links[than]);
+}
+
+void ProtocolManager::switchTo(Protocol protocol, unsigned long now, const char* reason) {
+  LOG_INFO("Switching from %s to %s, %s", protocolName(active), protocolName(protocol), reason);
+  LinkStats& left = links[active];
+  if (left.healthy == false) {
+    // a link that kept working for long enough starts over with a short hold down
+    if (now - lastSwitch >= PROTOCOL_MAX_HOLD_DOWN) {
+      left.holdDown = PROTOCOL_HOLD_DOWN;
+    }
+    left.heldUntil = now + left.holdDown;
+    left.holdDown = left.holdDown * 2 < PROTOCOL_MAX_HOLD_DOWN ? left.holdDown * 2 : PROTOCOL_MAX_HOLD_DOWN;
+  }
+  active = protocol;
+  lastSwitch = now;
+  switches++;
+}
+
+Protocol ProtocolManager::route(unsigned long now) {
+  lock();
+  Protocol other = active == PROTOCOL_ESPNOW ? PROTOCOL_LORA : PROTOCOL_ESPNOW;
+  updateHealth(links[active]);
+  updateHealth(links[other]);
+
+  if (links[active].healthy == false) {
+    // leave a failing link at once, for a healthy one or at least one with a route
+    if (links[other].healthy) {
+      switchTo(other, now, links[active].available ? "delivery failing" : "route lost");
+    } else if (links[active].available == false && links[other].available) {
+      switchTo(other, now, "route lost");
+    }
+  } else if (now - lastSwitch >= PROTOCOL_MIN_DWELL && (long)(now - links[other].heldUntil) >= 0
+             && links[other].healthy && isCheaper(other, active, PROTOCOL_SWITCH_MARGIN)) {
+    switchTo(other, now, "cheaper per delivered reading");
+  }
+
+  // now and then a reading keeps the figures of the other link current
+  Protocol chosen = active;
+  other = active == PROTOCOL_ESPNOW ? PROTOCOL_LORA : PROTOCOL_ESPNOW;
+  if (now - lastProbe >= PROTOCOL_PROBE_INTERVAL) {
+    lastProbe = now;
+    if (links[other].available) {
+      chosen = other;
+      probes++;
+    }
+  }
+  links[chosen].readings++;
+  unlock();
+  return chosen;
+}  // route
+
+LinkStats ProtocolManager::getStats(Protocol protocol) const {
+  lock();
+  LinkStats link = links[protocol];
+  unlock();
+  return link;
+}
+
+void ProtocolManager::printStats() const {
+  for (int i = 0; i < PROTOCOL_COUNT; i++) {
+    LinkStats link = getStats((Protocol)i);
+    LOG_INFO("%s%s: %s, %s, delivery %.2f, latency %.0f ms, %.0f uC/reading, sent %lu acked %lu failed %lu, readings %lu",
+             protocolName((Protocol)i), i == active ? " (active)" : "",
+             link.available ? "route" : "no route", link.healthy ? "healthy" : "unhealthy",
+             link.deliveryRatio, link.latency, cost((Protocol)i),
+             (unsigned long)link.sent, (unsigned long)link.delivered, (unsigned long)link.failed,
+             (unsigned long)link.readings);
+  }
+  LOG_INFO("Protocol switches %lu, probes %lu", (unsigned long)switches, (unsigned long)probes);
+}
@@ -1,8 +1,122 @@
+/** Protocol Manager
+ *  Chooses the link, ESP-NOW or LoRa, each of the node's own readings is
+ *  sent over. Both stacks keep running and report what happens to their
+ *  frames: the charge a send costs, and whether and how fast it was
+ *  acknowledged. Per link the manager keeps moving averages of
+ *
+ *    delivery ratio   acknowledged / sent frames
+ *    latency          ms from sending to the acknowledgement
+ *    charge           uC (mA * ms) drawn beyond idle per reading sent
+ *
+ *  and prices a link at its charge per delivered reading, charge divided
+ *  by delivery ratio. Readings go over the current link while it is
+ *  healthy. A link turns unhealthy below PROTOCOL_UNHEALTHY_RATIO or past
+ *  PROTOCOL_MAX_LATENCY, and healthy again only above
+ *  PROTOCOL_HEALTHY_RATIO, so a marginal link does not flap. A healthy
+ *  link is left for one that is cheaper by PROTOCOL_SWITCH_MARGIN after
+ *  PROTOCOL_MIN_DWELL at the earliest. A link left because it failed is
+ *  held down before it is taken back for being cheaper, starting at
+ *  PROTOCOL_HOLD_DOWN and doubling each time it fails again, up to
+ *  PROTOCOL_MAX_HOLD_DOWN. Every PROTOCOL_PROBE_INTERVAL one
+ *  reading goes over the other link, if it has a route, to keep its
+ *  figures current.
+ *
+ *  Reports may come from any task, route() is called from loop().
+ */
+
 #ifndef ProtocolManager_h
 #define ProtocolManager_h
 
-#define MAX_FAILED_MESSAGES 5
+#include <stdint.h>
+#include <Arduino.h>
+
+#define PROTOCOL_EWMA_WEIGHT 0.125f    // of each new outcome in the averages
+#define PROTOCOL_MIN_SAMPLES 4         // outcomes before the averages are trusted
+#define PROTOCOL_HEALTHY_RATIO 0.8f
+#define PROTOCOL_UNHEALTHY_RATIO 0.5f
+#define PROTOCOL_MAX_LATENCY 10000.0f  // ms, SF12 round trips take around 2 s
+#define PROTOCOL_SWITCH_MARGIN 0.7f    // the other link has to cost less than this share
+#define PROTOCOL_MIN_DWELL 30000       // ms on a link before a cheaper one is taken
+#define PROTOCOL_HOLD_DOWN 60000       // ms before a link that failed may be taken back
+#define PROTOCOL_MAX_HOLD_DOWN 3600000 // also how long it has to work to be forgiven
+#define PROTOCOL_PROBE_INTERVAL 60000  // ms between readings sent over the other link
+#define PROTOCOL_STATS_INTERVAL 60000  // how often the figures are printed
+
+enum Protocol : uint8_t {
+  PROTOCOL_ESPNOW,
+  PROTOCOL_LORA,
+  PROTOCOL_COUNT
+};
+
+typedef struct LinkStats {
+  bool available;       // the stack has a route to the master
+  bool healthy;
+  float deliveryRatio;
+  float latency;        // ms
+  float charge;         // uC per reading, 0 until the link has sent
+  uint32_t outcomes;    // since the route was found, the averages warm up over them
+  uint32_t sent;        // frames since boot
+  uint32_t delivered;
+  uint32_t failed;
+  uint32_t readings;    // own readings routed over the link
+  unsigned long holdDown;   // ms the link is held down after its next failure
+  unsigned long heldUntil;  // not taken back for being cheaper before then
+} LinkStats;
+
+class ProtocolManager {
+public:
+  // start out on the preferred link, before the stacks report
+  void begin(Protocol preferred, unsigned long now);
+
+  // the stack found or lost its route to the master
+  void setAvailable(Protocol protocol, bool available);
+
+  // a frame carrying the given number of readings went out, charge in uC
+  void recordSend(Protocol protocol, uint8_t readings, float charge);
+
+  // a frame was acknowledged after latency ms, or given up on
+  void recordResult(Protocol protocol, bool delivered, unsigned long latency);
+
+  // the link for the next own reading
+  Protocol route(unsigned long now);
+
+  Protocol current() const {
+    return active;
+  }
+
+  // uC per delivered reading, 0 while unknown
+  float cost(Protocol protocol) const;
+
+  LinkStats getStats(Protocol protocol) const;
+
+  uint32_t getSwitches() const {
+    return switches;
+  }
+
+  uint32_t getProbes() const {
+    return probes;
+  }
+
+  void printStats() const;
+
+private:
+  LinkStats links[PROTOCOL_COUNT] = {};
+  Protocol active = PROTOCOL_ESPNOW;
+  unsigned long lastSwitch = 0;
+  unsigned long lastProbe = 0;
+  uint32_t switches = 0;
+  uint32_t probes = 0;
+  SemaphoreHandle_t mutex = NULL;  // held around every access to the figures
+
+  void lock() const;
+  void unlock() const;
+  void updateHealth(LinkStats& link);
+  bool isCheaper(Protocol candidate, Protocol than, float margin) const;
+  void switchTo(Protocol protocol, unsigned long now, const char* reason);
+};
+
+extern ProtocolManager protocolManager;
 
-extern unsigned int failedMessageCount; 
+const char* protocolName(Protocol protocol);
 
-#endif
\ No newline at end of file
+#endif
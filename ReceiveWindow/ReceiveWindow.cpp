@@ -0,0 +1,78 @@
+#include "ReceiveWindow.h"
+
+#include <string.h>
+
+// seqs behind the highest one that are remembered
+#define HISTORY_BITS 32
+
+bool ReceiveWindow::isReceived(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq) {
+  Sender* sender = find(senderAddr);
+  return sender != NULL && sender->epoch == epoch && hasSeq(sender, seq);
+}
+
+void ReceiveWindow::record(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq) {
+  Sender* sender = find(senderAddr);
+  if (sender != NULL && sender->epoch == epoch) {
+    int8_t ahead = (int8_t)(seq - sender->highestSeq);
+    if (ahead > 0) {
+      // slide the history forward to the new highest seq
+      sender->received = ahead >= HISTORY_BITS ? 0 : sender->received << ahead;
+      sender->received |= 1;
+      sender->highestSeq = seq;
+      return;
+    }
+    if (-ahead < HISTORY_BITS) {
+      sender->received |= (uint32_t)1 << -ahead;
+      return;
+    }
+    // far behind the history, the sender has most likely restarted
+  } else if (sender == NULL) {
+    // take a free entry, or the one heard from least recently
+    sender = &senders[0];
+    for (int i = 0; i < RECEIVE_WINDOW_SENDERS; i++) {
+      if (senders[i].used == false) {
+        sender = &senders[i];
+        break;
+      }
+      if (senders[i].lastHeard < sender->lastHeard) {
+        sender = &senders[i];
+      }
+    }
+    memcpy(sender->MACaddr, senderAddr, MAC_ADDR_LENGTH);
+    sender->lastHeard = ++clock;
+    sender->used = true;
+  }
+  // a new sender, or a known one that restarted
+  sender->epoch = epoch;
+  sender->highestSeq = seq;
+  sender->received = 1;
+}  // record
+
+uint8_t ReceiveWindow::ackBitmap(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq) {
+  Sender* sender = find(senderAddr);
+  if (sender == NULL || sender->epoch != epoch) {
+    return 0;
+  }
+  uint8_t bitmap = 0;
+  for (uint8_t i = 0; i < LORA_ACK_BITMAP_BITS; i++) {
+    if (hasSeq(sender, seq - 1 - i) == true) {
+      bitmap |= 1 << i;
+    }
+  }
+  return bitmap;
+}  // ackBitmap
+
+ReceiveWindow::Sender* ReceiveWindow::find(const uint8_t* senderAddr) {
+  for (int i = 0; i < RECEIVE_WINDOW_SENDERS; i++) {
+    if (senders[i].used == true && memcmp(senders[i].MACaddr, senderAddr, MAC_ADDR_LENGTH) == 0) {
+      senders[i].lastHeard = ++clock;
+      return &senders[i];
+    }
+  }
+  return NULL;
+}
+
+bool ReceiveWindow::hasSeq(const Sender* sender, uint8_t seq) const {
+  uint8_t behind = sender->highestSeq - seq;
+  return behind < HISTORY_BITS && (sender->received >> behind) & 1;
+}
@@ -0,0 +1,50 @@
+/** Receive Window
+ *  Tracks the DATA_MESSAGE seqs recently received from each neighbour, so a
+ *  node can acknowledge several in-flight packets with one reply and can
+ *  recognise retransmissions of a batch it already accepted, whose reply was
+ *  lost, without merging the readings twice.
+ *
+ *  Each sender keeps a 32 seq history behind the highest seq seen, for the
+ *  boot epoch it sent last. A packet of another epoch comes from a sender
+ *  that restarted, its history starts over instead of the new seqs being
+ *  taken for old ones. Senders are looked up by MAC in a small table; when
+ *  it is full the least recently heard sender is forgotten.
+ */
+
+#ifndef RECEIVE_WINDOW_H
+#define RECEIVE_WINDOW_H
+
+#include <stdint.h>
+#include "LoraPacket.h"
+
+#define RECEIVE_WINDOW_SENDERS 16
+
+class ReceiveWindow {
+public:
+  // true if the seq from the sender has already been accepted in this epoch
+  bool isReceived(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq);
+
+  // remember an accepted seq from the sender, a new epoch drops the history
+  void record(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq);
+
+  // ack bitmap of a reply to the sender for the given seq
+  uint8_t ackBitmap(const uint8_t* senderAddr, uint16_t epoch, uint8_t seq);
+
+private:
+  typedef struct Sender {
+    uint8_t MACaddr[MAC_ADDR_LENGTH];
+    uint16_t epoch;
+    uint8_t highestSeq;
+    uint32_t received;  // bit i set if highestSeq - i was received
+    uint32_t lastHeard;
+    bool used;
+  } Sender;
+
+  Sender senders[RECEIVE_WINDOW_SENDERS] = {};
+  uint32_t clock = 0;
+
+  Sender* find(const uint8_t* senderAddr);
+  bool hasSeq(const Sender* sender, uint8_t seq) const;
+};
+
+#endif  // RECEIVE_WINDOW_H
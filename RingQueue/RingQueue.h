@@ -0,0 +1,198 @@
+/** Ring Queue
+ *  Fixed-capacity FIFO used by the LoRa stacks for the send, receive and
+ *  in-flight queues. Storage is a static array of N slots, so enqueue and
+ *  dequeue never touch the heap and run in O(1).
+ *
+ *  Like the linked-list Queue it replaces, adding an element that is already
+ *  queued is a no-op. A small counting filter indexed by the element hash
+ *  lets the common "not queued yet" case skip the scan entirely. Queues of
+ *  values that may legitimately repeat set UNIQUE to false to skip the check.
+ */
+
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// FNV-1a hash, used to index the duplicate filter
+inline uint32_t ringQueueHashBytes(const void* data, size_t length) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+#if defined(ARDUINO)
+#include <WString.h>
+
+inline uint32_t ringQueueHash(const String& value) {
+  return ringQueueHashBytes(value.c_str(), value.length());
+}
+#endif
+
+template<typename T, size_t N, bool UNIQUE = true>
+class RingQueue {
+public:
+  // number of elements currently queued
+  int count = 0;
+
+  // append to the tail, returns false if full or already queued
+  bool addToLast(const T& data) {
+    uint32_t hash = ringQueueHash(data);
+    if (isFull() || contains(data, hash)) {
+      return false;
+    }
+
+    size_t index = slotIndex(count);
+    slots[index] = data;
+    hashes[index] = hash;
+    filter[hash % FILTER_SIZE]++;
+    count++;
+    return true;
+  }
+
+  // insert at the head, returns false if full or already queued
+  bool addToFirst(const T& data) {
+    uint32_t hash = ringQueueHash(data);
+    if (isFull() || contains(data, hash)) {
+      return false;
+    }
+
+    headIndex = (headIndex + N - 1) % N;
+    slots[headIndex] = data;
+    hashes[headIndex] = hash;
+    filter[hash % FILTER_SIZE]++;
+    count++;
+    return true;
+  }
+
+  // tail slot to be filled in place, NULL if full. The element only joins
+  // the queue once commitLast() is called, so an abandoned slot is harmless.
+  T* reserveLast() {
+    if (isFull()) {
+      return NULL;
+    }
+    return &slots[slotIndex(count)];
+  }
+
+  // queue the element written into the reserved slot, returns false if already queued
+  bool commitLast() {
+    if (isFull()) {
+      return false;
+    }
+    size_t index = slotIndex(count);
+    uint32_t hash = ringQueueHash(slots[index]);
+    if (contains(slots[index], hash)) {
+      return false;
+    }
+
+    hashes[index] = hash;
+    filter[hash % FILTER_SIZE]++;
+    count++;
+    return true;
+  }
+
+  void removeFromFirst() {
+    if (count == 0) {
+      // The queue is already empty
+      return;
+    }
+    release(headIndex);
+    headIndex = (headIndex + 1) % N;
+    count--;
+  }
+
+  // element at the head, only valid if the queue is not empty
+  T& front() {
+    return slots[headIndex];
+  }
+
+  // i-th element counted from the head
+  T& at(size_t i) {
+    return slots[slotIndex(i)];
+  }
+
+  bool isEmpty() const {
+    return count == 0;
+  }
+
+  bool isFull() const {
+    return (size_t)count >= N;
+  }
+
+  size_t freeSlots() const {
+    return N - count;
+  }
+
+  void clear() {
+    while (count > 0) {
+      removeFromFirst();
+    }
+    headIndex = 0;
+  }
+
+  // remove the first element matching the condition, keeping the order of
+  // the rest. The condition is taken as is, a std::function would put a
+  // lambda with more than two captures on the heap.
+  template<typename Condition>
+  bool removeIfMatches(Condition condition) {
+    for (size_t i = 0; i < (size_t)count; i++) {
+      size_t index = slotIndex(i);
+      if (condition(slots[index])) {
+        release(index);
+        // close the gap by shifting the remaining elements towards the head
+        for (size_t j = i; j + 1 < (size_t)count; j++) {
+          size_t to = slotIndex(j);
+          size_t from = slotIndex(j + 1);
+          slots[to] = slots[from];
+          hashes[to] = hashes[from];
+        }
+        slots[slotIndex(count - 1)] = T();
+        count--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static const size_t FILTER_SIZE = N * 4;
+
+  T slots[N];
+  uint32_t hashes[N];
+  uint8_t filter[FILTER_SIZE] = {};
+  size_t headIndex = 0;
+
+  size_t slotIndex(size_t i) const {
+    return (headIndex + i) % N;
+  }
+
+  bool contains(const T& data, uint32_t hash) const {
+    if (!UNIQUE) {
+      return false;
+    }
+    // an empty bucket means no queued element shares this hash
+    if (filter[hash % FILTER_SIZE] == 0) {
+      return false;
+    }
+    for (size_t i = 0; i < (size_t)count; i++) {
+      size_t index = slotIndex(i);
+      if (hashes[index] == hash && slots[index] == data) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void release(size_t index) {
+    filter[hashes[index] % FILTER_SIZE]--;
+    // drop whatever the slot holds, e.g. a String buffer
+    slots[index] = T();
+  }
+};
+
+#endif  // RING_QUEUE_H
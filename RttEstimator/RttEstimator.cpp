@@ -0,0 +1,38 @@
+#include "RttEstimator.h"
+
+void RttEstimator::addSample(uint32_t rtt) {
+  if (samples == 0) {
+    srtt = rtt;
+    rttvar = rtt / 2;
+  } else {
+    uint32_t delta = rtt > srtt ? rtt - srtt : srtt - rtt;
+    rttvar = (3 * rttvar + delta) / 4;
+    srtt = (7 * srtt + rtt) / 8;
+  }
+  if (samples < UINT16_MAX) {
+    samples++;
+  }
+  // a fresh sample means the link answers again
+  backoffShift = 0;
+}  // addSample
+
+void RttEstimator::backoff() {
+  if (backoffShift < RTT_MAX_BACKOFF) {
+    backoffShift++;
+  }
+  if (timeouts < UINT16_MAX) {
+    timeouts++;
+  }
+}
+
+uint32_t RttEstimator::rto() const {
+  uint32_t timeout = samples == 0 ? RTT_INITIAL_RTO : srtt + 4 * rttvar;
+  if (timeout < RTT_MIN_RTO) {
+    timeout = RTT_MIN_RTO;
+  }
+  timeout <<= backoffShift;
+  if (timeout > RTT_MAX_RTO) {
+    timeout = RTT_MAX_RTO;
+  }
+  return timeout;
+}  // rto
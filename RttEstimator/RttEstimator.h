@@ -0,0 +1,57 @@
+/** RTT Estimator
+ *  Retransmission timeout for one LoRa parent, derived from the measured
+ *  round trip between sending a DATA_MESSAGE and receiving its reply.
+ *
+ *  Follows the usual SRTT/RTTVAR smoothing (gains 1/8 and 1/4) with
+ *  RTO = SRTT + 4 * RTTVAR. Every timeout doubles the RTO until the next
+ *  valid sample. Replies to retransmitted packets are not sampled, since it
+ *  is unknown which copy they answer (Karn's rule).
+ */
+
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+#include <stdint.h>
+
+// timeout until the first sample, a full frame and its reply are ~2.1 s on air at SF12
+#define RTT_INITIAL_RTO 3000
+#define RTT_MIN_RTO 500
+#define RTT_MAX_RTO 30000
+#define RTT_MAX_BACKOFF 4       // doublings of the RTO after repeated timeouts
+
+class RttEstimator {
+public:
+  // feed the round trip in ms of a packet that was sent once
+  void addSample(uint32_t rtt);
+
+  // the oldest packet timed out, back the timeout off
+  void backoff();
+
+  // current retransmission timeout in ms
+  uint32_t rto() const;
+
+  uint32_t getSrtt() const {
+    return srtt;
+  }
+
+  uint32_t getRttvar() const {
+    return rttvar;
+  }
+
+  uint16_t getSamples() const {
+    return samples;
+  }
+
+  uint16_t getTimeouts() const {
+    return timeouts;
+  }
+
+private:
+  uint32_t srtt = 0;
+  uint32_t rttvar = 0;
+  uint16_t samples = 0;
+  uint16_t timeouts = 0;
+  uint8_t backoffShift = 0;
+};
+
+#endif  // RTT_ESTIMATOR_H
@@ -3,6 +3,7 @@
 // LoRa
 #include <RadioLib.h>
 #include "boards.h"
+#include "RingQueue.h"
 
 #define DISCOVERY_MESSAGE 0
 #define DISCOVERY_REPLY_MESSAGE 1
@@ -64,105 +65,12 @@ SensorDataReply sdr = {
 unsigned long curr_time;
 unsigned long prev_time;
 
-template<typename T>
-class Queue {
-public:
-  struct Node {
-    T data;
-    Node* next;
-  };
-
-  Node* head = NULL;
-
-  void addToLast(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
-
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = NULL;
-
-    if (head == NULL) {
-      head = newNode;
-      return;
-    }
-
-    Node* last = head;
-    while (last->next != NULL) {
-      last = last->next;
-    }
-
-    last->next = newNode;
-  }
-
-  void addToFirst(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
-
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = head;
-    head = newNode;
-  }
-
-  void removeFromFirst() {
-    if (head == NULL) {
-      // The list is already empty
-      return;
-    }
-    Node* tempNode = head;
-    head = head->next;
-    delete tempNode;
-  }
-
-  bool isEmpty() {
-    return head == NULL;
-  }
-
-  void clear() {
-    while (head != NULL) {
-      removeFromFirst();
-    }
-  }
-
-  bool removeIfMatches(std::function<bool(T)> condition) {
-    Node* current = head;
-    Node* prev = NULL;
-    while (current != NULL) {
-      if (condition(current->data)) {
-        if (prev == NULL) {
-          head = current->next;
-        } else {
-          prev->next = current->next;
-        }
-        delete current;
-        return true;
-      }
-      prev = current;
-      current = current->next;
-    }
-    return false;
-  }
-};
+// queue capacities, all storage is allocated statically
+#define DATA_RECEIVED_CAPACITY 16
+#define DATA_TO_SEND_CAPACITY 16
 
-Queue<String> dataReceived;
-Queue<String> dataToSend;
+RingQueue<String, DATA_RECEIVED_CAPACITY> dataReceived;
+RingQueue<String, DATA_TO_SEND_CAPACITY> dataToSend;
 
 String serializeDRMToString() {
   String result;
@@ -186,7 +94,7 @@ String serializeSDRToString() {
   return result;
 }
 
-SensorData deserializeStringToSensorData(String* serialized) {
+SensorData deserializeStringToSensorData(const String* serialized) {
   SensorData sensorData;
   int firstCommaIndex = serialized->indexOf(',');
   int secondCommaIndex = serialized->indexOf(',', firstCommaIndex + 1);
@@ -484,12 +392,12 @@ void loop() {
 
   // regardless, process the data received in queue
   if (dataReceived.isEmpty() == false) {
-    String data = dataReceived.head->data;
+    String data = dataReceived.front();
     processStringReceived(&data);
   }
 
   if (dataToSend.isEmpty() == false) {
-    String data = dataToSend.head->data;
+    String data = dataToSend.front();
     transmitData(&data);
   }
 
@@ -20,6 +20,7 @@ Consist of leaf nodes (this) and master node.
 
 #include <RadioLib.h>
 #include <SensirionI2CScd4x.h>
+#include "RingQueue.h"
 
 #define DISCOVERY_MESSAGE 0
 #define DISCOVERY_REPLY_MESSAGE 1
@@ -244,115 +245,16 @@ typedef struct DiscoveryReplyMessage {
 
 DiscoveryReplyMessage drm;
 
-template<typename T>
-class Queue {
-public:
-  struct Node {
-    T data;
-    Node* next;
-  };
-
-  int count = 0;
-
-  Node* head = NULL;
-
-  void addToLast(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
-
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = NULL;
-
-    if (head == NULL) {
-      head = newNode;
-      count = 1;
-      return;
-    }
-
-    Node* last = head;
-    while (last->next != NULL) {
-      last = last->next;
-    }
-
-    last->next = newNode;
-    count++;
-  }
-
-  void addToFirst(T data) {
-    // Check if data already exists in the queue
-    Node* current = head;
-    while (current != NULL) {
-      if (current->data == data) {
-        // Data already exists, do not add
-        return;
-      }
-      current = current->next;
-    }
-
-    // Data does not exist in the queue, add it
-    Node* newNode = new Node;
-    newNode->data = data;
-    newNode->next = head;
-    head = newNode;
-    count++;
-  }
-
-  void removeFromFirst() {
-    if (head == NULL) {
-      // The list is already empty
-      return;
-    }
-    Node* tempNode = head;
-    head = head->next;
-    delete tempNode;
-    count--;
-  }
-
-  bool isEmpty() {
-    return head == NULL;
-  }
-
-  void clear() {
-    while (head != NULL) {
-      removeFromFirst();
-    }
-    count = 0;
-  }
-
-  bool removeIfMatches(std::function<bool(T)> condition) {
-    Node* current = head;
-    Node* prev = NULL;
-    while (current != NULL) {
-      if (condition(current->data)) {
-        if (prev == NULL) {
-          head = current->next;
-        } else {
-          prev->next = current->next;
-        }
-        delete current;
-        count--;
-        return true;
-      }
-      prev = current;
-      current = current->next;
-    }
-    return false;
-  }
-};
+// queue capacities, all storage is allocated statically
+#define DATA_TO_SEND_CAPACITY 32
+#define DATA_RECEIVED_CAPACITY 16
+#define DATA_SENDING_CAPACITY 16
+#define ADDR_LIST_CAPACITY 8
 
-Queue<String> dataToSend;
-Queue<String> dataReceived;
-Queue<String> dataSending;
-Queue<String> addrList;
+RingQueue<String, DATA_TO_SEND_CAPACITY> dataToSend;
+RingQueue<String, DATA_RECEIVED_CAPACITY> dataReceived;
+RingQueue<String, DATA_SENDING_CAPACITY> dataSending;
+RingQueue<String, ADDR_LIST_CAPACITY> addrList;
 
 // this function is called when a complete packet
 // is received or sent by the module
@@ -459,7 +361,7 @@ String serializeSensorDataToString(SensorData* data) {
   return result;
 }  // serializeSensorDataToString
 
-SensorData deserializeStringToSensorData(String* serialized) {
+SensorData deserializeStringToSensorData(const String* serialized) {
   SensorData sensorData;
   int firstCommaIndex = serialized->indexOf(',');
   int secondCommaIndex = serialized->indexOf(',', firstCommaIndex + 1);
@@ -510,7 +412,7 @@ void transmitData(String* data) {
 
   // if message is DataMessage, add first addr
   if (data->charAt(0) == '2') {
-    const char* addrChar = addrList.head->data.c_str();
+    const char* addrChar = addrList.front().c_str();
     SensorData sd = deserializeStringToSensorData(data);
     strncpy(sd.MACaddr, addrChar, MAX_MAC_LENGTH);
     *data = serializeSensorDataToString(&sd);
@@ -687,7 +589,7 @@ void processStringReceived(String* str) {
       // Serial.println("Set replyTimerFlag to false");
 
       // remove discovery message from dataSending
-      dataSending.removeIfMatches([](String data) {
+      dataSending.removeIfMatches([](const String& data) {
         return data.charAt(0) == '0';
       });
     }
@@ -722,7 +624,7 @@ void processStringReceived(String* str) {
     // loop through dataSending to find the corresponding data
     // if found, remove from dataSending
     if (dataSending.isEmpty() == false) {
-      bool state = dataSending.removeIfMatches([received](String data) {
+      bool state = dataSending.removeIfMatches([received](const String& data) {
         SensorData sd = deserializeStringToSensorData(&data);
         return sd.randomNumber == received.randomNumber;
       });
@@ -817,12 +719,12 @@ void loopLoRa() {
       retry_fail_count++;
       replyTimerFlag = false;
 
-      dataSending.removeIfMatches([](String data) {
+      dataSending.removeIfMatches([](const String& data) {
         return data.charAt(0) == '0';
       });
 
       while (dataSending.isEmpty() == false) {
-        dataToSend.addToLast(dataSending.head->data);
+        dataToSend.addToLast(dataSending.front());
         dataSending.removeFromFirst();
       }
 
@@ -867,13 +769,13 @@ void loopLoRa() {
 
   // if is not isolated, attempt to send data in queue
   if (dataToSend.isEmpty() == false) {
-    String data = dataToSend.head->data;
+    String data = dataToSend.front();
     transmitData(&data);
   }
 
   // regardless, process the data received in queue
   if (dataReceived.isEmpty() == false) {
-    String data = dataReceived.head->data;
+    String data = dataReceived.front();
     processStringReceived(&data);
   }
   delay(2);
@@ -0,0 +1,233 @@
+#include "SensorScheduler.h"
+#include "Log.h"
+
+#include <Wire.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+
+SensorMode sensorModeFor(unsigned long interval) {
+  // a shot costs about as much as this much periodic mode
+  unsigned long breakEven = (unsigned long)(SCD4X_SINGLE_SHOT_CHARGE / (SCD4X_PERIODIC_CURRENT_MA - SCD4X_IDLE_CURRENT_MA) * 1000.0f);
+  return interval > breakEven ? SENSOR_SINGLE_SHOT : SENSOR_PERIODIC;
+}
+
+const char* sensorModeName(SensorMode mode) {
+  switch (mode) {
+    case SENSOR_LOW_POWER:
+      return "low power periodic";
+    case SENSOR_SINGLE_SHOT:
+      return "single shot";
+    default:
+      return "periodic";
+  }
+}
+
+// how often the sensor measures on its own, 0 in single shot mode
+static unsigned long cadence(SensorMode mode) {
+  if (mode == SENSOR_PERIODIC) {
+    return SCD4X_PERIODIC_INTERVAL;
+  }
+  return mode == SENSOR_LOW_POWER ? SCD4X_LOW_POWER_INTERVAL : 0;
+}
+
+bool SensorScheduler::begin(SensirionI2CScd4x& sensor, SensorMode sensorMode, unsigned long reportInterval, unsigned long now) {
+  scd4x = &sensor;
+  mode = sensorMode;
+  unsigned long shortest = mode == SENSOR_SINGLE_SHOT ? SCD4X_SINGLE_SHOT_TIME : cadence(mode);
+  interval = reportInterval > shortest ? reportInterval : shortest;
+  measuring = false;
+  readings = 0;
+  shots = 0;
+  wakes = 0;
+  slept = 0;
+
+  // the sensor takes no other command while it measures periodically
+  scd4x->stopPeriodicMeasurement();
+  delay(SCD4X_STOP_TIME);
+  now += SCD4X_STOP_TIME;
+  started = now;
+
+  uint16_t error = 0;
+  if (mode == SENSOR_PERIODIC) {
+    error = scd4x->startPeriodicMeasurement();
+  } else if (mode == SENSOR_LOW_POWER) {
+    error = scd4x->startLowPowerPeriodicMeasurement();
+  }
+  if (error) {
+    char errorMessage[64];
+    errorToString(error, errorMessage, sizeof(errorMessage));
+    LOG_ERROR("Could not start %s measurement: %s", sensorModeName(mode), errorMessage);
+  }
+
+  // the first sample of a periodic mode takes a whole cadence
+  nextReading = now + (mode == SENSOR_SINGLE_SHOT ? SCD4X_SINGLE_SHOT_TIME : cadence(mode));
+  nextAction = mode == SENSOR_SINGLE_SHOT ? now : nextReading;
+  LOG_INFO("Sensor in %s mode, a reading every %lu ms", sensorModeName(mode), interval);
+  return error == 0;
+}  // begin
+
+void SensorScheduler::resume(SensirionI2CScd4x& sensor, SensorMode sensorMode, unsigned long reportInterval, unsigned long now) {
+  scd4x = &sensor;
+  mode = sensorMode;
+  unsigned long shortest = mode == SENSOR_SINGLE_SHOT ? SCD4X_SINGLE_SHOT_TIME : cadence(mode);
+  interval = reportInterval > shortest ? reportInterval : shortest;
+  // prepareDeepSleep() started the shot for this reading
+  measuring = mode == SENSOR_SINGLE_SHOT;
+  readings = 0;
+  shots = 0;
+  wakes = 0;
+  slept = 0;
+  started = now;
+  nextReading = now;
+  nextAction = now;
+}  // resume
+
+void SensorScheduler::prepareDeepSleep() {
+  if (mode == SENSOR_SINGLE_SHOT && startSingleShot() == false) {
+    LOG_WARN("Could not start a single shot measurement");
+  }
+}
+
+// the library's measureSingleShot() waits for the result, only the command is sent here
+bool SensorScheduler::startSingleShot() {
+  Wire.beginTransmission(SCD4X_I2C_ADDRESS);
+  Wire.write((uint8_t)(SCD4X_MEASURE_SINGLE_SHOT >> 8));
+  Wire.write((uint8_t)(SCD4X_MEASURE_SINGLE_SHOT & 0xFF));
+  return Wire.endTransmission() == 0;
+}
+
+void SensorScheduler::scheduleNext(unsigned long now) {
+  // readings missed while busy are skipped, the grid stays where it was
+  do {
+    nextReading += interval;
+  } while ((long)(nextReading - now) <= 0);
+  nextAction = mode == SENSOR_SINGLE_SHOT ? nextReading - SCD4X_SINGLE_SHOT_TIME : nextReading;
+  if ((long)(nextAction - now) < 0) {
+    nextAction = now;
+  }
+}
+
+bool SensorScheduler::poll(unsigned long now) {
+  if (scd4x == NULL || (long)(now - nextAction) < 0) {
+    return false;
+  }
+
+  if (mode == SENSOR_SINGLE_SHOT && measuring == false) {
+    if (startSingleShot() == false) {
+      LOG_WARN("Could not start a single shot measurement");
+    }
+    measuring = true;
+    shots++;
+    nextAction = now + SCD4X_SINGLE_SHOT_TIME;
+    return false;
+  }
+
+  bool ready = false;
+  uint16_t error = scd4x->getDataReadyFlag(ready);
+  if (error == 0 && ready == false) {
+    if ((long)(now - nextReading) < (long)interval) {
+      nextAction = now + SENSOR_READY_POLL;
+      return false;
+    }
+    // nothing came for a whole interval, try again with the next reading
+    LOG_WARN("No sample from the sensor");
+    measuring = false;
+    scheduleNext(now);
+    return false;
+  }
+
+  // a sample, or an error the caller covers when it reads
+  measuring = false;
+  readings++;
+  scheduleNext(now);
+  return true;
+}  // poll
+
+unsigned long SensorScheduler::wait(unsigned long now) const {
+  long left = (long)(nextAction - now);
+  return left > 0 ? left : 0;
+}
+
+unsigned long SensorScheduler::untilReading(unsigned long now) const {
+  long left = (long)(nextReading - now);
+  return left > 0 ? left : 0;
+}
+
+void SensorScheduler::alignTo(unsigned long wake) {
+  long after = (long)(nextAction - wake);
+  if (after <= 0 || after > SENSOR_ALIGN_SLACK) {
+    return;
+  }
+  // a single shot already under way is not ready any sooner, and a periodic
+  // sample is only there early if the sensor measures more often than it is read
+  bool early = mode == SENSOR_SINGLE_SHOT ? measuring == false : interval >= 2 * cadence(mode);
+  if (early) {
+    nextAction = wake;
+  }
+}
+
+unsigned long SensorScheduler::lightSleep(unsigned long ms, int wakePin) {
+  if (ms < SENSOR_MIN_SLEEP) {
+    return 0;
+  }
+  // the UART stops in light sleep, what is still in its FIFO would be garbled
+  Serial.flush();
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+  if (wakePin >= 0) {
+    // a level wakeup takes over the pin's edge interrupt until it is restored
+    gpio_intr_disable((gpio_num_t)wakePin);
+    gpio_wakeup_enable((gpio_num_t)wakePin, GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+  }
+
+  unsigned long before = millis();
+  esp_light_sleep_start();
+  unsigned long asleep = millis() - before;
+
+  if (wakePin >= 0) {
+    gpio_wakeup_disable((gpio_num_t)wakePin);
+    gpio_set_intr_type((gpio_num_t)wakePin, GPIO_INTR_POSEDGE);
+    gpio_intr_enable((gpio_num_t)wakePin);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+  }
+  slept += asleep;
+  wakes++;
+  return asleep;
+}  // lightSleep
+
+float SensorScheduler::mcuDutyCycle(unsigned long now) const {
+  unsigned long elapsed = now - started;
+  if (elapsed == 0) {
+    return 1.0f;
+  }
+  return 1.0f - (float)slept / elapsed;
+}
+
+float SensorScheduler::sensorDutyCycle(unsigned long now) const {
+  unsigned long elapsed = now - started;
+  if (mode != SENSOR_SINGLE_SHOT || elapsed == 0) {
+    return 1.0f;
+  }
+  float measured = (float)shots * SCD4X_SINGLE_SHOT_TIME;
+  return measured < elapsed ? measured / elapsed : 1.0f;
+}
+
+float SensorScheduler::sensorCurrent(unsigned long now) const {
+  if (mode == SENSOR_PERIODIC) {
+    return SCD4X_PERIODIC_CURRENT_MA;
+  }
+  if (mode == SENSOR_LOW_POWER) {
+    return SCD4X_LOW_POWER_CURRENT_MA;
+  }
+  unsigned long elapsed = now - started;
+  // mC per ms are A
+  return SCD4X_IDLE_CURRENT_MA + (elapsed > 0 ? shots * SCD4X_SINGLE_SHOT_CHARGE * 1000.0f / elapsed : 0.0f);
+}
+
+void SensorScheduler::printStats(unsigned long now) const {
+  float awake = mcuDutyCycle(now);
+  float mcu = awake * SENSOR_MCU_AWAKE_CURRENT_MA + (1.0f - awake) * SENSOR_MCU_SLEEP_CURRENT_MA;
+  LOG_INFO("Sensor %s every %lu ms: %lu readings, measuring %.1f %%, ~%.2f mA; MCU awake %.1f %% over %lu sleeps, ~%.1f mA",
+           sensorModeName(mode), interval, (unsigned long)readings, sensorDutyCycle(now) * 100.0f,
+           sensorCurrent(now), awake * 100.0f, (unsigned long)wakes, mcu);
+}
@@ -0,0 +1,143 @@
+/** Sensor Scheduler
+ *  Decides when the SCD4x measures and when its sample is read, instead of
+ *  leaving it in 5 s periodic mode and asking for data on every loop. A
+ *  reading is taken every reporting interval, on a fixed grid from begin(),
+ *  in one of the sensor's modes:
+ *
+ *    SENSOR_PERIODIC     measures every 5 s, the latest sample is read
+ *    SENSOR_LOW_POWER    measures every 30 s, the latest sample is read
+ *    SENSOR_SINGLE_SHOT  idle between readings, a measurement is started
+ *                        SCD4X_SINGLE_SHOT_TIME before each one (SCD41 only)
+ *
+ *  From the datasheet averages a single shot costs about as much as 6 s of
+ *  periodic mode, so sensorModeFor() picks single shot for any interval
+ *  above that. Low power mode is for the SCD40, which has no single shot.
+ *
+ *  Between readings the MCU can be put in light sleep until the sensor or
+ *  the radio is due again, DIO1 of the LoRa radio wakes it for a packet.
+ *  alignTo() moves a sensor action that falls shortly after a radio wake
+ *  onto that wake, so both share one. The awake and measuring shares are
+ *  counted, so printStats() tells the duty cycle and the estimated current
+ *  a reporting interval and mode achieve.
+ *
+ *  The sensor has its own supply and keeps measuring while the MCU is in
+ *  deep sleep. prepareDeepSleep() starts the single shot for the reading
+ *  after the wake, and resume() picks the mode up again without the stop
+ *  and restart begin() does.
+ *
+ *  Times are in ms and passed in.
+ */
+
+#ifndef SENSOR_SCHEDULER_H
+#define SENSOR_SCHEDULER_H
+
+#include <stdint.h>
+#include <SensirionI2CScd4x.h>
+
+#define SCD4X_I2C_ADDRESS 0x62
+#define SCD4X_MEASURE_SINGLE_SHOT 0x219D
+#define SCD4X_PERIODIC_INTERVAL 5000
+#define SCD4X_LOW_POWER_INTERVAL 30000
+#define SCD4X_SINGLE_SHOT_TIME 5000  // from the command until the sample is ready
+#define SCD4X_STOP_TIME 500          // after stopPeriodicMeasurement, before the next command
+
+// SCD4x datasheet, at 3.3 V
+#define SCD4X_PERIODIC_CURRENT_MA 15.0f
+#define SCD4X_LOW_POWER_CURRENT_MA 3.2f
+#define SCD4X_IDLE_CURRENT_MA 0.15f
+#define SCD4X_SINGLE_SHOT_CHARGE 90.0f  // mC per measurement beyond idle
+
+// ESP32-S3 board while awake, see AirtimeMeter, and in light sleep with the SX1280 listening
+#define SENSOR_MCU_AWAKE_CURRENT_MA 220.0f
+#define SENSOR_MCU_SLEEP_CURRENT_MA 6.0f
+
+#define SENSOR_READY_POLL 100   // ms between data ready checks once a reading is due
+#define SENSOR_ALIGN_SLACK 2000 // ms a sensor action is moved forward onto a radio wake
+#define SENSOR_MIN_SLEEP 20     // shorter waits are not worth a light sleep
+#define SENSOR_STATS_INTERVAL 60000
+
+enum SensorMode : uint8_t {
+  SENSOR_PERIODIC,
+  SENSOR_LOW_POWER,
+  SENSOR_SINGLE_SHOT
+};
+
+// the cheapest mode for a reporting interval, see above
+SensorMode sensorModeFor(unsigned long interval);
+
+const char* sensorModeName(SensorMode mode);
+
+class SensorScheduler {
+public:
+  // start the mode, the interval is raised to what the mode can deliver.
+  // Blocks for SCD4X_STOP_TIME, call it from setup().
+  bool begin(SensirionI2CScd4x& sensor, SensorMode mode, unsigned long interval, unsigned long now);
+
+  // after a deep sleep, the sensor still runs in the mode. The reading is
+  // due at once and the grid starts from it.
+  void resume(SensirionI2CScd4x& sensor, SensorMode mode, unsigned long interval, unsigned long now);
+
+  // the MCU is about to deep sleep until the next reading, in single shot
+  // mode its measurement starts now
+  void prepareDeepSleep();
+
+  // true once a reading is due and the sensor has a sample for it, the
+  // caller reads it right away. Starts single shot measurements on time.
+  bool poll(unsigned long now);
+
+  // ms until poll() has something to do
+  unsigned long wait(unsigned long now) const;
+
+  // ms until the next reading on the grid
+  unsigned long untilReading(unsigned long now) const;
+
+  // the MCU wakes at that time anyway, a sensor action due shortly after
+  // moves onto it
+  void alignTo(unsigned long wake);
+
+  // light sleep for up to ms, woken early by the pin going high, -1 for
+  // none. Returns the ms actually slept.
+  unsigned long lightSleep(unsigned long ms, int wakePin);
+
+  SensorMode getMode() const {
+    return mode;
+  }
+
+  unsigned long getInterval() const {
+    return interval;
+  }
+
+  // readings taken since begin() or resume()
+  uint32_t getReadings() const {
+    return readings;
+  }
+
+  // share of the time since begin() the MCU was awake, 0 to 1
+  float mcuDutyCycle(unsigned long now) const;
+
+  // share of the time since begin() the sensor was measuring, 0 to 1
+  float sensorDutyCycle(unsigned long now) const;
+
+  // estimated mean sensor current since begin(), mA
+  float sensorCurrent(unsigned long now) const;
+
+  void printStats(unsigned long now) const;
+
+private:
+  SensirionI2CScd4x* scd4x = NULL;
+  SensorMode mode = SENSOR_PERIODIC;
+  unsigned long interval = SCD4X_PERIODIC_INTERVAL;
+  unsigned long started = 0;
+  unsigned long nextReading = 0;  // on the reporting grid
+  unsigned long nextAction = 0;   // trigger or data ready check, may be moved by alignTo()
+  bool measuring = false;         // a single shot is under way
+  uint32_t readings = 0;
+  uint32_t shots = 0;
+  uint32_t wakes = 0;
+  unsigned long slept = 0;        // ms in light sleep since begin()
+
+  bool startSingleShot();
+  void scheduleNext(unsigned long now);
+};
+
+#endif  // SENSOR_SCHEDULER_H
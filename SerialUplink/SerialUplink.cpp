@@ -0,0 +1,285 @@
+#include "SerialUplink.h"
+
+#include <string.h>
+#include <math.h>
+
+static uint8_t makeHeader(uint8_t type) {
+  return (UPLINK_FRAME_VERSION << 4) | (type & 0x0F);
+}
+
+static void putUint16(uint8_t* buffer, uint16_t value) {
+  buffer[0] = value & 0xFF;
+  buffer[1] = value >> 8;
+}
+
+static uint16_t getUint16(const uint8_t* buffer) {
+  return buffer[0] | (buffer[1] << 8);
+}
+
+static void putUint32(uint8_t* buffer, uint32_t value) {
+  putUint16(buffer, value & 0xFFFF);
+  putUint16(buffer + 2, value >> 16);
+}
+
+static uint32_t getUint32(const uint8_t* buffer) {
+  return getUint16(buffer) | ((uint32_t)getUint16(buffer + 2) << 16);
+}
+
+// scale and round a float into a fixed point field, clamping to its range
+static int32_t toFixed(float value, float scale, int32_t min, int32_t max) {
+  float scaled = roundf(value * scale);
+  if (scaled < min) {
+    return min;
+  }
+  if (scaled > max) {
+    return max;
+  }
+  return (int32_t)scaled;
+}
+
+uint16_t uplinkCrc(const uint8_t* data, size_t length, uint16_t crc) {
+  // bytewise form of the 0x1021 polynomial, no table needed
+  for (size_t i = 0; i < length; i++) {
+    crc = (crc >> 8) | (crc << 8);
+    crc ^= data[i];
+    crc ^= (crc & 0xFF) >> 4;
+    crc ^= crc << 12;
+    crc ^= (crc & 0xFF) << 5;
+  }
+  return crc;
+}
+
+size_t uplinkFrame(const uint8_t* payload, size_t length, uint8_t* frame) {
+  uint16_t crc = uplinkCrc(payload, length);
+  uint8_t trailer[UPLINK_CRC_LENGTH];
+  putUint16(trailer, crc);
+
+  // COBS: every zero becomes the distance to the next one, the first
+  // code byte points at the first zero. Payload and CRC fit one block.
+  size_t code = 0;
+  size_t out = 1;
+  for (size_t i = 0; i < length + UPLINK_CRC_LENGTH; i++) {
+    uint8_t byte = i < length ? payload[i] : trailer[i - length];
+    if (byte == 0) {
+      frame[code] = out - code;
+      code = out++;
+    } else {
+      frame[out++] = byte;
+    }
+  }
+  frame[code] = out - code;
+  frame[out++] = 0;
+  return out;
+}  // uplinkFrame
+
+size_t encodeUplinkLog(uint16_t seq, uint8_t level, uint32_t time, const char* text, uint8_t* frame) {
+  uint8_t payload[UPLINK_MAX_PAYLOAD];
+  size_t textLength = strnlen(text, UPLINK_MAX_LOG_TEXT);
+  payload[0] = makeHeader(UPLINK_LOG);
+  putUint16(payload + 1, seq);
+  payload[3] = 1;
+  payload[4] = level;
+  putUint32(payload + 5, time);
+  memcpy(payload + UPLINK_HEADER_LENGTH + UPLINK_LOG_HEADER_LENGTH, text, textLength);
+  return uplinkFrame(payload, UPLINK_HEADER_LENGTH + UPLINK_LOG_HEADER_LENGTH + textLength, frame);
+}
+
+uint8_t* UplinkEncoder::reserve(uint8_t recordType, size_t recordLength, unsigned long now) {
+  if (count > 0 && recordType != type) {
+    return NULL;
+  }
+  if (UPLINK_HEADER_LENGTH + (count + 1) * recordLength > UPLINK_MAX_PAYLOAD) {
+    return NULL;
+  }
+  if (count == 0) {
+    type = recordType;
+    firstAdded = now;
+  }
+  return payload + UPLINK_HEADER_LENGTH + count++ * recordLength;
+}
+
+bool UplinkEncoder::addReading(const UplinkReading& reading, unsigned long now) {
+  uint8_t* p = reserve(UPLINK_READINGS, UPLINK_READING_LENGTH, now);
+  if (p == NULL) {
+    return false;
+  }
+  p[0] = reading.protocol;
+  memcpy(p + 1, reading.origin, MAC_ADDR_LENGTH);
+  putUint16(p + 7, reading.seq);
+  putUint32(p + 9, reading.receivedAt);
+  putUint16(p + 13, toFixed(reading.c02Data, 1.0f, 0, 0xFFFF));
+  putUint16(p + 15, (uint16_t)(int16_t)toFixed(reading.temperatureData, 100.0f, INT16_MIN, INT16_MAX));
+  putUint16(p + 17, toFixed(reading.humidityData, 100.0f, 0, 0xFFFF));
+  return true;
+}
+
+bool UplinkEncoder::addStats(const LoraStatsRecord& record, unsigned long now) {
+  uint8_t* p = reserve(UPLINK_STATS, UPLINK_STATS_LENGTH, now);
+  if (p == NULL) {
+    return false;
+  }
+  memcpy(p, record.MACaddr, MAC_ADDR_LENGTH);
+  putUint32(p + 6, record.uptime);
+  putUint32(p + 10, record.txTime);
+  putUint32(p + 14, record.rxTime);
+  putUint16(p + 18, record.readings);
+  putUint32(p + 20, record.charge);
+  return true;
+}
+
+bool UplinkEncoder::isDue(unsigned long now, unsigned long maxDelay) const {
+  if (count == 0) {
+    return false;
+  }
+  size_t recordLength = type == UPLINK_READINGS ? UPLINK_READING_LENGTH : UPLINK_STATS_LENGTH;
+  bool full = UPLINK_HEADER_LENGTH + (count + 1) * recordLength > UPLINK_MAX_PAYLOAD;
+  return full || now - firstAdded >= maxDelay;
+}
+
+size_t UplinkEncoder::finish(uint8_t* frame) {
+  if (count == 0) {
+    return 0;
+  }
+  size_t recordLength = type == UPLINK_READINGS ? UPLINK_READING_LENGTH : UPLINK_STATS_LENGTH;
+  payload[0] = makeHeader(type);
+  putUint16(payload + 1, seq++);
+  payload[3] = count;
+  size_t length = uplinkFrame(payload, UPLINK_HEADER_LENGTH + count * recordLength, frame);
+  count = 0;
+  return length;
+}
+
+bool UplinkDecoder::push(uint8_t byte) {
+  if (byte != 0) {
+    if (length < UPLINK_MAX_FRAME) {
+      buffer[length++] = byte;
+    } else {
+      overflow = true;
+    }
+    return false;
+  }
+
+  // delimiter, a lone one only resynchronises
+  if (length == 0 && overflow == false) {
+    return false;
+  }
+  bool valid = false;
+  if (overflow == true) {
+    framingErrors++;
+  } else {
+    valid = decode();
+  }
+  length = 0;
+  overflow = false;
+  return valid;
+}
+
+bool UplinkDecoder::decode() {
+  // undo COBS, a code byte that runs past the end means a broken frame
+  valid = false;
+  payloadLength = 0;
+  size_t i = 0;
+  while (i < length) {
+    uint8_t code = buffer[i++];
+    if (i + code - 1 > length) {
+      framingErrors++;
+      return false;
+    }
+    for (uint8_t j = 1; j < code; j++) {
+      payload[payloadLength++] = buffer[i++];
+    }
+    if (code < 0xFF && i < length) {
+      payload[payloadLength++] = 0;
+    }
+  }
+
+  if (payloadLength < UPLINK_HEADER_LENGTH + UPLINK_CRC_LENGTH) {
+    framingErrors++;
+    return false;
+  }
+  payloadLength -= UPLINK_CRC_LENGTH;
+  if (payloadLength > UPLINK_MAX_PAYLOAD) {
+    framingErrors++;
+    return false;
+  }
+  if (uplinkCrc(payload, payloadLength) != getUint16(payload + payloadLength)) {
+    crcErrors++;
+    return false;
+  }
+
+  int frameType = type();
+  size_t records = payloadLength - UPLINK_HEADER_LENGTH;
+  bool wellFormed = false;
+  if (payload[0] >> 4 != UPLINK_FRAME_VERSION) {
+    wellFormed = false;
+  } else if (frameType == UPLINK_READINGS) {
+    wellFormed = records == (size_t)count() * UPLINK_READING_LENGTH;
+  } else if (frameType == UPLINK_STATS) {
+    wellFormed = records == (size_t)count() * UPLINK_STATS_LENGTH;
+  } else if (frameType == UPLINK_LOG) {
+    wellFormed = count() == 1 && records >= UPLINK_LOG_HEADER_LENGTH
+                 && records - UPLINK_LOG_HEADER_LENGTH <= UPLINK_MAX_LOG_TEXT;
+  }
+  if (wellFormed == false) {
+    framingErrors++;
+    return false;
+  }
+  frames++;
+  valid = true;
+  return true;
+}  // decode
+
+int UplinkDecoder::type() const {
+  return payload[0] & 0x0F;
+}
+
+uint16_t UplinkDecoder::seq() const {
+  return getUint16(payload + 1);
+}
+
+int UplinkDecoder::count() const {
+  return payload[3];
+}
+
+bool UplinkDecoder::reading(int i, UplinkReading* reading) const {
+  if (valid == false || type() != UPLINK_READINGS || i < 0 || i >= count()) {
+    return false;
+  }
+  const uint8_t* p = payload + UPLINK_HEADER_LENGTH + i * UPLINK_READING_LENGTH;
+  reading->protocol = p[0];
+  memcpy(reading->origin, p + 1, MAC_ADDR_LENGTH);
+  reading->seq = getUint16(p + 7);
+  reading->receivedAt = getUint32(p + 9);
+  reading->c02Data = getUint16(p + 13);
+  reading->temperatureData = (int16_t)getUint16(p + 15) / 100.0f;
+  reading->humidityData = getUint16(p + 17) / 100.0f;
+  return true;
+}
+
+bool UplinkDecoder::stats(int i, LoraStatsRecord* record) const {
+  if (valid == false || type() != UPLINK_STATS || i < 0 || i >= count()) {
+    return false;
+  }
+  const uint8_t* p = payload + UPLINK_HEADER_LENGTH + i * UPLINK_STATS_LENGTH;
+  memcpy(record->MACaddr, p, MAC_ADDR_LENGTH);
+  record->uptime = getUint32(p + 6);
+  record->txTime = getUint32(p + 10);
+  record->rxTime = getUint32(p + 14);
+  record->readings = getUint16(p + 18);
+  record->charge = getUint32(p + 20);
+  return true;
+}
+
+bool UplinkDecoder::log(UplinkLog* log) const {
+  if (valid == false || type() != UPLINK_LOG) {
+    return false;
+  }
+  // decode() bounds the text to UPLINK_MAX_LOG_TEXT
+  const uint8_t* p = payload + UPLINK_HEADER_LENGTH;
+  size_t textLength = payloadLength - UPLINK_HEADER_LENGTH - UPLINK_LOG_HEADER_LENGTH;
+  log->level = p[0];
+  log->time = getUint32(p + 1);
+  memcpy(log->text, p + UPLINK_LOG_HEADER_LENGTH, textLength);
+  log->text[textLength] = '\0';
+  return true;
+}
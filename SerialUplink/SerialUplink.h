@@ -0,0 +1,167 @@
+/** Serial Uplink
+ *  Binary link from the master to the host gateway over the UART, in place
+ *  of the comma separated text lines. Nothing here touches the hardware,
+ *  the same code encodes on the master and decodes on the host.
+ *
+ *  A payload starts with a header byte, the frame version in the high
+ *  nibble and the type in the low one, followed by a frame seq (u16) and a
+ *  record count (u8). Multi-byte fields are little endian, sensor values
+ *  fixed point as in LoraPacket:
+ *
+ *    UPLINK_READINGS  per reading: protocol (u8), origin MAC (6), seq (u16),
+ *                     received at ms (u32), CO2 ppm (u16),
+ *                     temperature 0.01 C (i16), humidity 0.01 %RH (u16)
+ *    UPLINK_STATS     per record: origin MAC (6), uptime s (u32), TX ms (u32),
+ *                     RX ms (u32), readings (u16), charge uAh (u32)
+ *    UPLINK_LOG       a single record: level (u8), time ms (u32), then the
+ *                     text up to the end of the payload
+ *
+ *  The CRC-16/CCITT of the payload (poly 0x1021, init 0xFFFF) is appended
+ *  and the whole is COBS encoded, so it holds no zero byte, then ends with
+ *  a 0x00 delimiter. After noise, a reset or a partial read the receiver
+ *  picks up again at the next delimiter.
+ *
+ *  The seq counts data frames, readings and stats, so the host sees frames
+ *  it lost. The seq of a reading is the one its origin counted, the same
+ *  over either protocol. The master passes on each reading once, copies
+ *  that arrive again or over the other protocol are dropped (see
+ *  DedupWindow).
+ *
+ *  Bytes on the wire per reading, compared with the text lines:
+ *
+ *    text line                      ~44
+ *    1 reading per frame             27
+ *    UPLINK_MAX_READINGS per frame   ~19.7
+ */
+
+#ifndef SERIAL_UPLINK_H
+#define SERIAL_UPLINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "LoraPacket.h"
+
+#define UPLINK_FRAME_VERSION 1
+
+// frame types
+#define UPLINK_READINGS 1
+#define UPLINK_STATS 2
+#define UPLINK_LOG 3
+
+// protocol a reading arrived over
+#define UPLINK_PROTOCOL_ESPNOW 0
+#define UPLINK_PROTOCOL_LORA 1
+
+#define UPLINK_HEADER_LENGTH 4
+#define UPLINK_READING_LENGTH 19
+#define UPLINK_STATS_LENGTH 24
+#define UPLINK_LOG_HEADER_LENGTH 5
+#define UPLINK_CRC_LENGTH 2
+
+// payload without the CRC, small enough for a single COBS block
+#define UPLINK_MAX_PAYLOAD 250
+#define UPLINK_MAX_READINGS ((UPLINK_MAX_PAYLOAD - UPLINK_HEADER_LENGTH) / UPLINK_READING_LENGTH)
+#define UPLINK_MAX_STATS ((UPLINK_MAX_PAYLOAD - UPLINK_HEADER_LENGTH) / UPLINK_STATS_LENGTH)
+#define UPLINK_MAX_LOG_TEXT (UPLINK_MAX_PAYLOAD - UPLINK_HEADER_LENGTH - UPLINK_LOG_HEADER_LENGTH)
+
+// encoded frame: payload and CRC, one COBS code byte, the delimiter
+#define UPLINK_MAX_FRAME (UPLINK_MAX_PAYLOAD + UPLINK_CRC_LENGTH + 2)
+
+typedef struct UplinkReading {
+  uint8_t protocol;
+  uint8_t origin[MAC_ADDR_LENGTH];
+  uint16_t seq;
+  uint32_t receivedAt;  // master ms
+  float c02Data;
+  float temperatureData;
+  float humidityData;
+} UplinkReading;
+
+typedef struct UplinkLog {
+  uint8_t level;
+  uint32_t time;  // master ms
+  char text[UPLINK_MAX_LOG_TEXT + 1];
+} UplinkLog;
+
+// CRC-16/CCITT of the data, continuing from crc
+uint16_t uplinkCrc(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF);
+
+// CRC, COBS and delimiter around a payload of at most UPLINK_MAX_PAYLOAD
+// bytes, returns the frame length
+size_t uplinkFrame(const uint8_t* payload, size_t length, uint8_t* frame);
+
+// a whole UPLINK_LOG frame, longer texts are cut off, returns the frame length
+size_t encodeUplinkLog(uint16_t seq, uint8_t level, uint32_t time, const char* text, uint8_t* frame);
+
+// Collects readings or stats records into one pending frame
+class UplinkEncoder {
+public:
+  // add to the pending frame, false if it is full or holds the other type
+  bool addReading(const UplinkReading& reading, unsigned long now);
+  bool addStats(const LoraStatsRecord& record, unsigned long now);
+
+  // true once the pending frame is full or its oldest record is maxDelay ms old
+  bool isDue(unsigned long now, unsigned long maxDelay) const;
+
+  bool isEmpty() const {
+    return count == 0;
+  }
+
+  // encode the pending frame, returns its length, 0 if there was none
+  size_t finish(uint8_t* frame);
+
+private:
+  uint8_t payload[UPLINK_MAX_PAYLOAD];
+  uint8_t type = 0;
+  uint8_t count = 0;
+  uint16_t seq = 0;
+  unsigned long firstAdded = 0;
+
+  uint8_t* reserve(uint8_t recordType, size_t recordLength, unsigned long now);
+};
+
+// Reassembles frames from the received byte stream
+class UplinkDecoder {
+public:
+  // feed one byte, true if it completed a valid frame
+  bool push(uint8_t byte);
+
+  // of the last valid frame
+  int type() const;
+  uint16_t seq() const;
+  int count() const;
+
+  // a record of the last frame, false if the last frame was broken or
+  // holds no such record
+  bool reading(int i, UplinkReading* reading) const;
+  bool stats(int i, LoraStatsRecord* record) const;
+  bool log(UplinkLog* log) const;
+
+  uint32_t getFrames() const {
+    return frames;
+  }
+
+  uint32_t getCrcErrors() const {
+    return crcErrors;
+  }
+
+  // frames too long, badly encoded or malformed
+  uint32_t getFramingErrors() const {
+    return framingErrors;
+  }
+
+private:
+  uint8_t buffer[UPLINK_MAX_FRAME];
+  size_t length = 0;
+  bool overflow = false;
+  uint8_t payload[UPLINK_MAX_FRAME];  // noise can decode longer than any valid frame
+  size_t payloadLength = 0;
+  bool valid = false;  // payload holds the last frame push() accepted
+  uint32_t frames = 0;
+  uint32_t crcErrors = 0;
+  uint32_t framingErrors = 0;
+
+  bool decode();
+};
+
+#endif  // SERIAL_UPLINK_H
@@ -0,0 +1,79 @@
+/** SPSC Ring
+ *  Lock-free queue between exactly one producer and one consumer, e.g. a
+ *  driver callback handing frames to a worker task. Storage is a static
+ *  array of N slots, N a power of two, and elements are filled and drained
+ *  in place, so neither side ever blocks, allocates or copies twice.
+ *
+ *  The producer calls reserve(), fills the slot and commit()s it; the
+ *  consumer reads front() and pop()s it. Head and tail only ever grow and
+ *  are published with release/acquire ordering, so a slot is never seen
+ *  by the consumer before its contents are written.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+template<typename T, size_t N>
+class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+  // producer: free slot to fill, NULL if the ring is full
+  T* reserve() {
+    size_t tail = tailIndex.load(std::memory_order_relaxed);
+    if (tail - headIndex.load(std::memory_order_acquire) >= N) {
+      return NULL;
+    }
+    return &slots[tail & (N - 1)];
+  }
+
+  // producer: hand the reserved slot to the consumer
+  void commit() {
+    size_t tail = tailIndex.load(std::memory_order_relaxed) + 1;
+    tailIndex.store(tail, std::memory_order_release);
+    size_t used = tail - headIndex.load(std::memory_order_relaxed);
+    if (used > highWater.load(std::memory_order_relaxed)) {
+      highWater.store(used, std::memory_order_relaxed);
+    }
+  }
+
+  // consumer: oldest element, NULL if the ring is empty
+  T* front() {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    if (head == tailIndex.load(std::memory_order_acquire)) {
+      return NULL;
+    }
+    return &slots[head & (N - 1)];
+  }
+
+  // consumer: release the element returned by front()
+  void pop() {
+    headIndex.store(headIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // elements queued, only a snapshot when called from a third task
+  size_t size() const {
+    return tailIndex.load(std::memory_order_acquire) - headIndex.load(std::memory_order_acquire);
+  }
+
+  // most elements ever queued at once
+  size_t highWaterMark() const {
+    return highWater.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const {
+    return N;
+  }
+
+private:
+  T slots[N];
+  std::atomic<size_t> headIndex{0};
+  std::atomic<size_t> tailIndex{0};
+  std::atomic<size_t> highWater{0};
+};
+
+#endif  // SPSC_RING_H
@@ -0,0 +1,255 @@
+#include "TimeSeriesBuffer.h"
+
+#include <string.h>
+#include <math.h>
+
+// widths of the delta buckets, selected by the '10', '110', '1110' and '1111' prefixes
+static const uint8_t TIME_BITS[4] = { 7, 12, 20, 32 };
+static const uint8_t VALUE_BITS[4] = { 4, 8, 12, 17 };
+
+// scale and round a float into a fixed point field, clamping to its range
+static int32_t toFixed(float value, float scale, int32_t min, int32_t max) {
+  float scaled = roundf(value * scale);
+  if (scaled < min) {
+    return min;
+  }
+  if (scaled > max) {
+    return max;
+  }
+  return (int32_t)scaled;
+}
+
+static uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+  return (int32_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+// most significant bit first, the block has to be zeroed beforehand
+static void putBits(uint8_t* block, uint16_t& bit, uint32_t value, uint8_t bits) {
+  while (bits > 0) {
+    bits--;
+    if ((value >> bits) & 1) {
+      block[bit >> 3] |= 0x80 >> (bit & 7);
+    }
+    bit++;
+  }
+}
+
+static uint32_t getBits(const uint8_t* block, uint16_t& bit, uint8_t bits) {
+  uint32_t value = 0;
+  while (bits > 0) {
+    bits--;
+    value = (value << 1) | ((block[bit >> 3] >> (7 - (bit & 7))) & 1);
+    bit++;
+  }
+  return value;
+}
+
+static void putDelta(uint8_t* block, uint16_t& bit, int32_t delta, const uint8_t* widths) {
+  uint32_t value = zigzag(delta);
+  if (value == 0) {
+    putBits(block, bit, 0, 1);
+    return;
+  }
+  int bucket = 0;
+  while (bucket < 3 && widths[bucket] < 32 && value >= (1UL << widths[bucket])) {
+    bucket++;
+  }
+  // bucket + 1 ones, ended by a zero except for the widest bucket
+  putBits(block, bit, 0xF, bucket + 1);
+  if (bucket < 3) {
+    putBits(block, bit, 0, 1);
+  }
+  putBits(block, bit, value, widths[bucket]);
+}
+
+static int32_t getDelta(const uint8_t* block, uint16_t& bit, const uint8_t* widths) {
+  int ones = 0;
+  while (ones < 4 && getBits(block, bit, 1) == 1) {
+    ones++;
+  }
+  if (ones == 0) {
+    return 0;
+  }
+  return unzigzag(getBits(block, bit, widths[ones - 1]));
+}
+
+uint8_t TimeSeriesBuffer::newest() const {
+  return (first + used - 1) % TS_BLOCK_COUNT;
+}
+
+// encode the point after the cursor's last one, the first of a block in
+// full. The block must be zeroed and have room for TS_MAX_SAMPLE_BITS.
+static void writePoint(uint8_t* block, TimeSeriesCursor& cursor, const TimeSeriesPoint& point) {
+  if (cursor.samples == 0) {
+    putBits(block, cursor.bit, point.time, 32);
+    for (int i = 0; i < 3; i++) {
+      putBits(block, cursor.bit, (uint16_t)point.values[i], 16);
+    }
+    putBits(block, cursor.bit, point.seq, 16);
+  } else {
+    int32_t delta = (int32_t)(point.time - cursor.last.time);
+    putDelta(block, cursor.bit, delta - cursor.lastDelta, TIME_BITS);
+    for (int i = 0; i < 3; i++) {
+      putDelta(block, cursor.bit, point.values[i] - cursor.last.values[i], VALUE_BITS);
+    }
+    putDelta(block, cursor.bit, (int16_t)(point.seq - cursor.last.seq - 1), VALUE_BITS);
+    cursor.lastDelta = delta;
+  }
+  cursor.last = point;
+  cursor.samples++;
+}  // writePoint
+
+// decode the point at the cursor, which must be within the block
+static void readPoint(const uint8_t* block, TimeSeriesCursor& cursor, TimeSeriesPoint* point) {
+  if (cursor.samples == 0) {
+    point->time = getBits(block, cursor.bit, 32);
+    point->values[0] = getBits(block, cursor.bit, 16);
+    point->values[1] = (int16_t)getBits(block, cursor.bit, 16);
+    point->values[2] = getBits(block, cursor.bit, 16);
+    point->seq = getBits(block, cursor.bit, 16);
+    cursor.lastDelta = 0;
+  } else {
+    int32_t delta = cursor.lastDelta + getDelta(block, cursor.bit, TIME_BITS);
+    point->time = cursor.last.time + delta;
+    for (int i = 0; i < 3; i++) {
+      point->values[i] = cursor.last.values[i] + getDelta(block, cursor.bit, VALUE_BITS);
+    }
+    point->seq = cursor.last.seq + 1 + getDelta(block, cursor.bit, VALUE_BITS);
+    cursor.lastDelta = delta;
+  }
+  cursor.last = *point;
+  cursor.samples++;
+}  // readPoint
+
+static bool isBlockFull(const TimeSeriesCursor& cursor) {
+  return cursor.bit + TS_MAX_SAMPLE_BITS > TS_BLOCK_SIZE * 8;
+}
+
+void TimeSeriesBuffer::append(const TimeSeriesSample& sample) {
+  TimeSeriesPoint point;
+  point.time = sample.time;
+  point.values[0] = toFixed(sample.c02Data, 1.0f, 0, 0xFFFF);
+  point.values[1] = toFixed(sample.temperatureData, 100.0f, INT16_MIN, INT16_MAX);
+  point.values[2] = toFixed(sample.humidityData, 100.0f, 0, 0xFFFF);
+  point.seq = sample.seq;
+
+  if (used == 0 || isBlockFull(writer)) {
+    if (used == TS_BLOCK_COUNT) {
+      dropOldest();
+    }
+    used++;
+    memset(blocks[newest()], 0, TS_BLOCK_SIZE);
+    blockSamples[newest()] = 0;
+    writer = {};
+  }
+  writePoint(blocks[newest()], writer, point);
+  blockSamples[newest()]++;
+  stored++;
+}  // append
+
+// decode the sample at the cursor, which must be within the block
+static void readSample(const uint8_t* block, TimeSeriesCursor& cursor, TimeSeriesSample* sample) {
+  TimeSeriesPoint point;
+  readPoint(block, cursor, &point);
+  sample->time = point.time;
+  sample->seq = point.seq;
+  sample->c02Data = point.values[0];
+  sample->temperatureData = point.values[1] / 100.0f;
+  sample->humidityData = point.values[2] / 100.0f;
+}  // readSample
+
+bool TimeSeriesBuffer::pop(TimeSeriesSample* sample) {
+  if (stored == 0) {
+    return false;
+  }
+  readSample(blocks[first], reader, sample);
+  stored--;
+
+  if (stored == 0) {
+    // start afresh, the next sample opens a new block
+    clear();
+  } else if (reader.samples == blockSamples[first]) {
+    // the block is read to its end and no longer written, release it
+    first = (first + 1) % TS_BLOCK_COUNT;
+    used--;
+    reader = {};
+  }
+  return true;
+}  // pop
+
+void TimeSeriesBuffer::dropOldest() {
+  uint32_t lost = blockSamples[first] - reader.samples;
+  // a block that has been read from in part would be replayed in full
+  if (reader.samples > 0 || spill == NULL || spill(blocks[first], blockSamples[first]) == false) {
+    dropped += lost;
+  }
+  stored -= lost;
+  first = (first + 1) % TS_BLOCK_COUNT;
+  used--;
+  reader = {};
+}
+
+void TimeSeriesBuffer::spillAll() {
+  if (used > 0 && reader.samples > 0 && spill != NULL) {
+    // the unread rest of the block being read is encoded afresh, so it
+    // can be replayed on its own
+    uint8_t block[TS_BLOCK_SIZE] = {};
+    TimeSeriesCursor cursor = {};
+    stored -= blockSamples[first] - reader.samples;
+    while (reader.samples < blockSamples[first]) {
+      TimeSeriesPoint point;
+      readPoint(blocks[first], reader, &point);
+      if (isBlockFull(cursor)) {
+        if (spill(block, cursor.samples) == false) {
+          dropped += cursor.samples;
+        }
+        memset(block, 0, TS_BLOCK_SIZE);
+        cursor = {};
+      }
+      writePoint(block, cursor, point);
+    }
+    if (spill(block, cursor.samples) == false) {
+      dropped += cursor.samples;
+    }
+    first = (first + 1) % TS_BLOCK_COUNT;
+    used--;
+    reader = {};
+  }
+  while (used > 0) {
+    dropOldest();
+  }
+  clear();
+}  // spillAll
+
+void TimeSeriesBuffer::clear() {
+  first = 0;
+  used = 0;
+  writer = {};
+  reader = {};
+  stored = 0;
+}
+
+size_t TimeSeriesBuffer::bytesUsed() const {
+  if (used == 0) {
+    return 0;
+  }
+  return (used - 1) * TS_BLOCK_SIZE + (writer.bit + 7) / 8;
+}
+
+void TimeSeriesBlockReader::begin(const uint8_t* data, uint16_t count) {
+  block = data;
+  samples = count;
+  cursor = {};
+}
+
+bool TimeSeriesBlockReader::next(TimeSeriesSample* sample) {
+  if (cursor.samples >= samples) {
+    return false;
+  }
+  readSample(block, cursor, sample);
+  return true;
+}
@@ -0,0 +1,145 @@
+/** Time Series Buffer
+ *  Compressed store for a node's own readings while they cannot be sent,
+ *  e.g. while a LoRa node is isolated or ESP-NOW has no route.
+ *
+ *  Samples are kept in fixed point, as they go over the air (see
+ *  LoraPacket): CO2 in ppm, temperature in 0.01 C, humidity in 0.01 %RH,
+ *  with a ms timestamp and the reading's origin seq. They are bit packed into TS_BLOCK_COUNT blocks of
+ *  TS_BLOCK_SIZE bytes. Each block starts with one sample in full, so it
+ *  can be decoded on its own; every further sample stores only
+ *
+ *    time         delta of the delta to the previous sample:
+ *                 '0' for none, '10' + 7 bits, '110' + 12 bits,
+ *                 '1110' + 20 bits, else '1111' + 32 bits
+ *    each value   delta to the previous sample, zigzag encoded:
+ *                 '0' for none, '10' + 4 bits, '110' + 8 bits,
+ *                 '1110' + 12 bits, else '1111' + 17 bits
+ *    seq          seqs skipped since the previous sample, coded like a
+ *                 value, so '0' while every reading is kept
+ *
+ *  Readings at a steady interval that drift slowly cost a handful of bits
+ *  per field. When every block is full the oldest block is handed to the
+ *  spill target (see FlashBacklog) or dropped, so the buffer always holds
+ *  the most recent history. Samples come out oldest first, a block is
+ *  released as soon as it has been read.
+ *
+ *  Bytes per sample, 4 KB buffer at a 5 s sampling interval:
+ *
+ *    data                                   bytes  ratio  4 KB holds
+ *    LoraReading in pendingReadings           20     1      17 min
+ *    SCD4x indoor trace (noise, drift)       4.0    5.0     1.4 h
+ *    random fallback values                  8.1    2.5     42 min
+ */
+
+#ifndef TIME_SERIES_BUFFER_H
+#define TIME_SERIES_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TS_BLOCK_SIZE 256  // bytes
+#define TS_BLOCK_COUNT 16
+
+// header sample of a block: time, CO2, temperature, humidity, seq
+#define TS_FULL_SAMPLE_BITS (32 + 4 * 16)
+// the longest a compressed sample gets
+#define TS_MAX_SAMPLE_BITS ((4 + 32) + 4 * (4 + 17))
+
+typedef struct TimeSeriesSample {
+  uint32_t time;  // ms
+  uint16_t seq;   // counted per origin, see LoraPacket
+  float c02Data;
+  float temperatureData;
+  float humidityData;
+} TimeSeriesSample;
+
+// the fixed point fields, delta encoded
+typedef struct TimeSeriesPoint {
+  uint32_t time;
+  int32_t values[3];
+  uint16_t seq;
+} TimeSeriesPoint;
+
+// where encoding or decoding continues within a block
+typedef struct TimeSeriesCursor {
+  uint16_t bit;
+  uint16_t samples;   // encoded or decoded so far
+  TimeSeriesPoint last;
+  int32_t lastDelta;  // between the last two timestamps
+} TimeSeriesCursor;
+
+// takes a full block that would otherwise be dropped, false to drop it anyway
+typedef bool (*TimeSeriesSpill)(const uint8_t* block, uint16_t samples);
+
+// walks the samples of a single block, e.g. one read back from flash
+class TimeSeriesBlockReader {
+public:
+  // the block has to stay in place while it is read
+  void begin(const uint8_t* block, uint16_t samples);
+
+  // the next sample, false once the block is read
+  bool next(TimeSeriesSample* sample);
+
+  uint16_t remaining() const {
+    return samples - cursor.samples;
+  }
+
+private:
+  const uint8_t* block = NULL;
+  uint16_t samples = 0;
+  TimeSeriesCursor cursor = {};
+};
+
+class TimeSeriesBuffer {
+public:
+  // store a sample, spilling or dropping the oldest block if the buffer is full
+  void append(const TimeSeriesSample& sample);
+
+  // where the oldest block goes instead of being dropped, NULL to drop it
+  void setSpill(TimeSeriesSpill target) {
+    spill = target;
+  }
+
+  // hand every block to the spill target, the one being written too, e.g.
+  // before a deep sleep clears RAM. A block read from in part goes as a
+  // new block of its unread rest.
+  void spillAll();
+
+  // take the oldest sample, false if the buffer is empty
+  bool pop(TimeSeriesSample* sample);
+
+  void clear();
+
+  // samples stored
+  uint32_t count() const {
+    return stored;
+  }
+
+  bool isEmpty() const {
+    return stored == 0;
+  }
+
+  // samples lost to a full buffer since boot, spilled ones are not lost
+  uint32_t getDropped() const {
+    return dropped;
+  }
+
+  // bytes taken by the blocks in use
+  size_t bytesUsed() const;
+
+private:
+  uint8_t blocks[TS_BLOCK_COUNT][TS_BLOCK_SIZE];
+  uint16_t blockSamples[TS_BLOCK_COUNT] = {};
+  uint8_t first = 0;  // oldest block
+  uint8_t used = 0;   // blocks in use, the newest one is written
+  TimeSeriesCursor writer = {};
+  TimeSeriesCursor reader = {};
+  TimeSeriesSpill spill = NULL;
+  uint32_t stored = 0;
+  uint32_t dropped = 0;
+
+  void dropOldest();
+  uint8_t newest() const;
+};
+
+#endif  // TIME_SERIES_BUFFER_H
@@ -0,0 +1,102 @@
+#include "TrickleTimer.h"
+
+#include <Arduino.h>
+#include <limits.h>
+
+TrickleTimer::TrickleTimer(unsigned long imin, uint8_t doublings, uint8_t redundancy)
+    : imin(imin), imax(imin << doublings), redundancy(redundancy) {}
+
+void TrickleTimer::start(unsigned long now) {
+  running = true;
+  interval = imin;
+  beginInterval(now);
+}
+
+void TrickleTimer::stop() {
+  running = false;
+  answering = false;
+}
+
+// the random delay of a broadcast in an interval of that length
+static unsigned long randomDelay(unsigned long interval) {
+  return interval / 2 + esp_random() % (interval - interval / 2);
+}
+
+void TrickleTimer::hearConsistent() {
+  if (heard < UINT8_MAX) {
+    heard++;
+  }
+  if (answerHeard < UINT8_MAX) {
+    answerHeard++;
+  }
+}
+
+void TrickleTimer::hearInconsistent(unsigned long now) {
+  if (running == true && interval > imin) {
+    start(now);
+  }
+}
+
+void TrickleTimer::answer(unsigned long now) {
+  if (running == false || answering == true) {
+    return;
+  }
+  // the broadcast of this interval comes soon enough
+  if (fired == false && fireAt - (now - intervalStart) <= imin) {
+    return;
+  }
+  answering = true;
+  answerAt = now + randomDelay(imin);
+  answerHeard = 0;
+}
+
+bool TrickleTimer::poll(unsigned long now) {
+  if (running == false) {
+    return false;
+  }
+  if (answering == true && (long)(now - answerAt) >= 0) {
+    answering = false;
+    if (redundancy == TRICKLE_NO_SUPPRESSION || answerHeard < redundancy) {
+      // stands in for the broadcast of this interval
+      fired = true;
+      transmitted++;
+      return true;
+    }
+    suppressed++;
+  }
+  if (fired == false && now - intervalStart >= fireAt) {
+    fired = true;
+    if (redundancy == TRICKLE_NO_SUPPRESSION || heard < redundancy) {
+      transmitted++;
+      return true;
+    }
+    suppressed++;
+  }
+  if (now - intervalStart >= interval) {
+    // a late poll starts the next interval now, missed ones are not made up
+    interval = interval * 2 > imax ? imax : interval * 2;
+    beginInterval(now);
+  }
+  return false;
+}  // poll
+
+unsigned long TrickleTimer::wait(unsigned long now) const {
+  if (running == false) {
+    return ULONG_MAX;
+  }
+  unsigned long due = fired == true ? interval : fireAt;
+  unsigned long elapsed = now - intervalStart;
+  unsigned long left = elapsed >= due ? 0 : due - elapsed;
+  if (answering == true) {
+    unsigned long answerLeft = (long)(now - answerAt) >= 0 ? 0 : answerAt - now;
+    return answerLeft < left ? answerLeft : left;
+  }
+  return left;
+}
+
+void TrickleTimer::beginInterval(unsigned long now) {
+  intervalStart = now;
+  fireAt = randomDelay(interval);
+  fired = false;
+  heard = 0;
+}
@@ -0,0 +1,91 @@
+/** Trickle Timer
+ *  Paces a broadcast that neighbours repeat to each other, after RFC 6206.
+ *  Time is cut into intervals, starting at Imin and doubling after each one
+ *  up to Imax. Within an interval the broadcast is due once, at a random
+ *  point in its second half, and is left out if k neighbours have already
+ *  sent the same thing in that interval:
+ *
+ *    hearConsistent()    a neighbour sent what we would, counts towards k
+ *    hearInconsistent()  something changed, back to Imin
+ *    answer()            a neighbour asks, one broadcast within Imin unless
+ *                        k others answer first, the interval goes on
+ *
+ *  A settled network thus sends rarely and a crowded one no more than k
+ *  copies per interval, while a change still goes out within Imin. The
+ *  random point keeps neighbours that heard the same frame from answering
+ *  on top of each other. A request is not taken for a change, that would
+ *  cost every neighbour the whole climb back from Imin to Imax.
+ *
+ *  Times are in ms and passed in.
+ */
+
+#ifndef TRICKLE_TIMER_H
+#define TRICKLE_TIMER_H
+
+#include <stdint.h>
+
+#define TRICKLE_NO_SUPPRESSION 0xFF  // as redundancy, the broadcast is never left out
+
+class TrickleTimer {
+public:
+  // Imax is imin doubled that many times, redundancy is k
+  TrickleTimer(unsigned long imin, uint8_t doublings, uint8_t redundancy);
+
+  // begin with an interval of Imin, a running timer is restarted
+  void start(unsigned long now);
+
+  void stop();
+
+  bool isRunning() const {
+    return running;
+  }
+
+  void hearConsistent();
+
+  // restarts at Imin unless the interval is Imin already
+  void hearInconsistent(unsigned long now);
+
+  void answer(unsigned long now);
+
+  // true once per interval when the broadcast is due and not suppressed,
+  // moves on to the next interval at the end of this one
+  bool poll(unsigned long now);
+
+  // ms until poll() has something to do, ULONG_MAX while stopped
+  unsigned long wait(unsigned long now) const;
+
+  unsigned long getInterval() const {
+    return interval;
+  }
+
+  uint32_t getTransmitted() const {
+    return transmitted;
+  }
+
+  uint32_t getSuppressed() const {
+    return suppressed;
+  }
+
+private:
+  void beginInterval(unsigned long now);
+
+  unsigned long imin;
+  unsigned long imax;
+  uint8_t redundancy;
+
+  bool running = false;
+  unsigned long interval = 0;
+  unsigned long intervalStart = 0;
+  unsigned long fireAt = 0;  // ms after intervalStart
+  bool fired = false;
+  uint8_t heard = 0;
+
+  bool answering = false;
+  unsigned long answerAt = 0;
+  uint8_t answerHeard = 0;
+
+  uint32_t transmitted = 0;
+  uint32_t suppressed = 0;
+};
+
+#endif  // TRICKLE_TIMER_H
@@ -0,0 +1,942 @@
+#!/usr/bin/env python3
+"""Discrete-event simulator for the LoRa and ESP-NOW mesh.
+
+Runs tens of nodes in accelerated time and reports throughput, latency
+percentiles, duplicates, retransmissions and per-node queue depth, so
+protocol changes can be compared without a rack of boards.
+
+Every board runs its firmware: the nodes LoraCommunication.cpp or
+ESPNowCommunication.cpp with the modules (test/MeshSim.cpp), the master
+Master_Node.ino (test/MeshSimMaster.cpp), each built over the test mocks
+into a shared library. Every board loads its own copy of its library, so
+it has its own globals, clock and flash. The simulator only plays the
+medium: it takes the frames the SX1280 and ESP-NOW mocks were asked to
+send, decides who hears them and hands them to the receivers' mocks.
+What reached the host is what the master wrote to its serial port,
+decoded by the gateway's decoder (test/UplinkGateway.cpp). Build them
+first:
+
+    cmake -S . -B build && cmake --build build --target mesh_sim mesh_sim_master uplink_gateway
+
+The libraries are looked up in build/ and _gate_build/, or given with
+--native or MESH_SIM_LIB, the path of libmesh_sim.so with the other two
+next to it.
+
+Timing: LoRa boards run in lockstep slices no longer than the shortest
+frame on air, so nothing a board sends can reach another before that one
+got there. The nodes loop loraLoop() as loop() does, the master runs
+loRaLoop() and uplinkPass() in 1 ms steps. ESP-NOW boards are run when
+one of their jobs is due, see espnowPoll(), and when a frame arrives or
+has left.
+
+Channel model: SX1280 time on air from the loraSetup() modem settings,
+half duplex radios, frames that overlap at a receiver are lost (optionally
+the first one survives once its preamble is locked), plus independent loss
+per link. Every link gets a fixed SNR drawn from --snr, a LoRa frame only
+arrives if the receiver listens at its SF and the SNR is above the SX1280
+floor for that SF. ESP-NOW senders back off while a neighbour is on air
+and unicasts are retried at the MAC layer. --kill powers nodes off
+halfway through the run, --master-outage takes the master down halfway
+for a while and boots it again.
+
+The run fails, with exit status 1, if the delivery ratio drops below
+--min-delivery, more readings than --max-duplicates reach the host
+twice, or discovery takes more of the channel than
+--max-discovery-occupancy while the network forms, so the ctest runs
+catch regressions. --compare-timeouts runs the same network twice, with
+RttEstimator and with the fixed 1000 ms data timeout it replaced
+(libmesh_sim_fixed_timeout.so, build it as well), and fails unless
+RttEstimator resends fewer frames their receiver already had.
+
+Examples:
+    python3 mesh_simulator.py --topology grid --nodes 49 --duration 600
+    python3 mesh_simulator.py --protocol espnow --topology random --nodes 50
+    python3 mesh_simulator.py --sweep-hops 6
+    python3 mesh_simulator.py --topology grid --nodes 25 --snr 0 10
+    python3 mesh_simulator.py --protocol espnow --nodes 50 --sweep-density 1 3
+    python3 mesh_simulator.py --protocol espnow --topology random --nodes 50 --kill 5
+    python3 mesh_simulator.py --reading-interval 60 --master-outage 120
+    python3 mesh_simulator.py --nodes 9 --reading-interval 30 --compare-timeouts
+"""
+
+import argparse
+import collections
+import ctypes
+import functools
+import heapq
+import math
+import os
+import random
+import shutil
+import statistics
+import sys
+import tempfile
+
+# LoraPacket.h
+DISCOVERY_MESSAGE = 0
+DISCOVERY_REPLY_MESSAGE = 1
+DATA_MESSAGE = 2
+DATA_REPLY_MESSAGE = 3
+STATS_MESSAGE = 4
+LORA_MAX_PACKET_LENGTH = 255
+MAC_ADDR_LENGTH = 6
+LORA_SPREADING_FACTOR = 12  # at boot, LoraCommunication.h
+
+# Protocol_Manager/ProtocolManager.h
+PROTOCOL_ESPNOW = 0
+PROTOCOL_LORA = 1
+
+# SerialUplink.h
+UPLINK_READINGS = 1
+
+# esp_now.h and the air interface
+ESP_NOW_MAX_DATA_LEN = 250
+ESPNOW_BITRATE = 1e6
+ESPNOW_OVERHEAD_BYTES = 50
+ESPNOW_MAC_RETRIES = 3
+ESPNOW_DIFS = 50e-6
+ESPNOW_SLOT = 9e-6
+ESPNOW_CONTENTION_WINDOW = 15
+
+LORA_READING_INTERVAL = 1.0  # s, a busy network
+ESPNOW_READING_INTERVAL = 5.0  # READING_INTERVAL in Main.ino
+NOISE_FLOOR = -105.0  # dBm, the RSSI reported is the link SNR above it
+
+# nodes boot within this many seconds of the master
+BOOT_SPREAD = 10.0
+
+# channel occupancy is summed over bins of this many seconds
+OCCUPANCY_BIN = 10.0
+
+# formation is judged over this many seconds after boot and after the master is back
+FORMATION_WINDOW = 60.0
+
+# readings taken this close to the end of the run are left out of the delivery ratio
+SETTLE_TIME = 30.0
+
+Mac = ctypes.c_uint8 * MAC_ADDR_LENGTH
+
+
+class UplinkReading(ctypes.Structure):
+    _fields_ = [("protocol", ctypes.c_uint8), ("origin", Mac), ("seq", ctypes.c_uint16),
+                ("received_at", ctypes.c_uint32),
+                ("c02", ctypes.c_float), ("temperature", ctypes.c_float), ("humidity", ctypes.c_float)]
+
+
+def prototypes():
+    """Result and argument types of test/MeshSim.cpp, test/MeshSimMaster.cpp and test/UplinkGateway.cpp."""
+    u8, u16, u32, ulong, size = ctypes.c_uint8, ctypes.c_uint16, ctypes.c_uint32, ctypes.c_ulong, ctypes.c_size_t
+    handle, buffer, flag, real = ctypes.c_void_p, ctypes.c_char_p, ctypes.c_bool, ctypes.c_float
+    out = ctypes.POINTER
+    board = {
+        "simSetMillis": (None, [ulong]),
+        "simMillis": (ulong, []),
+        "simLoraRun": (flag, [ulong, out(u8)]),
+        "simLoraSent": (size, [buffer, out(ulong)]),
+        "simLoraTransmitDone": (None, []),
+        "simLoraListening": (u8, []),
+        "simLoraReceive": (flag, [buffer, size, real, real]),
+        "simLoraQueueDepth": (ctypes.c_int, []),
+        "simEspNowPoll": (ulong, []),
+        "simEspNowPending": (size, [buffer, buffer]),
+        "simEspNowSendDone": (None, [flag]),
+        "simEspNowReceive": (None, [buffer, buffer, ctypes.c_int]),
+        "simEspNowQueueDepth": (ctypes.c_int, []),
+    }
+    node = dict(board, **{
+        "simBoot": (None, [buffer, ctypes.c_int, u32, ulong, buffer]),
+        "simReading": (u16, [real, real, real]),
+        "simBacklogCount": (u32, []),
+        "simBacklogDropped": (u32, []),
+        "simLoraIsolated": (flag, []),
+        "simLoraLevel": (ctypes.c_int, []),
+        "simTrickleTransmitted": (u32, [flag]),
+        "simTrickleSuppressed": (u32, [flag]),
+        "simLoraFrameInfo": (ctypes.c_int, [buffer, size, buffer, buffer, out(u8), out(u16)]),
+        "simTimeOnAir": (u32, [u8, u8]),
+        "simSnrFloor": (real, [u8]),
+        "simEspNowConnected": (flag, []),
+        "simEspNowFrameInfo": (flag, [buffer, ctypes.c_int, buffer, out(u16), out(u8)]),
+    })
+    master = dict(board, **{
+        "simBoot": (None, [buffer, u32]),
+        "simSerialOutput": (size, [buffer, size]),
+        "simDuplicates": (u32, []),
+    })
+    gateway = {
+        "uplinkLayout": (None, [out(size)]),
+        "uplinkDecoderNew": (handle, []),
+        "uplinkDecoderFree": (None, [handle]),
+        "uplinkDecoderPush": (size, [handle, buffer, size]),
+        "uplinkDecoderType": (ctypes.c_int, [handle]),
+        "uplinkDecoderCount": (ctypes.c_int, [handle]),
+        "uplinkDecoderReading": (flag, [handle, ctypes.c_int, out(UplinkReading)]),
+        "uplinkDecoderFrames": (u32, [handle]),
+        "uplinkDecoderErrors": (u32, [handle]),
+    }
+    return node, master, gateway
+
+
+class Libraries:
+    """The firmware libraries of the host build, a fresh copy loaded for every board."""
+
+    def __init__(self, path):
+        here = os.path.dirname(os.path.abspath(__file__))
+        candidates = [path] if path else [os.environ.get("MESH_SIM_LIB")] + [
+            os.path.join(here, build, "test", "libmesh_sim.so") for build in ("build", "_gate_build")]
+        found = next((candidate for candidate in candidates if candidate and os.path.exists(candidate)), None)
+        directory = os.path.dirname(found) if found else ""
+        self.node = found
+        self.master = os.path.join(directory, "libmesh_sim_master.so")
+        self.fixed_timeout = os.path.join(directory, "libmesh_sim_fixed_timeout.so")
+        gateway = os.path.join(directory, "libuplink_gateway.so")
+        if found is None or not os.path.exists(self.master) or not os.path.exists(gateway):
+            sys.exit("libmesh_sim.so, libmesh_sim_master.so and libuplink_gateway.so not found, build them with\n"
+                     "    cmake -S . -B build && cmake --build build --target mesh_sim mesh_sim_master uplink_gateway\n"
+                     "or pass the path of libmesh_sim.so with --native")
+        self.node_types, self.master_types, gateway_types = prototypes()
+        # boards keep their flash here, copies of the libraries pass through
+        self.scratch = tempfile.TemporaryDirectory(prefix="mesh_sim_")
+        self.loaded = 0
+        self.gateway = self.bind(ctypes.CDLL(gateway), gateway_types)
+        sizes = (ctypes.c_size_t * 3)()
+        self.gateway.uplinkLayout(sizes)
+        if sizes[0] != ctypes.sizeof(UplinkReading):
+            sys.exit(f"{gateway} lays out UplinkReading in {sizes[0]} bytes, the simulator in "
+                     f"{ctypes.sizeof(UplinkReading)}, rebuild it")
+        # shared by the boards, only for what does not depend on their state
+        self.helpers = self.load(self.node, self.node_types)
+
+    @staticmethod
+    def bind(library, types):
+        for name, (restype, argtypes) in types.items():
+            function = getattr(library, name)
+            function.restype = restype
+            function.argtypes = argtypes
+        return library
+
+    def load(self, path, types):
+        """A private copy, the dynamic loader maps a file it loaded before only once."""
+        self.loaded += 1
+        copy = os.path.join(self.scratch.name, f"board{self.loaded}.so")
+        shutil.copyfile(path, copy)
+        try:
+            library = ctypes.CDLL(copy, mode=os.RTLD_LOCAL)
+        finally:
+            os.unlink(copy)
+        return self.bind(library, types)
+
+    def flash(self):
+        """An empty directory for a board's LittleFS."""
+        directory = os.path.join(self.scratch.name, f"flash{self.loaded}")
+        os.mkdir(directory)
+        return directory.encode()
+
+
+libraries = None
+
+
+def ms(t):
+    """Simulated seconds as the ms the firmware counts, rounded so a deadline read back is due on time."""
+    return int(round(t * 1000))
+
+
+# nodes are told apart by the last two bytes of their MAC, the master is node 0
+def node_mac(node_id):
+    return bytes([0x24, 0x6F, 0x28, 0x00, node_id >> 8, node_id & 0xFF])
+
+
+def mac_node(mac):
+    return int.from_bytes(bytes(mac[4:6]), "big")
+
+
+def sensor_values(rng, phase, now):
+    """CO2 ppm, C and %RH drifting like a room over the day, with the SCD4x noise on top."""
+    drift = math.sin(now / 3600.0 + phase)
+    return (600.0 + 150.0 * drift + rng.gauss(0, 5), 21.0 + drift + rng.gauss(0, 0.05),
+            45.0 + 5.0 * drift + rng.gauss(0, 0.2))
+
+
+@functools.lru_cache(maxsize=None)
+def time_on_air(length, sf):
+    """SX1280 LoRa time on air in seconds for a payload of the given length, from AirtimeMeter."""
+    return libraries.helpers.simTimeOnAir(sf, length) / 1e6
+
+
+def espnow_time_on_air(length, sf=None):
+    return (length + ESPNOW_OVERHEAD_BYTES) * 8 / ESPNOW_BITRATE
+
+
+@functools.lru_cache(maxsize=None)
+def snr_floor(sf):
+    """SNR in dB below which the SX1280 cannot demodulate the SF."""
+    return libraries.helpers.simSnrFloor(sf)
+
+
+class Simulator:
+    def __init__(self, seed):
+        self.now = 0.0
+        self.events = []
+        self.counter = 0
+        self.rng = random.Random(seed)
+
+    def schedule(self, at, callback, *args):
+        self.counter += 1
+        heapq.heappush(self.events, (at, self.counter, callback, args))
+
+    def next_event(self):
+        return self.events[0][0] if self.events else math.inf
+
+    def run_due(self):
+        while self.events and self.events[0][0] <= self.now:
+            _, _, callback, args = heapq.heappop(self.events)
+            callback(*args)
+
+
+class Board:
+    """A node or the master, a copy of its firmware library running on its own clock."""
+
+    def __init__(self, node_id, boot, phase):
+        self.id = node_id
+        self.mac = node_mac(node_id)
+        self.boot = boot  # s, millis() counts from here
+        self.ready = boot  # s, setup() has returned
+        self.phase = phase
+        self.lib = None
+        self.dead = False
+        self.sf = LORA_SPREADING_FACTOR
+        self.sending = None  # the ESP-NOW frame on its way out
+        self.depth_samples = []
+
+    def running(self, now):
+        return self.lib is not None and not self.dead and now >= self.ready
+
+    def clock(self, now):
+        return ms(now - self.boot)
+
+
+class Transmission:
+    def __init__(self, board, start, end, data, sf, dst=None):
+        self.board = board
+        self.lib = board.lib  # a rebooted board does not finish what it sent before
+        self.start = start
+        self.end = end
+        self.data = data
+        self.sf = sf
+        self.dst = dst
+
+
+class Stats:
+    def __init__(self):
+        self.generated = 0
+        self.created = {}  # (origin, seq): when the reading was taken
+        self.delivered = {}  # (origin, seq): when the host decoded it
+        self.latencies = []
+        self.duplicates = 0  # dropped by the master's DedupWindow, of the masters before the current one
+        self.passed_duplicates = 0  # reached the host more than once
+        self.data_frames = 0
+        self.retransmissions = 0
+        self.spurious = 0  # retransmissions of frames their receiver had already got
+        self.overruns = 0  # arrived before the radio's previous frame was read
+        self.uplink_bytes = 0
+
+
+class Network:
+    """The boards and the medium between them."""
+
+    def __init__(self, config, topology, nodes, firmware):
+        self.config = config
+        self.firmware = firmware  # the node library
+        self.sim = Simulator(config.seed)
+        self.lora = config.protocol == "lora"
+        self.neighbours = build_topology(topology, nodes, self.sim.rng, config.radius)
+        self.link_snr = {}
+        for a, near in enumerate(self.neighbours):
+            for b in near:
+                if a < b:
+                    self.link_snr[(a, b)] = self.link_snr[(b, a)] = self.sim.rng.uniform(*config.snr)
+        self.stats = Stats()
+        self.decoder = libraries.gateway.uplinkDecoderNew()
+        self.serial = ctypes.create_string_buffer(4096)
+        self.frame = ctypes.create_string_buffer(max(LORA_MAX_PACKET_LENGTH, ESP_NOW_MAX_DATA_LEN))
+        self.peer = ctypes.create_string_buffer(MAC_ADDR_LENGTH)
+        self.boards = [Board(0, 0.0, 0.0)]
+        self.boards += [Board(i, self.sim.rng.uniform(0, BOOT_SPREAD), self.sim.rng.uniform(0, 2 * math.pi))
+                        for i in range(1, nodes)]
+        self.masters = 0
+        self.active = []
+        self.collisions = 0
+        self.frames = 0
+        self.airtime_total = 0.0
+        self.occupancy = collections.defaultdict(collections.Counter)  # bin: {frame type: airtime}
+        self.sent_frames = set()  # (sender, epoch, seq) of the sequenced LoRa frames sent
+        self.received_frames = set()  # the same, once their receiver got them
+        self.connected = []  # (time, reachable nodes with a route, reachable nodes)
+        self.reachable = set(hop_counts(self.neighbours)) - {0}
+
+    def __del__(self):
+        libraries.gateway.uplinkDecoderFree(self.decoder)
+
+    # boards
+
+    def boot(self, board):
+        if board.id == 0:
+            self.masters += 1
+            board.lib = libraries.load(libraries.master, libraries.master_types)
+            board.lib.simBoot(board.mac, self.seed(board.id))
+        else:
+            interval = self.config.reading_interval
+            board.lib = libraries.load(self.firmware, libraries.node_types)
+            board.lib.simBoot(board.mac, PROTOCOL_LORA if self.lora else PROTOCOL_ESPNOW, self.seed(board.id),
+                              ms(interval), libraries.flash())
+            self.sim.schedule(self.sim.now + self.sim.rng.uniform(0, interval), self.take_reading, board)
+        # the master's setup() waits for the display
+        board.ready = board.boot + board.lib.simMillis() / 1000.0
+        if self.lora:
+            sent_time = ctypes.c_ulong()
+            if board.lib.simLoraSent(self.frame, ctypes.byref(sent_time)) > 0:
+                self.lora_sent(board, LORA_SPREADING_FACTOR)
+        else:
+            self.sim.schedule(board.ready, self.espnow_poll, board)
+
+    def seed(self, node_id):
+        return (self.config.seed * 1000003 + node_id * 7919 + self.masters) & 0xFFFFFFFF or 1
+
+    def take_reading(self, board):
+        if board.dead:
+            return
+        if not self.lora:
+            board.lib.simSetMillis(board.clock(self.sim.now))
+        seq = board.lib.simReading(*sensor_values(self.sim.rng, board.phase, self.sim.now))
+        self.stats.generated += 1
+        self.stats.created[(board.id, seq)] = self.sim.now
+        if not self.lora:
+            self.espnow_kick(board)
+        self.sim.schedule(self.sim.now + self.config.reading_interval, self.take_reading, board)
+
+    def master_down(self):
+        master = self.boards[0]
+        self.collect_uplink()
+        self.stats.duplicates += master.lib.simDuplicates()
+        master.dead = True
+        self.sim.schedule(self.sim.now + self.config.master_outage, self.master_up)
+
+    def master_up(self):
+        master = self.boards[0]
+        master.dead = False
+        master.sending = None
+        master.boot = self.sim.now
+        self.boot(master)
+
+    def kill(self):
+        for node_id in self.sim.rng.sample(range(1, len(self.boards)), min(self.config.kill, len(self.boards) - 1)):
+            self.boards[node_id].dead = True
+
+    # the host
+
+    def collect_uplink(self):
+        """Decode what the master wrote to its serial port."""
+        master = self.boards[0]
+        gateway = libraries.gateway
+        while True:
+            length = master.lib.simSerialOutput(self.serial, len(self.serial))
+            if length == 0:
+                return
+            self.stats.uplink_bytes += length
+            data = self.serial.raw[:length]
+            while data:
+                taken = gateway.uplinkDecoderPush(self.decoder, data, len(data))
+                data = data[taken:]
+                if taken > 0 and gateway.uplinkDecoderType(self.decoder) == UPLINK_READINGS:
+                    self.readings_decoded()
+
+    def readings_decoded(self):
+        gateway = libraries.gateway
+        reading = UplinkReading()
+        for i in range(gateway.uplinkDecoderCount(self.decoder)):
+            if not gateway.uplinkDecoderReading(self.decoder, i, ctypes.byref(reading)):
+                continue
+            key = (mac_node(reading.origin), reading.seq)
+            if key in self.stats.delivered:
+                self.stats.passed_duplicates += 1
+            elif key in self.stats.created:
+                self.stats.delivered[key] = self.sim.now
+                self.stats.latencies.append(self.sim.now - self.stats.created[key])
+
+    # the medium
+
+    def record(self, tx, kind):
+        self.frames += 1
+        self.airtime_total += tx.end - tx.start
+        self.occupancy[int(tx.start // OCCUPANCY_BIN)][kind] += tx.end - tx.start
+        self.active.append(tx)
+
+    def forget_old(self, horizon):
+        """Transmissions that can no longer overlap anything."""
+        self.active = [t for t in self.active if t.end >= horizon]
+
+    # LoRa
+
+    def run_lora(self, duration):
+        sim = self.sim
+        sf = ctypes.c_uint8()
+        while sim.now < duration:
+            # no board gets further ahead than the shortest frame takes
+            quantum = max(0.002, min(time_on_air(1, board.sf) for board in self.boards))
+            until = min(sim.now + quantum, sim.next_event(), duration)
+            for board in self.boards:
+                if board.running(sim.now):
+                    target = board.clock(until)
+                    while board.lib.simLoraRun(target, ctypes.byref(sf)):
+                        self.lora_sent(board, sf.value)
+                    board.sf = sf.value
+            if self.boards[0].running(sim.now):
+                self.collect_uplink()
+            sim.now = until
+            sim.run_due()
+
+    def lora_sent(self, board, sf):
+        sent_time = ctypes.c_ulong()
+        length = board.lib.simLoraSent(self.frame, ctypes.byref(sent_time))
+        data = self.frame.raw[:length]
+        start = board.boot + sent_time.value / 1000.0
+        tx = Transmission(board, start, start + time_on_air(length, sf), data, sf)
+        sender, receiver = ctypes.create_string_buffer(MAC_ADDR_LENGTH), ctypes.create_string_buffer(MAC_ADDR_LENGTH)
+        seq, epoch = ctypes.c_uint8(), ctypes.c_uint16()
+        kind = libraries.helpers.simLoraFrameInfo(data, length, sender, receiver, ctypes.byref(seq),
+                                                  ctypes.byref(epoch))
+        if kind in (DATA_MESSAGE, STATS_MESSAGE):
+            tx.key = (sender.raw, epoch.value, seq.value)
+            tx.dst = mac_node(receiver.raw)
+            self.stats.data_frames += kind == DATA_MESSAGE
+            if tx.key in self.sent_frames:
+                self.stats.retransmissions += 1
+                self.stats.spurious += tx.key in self.received_frames
+            self.sent_frames.add(tx.key)
+        self.record(tx, kind)
+        self.sim.schedule(tx.end, self.lora_finish, tx)
+
+    def lora_finish(self, tx):
+        sender = tx.board
+        if sender.lib is tx.lib and not sender.dead:
+            sender.lib.simLoraTransmitDone()
+            for receiver in self.neighbours[sender.id]:
+                board = self.boards[receiver]
+                if board.running(self.sim.now) and self.lora_received(board, tx):
+                    snr = self.link_snr[(sender.id, receiver)]
+                    if not board.lib.simLoraReceive(tx.data, len(tx.data), snr, NOISE_FLOOR + snr):
+                        self.stats.overruns += 1
+                    elif receiver == tx.dst:
+                        self.received_frames.add(tx.key)
+        self.forget_old(self.sim.now - 2 * time_on_air(LORA_MAX_PACKET_LENGTH, 12))
+
+    def lora_received(self, board, tx):
+        # the receiver listens at another SF or transmits, or the link is too weak for this SF
+        sender = tx.board.id
+        if board.lib.simLoraListening() != tx.sf or self.link_snr[(sender, board.id)] < snr_floor(tx.sf):
+            return False
+        for other in self.active:
+            if other is tx or other.end <= tx.start or other.start >= tx.end:
+                continue
+            # half duplex, a transmitting board hears nothing
+            if other.board is board:
+                return False
+            if other.board.id in self.neighbours[board.id] or other.board is tx.board:
+                if self.config.capture and other.start - tx.start >= preamble_time(tx.sf):
+                    continue
+                self.collisions += 1
+                return False
+        return self.sim.rng.random() >= self.config.loss
+
+    # ESP-NOW
+
+    def run_espnow(self, duration):
+        sim = self.sim
+        while sim.events and sim.next_event() <= duration:
+            sim.now = sim.next_event()
+            sim.run_due()
+        sim.now = duration
+
+    def espnow_poll(self, board):
+        if board.dead or board.lib is None:
+            return
+        board.lib.simSetMillis(board.clock(self.sim.now))
+        wait = board.lib.simEspNowPoll()
+        self.espnow_kick(board)
+        self.sim.schedule(self.sim.now + max(wait, 1) / 1000.0, self.espnow_poll, board)
+
+    def espnow_kick(self, board):
+        """Put the next frame of the driver's TX queue on air."""
+        if board.id == 0:
+            self.collect_uplink()
+        if board.sending is not None:
+            return
+        length = board.lib.simEspNowPending(self.peer, self.frame)
+        if length > 0:
+            dst = self.peer.raw
+            board.sending = (None if dst == b"\xff" * MAC_ADDR_LENGTH else mac_node(dst), self.frame.raw[:length])
+            self.espnow_contend(board)
+
+    def busy_until(self, board):
+        ends = [t.end for t in self.active if t.board is board or t.board.id in self.neighbours[board.id]]
+        return max(ends, default=0.0)
+
+    def espnow_contend(self, board):
+        # carrier sense, wait for the channel to be idle plus a random backoff
+        idle = max(self.sim.now, self.busy_until(board))
+        backoff = ESPNOW_DIFS + self.sim.rng.randint(0, ESPNOW_CONTENTION_WINDOW) * ESPNOW_SLOT
+        self.sim.schedule(idle + backoff, self.espnow_access, board)
+
+    def espnow_access(self, board):
+        if board.dead or board.sending is None:
+            return
+        if self.busy_until(board) > self.sim.now:
+            self.espnow_contend(board)
+            return
+        dst, data = board.sending
+        tx = Transmission(board, self.sim.now, self.sim.now + espnow_time_on_air(len(data)), data, None, dst)
+        origin, seq, hops = ctypes.create_string_buffer(MAC_ADDR_LENGTH), ctypes.c_uint16(), ctypes.c_uint8()
+        is_data = libraries.helpers.simEspNowFrameInfo(data, len(data), origin, ctypes.byref(seq), ctypes.byref(hops))
+        self.stats.data_frames += is_data
+        self.record(tx, "data" if is_data else "route")
+        self.sim.schedule(tx.end, self.espnow_finish, tx)
+
+    def espnow_finish(self, tx):
+        sender = tx.board
+        self.forget_old(self.sim.now - 0.01)
+        if sender.lib is not tx.lib or sender.dead:
+            return
+        delivered = False
+        for receiver in self.neighbours[sender.id]:
+            board = self.boards[receiver]
+            if tx.dst is not None and tx.dst != receiver:
+                continue
+            attempts = 1 if tx.dst is None else ESPNOW_MAC_RETRIES + 1
+            if board.running(self.sim.now) and any(self.sim.rng.random() >= self.config.loss for _ in range(attempts)):
+                delivered = True
+                board.lib.simSetMillis(board.clock(self.sim.now))
+                board.lib.simEspNowReceive(sender.mac, tx.data, len(tx.data))
+                self.espnow_kick(board)
+        # the send callback, after the MAC retries
+        sender.lib.simSetMillis(sender.clock(self.sim.now))
+        sender.lib.simEspNowSendDone(delivered)
+        sender.sending = None
+        self.espnow_kick(sender)
+
+    # the run
+
+    def sample(self):
+        """Queue depths and routes, once a second."""
+        connected = 0
+        for board in self.boards:
+            if not board.running(self.sim.now):
+                continue
+            board.depth_samples.append(board.lib.simLoraQueueDepth() if self.lora else board.lib.simEspNowQueueDepth())
+            if board.id in self.reachable:
+                connected += (not board.lib.simLoraIsolated()) if self.lora else board.lib.simEspNowConnected()
+        self.connected.append((self.sim.now, connected, len(self.reachable)))
+        self.sim.schedule(self.sim.now + 1.0, self.sample)
+
+    def run(self):
+        config = self.config
+        for board in self.boards:
+            self.sim.schedule(board.boot, self.boot, board)
+        if config.kill:
+            self.sim.schedule(config.duration / 2, self.kill)
+        if config.master_outage:
+            self.sim.schedule(config.duration / 2, self.master_down)
+        self.sim.schedule(1.0, self.sample)
+        if self.lora:
+            self.run_lora(config.duration)
+        else:
+            self.run_espnow(config.duration)
+        if self.boards[0].running(self.sim.now):
+            self.collect_uplink()
+            self.stats.duplicates += self.boards[0].lib.simDuplicates()
+        return self
+
+
+def preamble_time(sf):
+    # LORA_PREAMBLE_LENGTH symbols plus the sync word, LORA_BANDWIDTH
+    return (12 + 4.25) * (2 ** sf) / 812.5e3
+
+
+def build_topology(kind, nodes, rng, radius):
+    """Neighbour sets, node 0 is the master."""
+    neighbours = [set() for _ in range(nodes)]
+
+    def link(a, b):
+        neighbours[a].add(b)
+        neighbours[b].add(a)
+
+    if kind == "line":
+        for i in range(1, nodes):
+            link(i - 1, i)
+    elif kind == "grid":
+        side = math.ceil(math.sqrt(nodes))
+        for i in range(nodes):
+            if i % side + 1 < side and i + 1 < nodes:
+                link(i, i + 1)
+            if i + side < nodes:
+                link(i, i + side)
+    else:
+        # scatter nodes over a square sized for roughly the same density at any count
+        side = math.sqrt(nodes)
+        points = [(rng.uniform(0, side), rng.uniform(0, side)) for _ in range(nodes)]
+        # the master sits in the middle of the deployment
+        points[0] = (side / 2, side / 2)
+        for a in range(nodes):
+            for b in range(a + 1, nodes):
+                if math.dist(points[a], points[b]) <= radius:
+                    link(a, b)
+    return neighbours
+
+
+def hop_counts(neighbours):
+    hops = {0: 0}
+    frontier = [0]
+    while frontier:
+        following = []
+        for node in frontier:
+            for neighbour in neighbours[node]:
+                if neighbour not in hops:
+                    hops[neighbour] = hops[node] + 1
+                    following.append(neighbour)
+        frontier = following
+    return hops
+
+
+def percentile(values, fraction):
+    if not values:
+        return float("nan")
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def simulate(config, topology, nodes, firmware=None):
+    return Network(config, topology, nodes, firmware or libraries.node).run()
+
+
+def delivery_ratio(config, net):
+    """Delivered share of the readings reachable nodes took up to SETTLE_TIME before the end, in %."""
+    settle = config.duration - SETTLE_TIME
+    taken = [key for key, at in net.stats.created.items() if at <= settle and key[0] in net.reachable]
+    return 100.0 * sum(1 for key in taken if key in net.stats.delivered) / max(len(taken), 1)
+
+
+def report(config, net):
+    stats = net.stats
+    hops = hop_counts(net.neighbours)
+    delivered = len(stats.delivered)
+    print(f"protocol {config.protocol}, {len(net.boards)} nodes, {config.duration:.0f} s simulated, "
+          f"max hops {max(hops.values())}, {len(net.neighbours) - len(hops)} unreachable")
+    print(f"readings generated {stats.generated}, delivered {delivered} "
+          f"({100.0 * delivered / max(stats.generated, 1):.1f} %, {delivery_ratio(config, net):.1f} % of those taken "
+          f"by reachable nodes until {SETTLE_TIME:.0f} s before the end), duplicates {stats.duplicates} dropped by "
+          f"DedupWindow, {stats.passed_duplicates} passed to the host")
+    print(f"throughput {delivered / config.duration:.2f} readings/s")
+    print(f"latency p50 {percentile(stats.latencies, 0.5):.2f} s, p90 {percentile(stats.latencies, 0.9):.2f} s, "
+          f"p99 {percentile(stats.latencies, 0.99):.2f} s")
+    print(f"frames sent {net.frames}, collisions {net.collisions}, overruns {stats.overruns}, "
+          f"data frames {stats.data_frames}")
+    if net.lora:
+        print(f"retransmissions {stats.retransmissions}, of them {stats.spurious} of frames the receiver already had")
+    frames = libraries.gateway.uplinkDecoderFrames(net.decoder)
+    errors = libraries.gateway.uplinkDecoderErrors(net.decoder)
+    print(f"serial uplink {stats.uplink_bytes} bytes in {frames} frames, "
+          f"{stats.uplink_bytes / max(delivered, 1):.1f} bytes per delivered reading, {errors} errors")
+    nodes = [board for board in net.boards[1:] if board.lib is not None]
+    print(f"backlog: {sum(board.lib.simBacklogCount() for board in nodes)} readings still held, "
+          f"{sum(board.lib.simBacklogDropped() for board in nodes)} lost")
+    if net.lora:
+        spreading = collections.Counter(board.sf for board in net.boards if board.lib is not None)
+        print(f"airtime {net.airtime_total:.1f} s, {1000.0 * net.airtime_total / max(delivered, 1):.1f} ms "
+              f"per delivered reading, boards per SF at the end "
+              + ", ".join(f"SF{sf}: {count}" for sf, count in sorted(spreading.items())))
+        print("trickle: discovery sent {} suppressed {}, adverts sent {} suppressed {}".format(
+            *(sum(board.lib.simTrickleTransmitted(discovery) if sent else board.lib.simTrickleSuppressed(discovery)
+                  for board in nodes) for discovery in (True, False) for sent in (True, False))))
+        report_formation(config, net)
+
+    if config.per_node:
+        print("node  hops  delivered  mean depth  max depth")
+        for board in net.boards:
+            received = sum(1 for origin, _ in stats.delivered if origin == board.id)
+            depths = board.depth_samples or [0]
+            print(f"{board.id:4d}  {hops.get(board.id, -1):4d}  {received:9d}  {statistics.mean(depths):10.1f}  "
+                  f"{max(depths):9d}")
+    else:
+        depths = [max(board.depth_samples or [0]) for board in net.boards]
+        print(f"queue depth max per node: mean {statistics.mean(depths):.1f}, worst {max(depths)}")
+
+
+def formation_time(net, since):
+    """Seconds from since until every reachable node has a route, None if never."""
+    for at, connected, reachable in net.connected:
+        if at >= since and connected == reachable:
+            return at - since
+    return None
+
+
+def formation_phases(config):
+    """When the network forms: at boot, and once the master is back from an outage."""
+    phases = [("boot", 0.0)]
+    if config.master_outage:
+        phases.append(("master back", config.duration / 2 + config.master_outage))
+    return phases
+
+
+def discovery_occupancy(net, since):
+    """Discovery and reply airtime in the FORMATION_WINDOW from the bin of since, in % of it, summed over the senders."""
+    first = int(since // OCCUPANCY_BIN)
+    bins = [net.occupancy[b] for b in range(first, first + int(FORMATION_WINDOW // OCCUPANCY_BIN)) if b in net.occupancy]
+    return 100.0 * sum(b[DISCOVERY_MESSAGE] + b[DISCOVERY_REPLY_MESSAGE] for b in bins) / FORMATION_WINDOW
+
+
+def report_formation(config, net):
+    """Channel occupancy by frame type while the network forms, and after a master reboot."""
+    discovery = sum(bins[DISCOVERY_MESSAGE] + bins[DISCOVERY_REPLY_MESSAGE] for bins in net.occupancy.values())
+    print(f"discovery airtime {discovery:.1f} s, {100.0 * discovery / max(net.airtime_total, 1e-9):.1f} % "
+          f"of all, {100.0 * discovery / config.duration:.2f} % of the run")
+    phases = formation_phases(config)
+    for name, since in phases:
+        formed = formation_time(net, since)
+        print(f"{name} at {since:.0f} s, discovery took {discovery_occupancy(net, since):.1f} % of the channel "
+              f"over {FORMATION_WINDOW:.0f} s, all reachable nodes connected "
+              + ("never" if formed is None else f"after {formed:.0f} s"))
+    print("airtime in % of each bin, summed over the senders")
+    print("     time  discovery  disc reply   data+ack  connected")
+    connected = {int(at): count for at, count, _ in net.connected}
+    shown = []
+    for since in [since for _, since in phases] + [config.duration / 2] * bool(config.master_outage):
+        first = int(since // OCCUPANCY_BIN)
+        shown += [b for b in range(first, first + 6) if b not in shown and b * OCCUPANCY_BIN < config.duration]
+    for b in sorted(shown):
+        bins = net.occupancy.get(b, collections.Counter())
+        data = sum(airtime for kind, airtime in bins.items()
+                   if kind in (DATA_MESSAGE, DATA_REPLY_MESSAGE, STATS_MESSAGE))
+        end = int((b + 1) * OCCUPANCY_BIN)
+        print(f"{int(b * OCCUPANCY_BIN):4d}-{end:<4d}  {100.0 * bins[DISCOVERY_MESSAGE] / OCCUPANCY_BIN:8.1f}  "
+              f"{100.0 * bins[DISCOVERY_REPLY_MESSAGE] / OCCUPANCY_BIN:10.1f}  {100.0 * data / OCCUPANCY_BIN:9.1f}  "
+              f"{connected.get(end - 1, connected.get(end, 0)):9d}")
+
+
+def sweep_hops(config):
+    """Throughput of a line of relays, readings and data frames per second at the master."""
+    print("hops  readings/s  latency p50  data frames  retransmissions  duplicates")
+    for hop in range(1, config.sweep_hops + 1):
+        net = simulate(config, "line", hop + 1)
+        stats = net.stats
+        print(f"{hop:4d}  {len(stats.delivered) / config.duration:10.2f}  "
+              f"{percentile(stats.latencies, 0.5):9.2f} s  {stats.data_frames:11d}  "
+              f"{stats.retransmissions:15d}  {stats.duplicates:10d}")
+
+
+def sweep_density(config):
+    """Forwarded ESP-NOW data frames per delivered reading as the random topology gets denser."""
+    print("radius  neighbours  frames/reading  delivered")
+    steps = 5
+    low, high = config.sweep_density
+    for step in range(steps):
+        config.radius = low + (high - low) * step / (steps - 1)
+        net = simulate(config, "random", config.nodes)
+        delivered = len(net.stats.delivered)
+        density = statistics.mean(len(near) for near in net.neighbours)
+        print(f"{config.radius:6.2f}  {density:10.1f}  {net.stats.data_frames / max(delivered, 1):14.2f}  "
+              f"{100.0 * delivered / max(net.stats.generated, 1):7.1f} %")
+
+
+def compare_timeouts(config):
+    """The same run with RttEstimator and with the fixed data timeout, returns the failures."""
+    if not os.path.exists(libraries.fixed_timeout):
+        sys.exit(f"{libraries.fixed_timeout} not found, build it with\n"
+                 "    cmake --build build --target mesh_sim_fixed_timeout")
+    print("timeout       delivered  data frames  retransmissions  of frames already received")
+    spurious = {}
+    for name, firmware in (("fixed 1000 ms", libraries.fixed_timeout), ("RttEstimator", libraries.node)):
+        net = simulate(config, config.topology, config.nodes, firmware)
+        stats = net.stats
+        spurious[name] = stats.spurious
+        print(f"{name:13s}  {delivery_ratio(config, net):6.1f} %  {stats.data_frames:11d}  "
+              f"{stats.retransmissions:15d}  {stats.spurious:26d}")
+    if spurious["RttEstimator"] >= spurious["fixed 1000 ms"]:
+        return [f"RttEstimator resent {spurious['RttEstimator']} frames their receiver already had, "
+                f"the fixed timeout {spurious['fixed 1000 ms']}"]
+    return []
+
+
+def check(config, net):
+    """The thresholds given on the command line, returns the ones missed."""
+    failures = []
+    ratio = delivery_ratio(config, net)
+    if config.min_delivery is not None and ratio < config.min_delivery:
+        failures.append(f"delivery {ratio:.1f} % below {config.min_delivery:.1f} %")
+    if config.max_duplicates is not None and net.stats.passed_duplicates > config.max_duplicates:
+        failures.append(f"{net.stats.passed_duplicates} readings reached the host twice, "
+                        f"at most {config.max_duplicates} allowed")
+    for name, since in formation_phases(config):
+        occupancy = discovery_occupancy(net, since)
+        if config.max_discovery_occupancy is not None and occupancy > config.max_discovery_occupancy:
+            failures.append(f"discovery took {occupancy:.1f} % of the channel after {name}, "
+                            f"at most {config.max_discovery_occupancy:.1f} % allowed")
+    return failures
+
+
+def main():
+    global libraries
+    parser = argparse.ArgumentParser(description="Discrete-event simulator for the LoRa and ESP-NOW mesh")
+    parser.add_argument("--protocol", choices=["lora", "espnow"], default="lora")
+    parser.add_argument("--topology", choices=["line", "grid", "random"], default="grid")
+    parser.add_argument("--nodes", type=int, default=25, help="number of nodes including the master")
+    parser.add_argument("--radius", type=float, default=1.5, help="radio range for the random topology")
+    parser.add_argument("--loss", type=float, default=0.05, help="independent loss probability per link")
+    parser.add_argument("--capture", action="store_true", help="the first of two overlapping frames survives")
+    parser.add_argument("--duration", type=float, default=600.0, help="simulated seconds")
+    parser.add_argument("--reading-interval", type=float,
+                        help=f"seconds between the readings of a node, {LORA_READING_INTERVAL:.0f} for LoRa and "
+                             f"{ESPNOW_READING_INTERVAL:.0f} for ESP-NOW by default")
+    parser.add_argument("--snr", type=float, nargs=2, default=[0.0, 10.0], metavar=("MIN", "MAX"),
+                        help="range of the per link SNR in dB")
+    parser.add_argument("--kill", type=int, default=0, help="nodes powered off halfway through the run")
+    parser.add_argument("--master-outage", type=float, default=0.0,
+                        help="master down for this many seconds halfway through the run, then booted again")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--native", help="path of libmesh_sim.so, else MESH_SIM_LIB or build/ and _gate_build/")
+    parser.add_argument("--per-node", action="store_true", help="print a line per node")
+    parser.add_argument("--sweep-hops", type=int, default=0, help="run lines of 1..N hops and print a table")
+    parser.add_argument("--sweep-density", type=float, nargs=2, metavar=("MIN", "MAX"),
+                        help="run random topologies over this range of radii and print a table")
+    parser.add_argument("--min-delivery", type=float,
+                        help="fail below this delivered share in %% of the readings reachable nodes took")
+    parser.add_argument("--max-duplicates", type=int, help="fail if more readings reach the host twice")
+    parser.add_argument("--max-discovery-occupancy", type=float,
+                        help=f"fail if discovery and its replies take more of the channel in %% in the "
+                             f"{FORMATION_WINDOW:.0f} s after boot or after the master is back, LoRa only")
+    parser.add_argument("--compare-timeouts", action="store_true",
+                        help="run LoRa with RttEstimator and with the fixed data timeout, fail unless "
+                             "RttEstimator resends fewer frames their receiver already had")
+    config = parser.parse_args()
+    if config.reading_interval is None:
+        config.reading_interval = LORA_READING_INTERVAL if config.protocol == "lora" else ESPNOW_READING_INTERVAL
+    libraries = Libraries(config.native)
+
+    failures = []
+    if config.sweep_hops > 0:
+        sweep_hops(config)
+    elif config.sweep_density:
+        sweep_density(config)
+    elif config.compare_timeouts:
+        config.protocol = "lora"
+        failures = compare_timeouts(config)
+    else:
+        net = simulate(config, config.topology, config.nodes)
+        report(config, net)
+        failures = check(config, net)
+    for failure in failures:
+        print(f"FAILED: {failure}")
+    if failures:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
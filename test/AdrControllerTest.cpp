@@ -0,0 +1,187 @@
+#include <catch2/catch.hpp>
+
+#include <AdrController.h>
+
+#include <vector>
+
+// the MAC of a node, valid until the next call
+static const uint8_t* childOf(int id) {
+  static uint8_t mac[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x00 };
+  mac[5] = id;
+  return mac;
+}
+
+TEST_CASE("the SF keeps the margin above the demodulation floor", "[AdrController]") {
+  REQUIRE(AdrController::snrFloor(5) == -2.5f);
+  REQUIRE(AdrController::snrFloor(12) == -20.0f);
+  for (uint8_t sf = ADR_MIN_SF; sf < ADR_MAX_SF; sf++) {
+    float snr = AdrController::snrFloor(sf) + ADR_MARGIN_DB;
+    REQUIRE(AdrController::requiredSF(snr) == sf);
+    REQUIRE(AdrController::requiredSF(snr - 0.1f) == sf + 1);
+  }
+  REQUIRE(AdrController::requiredSF(30.0f) == ADR_MIN_SF);
+  // below the margin even at SF12 there is nothing better
+  REQUIRE(AdrController::requiredSF(-25.0f) == ADR_MAX_SF);
+}
+
+TEST_CASE("a child needing more is served after the switch delay", "[AdrController]") {
+  AdrController adr(7);
+  adr.reportChild(childOf(1), 7, 0);
+  adr.reportChild(childOf(2), 9, 0);
+  REQUIRE(adr.childrenSF(0) == 9);
+
+  adr.decide(1000);
+  REQUIRE(adr.target() == 9);
+  REQUIRE(adr.current() == 7);
+  REQUIRE(adr.switchIn(1000) == ADR_SWITCH_DELAY);
+  REQUIRE(adr.switchDue(1000 + ADR_SWITCH_DELAY - 1) == 0);
+  REQUIRE(adr.switchIn(1000 + ADR_SWITCH_DELAY - 1) == 1);
+  REQUIRE(adr.switchDue(1000 + ADR_SWITCH_DELAY) == 9);
+  REQUIRE(adr.current() == 9);
+  REQUIRE(adr.switchDue(1000 + ADR_SWITCH_DELAY + 1) == 0);
+  REQUIRE(adr.switchIn(1000 + ADR_SWITCH_DELAY) == 0);
+
+  SECTION("a decision again does not push the switch back") {
+    AdrController other(7);
+    other.reportChild(childOf(1), 9, 0);
+    other.decide(0);
+    other.decide(10000);
+    REQUIRE(other.switchIn(10000) == ADR_SWITCH_DELAY - 10000);
+  }
+}
+
+TEST_CASE("the SF is lowered only once the reports allowed it for the hold", "[AdrController]") {
+  AdrController adr(10);
+  unsigned long now = 0;
+  adr.reportChild(childOf(1), 7, now);
+  adr.decide(now);
+  REQUIRE(adr.target() == 10);
+
+  SECTION("allowed throughout") {
+    for (now = 10000; now < ADR_LOWER_HOLD; now += 10000) {
+      adr.reportChild(childOf(1), 7, now);
+      adr.decide(now);
+      REQUIRE(adr.target() == 10);
+    }
+    adr.decide(ADR_LOWER_HOLD);
+    REQUIRE(adr.target() == 7);
+    REQUIRE(adr.switchIn(ADR_LOWER_HOLD) == ADR_SWITCH_DELAY);
+  }
+
+  SECTION("a report for the current SF starts the hold over") {
+    adr.reportChild(childOf(1), 10, 30000);
+    adr.decide(30000);
+    adr.reportChild(childOf(1), 7, 40000);
+    adr.decide(40000);
+    adr.reportChild(childOf(1), 7, 40000 + ADR_LOWER_HOLD - 1);
+    adr.decide(40000 + ADR_LOWER_HOLD - 1);
+    REQUIRE(adr.target() == 10);
+    adr.decide(40000 + ADR_LOWER_HOLD);
+    REQUIRE(adr.target() == 7);
+  }
+
+  SECTION("a raise in between is taken at once") {
+    adr.reportChild(childOf(2), 11, 30000);
+    adr.decide(30000);
+    REQUIRE(adr.target() == 11);
+  }
+}
+
+TEST_CASE("a quiet child asks for SF12, then is forgotten", "[AdrController]") {
+  AdrController adr(7);
+  adr.reportChild(childOf(1), 7, 0);
+  REQUIRE(adr.childrenSF(ADR_CHILD_TIMEOUT - 1) == 7);
+  REQUIRE(adr.childrenSF(ADR_CHILD_TIMEOUT) == ADR_MAX_SF);
+  REQUIRE(adr.childrenSF(ADR_CHILD_TIMEOUT + ADR_LOST_HOLD - 1) == ADR_MAX_SF);
+  REQUIRE(adr.childrenSF(ADR_CHILD_TIMEOUT + ADR_LOST_HOLD) == 0);
+
+  // without children the master listens where new nodes start
+  adr.decide(ADR_CHILD_TIMEOUT + ADR_LOST_HOLD);
+  REQUIRE(adr.target() == ADR_MAX_SF);
+}
+
+TEST_CASE("the subtree SF is the highest of the uplink's and the children's", "[AdrController]") {
+  AdrController adr(7);
+  // the uplink is unknown until the first reply
+  REQUIRE(adr.subtreeSF(0) == ADR_MAX_SF);
+  adr.reportUplink(AdrController::snrFloor(6) + ADR_MARGIN_DB);
+  REQUIRE(adr.subtreeSF(0) == 6);
+  adr.reportChild(childOf(1), 8, 0);
+  REQUIRE(adr.subtreeSF(0) == 8);
+  // out of range reports count as the slowest SF
+  adr.reportChild(childOf(2), 3, 0);
+  REQUIRE(adr.subtreeSF(0) == ADR_MAX_SF);
+}
+
+TEST_CASE("lost acks climb the SF a step at a time", "[AdrController]") {
+  AdrController adr(7);
+  adr.reportUplink(20.0f);
+  REQUIRE(adr.subtreeSF(0) == ADR_MIN_SF);
+
+  // one is not enough, from the current SF up
+  adr.uplinkTimeout();
+  REQUIRE(adr.subtreeSF(0) == ADR_MIN_SF);
+  adr.uplinkTimeout();
+  REQUIRE(adr.subtreeSF(0) == 8);
+
+  // a reply in between starts the count over
+  adr.uplinkTimeout();
+  adr.reportUplink(20.0f);
+  adr.uplinkTimeout();
+  REQUIRE(adr.subtreeSF(0) == ADR_MIN_SF);
+
+  for (int i = 0; i < 20 * ADR_TIMEOUTS_PER_STEP; i++) {
+    adr.uplinkTimeout();
+  }
+  REQUIRE(adr.subtreeSF(0) == ADR_MAX_SF);
+}
+
+TEST_CASE("the parent's announcement is followed at its time", "[AdrController]") {
+  AdrController adr(7);
+  adr.announce(9, 12000, 1000);
+  REQUIRE(adr.target() == 9);
+  REQUIRE(adr.switchIn(1000) == 12000);
+  // repeated by later replies with less time left, the switch stays put
+  adr.announce(9, 2000, 11000);
+  REQUIRE(adr.switchIn(11000) == 2000);
+  REQUIRE(adr.switchDue(12999) == 0);
+  REQUIRE(adr.switchDue(13000) == 9);
+
+  // nonsense is ignored
+  adr.announce(13, 0, 14000);
+  adr.announce(4, 0, 14000);
+  REQUIRE(adr.target() == 9);
+}
+
+TEST_CASE("an isolated node scans the SFs, dwelling at SF12", "[AdrController]") {
+  AdrController adr(10);
+  std::vector<uint8_t> switches;
+  int attempts = 0;
+  while (switches.size() < 4) {
+    attempts++;
+    uint8_t sf = adr.discoveryFailed();
+    if (sf != 0) {
+      switches.push_back(sf);
+      REQUIRE(adr.current() == sf);
+      REQUIRE(adr.target() == sf);
+    }
+  }
+  REQUIRE(switches == std::vector<uint8_t>({ 11, 12, ADR_MIN_SF, 6 }));
+  REQUIRE(attempts == 3 * ADR_SCAN_ATTEMPTS + ADR_SCAN_HOME_ATTEMPTS);
+  // the next parent's link is unknown
+  REQUIRE(adr.subtreeSF(0) == ADR_MAX_SF);
+}
+
+TEST_CASE("a full child table forgets the child heard from least recently", "[AdrController]") {
+  AdrController adr(7);
+  for (int id = 0; id < ADR_CHILDREN; id++) {
+    adr.reportChild(childOf(id), id == 0 ? 11 : 7, 1000 + id);
+  }
+  REQUIRE(adr.childrenSF(2000) == 11);
+  adr.reportChild(childOf(ADR_CHILDREN), 8, 3000);
+  REQUIRE(adr.childrenSF(3000) == 8);
+  // its own entry is updated, not a second one taken
+  adr.reportChild(childOf(ADR_CHILDREN), 9, 3000);
+  adr.reportChild(childOf(ADR_CHILDREN), 7, 3000);
+  REQUIRE(adr.childrenSF(3000) == 7);
+}
@@ -0,0 +1,67 @@
+#include "AllocCounter.h"
+
+#include <stdlib.h>
+#include <cstddef>
+#include <new>
+
+static size_t allocations = 0;
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+// the size is kept in front of the block, so delete knows what it frees
+static const size_t HEADER = alignof(std::max_align_t);
+
+static void* countedAlloc(size_t size) {
+  unsigned char* block = (unsigned char*)malloc(size + HEADER);
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  *(size_t*)block = size;
+  allocations++;
+  liveBytes += size;
+  if (liveBytes > peakBytes) {
+    peakBytes = liveBytes;
+  }
+  return block + HEADER;
+}
+
+static void countedFree(void* pointer) {
+  if (pointer == NULL) {
+    return;
+  }
+  unsigned char* block = (unsigned char*)pointer - HEADER;
+  liveBytes -= *(size_t*)block;
+  free(block);
+}
+
+void* operator new(size_t size) {
+  return countedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+  return countedAlloc(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  countedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  countedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  countedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  countedFree(pointer);
+}
+
+AllocStats allocStats() {
+  return { allocations, liveBytes, peakBytes };
+}
+
+void resetAllocPeak() {
+  peakBytes = liveBytes;
+}
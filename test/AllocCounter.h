@@ -0,0 +1,24 @@
+/** Alloc Counter
+ *  Replaces the global operator new and delete of a host test or benchmark
+ *  that links AllocCounter.cpp, counting every heap allocation and the
+ *  bytes live at once. Code under test that must not touch the heap is
+ *  run between two snapshots.
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stddef.h>
+
+typedef struct AllocStats {
+  size_t allocations;  // calls to operator new since start
+  size_t liveBytes;
+  size_t peakBytes;    // highest liveBytes since the last resetAllocPeak()
+} AllocStats;
+
+AllocStats allocStats();
+
+// the peak starts again from the bytes live now
+void resetAllocPeak();
+
+#endif  // ALLOC_COUNTER_H
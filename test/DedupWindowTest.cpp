@@ -0,0 +1,142 @@
+#include <catch2/catch.hpp>
+
+#include <DedupWindow.h>
+
+#include <random>
+#include <set>
+
+// the MAC of a node, valid until the next call
+static const uint8_t* originOf(int id) {
+  static uint8_t mac[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x00 };
+  mac[4] = id >> 8;
+  mac[5] = id;
+  return mac;
+}
+
+TEST_CASE("copies of a reading are passed on once", "[DedupWindow]") {
+  DedupWindow dedup;
+  REQUIRE(dedup.check(originOf(1), 10) == DEDUP_NEW);
+  REQUIRE(dedup.check(originOf(1), 10) == DEDUP_DUPLICATE);
+  REQUIRE(dedup.check(originOf(2), 10) == DEDUP_NEW);
+  REQUIRE(dedup.check(originOf(1), 12) == DEDUP_NEW);
+  // a reading that arrives late over the other path fills its gap
+  REQUIRE(dedup.check(originOf(1), 11) == DEDUP_NEW);
+  REQUIRE(dedup.check(originOf(1), 11) == DEDUP_DUPLICATE);
+  REQUIRE(dedup.check(originOf(1), 12) == DEDUP_DUPLICATE);
+  REQUIRE(dedup.check(originOf(2), 10) == DEDUP_DUPLICATE);
+
+  REQUIRE(dedup.getDuplicates() == 4);
+  REQUIRE(dedup.getUnchecked() == 0);
+  REQUIRE(dedup.getEvicted() == 0);
+}
+
+TEST_CASE("the seq wraps without losing the history", "[DedupWindow]") {
+  DedupWindow dedup;
+  for (uint16_t seq = 65500; seq != 40; seq++) {
+    REQUIRE(dedup.check(originOf(1), seq) == DEDUP_NEW);
+  }
+  // every seq from before and after the wrap is still known
+  for (uint16_t seq = 65500; seq != 40; seq++) {
+    REQUIRE(dedup.check(originOf(1), seq) == DEDUP_DUPLICATE);
+  }
+  REQUIRE(dedup.getDuplicates() == 76);
+  REQUIRE(dedup.getUnchecked() == 0);
+}
+
+TEST_CASE("the history ends at the window edge", "[DedupWindow]") {
+  DedupWindow dedup;
+  const uint16_t first = 1000;
+  REQUIRE(dedup.check(originOf(1), first) == DEDUP_NEW);
+
+  SECTION("a seq exactly at the edge is still known") {
+    REQUIRE(dedup.check(originOf(1), first + DEDUP_HISTORY_BITS - 1) == DEDUP_NEW);
+    REQUIRE(dedup.check(originOf(1), first) == DEDUP_DUPLICATE);
+    REQUIRE(dedup.getUnchecked() == 0);
+  }
+
+  SECTION("one just past it cannot be checked and is passed on") {
+    REQUIRE(dedup.check(originOf(1), first + DEDUP_HISTORY_BITS) == DEDUP_NEW);
+    REQUIRE(dedup.check(originOf(1), first) == DEDUP_UNCHECKED);
+    REQUIRE(dedup.check(originOf(1), first + 1) == DEDUP_NEW);
+    REQUIRE(dedup.check(originOf(1), first + 1) == DEDUP_DUPLICATE);
+    REQUIRE(dedup.getUnchecked() == 1);
+  }
+}
+
+TEST_CASE("the history slides like a set of recent seqs", "[DedupWindow]") {
+  // any step size, across and within the words of the bitmap
+  DedupWindow dedup;
+  std::mt19937 random(5);
+  std::set<uint32_t> seen;
+  uint32_t highest = 40000;
+  REQUIRE(dedup.check(originOf(1), highest) == DEDUP_NEW);
+  seen.insert(highest);
+  for (int i = 0; i < 20000; i++) {
+    uint32_t seq;
+    if (random() % 3 == 0) {
+      seq = highest + 1 + random() % (DEDUP_HISTORY_BITS + 40);
+    } else {
+      seq = highest - random() % DEDUP_HISTORY_BITS;
+    }
+    DedupResult expected = seen.count(seq) > 0 ? DEDUP_DUPLICATE : DEDUP_NEW;
+    REQUIRE(dedup.check(originOf(1), (uint16_t)seq) == expected);
+    seen.insert(seq);
+    highest = std::max(highest, seq);
+  }
+  REQUIRE(dedup.getUnchecked() == 0);
+}
+
+TEST_CASE("a restarted origin moves the window to its new seqs", "[DedupWindow]") {
+  DedupWindow dedup;
+  for (uint16_t seq = 5000; seq < 5010; seq++) {
+    dedup.check(originOf(1), seq);
+  }
+
+  SECTION("after a run of readings too far behind") {
+    for (uint16_t seq = 0; seq < DEDUP_RESTART_RUN - 1; seq++) {
+      REQUIRE(dedup.check(originOf(1), seq) == DEDUP_UNCHECKED);
+    }
+    REQUIRE(dedup.check(originOf(1), DEDUP_RESTART_RUN - 1) == DEDUP_NEW);
+    REQUIRE(dedup.getUnchecked() == DEDUP_RESTART_RUN - 1);
+
+    // the new seqs are checked from here on, the old ones are gone
+    REQUIRE(dedup.check(originOf(1), DEDUP_RESTART_RUN - 1) == DEDUP_DUPLICATE);
+    REQUIRE(dedup.check(originOf(1), DEDUP_RESTART_RUN) == DEDUP_NEW);
+    REQUIRE(dedup.check(originOf(1), DEDUP_RESTART_RUN) == DEDUP_DUPLICATE);
+    REQUIRE(dedup.check(originOf(1), 5009) == DEDUP_NEW);
+  }
+
+  SECTION("a reading inside the window breaks the run") {
+    for (int round = 0; round < 3; round++) {
+      for (uint16_t seq = 0; seq < DEDUP_RESTART_RUN - 1; seq++) {
+        REQUIRE(dedup.check(originOf(1), round * 100 + seq) == DEDUP_UNCHECKED);
+      }
+      REQUIRE(dedup.check(originOf(1), 5009) == DEDUP_DUPLICATE);
+    }
+    REQUIRE(dedup.getUnchecked() == 3 * (DEDUP_RESTART_RUN - 1));
+    REQUIRE(dedup.getDuplicates() == 3);
+  }
+}
+
+TEST_CASE("a full table forgets the origin heard from least recently", "[DedupWindow]") {
+  DedupWindow dedup;
+  for (int id = 0; id < DEDUP_ORIGINS; id++) {
+    REQUIRE(dedup.check(originOf(id), 100) == DEDUP_NEW);
+  }
+  REQUIRE(dedup.getEvicted() == 0);
+  // origin 0 is heard again, origin 1 is now the least recent
+  REQUIRE(dedup.check(originOf(0), 101) == DEDUP_NEW);
+
+  REQUIRE(dedup.check(originOf(DEDUP_ORIGINS), 100) == DEDUP_NEW);
+  REQUIRE(dedup.getEvicted() == 1);
+  REQUIRE(dedup.check(originOf(0), 100) == DEDUP_DUPLICATE);
+  REQUIRE(dedup.check(originOf(2), 100) == DEDUP_DUPLICATE);
+  REQUIRE(dedup.check(originOf(DEDUP_ORIGINS), 100) == DEDUP_DUPLICATE);
+
+  // a forgotten origin starts over, and takes the place of the next least recent
+  REQUIRE(dedup.check(originOf(1), 100) == DEDUP_NEW);
+  REQUIRE(dedup.getEvicted() == 2);
+  REQUIRE(dedup.check(originOf(3), 100) == DEDUP_NEW);
+  REQUIRE(dedup.getEvicted() == 3);
+  REQUIRE(dedup.getDuplicates() == 3);
+}
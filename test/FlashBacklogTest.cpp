@@ -0,0 +1,329 @@
+#include <catch2/catch.hpp>
+
+#include <FlashBacklog.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+typedef std::vector<TimeSeriesSample> Trace;
+
+// an indoor trace at a 5 s interval, the time tells the samples apart
+static const Trace& indoorTrace() {
+  static Trace trace;
+  if (trace.empty()) {
+    std::mt19937 random(7);
+    std::normal_distribution<float> noise(0, 1);
+    uint32_t time = 1000;
+    float c02 = 600, temperature = 24, humidity = 55;
+    for (int i = 0; i < 80000; i++) {
+      time += 5000 + random() % 4;
+      c02 += (600 - c02) * 0.01f + noise(random) * 2;
+      temperature += noise(random) * 0.003f;
+      humidity += noise(random) * 0.01f;
+      trace.push_back({ time, (uint16_t)(65000 + i), roundf(c02 + noise(random) * 5),
+                        temperature + noise(random) * 0.02f, humidity + noise(random) * 0.08f });
+    }
+  }
+  return trace;
+}
+
+// index of a sample in the trace
+static size_t indexOf(const TimeSeriesSample& sample) {
+  const Trace& trace = indoorTrace();
+  size_t i = std::lower_bound(trace.begin(), trace.end(), sample.time,
+                              [](const TimeSeriesSample& s, uint32_t time) { return s.time < time; })
+             - trace.begin();
+  REQUIRE(i < trace.size());
+  REQUIRE(trace[i].time == sample.time);
+  REQUIRE(trace[i].seq == sample.seq);
+  REQUIRE(sample.c02Data == roundf(trace[i].c02Data));
+  return i;
+}
+
+// a flash partition in a fresh directory, removed again with the case
+class Flash {
+public:
+  fs::FS fs;
+
+  Flash() {
+    char path[] = "/tmp/FlashBacklogTest.XXXXXX";
+    REQUIRE(mkdtemp(path) != NULL);
+    root = path;
+    fs.mount(root);
+  }
+
+  ~Flash() {
+    std::filesystem::remove_all(root);
+  }
+
+  // the segment files, in name order
+  std::vector<std::string> segments() const {
+    std::vector<std::string> names;
+    for (const auto& entry : std::filesystem::directory_iterator(root + FLASH_BACKLOG_DIR)) {
+      std::string name = entry.path().filename();
+      if (name != "cursor") {
+        names.push_back(entry.path());
+      }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+private:
+  std::string root;
+};
+
+// the RAM buffer of a node spilling into flash
+static TimeSeriesBuffer ram;
+static FlashBacklog* spillTarget = NULL;
+
+static bool spillToFlash(const uint8_t* block, uint16_t samples) {
+  return spillTarget->append(block, samples);
+}
+
+static void isolate(FlashBacklog& flash, size_t from, size_t to) {
+  spillTarget = &flash;
+  ram.setSpill(spillToFlash);
+  for (size_t i = from; i < to; i++) {
+    ram.append(indoorTrace()[i]);
+  }
+}
+
+TEST_CASE("spilled blocks rotate through segments and drain oldest first", "[FlashBacklog]") {
+  Flash flash;
+  FlashBacklog backlog;
+  REQUIRE(backlog.begin(flash.fs, BACKLOG_OLDEST_FIRST));
+  REQUIRE(backlog.isEmpty());
+  ram.clear();
+  uint32_t ramDropped = ram.getDropped();
+  isolate(backlog, 0, 30000);
+
+  REQUIRE(ram.getDropped() == ramDropped);
+  REQUIRE(backlog.getDropped() == 0);
+  REQUIRE(backlog.count() + ram.count() == 30000);
+  size_t segments = flash.segments().size();
+  REQUIRE(segments > 1);
+  REQUIRE(segments <= FLASH_BACKLOG_SEGMENTS);
+  // every sealed segment is full, one record per spilled block
+  for (size_t i = 0; i + 1 < segments; i++) {
+    REQUIRE(std::filesystem::file_size(flash.segments()[i])
+            == FLASH_BACKLOG_SEGMENT_BLOCKS * FLASH_BACKLOG_RECORD_LENGTH);
+  }
+
+  // flash then RAM give back the whole trace in order
+  TimeSeriesSample sample;
+  size_t next = 0;
+  while (backlog.pop(&sample) || ram.pop(&sample)) {
+    REQUIRE(indexOf(sample) == next++);
+  }
+  REQUIRE(next == 30000);
+  REQUIRE(backlog.isEmpty());
+  REQUIRE(flash.fs.bytesUsed() == 0);
+}
+
+TEST_CASE("segments past the limit drop the oldest history", "[FlashBacklog]") {
+  Flash flash;
+  FlashBacklog backlog;
+  REQUIRE(backlog.begin(flash.fs, BACKLOG_OLDEST_FIRST));
+  ram.clear();
+  uint32_t ramDropped = ram.getDropped();
+  isolate(backlog, 0, 80000);
+
+  REQUIRE(flash.segments().size() == FLASH_BACKLOG_SEGMENTS);
+  REQUIRE(flash.fs.bytesUsed() <= FLASH_BACKLOG_SEGMENTS * FLASH_BACKLOG_SEGMENT_BLOCKS * FLASH_BACKLOG_RECORD_LENGTH);
+  REQUIRE(ram.getDropped() == ramDropped);
+  REQUIRE(backlog.getDropped() > 0);
+  REQUIRE(backlog.count() + backlog.getDropped() + ram.count() == 80000);
+
+  // what is kept is the most recent history, without gaps
+  TimeSeriesSample sample;
+  size_t next = backlog.getDropped();
+  while (backlog.pop(&sample) || ram.pop(&sample)) {
+    REQUIRE(indexOf(sample) == next++);
+  }
+  REQUIRE(next == 80000);
+}
+
+TEST_CASE("newest first drains the latest segment first", "[FlashBacklog]") {
+  Flash flash;
+  FlashBacklog backlog;
+  REQUIRE(backlog.begin(flash.fs, BACKLOG_NEWEST_FIRST));
+  ram.clear();
+  isolate(backlog, 0, 30000);
+  size_t inFlash = backlog.count();
+
+  // blocks come newest first, the samples of a block oldest first
+  std::set<size_t> seen;
+  std::vector<size_t> blockStarts;
+  size_t previous = SIZE_MAX;
+  TimeSeriesSample sample;
+  while (backlog.pop(&sample)) {
+    size_t i = indexOf(sample);
+    REQUIRE(seen.insert(i).second);
+    if (previous == SIZE_MAX || i != previous + 1) {
+      blockStarts.push_back(i);
+    }
+    previous = i;
+  }
+  REQUIRE(seen.size() == inFlash);
+  REQUIRE(*seen.rbegin() + 1 == 30000 - ram.count());
+  REQUIRE(blockStarts.size() > 1);
+  for (size_t i = 1; i < blockStarts.size(); i++) {
+    REQUIRE(blockStarts[i] < blockStarts[i - 1]);
+  }
+  REQUIRE(flash.fs.bytesUsed() == 0);
+}
+
+TEST_CASE("a reboot continues draining where it left off", "[FlashBacklog]") {
+  BacklogReplay order = GENERATE(BACKLOG_OLDEST_FIRST, BACKLOG_NEWEST_FIRST);
+  Flash flash;
+  ram.clear();
+  std::set<size_t> seen;
+  TimeSeriesSample sample;
+  uint32_t before;
+  {
+    FlashBacklog backlog;
+    REQUIRE(backlog.begin(flash.fs, order));
+    isolate(backlog, 0, 30000);
+    for (int i = 0; i < 5000; i++) {
+      REQUIRE(backlog.pop(&sample));
+      REQUIRE(seen.insert(indexOf(sample)).second);
+    }
+    before = backlog.count();
+  }
+
+  FlashBacklog rebooted;
+  REQUIRE(rebooted.begin(flash.fs, order));
+  // the rest of the block in RAM is lost, nothing is repeated
+  REQUIRE(rebooted.count() <= before);
+  REQUIRE(before - rebooted.count() < TS_BLOCK_SIZE * 8 / 2);
+  uint32_t after = rebooted.count();
+  while (rebooted.pop(&sample)) {
+    REQUIRE(seen.insert(indexOf(sample)).second);
+  }
+  REQUIRE(seen.size() == 5000 + after);
+  if (order == BACKLOG_OLDEST_FIRST) {
+    REQUIRE(*seen.rbegin() + 1 == 30000 - ram.count());
+  }
+}
+
+TEST_CASE("a full partition fails the spill and the RAM buffer drops", "[FlashBacklog]") {
+  Flash flash;
+  flash.fs.setCapacity(20000);
+  FlashBacklog backlog;
+  REQUIRE(backlog.begin(flash.fs, BACKLOG_OLDEST_FIRST));
+  ram.clear();
+  uint32_t ramDropped = ram.getDropped();
+  isolate(backlog, 0, 30000);
+
+  REQUIRE(flash.fs.bytesUsed() <= 20000);
+  REQUIRE(ram.getDropped() > ramDropped);
+  REQUIRE(backlog.count() + ram.count() + ram.getDropped() - ramDropped == 30000);
+
+  // what made it to flash is intact and in order
+  flash.fs.setCapacity(0);
+  TimeSeriesSample sample;
+  size_t previous = 0;
+  size_t drained = 0;
+  size_t inFlash = backlog.count();
+  while (backlog.pop(&sample)) {
+    size_t i = indexOf(sample);
+    REQUIRE((drained == 0 || i > previous));
+    previous = i;
+    drained++;
+  }
+  REQUIRE(drained == inFlash);
+  REQUIRE(backlog.getDropped() == 0);
+}
+
+TEST_CASE("damaged records are dropped on the way back", "[FlashBacklog]") {
+  Flash flash;
+  ram.clear();
+  {
+    FlashBacklog backlog;
+    REQUIRE(backlog.begin(flash.fs, BACKLOG_OLDEST_FIRST));
+    isolate(backlog, 0, 3000);
+  }
+  std::vector<std::string> segments = flash.segments();
+  REQUIRE(segments.size() >= 2);
+  // a torn tail in the first segment, a flipped bit in the second
+  std::filesystem::resize_file(segments[0], 3 * FLASH_BACKLOG_RECORD_LENGTH + 100);
+  FILE* file = fopen(segments[1].c_str(), "r+b");
+  REQUIRE(file != NULL);
+  fseek(file, FLASH_BACKLOG_RECORD_HEADER + 40, SEEK_SET);
+  uint8_t byte = fgetc(file);
+  fseek(file, FLASH_BACKLOG_RECORD_HEADER + 40, SEEK_SET);
+  fputc(byte ^ 0x10, file);
+  fclose(file);
+
+  FlashBacklog rebooted;
+  REQUIRE(rebooted.begin(flash.fs, BACKLOG_OLDEST_FIRST));
+  uint32_t counted = rebooted.count();
+  TimeSeriesSample sample;
+  size_t drained = 0;
+  size_t previous = 0;
+  while (rebooted.pop(&sample)) {
+    size_t i = indexOf(sample);
+    REQUIRE((drained == 0 || i > previous));
+    previous = i;
+    drained++;
+  }
+  REQUIRE(rebooted.getDropped() > 0);
+  REQUIRE(drained + rebooted.getDropped() == counted);
+}
+
+TEST_CASE("a power cut at any point loses no more than it must", "[FlashBacklog]") {
+  BacklogReplay order = GENERATE(BACKLOG_OLDEST_FIRST, BACKLOG_NEWEST_FIRST);
+  // every commit, remove and mkdir of a spill and part of a drain in turn
+  for (unsigned long cut = 0;; cut++) {
+    INFO("power cut after " << cut << " operations");
+    Flash flash;
+    ram.clear();
+    std::set<size_t> seen;
+    TimeSeriesSample sample;
+    bool finished;
+    {
+      FlashBacklog backlog;
+      flash.fs.cutPowerAfter(cut);
+      if (backlog.begin(flash.fs, order) == true) {
+        spillTarget = &backlog;
+        ram.setSpill(spillToFlash);
+        for (size_t i = 0; i < 3000 && flash.fs.isPowered(); i++) {
+          ram.append(indoorTrace()[i]);
+        }
+        // the board is dead from the cut on, what it would pop then is never sent
+        for (int i = 0; i < 1500 && backlog.pop(&sample) && flash.fs.isPowered(); i++) {
+          REQUIRE(seen.insert(indexOf(sample)).second);
+        }
+      }
+      finished = flash.fs.isPowered();
+    }
+    flash.fs.powerOn();
+
+    // whatever survived reads back whole, and nothing comes twice
+    FlashBacklog rebooted;
+    REQUIRE(rebooted.begin(flash.fs, order));
+    uint32_t counted = rebooted.count();
+    size_t drained = 0;
+    size_t previous = 0;
+    while (rebooted.pop(&sample)) {
+      size_t i = indexOf(sample);
+      REQUIRE(seen.insert(i).second);
+      if (order == BACKLOG_OLDEST_FIRST) {
+        REQUIRE((drained == 0 || i > previous));
+      }
+      previous = i;
+      drained++;
+    }
+    REQUIRE(drained + rebooted.getDropped() == counted);
+    REQUIRE(flash.fs.bytesUsed() == 0);
+    if (finished) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,93 @@
+#include <catch2/catch.hpp>
+
+#include <JobScheduler.h>
+
+#include <utility>
+#include <vector>
+
+// the jobs log which of them ran when
+static std::vector<std::pair<char, unsigned long>> ran;
+
+static unsigned long jobA(unsigned long now) {
+  ran.push_back({ 'a', now });
+  return 300;
+}
+
+static unsigned long jobB(unsigned long now) {
+  ran.push_back({ 'b', now });
+  return 700;
+}
+
+static unsigned long jobC(unsigned long now) {
+  ran.push_back({ 'c', now });
+  return 1000;
+}
+
+// sleeps as long as poll() says, from..to
+static void run(JobScheduler& scheduler, unsigned long from, unsigned long to, unsigned long maxWait) {
+  unsigned long now = from;
+  while ((long)(to - now) > 0) {
+    now += scheduler.poll(now, maxWait);
+  }
+}
+
+TEST_CASE("jobs run at their deadlines, whatever their order in the table", "[JobScheduler]") {
+  ran.clear();
+  JobScheduler scheduler;
+  // added latest first
+  REQUIRE(scheduler.add(jobC, 500));
+  REQUIRE(scheduler.add(jobB, 200));
+  REQUIRE(scheduler.add(jobA, 100));
+
+  // nothing due yet, the wait is until the earliest deadline
+  REQUIRE(scheduler.poll(0, 5000) == 100);
+  REQUIRE(ran.empty());
+
+  run(scheduler, 0, 1601, 5000);
+  std::vector<std::pair<char, unsigned long>> expected = {
+    { 'a', 100 }, { 'b', 200 }, { 'a', 400 }, { 'c', 500 }, { 'a', 700 },
+    { 'b', 900 }, { 'a', 1000 }, { 'a', 1300 }, { 'c', 1500 }, { 'b', 1600 }, { 'a', 1600 },
+  };
+  // jobs due at the same poll run in table order
+  REQUIRE(ran == expected);
+}
+
+TEST_CASE("the wait is capped at maxWait", "[JobScheduler]") {
+  ran.clear();
+  JobScheduler scheduler;
+  scheduler.add(jobC, 1000);
+  REQUIRE(scheduler.poll(0, 250) == 250);
+  // a late poll runs the job once, from then on
+  REQUIRE(scheduler.poll(1400, 5000) == 1000);
+  REQUIRE(ran.size() == 1);
+  REQUIRE(ran[0].second == 1400);
+
+  SECTION("without jobs") {
+    scheduler.clear();
+    REQUIRE(scheduler.poll(2000, 250) == 250);
+  }
+}
+
+TEST_CASE("deadlines survive the millis() wrap", "[JobScheduler]") {
+  ran.clear();
+  JobScheduler scheduler;
+  unsigned long start = (unsigned long)-500;
+  scheduler.add(jobA, start + 200);
+  scheduler.add(jobB, start + 600);
+  REQUIRE(scheduler.poll(start, 5000) == 200);
+  run(scheduler, start, start + 1000, 5000);
+  std::vector<std::pair<char, unsigned long>> expected = {
+    { 'a', start + 200 }, { 'a', start + 500 }, { 'b', start + 600 }, { 'a', start + 800 },
+  };
+  REQUIRE(ran == expected);
+}
+
+TEST_CASE("a full table takes no more jobs", "[JobScheduler]") {
+  JobScheduler scheduler;
+  for (int i = 0; i < JOB_SCHEDULER_CAPACITY; i++) {
+    REQUIRE(scheduler.add(jobA, 0));
+  }
+  REQUIRE(scheduler.add(jobB, 0) == false);
+  scheduler.clear();
+  REQUIRE(scheduler.add(jobB, 0));
+}
@@ -0,0 +1,284 @@
+#include <catch2/catch.hpp>
+
+#include <LoraCommunication.h>
+
+#include "AllocCounter.h"
+
+static const uint8_t PARENT[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x0A };
+static const uint8_t CHILD[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x0C };
+static const uint8_t SELF[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x0B };
+
+static void receive(const LoraPacket& packet) {
+  radio.mockReceive(packet.data, packet.length);
+}
+
+static LoraPacket lastSent() {
+  LoraPacket packet;
+  packet.length = radio.sentLength;
+  memcpy(packet.data, radio.sent, radio.sentLength);
+  return packet;
+}
+
+// run the loop until nothing more goes on air, every frame sent ends right away
+static void settle() {
+  for (int i = 0; i < 20; i++) {
+    uint32_t sent = radio.sentCount;
+    loraLoop();
+    if (radio.transmitting == true) {
+      radio.mockTransmitDone();
+      loraLoop();
+    }
+    if (radio.sentCount == sent && loraIdle() == true) {
+      return;
+    }
+  }
+}
+
+static void joinParent() {
+  DiscoveryReplyMessage advert = {};
+  advert.requestType = DISCOVERY_REPLY_MESSAGE;
+  advert.level = 0;
+  memcpy(advert.MACaddr, PARENT, MAC_ADDR_LENGTH);
+  advert.spreadingFactor = LORA_SPREADING_FACTOR;
+  advert.quality = makeLinkQuality(10.0f, -60.0f);
+  LoraPacket packet;
+  serializeDRM(&advert, &packet);
+  receive(packet);
+  loraLoop();
+}
+
+// one relay round: a child's batch comes in, is acknowledged, merged and
+// forwarded, and the parent acknowledges the forwarded batch. Returns the
+// data frames that went to the parent.
+static int relayRound(uint16_t childEpoch, uint8_t childSeq, uint16_t readingSeq) {
+  LoraSensorData data = {};
+  data.requestType = DATA_MESSAGE;
+  memcpy(data.MACaddr, SELF, MAC_ADDR_LENGTH);
+  memcpy(data.senderMACaddr, CHILD, MAC_ADDR_LENGTH);
+  data.seq = childSeq;
+  data.epoch = childEpoch;
+  data.spreadingFactor = LORA_SPREADING_FACTOR;
+  data.readingCount = 2;
+  for (uint8_t i = 0; i < 2; i++) {
+    memcpy(data.readings[i].SMACaddr, CHILD, MAC_ADDR_LENGTH);
+    data.readings[i].seq = readingSeq + i;
+    data.readings[i].c02Data = 500;
+    data.readings[i].temperatureData = 28.0f;
+    data.readings[i].humidityData = 70.0f;
+  }
+  LoraPacket packet;
+  serializeSensorData(&data, &packet);
+  receive(packet);
+
+  int forwarded = 0;
+  for (int i = 0; i < 20; i++) {
+    loraLoop();
+    if (radio.transmitting == false) {
+      continue;
+    }
+    LoraPacket sent = lastSent();
+    radio.mockTransmitDone();
+    loraLoop();
+    if (getPacketType(&sent) == DATA_MESSAGE) {
+      forwarded++;
+      SensorDataReply reply = {};
+      reply.requestType = DATA_REPLY_MESSAGE;
+      memcpy(reply.MACaddr, SELF, MAC_ADDR_LENGTH);
+      reply.seq = getSensorDataSeq(&sent);
+      reply.spreadingFactor = LORA_SPREADING_FACTOR;
+      reply.quality = makeLinkQuality(10.0f, -60.0f);
+      LoraPacket replyPacket;
+      serializeSDR(&reply, &replyPacket);
+      mockAdvanceMillis(300);
+      receive(replyPacket);
+      loraLoop();
+    }
+  }
+  return forwarded;
+}  // relayRound
+
+// the node state is global, every test case goes on from where the last left it
+static void startNode() {
+  static bool started = false;
+  if (started == true) {
+    return;
+  }
+  started = true;
+  mockSetMillis(1000);
+  mockSeedRandom(3);
+  memcpy(MACbytesG, SELF, MAC_ADDR_LENGTH);
+  // every merged batch is forwarded at once
+  loraSetReadingInterval(BATCH_MAX_AGE);
+  loraSetup();
+  joinParent();
+  settle();
+}
+
+static const uint16_t CHILD_EPOCH = 0x5A5A;
+
+TEST_CASE("relaying a batch does not touch the heap once running", "[LoraCommunication]") {
+  startNode();
+  REQUIRE(isolated == false);
+
+  // the first rounds fill the receive window and the ADR child table
+  uint8_t childSeq = 0;
+  uint16_t readingSeq = 0;
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(relayRound(CHILD_EPOCH, childSeq++, readingSeq) == 1);
+    readingSeq += 2;
+  }
+
+  AllocStats before = allocStats();
+  int forwarded = 0;
+  for (int i = 0; i < 100; i++) {
+    forwarded += relayRound(CHILD_EPOCH, childSeq++, readingSeq);
+    readingSeq += 2;
+  }
+  AllocStats after = allocStats();
+
+  REQUIRE(forwarded == 100);
+  REQUIRE(loraIdle() == true);
+  REQUIRE(after.allocations == before.allocations);
+}
+
+TEST_CASE("a restarted child is not taken for a retransmission", "[LoraCommunication]") {
+  startNode();
+  uint8_t childSeq = 40;
+  for (int i = 0; i < 8; i++) {
+    REQUIRE(relayRound(CHILD_EPOCH, childSeq++, 5000 + i * 2) == 1);
+  }
+  // a retransmission of an accepted batch is only acknowledged
+  REQUIRE(relayRound(CHILD_EPOCH, childSeq - 3, 5010) == 0);
+
+  // after a reboot the child's seqs land in the history kept of the old ones
+  REQUIRE(relayRound(CHILD_EPOCH + 1, childSeq - 3, 6000) == 1);
+  REQUIRE(relayRound(CHILD_EPOCH + 1, childSeq - 2, 6002) == 1);
+  REQUIRE(relayRound(CHILD_EPOCH + 1, childSeq - 2, 6002) == 0);
+}
+
+static void advertise(const uint8_t* parent, int level) {
+  DiscoveryReplyMessage advert = {};
+  advert.requestType = DISCOVERY_REPLY_MESSAGE;
+  advert.level = level;
+  memcpy(advert.MACaddr, parent, MAC_ADDR_LENGTH);
+  advert.spreadingFactor = LORA_SPREADING_FACTOR;
+  advert.quality = makeLinkQuality(10.0f, -60.0f);
+  LoraPacket packet;
+  serializeDRM(&advert, &packet);
+  receive(packet);
+  loraLoop();
+}
+
+static void acknowledge(uint8_t seq) {
+  SensorDataReply reply = {};
+  reply.requestType = DATA_REPLY_MESSAGE;
+  memcpy(reply.MACaddr, SELF, MAC_ADDR_LENGTH);
+  reply.seq = seq;
+  reply.spreadingFactor = LORA_SPREADING_FACTOR;
+  reply.quality = makeLinkQuality(10.0f, -60.0f);
+  LoraPacket packet;
+  serializeSDR(&reply, &packet);
+  receive(packet);
+  loraLoop();
+}
+
+// queue one own reading and run the loop until its batch is on air
+static LoraPacket sendOwnReading(uint16_t seq) {
+  TimeSeriesSample sample = { (uint32_t)millis(), seq, 450.0f, 26.0f, 60.0f };
+  loraSendReading(sample);
+  for (int i = 0; i < 10 && radio.transmitting == false; i++) {
+    loraLoop();
+  }
+  LoraPacket sent = lastSent();
+  radio.mockTransmitDone();
+  loraLoop();
+  return sent;
+}
+
+TEST_CASE("a reply samples the round trip of the parent the data went to", "[LoraCommunication]") {
+  static const uint8_t FAR[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x0D };
+  static const uint8_t NEAR[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x0E };
+  startNode();
+  settle();
+
+  // one parent three levels further out
+  LoraSleepState state;
+  loraSaveState(&state);
+  state.parentCount = 1;
+  memcpy(state.parents[0], FAR, MAC_ADDR_LENGTH);
+  state.rtt[0] = RttEstimator();
+  state.level = 4;
+  loraRestoreState(state);
+
+  LoraPacket sent = sendOwnReading(9000);
+  REQUIRE(getPacketType(&sent) == DATA_MESSAGE);
+  REQUIRE(memcmp(getSensorDataReceiver(&sent), FAR, MAC_ADDR_LENGTH) == 0);
+
+  // a closer parent replaces it while the data is in flight, then the
+  // reply of the old one comes in
+  mockAdvanceMillis(200);
+  advertise(NEAR, 0);
+  mockAdvanceMillis(400);
+  acknowledge(getSensorDataSeq(&sent));
+  settle();
+
+  loraSaveState(&state);
+  REQUIRE(state.parentCount == 1);
+  REQUIRE(memcmp(state.parents[0], NEAR, MAC_ADDR_LENGTH) == 0);
+  REQUIRE(state.rtt[0].getSamples() == 0);
+
+  // data sent to the new parent samples its round trip
+  sent = sendOwnReading(9001);
+  REQUIRE(memcmp(getSensorDataReceiver(&sent), NEAR, MAC_ADDR_LENGTH) == 0);
+  mockAdvanceMillis(700);
+  acknowledge(getSensorDataSeq(&sent));
+  loraSaveState(&state);
+  REQUIRE(state.rtt[0].getSamples() == 1);
+  // give or take the 2 ms each loraLoop() waits
+  REQUIRE(state.rtt[0].getSrtt() >= 700);
+  REQUIRE(state.rtt[0].getSrtt() < 720);
+  REQUIRE(loraIdle() == true);
+}
+
+TEST_CASE("a reply to a retransmitted packet is not sampled", "[LoraCommunication]") {
+  startNode();
+  settle();
+  LoraSleepState state;
+  loraSaveState(&state);
+  REQUIRE(state.parentCount == 1);
+  uint16_t samples = state.rtt[0].getSamples();
+  uint16_t timeouts = state.rtt[0].getTimeouts();
+
+  LoraPacket sent = sendOwnReading(9100);
+  REQUIRE(getPacketType(&sent) == DATA_MESSAGE);
+  int seq = getSensorDataSeq(&sent);
+
+  // the reply is late, the packet goes out again under its seq
+  mockAdvanceMillis(state.rtt[0].rto());
+  bool resent = false;
+  for (int i = 0; i < 10 && resent == false; i++) {
+    loraLoop();
+    if (radio.transmitting == true) {
+      LoraPacket again = lastSent();
+      resent = getPacketType(&again) == DATA_MESSAGE && getSensorDataSeq(&again) == seq;
+      radio.mockTransmitDone();
+      loraLoop();
+    }
+  }
+  REQUIRE(resent);
+
+  // it is unknown which copy the reply answers (Karn's rule)
+  mockAdvanceMillis(300);
+  acknowledge(seq);
+  loraSaveState(&state);
+  REQUIRE(state.rtt[0].getSamples() == samples);
+  REQUIRE(state.rtt[0].getTimeouts() == timeouts + 1);
+  REQUIRE(loraIdle() == true);
+
+  // the next packet is sent once and sampled again
+  sent = sendOwnReading(9101);
+  mockAdvanceMillis(500);
+  acknowledge(getSensorDataSeq(&sent));
+  loraSaveState(&state);
+  REQUIRE(state.rtt[0].getSamples() == samples + 1);
+}
@@ -0,0 +1,386 @@
+#include <catch2/catch.hpp>
+
+#include <LoraPacket.h>
+#include <RingQueue.h>
+
+#include <limits.h>
+#include <string.h>
+
+static const uint8_t RECEIVER[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x01, 0x02, 0x03 };
+static const uint8_t SENDER[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x0A, 0x0B, 0x0C };
+
+static LoraReading makeReading(uint8_t id, uint16_t seq) {
+  LoraReading reading = {};
+  memcpy(reading.SMACaddr, SENDER, MAC_ADDR_LENGTH);
+  reading.SMACaddr[5] = id;
+  reading.seq = seq;
+  reading.c02Data = 400 + id;
+  reading.temperatureData = 27.35f;
+  reading.humidityData = 61.2f;
+  return reading;
+}
+
+static LoraSensorData makeSensorData(uint8_t readings) {
+  LoraSensorData data = {};
+  data.requestType = DATA_MESSAGE;
+  memcpy(data.MACaddr, RECEIVER, MAC_ADDR_LENGTH);
+  memcpy(data.senderMACaddr, SENDER, MAC_ADDR_LENGTH);
+  data.seq = 200;
+  data.spreadingFactor = 9;
+  data.epoch = 0xBEEF;
+  data.readingCount = readings;
+  for (uint8_t i = 0; i < readings; i++) {
+    data.readings[i] = makeReading(i, 1000 + i);
+  }
+  return data;
+}
+
+TEST_CASE("a discovery message is a bare header", "[LoraPacket]") {
+  DiscoveryMessage message = { DISCOVERY_MESSAGE };
+  LoraPacket packet;
+  serializeDM(&message, &packet);
+  REQUIRE(packet.length == DISCOVERY_MESSAGE_LENGTH);
+  REQUIRE(getPacketType(&packet) == DISCOVERY_MESSAGE);
+  REQUIRE(getSensorDataSeq(&packet) == -1);
+}
+
+TEST_CASE("a discovery reply round trips", "[LoraPacket]") {
+  DiscoveryReplyMessage message = {};
+  message.requestType = DISCOVERY_REPLY_MESSAGE;
+  message.level = 3;
+  memcpy(message.MACaddr, SENDER, MAC_ADDR_LENGTH);
+  message.spreadingFactor = 10;
+  message.switchIn = 6;
+  message.quality = makeLinkQuality(-7.25f, -118.0f);
+
+  LoraPacket packet;
+  serializeDRM(&message, &packet);
+  REQUIRE(packet.length == DISCOVERY_REPLY_MESSAGE_LENGTH);
+  REQUIRE(getPacketType(&packet) == DISCOVERY_REPLY_MESSAGE);
+
+  DiscoveryReplyMessage decoded;
+  REQUIRE(deserializeDRM(&packet, &decoded));
+  REQUIRE(decoded.requestType == DISCOVERY_REPLY_MESSAGE);
+  REQUIRE(decoded.level == 3);
+  REQUIRE(memcmp(decoded.MACaddr, SENDER, MAC_ADDR_LENGTH) == 0);
+  REQUIRE(decoded.spreadingFactor == 10);
+  REQUIRE(decoded.switchIn == 6);
+  REQUIRE(decoded.quality.snr == -29);
+  REQUIRE(getLinkSnr(&decoded.quality) == Approx(-7.25f));
+  REQUIRE(decoded.quality.rssi == -118);
+}
+
+TEST_CASE("the level of a discovery reply is sent as u16", "[LoraPacket]") {
+  DiscoveryReplyMessage message = {};
+  message.requestType = DISCOVERY_REPLY_MESSAGE;
+  LoraPacket packet;
+  DiscoveryReplyMessage decoded;
+
+  // INT_MAX stands for "no route" and comes back clamped
+  message.level = INT_MAX;
+  serializeDRM(&message, &packet);
+  REQUIRE(deserializeDRM(&packet, &decoded));
+  REQUIRE(decoded.level == 0xFFFF);
+
+  message.level = 0xFFFF;
+  serializeDRM(&message, &packet);
+  REQUIRE(deserializeDRM(&packet, &decoded));
+  REQUIRE(decoded.level == 0xFFFF);
+
+  message.level = 0xFFFE;
+  serializeDRM(&message, &packet);
+  REQUIRE(deserializeDRM(&packet, &decoded));
+  REQUIRE(decoded.level == 0xFFFE);
+}
+
+TEST_CASE("the SF switch delay is sent in 2 s steps", "[LoraPacket]") {
+  SensorDataReply reply = {};
+  reply.requestType = DATA_REPLY_MESSAGE;
+  reply.spreadingFactor = 12;
+  LoraPacket packet;
+  SensorDataReply decoded;
+
+  // odd delays round up, anything past the maximum is clamped
+  uint8_t sent[] = { 0, 1, 2, 7, LORA_MAX_SWITCH_IN, LORA_MAX_SWITCH_IN + 1, 255 };
+  uint8_t received[] = { 0, 2, 2, 8, LORA_MAX_SWITCH_IN, LORA_MAX_SWITCH_IN, LORA_MAX_SWITCH_IN };
+  for (size_t i = 0; i < sizeof(sent); i++) {
+    reply.switchIn = sent[i];
+    serializeSDR(&reply, &packet);
+    REQUIRE(deserializeSDR(&packet, &decoded));
+    REQUIRE(decoded.spreadingFactor == 12);
+    REQUIRE(decoded.switchIn == received[i]);
+  }
+}
+
+TEST_CASE("a data reply round trips and acknowledges through its bitmap", "[LoraPacket]") {
+  SensorDataReply reply = {};
+  reply.requestType = DATA_REPLY_MESSAGE;
+  memcpy(reply.MACaddr, SENDER, MAC_ADDR_LENGTH);
+  reply.seq = 2;
+  reply.ackBitmap = 0x85;  // 1, 255 and 250
+  reply.quality = makeLinkQuality(40.0f, -200.0f);
+
+  LoraPacket packet;
+  serializeSDR(&reply, &packet);
+  REQUIRE(packet.length == DATA_REPLY_MESSAGE_LENGTH);
+
+  SensorDataReply decoded;
+  REQUIRE(deserializeSDR(&packet, &decoded));
+  REQUIRE(memcmp(decoded.MACaddr, SENDER, MAC_ADDR_LENGTH) == 0);
+  REQUIRE(decoded.seq == 2);
+  REQUIRE(decoded.ackBitmap == 0x85);
+  // clamped to the wire range
+  REQUIRE(decoded.quality.snr == INT8_MAX);
+  REQUIRE(decoded.quality.rssi == INT8_MIN);
+
+  REQUIRE(isSeqAcked(&decoded, 2));
+  REQUIRE(isSeqAcked(&decoded, 1));
+  REQUIRE_FALSE(isSeqAcked(&decoded, 0));
+  REQUIRE(isSeqAcked(&decoded, 255));
+  REQUIRE(isSeqAcked(&decoded, 250));
+  REQUIRE_FALSE(isSeqAcked(&decoded, 249));
+  REQUIRE_FALSE(isSeqAcked(&decoded, 3));
+}
+
+TEST_CASE("a data message round trips with every batch size", "[LoraPacket]") {
+  for (uint8_t count = 0; count <= LORA_MAX_BATCH_READINGS; count++) {
+    LoraSensorData data = makeSensorData(count);
+    LoraPacket packet;
+    serializeSensorData(&data, &packet);
+    REQUIRE(packet.length == DATA_MESSAGE_LENGTH(count));
+    REQUIRE(getPacketType(&packet) == DATA_MESSAGE);
+    REQUIRE(getSensorDataSeq(&packet) == 200);
+
+    LoraSensorData decoded;
+    REQUIRE(deserializeSensorData(&packet, &decoded));
+    REQUIRE(memcmp(decoded.MACaddr, RECEIVER, MAC_ADDR_LENGTH) == 0);
+    REQUIRE(memcmp(decoded.senderMACaddr, SENDER, MAC_ADDR_LENGTH) == 0);
+    REQUIRE(decoded.seq == 200);
+    REQUIRE(decoded.spreadingFactor == 9);
+    REQUIRE(decoded.epoch == 0xBEEF);
+    REQUIRE(decoded.readingCount == count);
+    for (uint8_t i = 0; i < count; i++) {
+      const LoraReading& reading = decoded.readings[i];
+      REQUIRE(memcmp(reading.SMACaddr, data.readings[i].SMACaddr, MAC_ADDR_LENGTH) == 0);
+      REQUIRE(reading.seq == 1000 + i);
+      REQUIRE(reading.c02Data == 400 + i);
+      REQUIRE(reading.temperatureData == Approx(27.35f));
+      REQUIRE(reading.humidityData == Approx(61.2f));
+    }
+  }
+}
+
+TEST_CASE("readings are clamped to their fixed point range", "[LoraPacket]") {
+  LoraSensorData data = makeSensorData(2);
+  data.readings[0].c02Data = 70000;
+  data.readings[0].temperatureData = -400;
+  data.readings[0].humidityData = -5;
+  data.readings[1].c02Data = -1;
+  data.readings[1].temperatureData = 400;
+  data.readings[1].humidityData = 700;
+
+  LoraPacket packet;
+  serializeSensorData(&data, &packet);
+  LoraSensorData decoded;
+  REQUIRE(deserializeSensorData(&packet, &decoded));
+  REQUIRE(decoded.readings[0].c02Data == 0xFFFF);
+  REQUIRE(decoded.readings[0].temperatureData == Approx(INT16_MIN / 100.0f));
+  REQUIRE(decoded.readings[0].humidityData == 0);
+  REQUIRE(decoded.readings[1].c02Data == 0);
+  REQUIRE(decoded.readings[1].temperatureData == Approx(INT16_MAX / 100.0f));
+  REQUIRE(decoded.readings[1].humidityData == Approx(655.35f));
+}
+
+TEST_CASE("a data message stops growing at the maximum batch", "[LoraPacket]") {
+  LoraSensorData data = makeSensorData(0);
+  LoraPacket packet;
+  serializeSensorData(&data, &packet);
+  for (uint8_t i = 0; i < LORA_MAX_BATCH_READINGS; i++) {
+    LoraReading reading = makeReading(i, i);
+    REQUIRE(appendReading(&packet, &reading));
+  }
+  LoraReading extra = makeReading(99, 99);
+  REQUIRE_FALSE(appendReading(&packet, &extra));
+  REQUIRE(packet.length == DATA_MESSAGE_LENGTH(LORA_MAX_BATCH_READINGS));
+  REQUIRE(packet.length <= LORA_MAX_PACKET_LENGTH);
+}
+
+TEST_CASE("readings are told apart by origin and seq", "[LoraPacket]") {
+  LoraReading reading = makeReading(1, 500);
+  LoraReading resent = reading;
+  resent.c02Data += 10;  // another reading of the origin would not repeat the seq
+  LoraReading next = makeReading(1, 501);
+  next.c02Data = reading.c02Data;
+  next.temperatureData = reading.temperatureData;
+  next.humidityData = reading.humidityData;
+  LoraReading other = makeReading(2, 500);
+
+  REQUIRE(reading == resent);
+  REQUIRE(ringQueueHash(reading) == ringQueueHash(resent));
+  REQUIRE_FALSE(reading == next);
+  REQUIRE_FALSE(reading == other);
+
+  // equal values from one origin are separate readings, a repeat is not
+  RingQueue<LoraReading, 8> queue;
+  queue.addToLast(reading);
+  queue.addToLast(next);
+  queue.addToLast(other);
+  queue.addToLast(resent);
+  REQUIRE(queue.count == 3);
+}
+
+TEST_CASE("the readings of one origin are counted in an encoded batch", "[LoraPacket]") {
+  LoraSensorData data = makeSensorData(5);
+  memcpy(data.readings[1].SMACaddr, RECEIVER, MAC_ADDR_LENGTH);
+  memcpy(data.readings[4].SMACaddr, RECEIVER, MAC_ADDR_LENGTH);
+  LoraPacket packet;
+  serializeSensorData(&data, &packet);
+  REQUIRE(countReadingsFrom(&packet, RECEIVER) == 2);
+  REQUIRE(countReadingsFrom(&packet, data.readings[0].SMACaddr) == 1);
+  REQUIRE(countReadingsFrom(&packet, SENDER) == 0);
+
+  // a stats message carries no readings
+  LoraStatsData stats = {};
+  stats.requestType = STATS_MESSAGE;
+  stats.recordCount = 1;
+  memcpy(stats.records[0].MACaddr, RECEIVER, MAC_ADDR_LENGTH);
+  serializeStats(&stats, &packet);
+  REQUIRE(countReadingsFrom(&packet, RECEIVER) == 0);
+}
+
+TEST_CASE("header fields of an encoded data message are patched in place", "[LoraPacket]") {
+  LoraSensorData data = makeSensorData(1);
+  LoraPacket packet;
+  serializeSensorData(&data, &packet);
+  uint8_t parent[MAC_ADDR_LENGTH] = { 1, 2, 3, 4, 5, 6 };
+  setSensorDataReceiver(&packet, parent);
+  setSensorDataSeq(&packet, 7);
+  setSensorDataSF(&packet, 11);
+  setSensorDataEpoch(&packet, 0x0102);
+
+  LoraSensorData decoded;
+  REQUIRE(deserializeSensorData(&packet, &decoded));
+  REQUIRE(memcmp(decoded.MACaddr, parent, MAC_ADDR_LENGTH) == 0);
+  REQUIRE(decoded.seq == 7);
+  REQUIRE(decoded.spreadingFactor == 11);
+  REQUIRE(decoded.epoch == 0x0102);
+  REQUIRE(decoded.readingCount == 1);
+}
+
+TEST_CASE("a stats message round trips", "[LoraPacket]") {
+  LoraStatsData stats = {};
+  stats.requestType = STATS_MESSAGE;
+  memcpy(stats.MACaddr, RECEIVER, MAC_ADDR_LENGTH);
+  memcpy(stats.senderMACaddr, SENDER, MAC_ADDR_LENGTH);
+  stats.seq = 9;
+  stats.spreadingFactor = 7;
+  stats.epoch = 0xFFFF;
+  stats.recordCount = LORA_MAX_STATS_RECORDS;
+  for (uint8_t i = 0; i < LORA_MAX_STATS_RECORDS; i++) {
+    LoraStatsRecord& record = stats.records[i];
+    memcpy(record.MACaddr, SENDER, MAC_ADDR_LENGTH);
+    record.MACaddr[5] = i;
+    record.uptime = 0xFFFFFFF0u + i;
+    record.txTime = 123456 + i;
+    record.rxTime = 654321 + i;
+    record.readings = 0xFFFF - i;
+    record.charge = 1000000 + i;
+  }
+
+  LoraPacket packet;
+  serializeStats(&stats, &packet);
+  REQUIRE(packet.length == STATS_MESSAGE_LENGTH(LORA_MAX_STATS_RECORDS));
+  REQUIRE(getPacketType(&packet) == STATS_MESSAGE);
+  REQUIRE(getSensorDataSeq(&packet) == 9);
+
+  LoraStatsData decoded;
+  REQUIRE(deserializeStats(&packet, &decoded));
+  REQUIRE(decoded.recordCount == LORA_MAX_STATS_RECORDS);
+  REQUIRE(decoded.epoch == 0xFFFF);
+  for (uint8_t i = 0; i < LORA_MAX_STATS_RECORDS; i++) {
+    REQUIRE(decoded.records[i] == stats.records[i]);
+    REQUIRE(decoded.records[i].txTime == 123456u + i);
+    REQUIRE(decoded.records[i].rxTime == 654321u + i);
+    REQUIRE(decoded.records[i].readings == 0xFFFF - i);
+    REQUIRE(decoded.records[i].charge == 1000000u + i);
+  }
+
+  // more records than fit are cut off
+  stats.recordCount = LORA_MAX_STATS_RECORDS + 3;
+  serializeStats(&stats, &packet);
+  REQUIRE(deserializeStats(&packet, &decoded));
+  REQUIRE(decoded.recordCount == LORA_MAX_STATS_RECORDS);
+}
+
+TEST_CASE("frames of the wrong length are rejected", "[LoraPacket]") {
+  LoraPacket packet;
+  LoraSensorData data = makeSensorData(3);
+  LoraSensorData decodedData;
+  serializeSensorData(&data, &packet);
+
+  SECTION("a data message cut short") {
+    packet.length--;
+    REQUIRE_FALSE(deserializeSensorData(&packet, &decodedData));
+    packet.length = DATA_MESSAGE_HEADER_LENGTH - 1;
+    REQUIRE_FALSE(deserializeSensorData(&packet, &decodedData));
+    REQUIRE(getSensorDataSeq(&packet) == -1);
+  }
+
+  SECTION("a data message with trailing bytes") {
+    packet.length++;
+    REQUIRE_FALSE(deserializeSensorData(&packet, &decodedData));
+  }
+
+  SECTION("a reading count larger than a frame can hold") {
+    packet.data[14] = LORA_MAX_BATCH_READINGS + 1;
+    packet.length = LORA_MAX_PACKET_LENGTH;
+    REQUIRE_FALSE(deserializeSensorData(&packet, &decodedData));
+  }
+
+  SECTION("a stats message whose length does not match its records") {
+    LoraStatsData stats = {};
+    stats.requestType = STATS_MESSAGE;
+    stats.recordCount = 2;
+    LoraStatsData decodedStats;
+    serializeStats(&stats, &packet);
+    packet.length -= 1;
+    REQUIRE_FALSE(deserializeStats(&packet, &decodedStats));
+    packet.length = STATS_MESSAGE_LENGTH(2);
+    packet.data[14] = LORA_MAX_STATS_RECORDS + 1;
+    REQUIRE_FALSE(deserializeStats(&packet, &decodedStats));
+  }
+
+  SECTION("replies of the wrong length") {
+    SensorDataReply reply = {};
+    reply.requestType = DATA_REPLY_MESSAGE;
+    SensorDataReply decodedReply;
+    serializeSDR(&reply, &packet);
+    packet.length = DATA_REPLY_MESSAGE_LENGTH - 1;
+    REQUIRE_FALSE(deserializeSDR(&packet, &decodedReply));
+    packet.length = DATA_REPLY_MESSAGE_LENGTH + 1;
+    REQUIRE_FALSE(deserializeSDR(&packet, &decodedReply));
+
+    DiscoveryReplyMessage message = {};
+    message.requestType = DISCOVERY_REPLY_MESSAGE;
+    DiscoveryReplyMessage decodedMessage;
+    serializeDRM(&message, &packet);
+    packet.length = DISCOVERY_REPLY_MESSAGE_LENGTH - 1;
+    REQUIRE_FALSE(deserializeDRM(&packet, &decodedMessage));
+  }
+}
+
+TEST_CASE("frames of another version or empty ones have no type", "[LoraPacket]") {
+  LoraPacket packet;
+  packet.length = 0;
+  REQUIRE(getPacketType(&packet) == -1);
+
+  DiscoveryMessage message = { DISCOVERY_MESSAGE };
+  serializeDM(&message, &packet);
+  packet.data[0] = ((LORA_FRAME_VERSION - 1) << 4) | DISCOVERY_MESSAGE;
+  REQUIRE(getPacketType(&packet) == -1);
+
+  LoraSensorData data = makeSensorData(1);
+  serializeSensorData(&data, &packet);
+  packet.data[0] = ((LORA_FRAME_VERSION + 1) << 4) | DATA_MESSAGE;
+  REQUIRE(getSensorDataSeq(&packet) == -1);
+}
@@ -0,0 +1,234 @@
+/** Mesh Simulator Node
+ *  One node of mesh_simulator.py: LoraCommunication.cpp and
+ *  ESPNowCommunication.cpp with MACaddr, ProtocolManager, the backlog and
+ *  the modules, built over the mocks into a shared library. The simulator
+ *  loads a copy of the library per node, so every node has its own
+ *  globals, clock, flash and radios, and drives it through the entry
+ *  points below the way Main.ino and the radio interrupts would. What the
+ *  SX1280 and the ESP-NOW driver send goes on the simulated medium, what
+ *  the medium delivers comes in through their mocks.
+ *
+ *  Times are the node's own millis(), MACs MAC_ADDR_LENGTH bytes.
+ */
+
+#include <string.h>
+
+#include <LittleFS.h>
+#include "LoraCommunication.h"
+#include "ESPNowCommunication.h"
+
+// the protocol the node was booted with, its readings all go over it
+static Protocol simProtocol = PROTOCOL_LORA;
+
+extern RingQueue<LoraPacket, DATA_TO_SEND_CAPACITY> dataToSend;
+extern RingQueue<LoraReading, PENDING_READINGS_CAPACITY, false> pendingReadings;
+
+extern "C" {
+
+// what Main.ino's setup() does for one of the stacks, the clock starts at 0
+void simBoot(const uint8_t* macAddr, int protocol, uint32_t seed, unsigned long readingInterval,
+             const char* flashDirectory) {
+  mockSetMillis(0);
+  mockSeedRandom(seed);
+  formatMacAddress(macAddr, WiFi.address, sizeof(WiFi.address));
+  LittleFS.mount(flashDirectory);
+  simProtocol = (Protocol)protocol;
+
+  setupMACaddr();
+  loraSetReadingInterval(readingInterval);
+  setupBacklog(BACKLOG_OLDEST_FIRST);
+  protocolManager.begin(simProtocol, millis());
+  if (simProtocol == PROTOCOL_LORA) {
+    loraSetup();
+  } else {
+    espnowSetup();
+  }
+}
+
+void simSetMillis(unsigned long now) {
+  mockSetMillis(now);
+}
+
+unsigned long simMillis() {
+  return millis();
+}
+
+// takes a reading now and hands it to the stack, returns its seq
+uint16_t simReading(float c02Data, float temperatureData, float humidityData) {
+  TimeSeriesSample reading;
+  reading.time = millis();
+  reading.seq = getReadingSeq();
+  setReadingSeq(reading.seq + 1);
+  reading.c02Data = c02Data;
+  reading.temperatureData = temperatureData;
+  reading.humidityData = humidityData;
+  if (simProtocol == PROTOCOL_LORA) {
+    loraSendReading(reading);
+  } else {
+    espnowSendReading(reading);
+  }
+  return reading.seq;
+}
+
+// readings held while there was no route, in RAM and in flash
+uint32_t simBacklogCount() {
+  return readingBacklog.count() + flashBacklog.count();
+}
+
+uint32_t simBacklogDropped() {
+  return readingBacklog.getDropped() + flashBacklog.getDropped();
+}
+
+// LoRa
+
+// runs loraLoop() until the clock reaches until, or returns early once a
+// frame went on air. Returns whether one did, spreadingFactor is the radio's.
+bool simLoraRun(unsigned long until, uint8_t* spreadingFactor) {
+  bool sent = false;
+  while (sent == false && (long)(until - millis()) > 0) {
+    uint32_t sentCount = radio.sentCount;
+    loraLoop();
+    sent = radio.sentCount != sentCount;
+  }
+  *spreadingFactor = radio.spreadingFactor;
+  return sent;
+}
+
+// the frame on air, MOCK_RADIO_MAX_LENGTH bytes, returns its length
+size_t simLoraSent(uint8_t* data, unsigned long* sentTime) {
+  memcpy(data, radio.sent, radio.sentLength);
+  *sentTime = radio.sentTime;
+  return radio.sentLength;
+}
+
+void simLoraTransmitDone() {
+  radio.mockTransmitDone();
+}
+
+// the radio listens at spreadingFactor, or 0 while it transmits
+uint8_t simLoraListening() {
+  return radio.transmitting == true ? 0 : radio.spreadingFactor;
+}
+
+// a frame arrives, returns false if the one before was not read yet and it is lost
+bool simLoraReceive(const uint8_t* data, size_t length, float snr, float rssi) {
+  if (rxFlag == true) {
+    return false;
+  }
+  radio.mockReceive(data, length, snr, rssi);
+  return true;
+}
+
+bool simLoraIsolated() {
+  return isolated;
+}
+
+int simLoraLevel() {
+  return selfLevel;
+}
+
+// frames waiting to be sent plus readings waiting to be batched
+int simLoraQueueDepth() {
+  return dataToSend.count + pendingReadings.count;
+}
+
+uint32_t simTrickleTransmitted(bool discovery) {
+  return (discovery == true ? discoveryTrickle : advertTrickle).getTransmitted();
+}
+
+uint32_t simTrickleSuppressed(bool discovery) {
+  return (discovery == true ? discoveryTrickle : advertTrickle).getSuppressed();
+}
+
+// the type of a frame on air, with the sender, receiver, seq and epoch of a sequenced one
+int simLoraFrameInfo(const uint8_t* data, size_t length, uint8_t* senderAddr, uint8_t* receiverAddr, uint8_t* seq,
+                     uint16_t* epoch) {
+  LoraPacket packet;
+  packet.length = length < LORA_MAX_PACKET_LENGTH ? length : LORA_MAX_PACKET_LENGTH;
+  memcpy(packet.data, data, packet.length);
+  int type = getPacketType(&packet);
+  if (type == DATA_MESSAGE) {
+    LoraSensorData message;
+    if (deserializeSensorData(&packet, &message) == false) {
+      return -1;
+    }
+    memcpy(senderAddr, message.senderMACaddr, MAC_ADDR_LENGTH);
+    memcpy(receiverAddr, message.MACaddr, MAC_ADDR_LENGTH);
+    *seq = message.seq;
+    *epoch = message.epoch;
+  } else if (type == STATS_MESSAGE) {
+    LoraStatsData message;
+    if (deserializeStats(&packet, &message) == false) {
+      return -1;
+    }
+    memcpy(senderAddr, message.senderMACaddr, MAC_ADDR_LENGTH);
+    memcpy(receiverAddr, message.MACaddr, MAC_ADDR_LENGTH);
+    *seq = message.seq;
+    *epoch = message.epoch;
+  }
+  return type;
+}
+
+// SX1280 time on air in us, with the modem settings of loraSetup()
+uint32_t simTimeOnAir(uint8_t spreadingFactor, uint8_t length) {
+  AirtimeMeter meter(spreadingFactor, LORA_BANDWIDTH, LORA_CODING_RATE, LORA_PREAMBLE_LENGTH);
+  return meter.timeOnAir(length);
+}
+
+float simSnrFloor(uint8_t spreadingFactor) {
+  return AdrController::snrFloor(spreadingFactor);
+}
+
+// ESP-NOW
+
+// runs the jobs that are due, returns ms until the next one
+unsigned long simEspNowPoll() {
+  return espnowPoll();
+}
+
+// the frame the driver sends next, ESP_NOW_MAX_DATA_LEN bytes, returns its length or 0
+size_t simEspNowPending(uint8_t* peerAddr, uint8_t* data) {
+  const MockEspNowFrame* frame = mockEspNowPending();
+  if (frame == NULL) {
+    return 0;
+  }
+  memcpy(peerAddr, frame->peerAddr, ESP_NOW_ETH_ALEN);
+  memcpy(data, frame->data, frame->length);
+  return frame->length;
+}
+
+// the pending frame is out, the worker handles the send callback's event
+void simEspNowSendDone(bool delivered) {
+  mockEspNowSendDone(delivered == true ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+  espnowDrainEvents();
+}
+
+void simEspNowReceive(const uint8_t* macAddr, const uint8_t* data, int length) {
+  mockEspNowReceive(macAddr, data, length);
+  espnowDrainEvents();
+}
+
+bool simEspNowConnected() {
+  return isConnectedToMaster;
+}
+
+// frames in the driver's TX queue
+int simEspNowQueueDepth() {
+  return mockEspNowQueued();
+}
+
+// the origin, seq and hops of a SensorData frame, false for any other
+bool simEspNowFrameInfo(const uint8_t* data, int length, uint8_t* origin, uint16_t* seq, uint8_t* hops) {
+  if (length != sizeof(SensorData)) {
+    return false;
+  }
+  SensorData reading;
+  memcpy(&reading, data, sizeof(SensorData));
+  reading.MACaddr[MAX_MAC_LENGTH - 1] = '\0';
+  parseMacAddress(String(reading.MACaddr), origin);
+  *seq = reading.seq;
+  *hops = reading.hops;
+  return true;
+}
+
+}  // extern "C"
@@ -0,0 +1,133 @@
+/** Mesh Simulator Master
+ *  The master of mesh_simulator.py: Master_Node.ino with its LoRa,
+ *  ESP-NOW and uplink implementations, built over the mocks into a shared
+ *  library of its own. Without FreeRTOS the tasks never start, the entry
+ *  points below run their bodies instead, loRaLoop() and uplinkPass() in
+ *  1 ms steps and drainFrames() whenever the medium delivers a frame.
+ *
+ *  The master's serial output, the SerialUplink frames the host gateway
+ *  reads, is kept for the simulator to decode. A reboot loads a fresh
+ *  copy of the library. Times are the master's own millis().
+ */
+
+#include <vector>
+
+#include "../Master_Node/Master_Node.ino"
+
+// written to Serial since the simulator last took it
+static std::vector<uint8_t> serialOutput;
+
+static void captureSerial(const uint8_t* data, size_t length) {
+  serialOutput.insert(serialOutput.end(), data, data + length);
+}
+
+extern "C" {
+
+// the sketch's setup(), the clock starts at 0
+void simBoot(const uint8_t* macAddr, uint32_t seed) {
+  mockSetMillis(0);
+  mockSeedRandom(seed);
+  formatMacAddress(macAddr, WiFi.address, sizeof(WiFi.address));
+  Serial.output = captureSerial;
+  setup();
+}
+
+void simSetMillis(unsigned long now) {
+  mockSetMillis(now);
+}
+
+unsigned long simMillis() {
+  return millis();
+}
+
+// the serial output since the last call, returns how many bytes went to output
+size_t simSerialOutput(uint8_t* output, size_t capacity) {
+  size_t length = serialOutput.size() < capacity ? serialOutput.size() : capacity;
+  memcpy(output, serialOutput.data(), length);
+  serialOutput.erase(serialOutput.begin(), serialOutput.begin() + length);
+  return length;
+}
+
+// readings the DedupWindow kept from the host
+uint32_t simDuplicates() {
+  return dedup.getDuplicates();
+}
+
+// LoRa, as simLoraRun() of the nodes
+
+bool simLoraRun(unsigned long until, uint8_t* spreadingFactor) {
+  bool sent = false;
+  while (sent == false && (long)(until - millis()) > 0) {
+    uint32_t sentCount = radio.sentCount;
+    loRaLoop();
+    uplinkPass();
+    sent = radio.sentCount != sentCount;
+    delay(1);
+  }
+  *spreadingFactor = radio.spreadingFactor;
+  return sent;
+}
+
+size_t simLoraSent(uint8_t* data, unsigned long* sentTime) {
+  memcpy(data, radio.sent, radio.sentLength);
+  *sentTime = radio.sentTime;
+  return radio.sentLength;
+}
+
+void simLoraTransmitDone() {
+  radio.mockTransmitDone();
+}
+
+uint8_t simLoraListening() {
+  return radio.transmitting == true ? 0 : radio.spreadingFactor;
+}
+
+bool simLoraReceive(const uint8_t* data, size_t length, float snr, float rssi) {
+  if (rxFlag == true) {
+    return false;
+  }
+  radio.mockReceive(data, length, snr, rssi);
+  return true;
+}
+
+int simLoraQueueDepth() {
+  return dataToSend.count + dataReceived.count;
+}
+
+// ESP-NOW, as simEspNowPoll() of the nodes
+
+unsigned long simEspNowPoll() {
+  drainFrames();
+  espNowLoop();
+  uplinkPass();
+  unsigned long sinceAdvert = millis() - lastAdvertised;
+  unsigned long wait = sinceAdvert < ROUTE_ADVERTISE_INTERVAL ? ROUTE_ADVERTISE_INTERVAL - sinceAdvert : 0;
+  return wait < UPLINK_IDLE_WAIT ? wait : UPLINK_IDLE_WAIT;
+}
+
+size_t simEspNowPending(uint8_t* peerAddr, uint8_t* data) {
+  const MockEspNowFrame* frame = mockEspNowPending();
+  if (frame == NULL) {
+    return 0;
+  }
+  memcpy(peerAddr, frame->peerAddr, ESP_NOW_ETH_ALEN);
+  memcpy(data, frame->data, frame->length);
+  return frame->length;
+}
+
+// the master registers no send callback
+void simEspNowSendDone(bool delivered) {
+  mockEspNowSendDone(delivered == true ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+}
+
+void simEspNowReceive(const uint8_t* macAddr, const uint8_t* data, int length) {
+  mockEspNowReceive(macAddr, data, length);
+  drainFrames();
+  uplinkPass();
+}
+
+int simEspNowQueueDepth() {
+  return mockEspNowQueued();
+}
+
+}  // extern "C"
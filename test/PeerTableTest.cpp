@@ -0,0 +1,183 @@
+#include <catch2/catch.hpp>
+
+#include <PeerTable.h>
+
+#include <array>
+#include <random>
+#include <set>
+#include <string.h>
+#include <vector>
+
+typedef std::array<uint8_t, PEER_MAC_LENGTH> Mac;
+
+static size_t homeOf(const Mac& mac) {
+  return ringQueueHashBytes(mac.data(), PEER_MAC_LENGTH) & (PEER_TABLE_SLOTS - 1);
+}
+
+// the n-th MAC, counting from 0, that hashes to the slot
+static Mac homedAt(size_t slot, int n) {
+  Mac mac = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x00 };
+  for (uint32_t i = 0;; i++) {
+    mac[3] = i >> 16;
+    mac[4] = i >> 8;
+    mac[5] = i;
+    if (homeOf(mac) == slot && n-- == 0) {
+      return mac;
+    }
+  }
+}
+
+TEST_CASE("a removal closes the gap in a probe run across the end of the table", "[PeerTable]") {
+  const size_t last = PEER_TABLE_SLOTS - 1;
+  // a run from the second to last slot round to slot 3, its members out of place by up to 3
+  Mac a = homedAt(last - 1, 0);
+  Mac b = homedAt(last - 1, 1);
+  Mac c = homedAt(last, 0);
+  Mac d = homedAt(last - 1, 2);
+  Mac e = homedAt(0, 0);
+  Mac f = homedAt(1, 0);
+  std::vector<Mac> run = { a, b, c, d, e, f };
+
+  PeerTable table;
+  for (const Mac& mac : run) {
+    REQUIRE(table.add(mac.data(), 0) != NULL);
+  }
+  REQUIRE(table.count() == 6);
+  // a MAC homed inside the run but not in the table is probed for to its end
+  Mac absent = homedAt(2, 0);
+  REQUIRE(table.find(absent.data()) == NULL);
+
+  size_t removed = GENERATE(0, 1, 2, 3, 4, 5);
+  REQUIRE(table.remove(run[removed].data()));
+  REQUIRE(table.find(run[removed].data()) == NULL);
+  REQUIRE(table.remove(run[removed].data()) == false);
+  REQUIRE(table.count() == 5);
+  for (size_t i = 0; i < run.size(); i++) {
+    if (i != removed) {
+      PeerEntry* peer = table.find(run[i].data());
+      REQUIRE(peer != NULL);
+      REQUIRE(memcmp(peer->MACaddr, run[i].data(), PEER_MAC_LENGTH) == 0);
+    }
+  }
+  REQUIRE(table.find(absent.data()) == NULL);
+
+  // the slot freed is taken again
+  REQUIRE(table.add(absent.data(), 0) != NULL);
+  REQUIRE(table.add(run[removed].data(), 0) != NULL);
+  for (const Mac& mac : run) {
+    REQUIRE(table.find(mac.data()) != NULL);
+  }
+  REQUIRE(table.count() == 7);
+}
+
+TEST_CASE("an entry is not pulled in front of its home slot", "[PeerTable]") {
+  // slots 4..7: a and b homed at 4, c and d at their own slots 6 and 7 once
+  // b took 5. Removing a moves b into 4, c and d stay.
+  Mac a = homedAt(4, 0);
+  Mac b = homedAt(4, 1);
+  Mac c = homedAt(6, 0);
+  Mac d = homedAt(7, 0);
+  PeerTable table;
+  for (const Mac* mac : { &a, &b, &c, &d }) {
+    table.add(mac->data(), 0);
+  }
+  PeerEntry* atC = table.find(c.data());
+  PeerEntry* atD = table.find(d.data());
+  PeerEntry* atA = table.find(a.data());
+  REQUIRE(table.remove(a.data()));
+  REQUIRE(table.find(b.data()) == atA);
+  REQUIRE(table.find(c.data()) == atC);
+  REQUIRE(table.find(d.data()) == atD);
+}
+
+TEST_CASE("the table behaves like a set under clustered adds and removes", "[PeerTable]") {
+  // MACs homed on a few neighbouring slots at the end of the table, so the
+  // runs are long, wrap and merge
+  std::vector<Mac> pool;
+  for (size_t slot : { PEER_TABLE_SLOTS - 3, PEER_TABLE_SLOTS - 2, PEER_TABLE_SLOTS - 1, 0, 3 }) {
+    for (int n = 0; n < 6; n++) {
+      pool.push_back(homedAt(slot, n));
+    }
+  }
+
+  PeerTable table;
+  std::set<Mac> model;
+  std::mt19937 random(7);
+  for (int step = 0; step < 20000; step++) {
+    const Mac& mac = pool[random() % pool.size()];
+    if (random() % 2 == 0) {
+      bool added = table.add(mac.data(), step) != NULL;
+      bool expected = model.count(mac) == 0 && model.size() < PEER_TABLE_CAPACITY;
+      REQUIRE(added == expected);
+      if (added) {
+        model.insert(mac);
+      }
+    } else {
+      REQUIRE(table.remove(mac.data()) == (model.erase(mac) > 0));
+    }
+    REQUIRE(table.count() == (int)model.size());
+    if (step % 16 == 0) {
+      for (const Mac& known : pool) {
+        REQUIRE((table.find(known.data()) != NULL) == (model.count(known) > 0));
+      }
+    }
+  }
+}
+
+TEST_CASE("parents are ranked by hops plus expected transmissions", "[PeerTable]") {
+  PeerTable table;
+  Mac near = homedAt(1, 0);
+  Mac far = homedAt(2, 0);
+  Mac lossy = homedAt(3, 0);
+  Mac child = homedAt(4, 0);
+  table.add(near.data(), 0)->hops = 1;
+  table.add(far.data(), 0)->hops = 2;
+  table.add(lossy.data(), 0)->hops = 1;
+  table.add(child.data(), 0)->hops = 3;
+  // a few lost frames make one hop over a poor link dearer than two over good ones
+  for (int i = 0; i < 6; i++) {
+    table.recordSend(lossy.data(), false, 1000);
+  }
+  REQUIRE(PeerTable::cost(*table.find(lossy.data())) > PeerTable::cost(*table.find(far.data())));
+
+  const PeerEntry* parents[2];
+  REQUIRE(table.bestParents(parents, 2, 3, 1000) == 2);
+  REQUIRE(memcmp(parents[0]->MACaddr, near.data(), PEER_MAC_LENGTH) == 0);
+  REQUIRE(memcmp(parents[1]->MACaddr, far.data(), PEER_MAC_LENGTH) == 0);
+  // only peers closer to the master than we are
+  REQUIRE(table.bestParents(parents, 2, 2, 1000) == 2);
+  REQUIRE(memcmp(parents[1]->MACaddr, lossy.data(), PEER_MAC_LENGTH) == 0);
+  REQUIRE(table.hasChildren(2, 1000));
+  REQUIRE(table.hasChildren(3, 1000) == false);
+
+  // the costliest parent makes way when nothing without a route is left
+  REQUIRE(memcmp(table.victim()->MACaddr, child.data(), PEER_MAC_LENGTH) == 0);
+  table.find(child.data())->hops = PEER_NO_ROUTE;
+  REQUIRE(memcmp(table.victim()->MACaddr, child.data(), PEER_MAC_LENGTH) == 0);
+  table.remove(child.data());
+  REQUIRE(memcmp(table.victim()->MACaddr, lossy.data(), PEER_MAC_LENGTH) == 0);
+}
+
+TEST_CASE("a peer expires when it goes quiet or its link breaks", "[PeerTable]") {
+  PeerTable table;
+  Mac quiet = homedAt(5, 0);
+  Mac broken = homedAt(9, 0);
+  table.add(quiet.data(), 0);
+  table.add(broken.data(), 0);
+
+  // delivered frames count as hearing from the peer
+  table.recordSend(broken.data(), true, PEER_TIMEOUT - 1);
+  REQUIRE(table.expired(PEER_TIMEOUT - 1) == NULL);
+  REQUIRE(table.expired(PEER_TIMEOUT) == table.find(quiet.data()));
+  table.remove(quiet.data());
+
+  int sends = 0;
+  while (table.expired(PEER_TIMEOUT) == NULL) {
+    table.recordSend(broken.data(), false, PEER_TIMEOUT);
+    sends++;
+    REQUIRE(sends < 100);
+  }
+  REQUIRE(table.find(broken.data())->deliveryRatio < PEER_DROP_RATIO);
+  // 255 * (7/8)^n in integer steps falls below 32 after 17 losses in a row
+  REQUIRE(sends == 17);
+}
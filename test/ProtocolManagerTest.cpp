@@ -0,0 +1,178 @@
+#include <catch2/catch.hpp>
+
+#include <ProtocolManager.h>
+
+// both links with a route, readings going over the preferred one
+static void start(ProtocolManager& manager, Protocol preferred) {
+  manager.begin(preferred, 0);
+  manager.setAvailable(PROTOCOL_ESPNOW, true);
+  manager.setAvailable(PROTOCOL_LORA, true);
+}
+
+// a loss a second until the manager leaves the link, returns how many it took
+static int failUntilLeft(ProtocolManager& manager, Protocol protocol, unsigned long& now) {
+  int failures = 0;
+  while (manager.current() == protocol) {
+    manager.recordResult(protocol, false, 0);
+    failures++;
+    now += 1000;
+    manager.route(now);
+    REQUIRE(failures < 20);
+  }
+  return failures;
+}
+
+TEST_CASE("a marginal link does not flap between the thresholds", "[ProtocolManager]") {
+  ProtocolManager manager;
+  start(manager, PROTOCOL_LORA);
+  manager.recordSend(PROTOCOL_LORA, 1, 100);
+  manager.recordSend(PROTOCOL_ESPNOW, 1, 1000);
+
+  // two of three frames get through, the ratio settles between 0.62 and 0.71
+  unsigned long now = 0;
+  for (int i = 0; i < 300; i++) {
+    manager.recordResult(PROTOCOL_LORA, i % 3 != 2, 500);
+    now += 1000;
+    manager.route(now);
+    LinkStats lora = manager.getStats(PROTOCOL_LORA);
+    if (i >= 30) {
+      REQUIRE(lora.deliveryRatio > PROTOCOL_UNHEALTHY_RATIO);
+      REQUIRE(lora.deliveryRatio < PROTOCOL_HEALTHY_RATIO);
+    }
+    REQUIRE(lora.healthy);
+    REQUIRE(manager.current() == PROTOCOL_LORA);
+  }
+  REQUIRE(manager.getSwitches() == 0);
+
+  // once failed, the same ratio does not bring it back although it is cheaper
+  failUntilLeft(manager, PROTOCOL_LORA, now);
+  REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+  for (int i = 0; i < 300; i++) {
+    manager.recordResult(PROTOCOL_LORA, i % 3 != 2, 500);
+    now += 1000;
+    manager.route(now);
+    REQUIRE(manager.getStats(PROTOCOL_LORA).healthy == false);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+  }
+  REQUIRE(manager.getSwitches() == 1);
+}
+
+TEST_CASE("sustained loss moves readings to the other link", "[ProtocolManager]") {
+  ProtocolManager manager;
+  start(manager, PROTOCOL_LORA);
+  manager.recordSend(PROTOCOL_LORA, 1, 100);
+  manager.recordSend(PROTOCOL_ESPNOW, 1, 1000);
+  unsigned long now = 1000;
+
+  SECTION("delivery falling below the unhealthy ratio") {
+    // 0.875^5 = 0.51 is still inside the band, the sixth loss in a row is not
+    REQUIRE(failUntilLeft(manager, PROTOCOL_LORA, now) == 6);
+    REQUIRE(manager.getStats(PROTOCOL_LORA).healthy == false);
+    // a failing link is left before PROTOCOL_MIN_DWELL
+    REQUIRE(now < PROTOCOL_MIN_DWELL);
+    REQUIRE(manager.getSwitches() == 1);
+  }
+
+  SECTION("a lost route") {
+    manager.setAvailable(PROTOCOL_LORA, false);
+    manager.route(now);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+    REQUIRE(manager.getStats(PROTOCOL_LORA).healthy == false);
+    REQUIRE(manager.getSwitches() == 1);
+  }
+
+  SECTION("losses while neither link works keep the route") {
+    manager.setAvailable(PROTOCOL_ESPNOW, false);
+    for (int i = 0; i < 20; i++) {
+      manager.recordResult(PROTOCOL_LORA, false, 0);
+      now += 1000;
+      REQUIRE(manager.route(now) == PROTOCOL_LORA);
+    }
+    REQUIRE(manager.getSwitches() == 0);
+  }
+}
+
+TEST_CASE("a failed link is held down before it is taken back", "[ProtocolManager]") {
+  ProtocolManager manager;
+  start(manager, PROTOCOL_LORA);
+  manager.recordSend(PROTOCOL_LORA, 1, 100);
+  manager.recordSend(PROTOCOL_ESPNOW, 1, 1000);
+  unsigned long now = 0;
+
+  unsigned long holdDown = PROTOCOL_HOLD_DOWN;
+  for (int round = 0; round < 3; round++) {
+    failUntilLeft(manager, PROTOCOL_LORA, now);
+    unsigned long left = now;
+
+    // healthy and cheaper again at once, but held down
+    for (int i = 0; i < 20; i++) {
+      manager.recordResult(PROTOCOL_LORA, true, 500);
+    }
+    REQUIRE(manager.getStats(PROTOCOL_LORA).healthy);
+    manager.route(left + holdDown - 1);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+    manager.route(left + holdDown);
+    REQUIRE(manager.current() == PROTOCOL_LORA);
+
+    // failing again doubles the hold down
+    now = left + holdDown;
+    holdDown *= 2;
+  }
+  REQUIRE(manager.getSwitches() == 6);
+}
+
+TEST_CASE("a healthy link is left only for a clearly cheaper one", "[ProtocolManager]") {
+  ProtocolManager manager;
+  start(manager, PROTOCOL_ESPNOW);
+  manager.recordSend(PROTOCOL_ESPNOW, 1, 100);
+
+  SECTION("a link that has not sent has no price") {
+    manager.route(PROTOCOL_MIN_DWELL * 10);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+    REQUIRE(manager.cost(PROTOCOL_LORA) == 0);
+  }
+
+  SECTION("cheaper by less than the margin") {
+    manager.recordSend(PROTOCOL_LORA, 1, 75);
+    manager.route(PROTOCOL_MIN_DWELL * 10);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+  }
+
+  SECTION("cheaper per reading, after the dwell time") {
+    // a frame's charge is shared by the readings it carries
+    manager.recordSend(PROTOCOL_LORA, 4, 240);
+    manager.recordSend(PROTOCOL_LORA, 0, 1000);
+    REQUIRE(manager.cost(PROTOCOL_LORA) == Approx(60));
+    manager.route(PROTOCOL_MIN_DWELL - 1);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+    manager.route(PROTOCOL_MIN_DWELL);
+    REQUIRE(manager.current() == PROTOCOL_LORA);
+    // and not straight back, the link left was healthy
+    REQUIRE(manager.getStats(PROTOCOL_ESPNOW).heldUntil == 0);
+  }
+
+  SECTION("cheap per frame but lossy, priced per delivered reading") {
+    manager.recordSend(PROTOCOL_LORA, 1, 50);
+    for (int i = 0; i < 3; i++) {
+      manager.recordResult(PROTOCOL_LORA, false, 0);
+    }
+    REQUIRE(manager.cost(PROTOCOL_LORA) == Approx(50 / (0.875 * 0.875 * 0.875)));
+    manager.route(PROTOCOL_MIN_DWELL * 10);
+    REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+  }
+}
+
+TEST_CASE("the other link gets a probe reading now and then", "[ProtocolManager]") {
+  ProtocolManager manager;
+  start(manager, PROTOCOL_ESPNOW);
+  int probes = 0;
+  for (unsigned long now = 1000; now <= 10 * PROTOCOL_PROBE_INTERVAL; now += 1000) {
+    if (manager.route(now) == PROTOCOL_LORA) {
+      probes++;
+    }
+  }
+  REQUIRE(probes == 10);
+  REQUIRE(manager.getProbes() == 10);
+  REQUIRE(manager.current() == PROTOCOL_ESPNOW);
+  REQUIRE(manager.getStats(PROTOCOL_LORA).readings == 10);
+}
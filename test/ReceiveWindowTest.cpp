@@ -0,0 +1,76 @@
+#include <catch2/catch.hpp>
+
+#include <ReceiveWindow.h>
+
+static const uint8_t SENDER[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x00, 0x00, 0x01 };
+static const uint16_t EPOCH = 0x1234;
+
+TEST_CASE("accepted seqs are recognised as retransmissions", "[ReceiveWindow]") {
+  ReceiveWindow window;
+  REQUIRE_FALSE(window.isReceived(SENDER, EPOCH, 10));
+  window.record(SENDER, EPOCH, 10);
+  REQUIRE(window.isReceived(SENDER, EPOCH, 10));
+  REQUIRE_FALSE(window.isReceived(SENDER, EPOCH, 11));
+  REQUIRE_FALSE(window.isReceived(SENDER, EPOCH, 9));
+}
+
+TEST_CASE("the history covers 32 seqs across the wrap", "[ReceiveWindow]") {
+  ReceiveWindow window;
+  for (int i = 0; i < 40; i++) {
+    window.record(SENDER, EPOCH, (uint8_t)(240 + i));
+  }
+  // 240 + 39 wraps to 23
+  REQUIRE(window.isReceived(SENDER, EPOCH, 23));
+  REQUIRE(window.isReceived(SENDER, EPOCH, 0));
+  REQUIRE(window.isReceived(SENDER, EPOCH, 255));
+  REQUIRE(window.isReceived(SENDER, EPOCH, 248));
+  REQUIRE_FALSE(window.isReceived(SENDER, EPOCH, 247));
+}
+
+TEST_CASE("out of order seqs fill the history", "[ReceiveWindow]") {
+  ReceiveWindow window;
+  window.record(SENDER, EPOCH, 20);
+  window.record(SENDER, EPOCH, 17);
+  window.record(SENDER, EPOCH, 19);
+  // bit i for 20 - 1 - i: 19 and 17
+  REQUIRE(window.ackBitmap(SENDER, EPOCH, 20) == 0x05);
+  REQUIRE(window.isReceived(SENDER, EPOCH, 17));
+  REQUIRE_FALSE(window.isReceived(SENDER, EPOCH, 18));
+}
+
+TEST_CASE("a restarted sender starts a new history", "[ReceiveWindow]") {
+  ReceiveWindow window;
+  for (uint8_t seq = 100; seq < 120; seq++) {
+    window.record(SENDER, EPOCH, seq);
+  }
+
+  // after the reboot the seqs start over inside the old history
+  uint16_t rebooted = EPOCH + 1;
+  REQUIRE_FALSE(window.isReceived(SENDER, rebooted, 105));
+  REQUIRE(window.ackBitmap(SENDER, rebooted, 105) == 0);
+  window.record(SENDER, rebooted, 105);
+  REQUIRE(window.isReceived(SENDER, rebooted, 105));
+  REQUIRE_FALSE(window.isReceived(SENDER, rebooted, 104));
+  REQUIRE_FALSE(window.isReceived(SENDER, rebooted, 119));
+  REQUIRE(window.ackBitmap(SENDER, rebooted, 106) == 0x01);
+
+  // and the old epoch is forgotten
+  REQUIRE_FALSE(window.isReceived(SENDER, EPOCH, 110));
+}
+
+TEST_CASE("the least recently heard sender is forgotten", "[ReceiveWindow]") {
+  ReceiveWindow window;
+  uint8_t senders[RECEIVE_WINDOW_SENDERS + 1][MAC_ADDR_LENGTH] = {};
+  for (int i = 0; i <= RECEIVE_WINDOW_SENDERS; i++) {
+    senders[i][5] = i + 1;
+  }
+  for (int i = 0; i < RECEIVE_WINDOW_SENDERS; i++) {
+    window.record(senders[i], EPOCH, 1);
+  }
+  // the first sender is heard again, the second is now the oldest
+  REQUIRE(window.isReceived(senders[0], EPOCH, 1));
+  window.record(senders[RECEIVE_WINDOW_SENDERS], EPOCH, 1);
+  REQUIRE(window.isReceived(senders[0], EPOCH, 1));
+  REQUIRE_FALSE(window.isReceived(senders[1], EPOCH, 1));
+  REQUIRE(window.isReceived(senders[RECEIVE_WINDOW_SENDERS], EPOCH, 1));
+}
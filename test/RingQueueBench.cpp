@@ -0,0 +1,176 @@
+// Ops/sec and peak heap of RingQueue against the linked-list Queue it
+// replaced, on the relay pattern of the LoRa stacks: a burst of frames is
+// queued, a few copies of queued frames are offered again and the burst is
+// drained. Usage: RingQueueBench [rounds]
+
+#include <RingQueue.h>
+
+#include "AllocCounter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+
+// the Queue of LoraCommunication.cpp before the ring queue, unchanged
+template<typename T>
+class Queue {
+public:
+  struct Node {
+    T data;
+    Node* next;
+  };
+
+  int count = 0;
+
+  Node* head = NULL;
+
+  void addToLast(T data) {
+    // Check if data already exists in the queue
+    Node* current = head;
+    while (current != NULL) {
+      if (current->data == data) {
+        // Data already exists, do not add
+        return;
+      }
+      current = current->next;
+    }
+
+    // Data does not exist in the queue, add it
+    Node* newNode = new Node;
+    newNode->data = data;
+    newNode->next = NULL;
+
+    if (head == NULL) {
+      head = newNode;
+      count = 1;
+      return;
+    }
+
+    Node* last = head;
+    while (last->next != NULL) {
+      last = last->next;
+    }
+
+    last->next = newNode;
+    count++;
+  }
+
+  void removeFromFirst() {
+    if (head == NULL) {
+      // The list is already empty
+      return;
+    }
+    Node* tempNode = head;
+    head = head->next;
+    delete tempNode;
+    count--;
+  }
+
+  bool isEmpty() {
+    return head == NULL;
+  }
+
+  void clear() {
+    while (head != NULL) {
+      removeFromFirst();
+    }
+    count = 0;
+  }
+};
+
+// sized like a LoRa frame
+struct Frame {
+  uint8_t data[64];
+  uint8_t length;
+
+  bool operator==(const Frame& other) const {
+    return length == other.length && memcmp(data, other.data, length) == 0;
+  }
+};
+
+uint32_t ringQueueHash(const Frame& frame) {
+  return ringQueueHashBytes(frame.data, frame.length);
+}
+
+static Frame makeFrame(uint32_t id) {
+  Frame frame;
+  memset(frame.data, 0, sizeof(frame.data));
+  frame.length = 24 + id % 32;
+  memcpy(frame.data, &id, sizeof(id));
+  return frame;
+}
+
+static const int DUPLICATES = 4;  // copies offered again per burst
+
+// queues one burst of depth frames, offers repeats and drains it,
+// returns the number of operations
+template<typename Q>
+static unsigned long burst(Q& queue, const Frame* frames, int depth) {
+  unsigned long ops = 0;
+  for (int i = 0; i < depth; i++) {
+    queue.addToLast(frames[i]);
+    ops++;
+  }
+  for (int i = 0; i < DUPLICATES; i++) {
+    queue.addToLast(frames[(i * 7) % depth]);
+    ops++;
+  }
+  while (!queue.isEmpty()) {
+    queue.removeFromFirst();
+    ops++;
+  }
+  return ops;
+}
+
+struct Result {
+  double opsPerSecond;
+  size_t peakBytes;
+  size_t allocations;
+};
+
+template<typename Q>
+static Result run(Q& queue, const Frame* frames, int depth, unsigned long rounds) {
+  AllocStats before = allocStats();
+  resetAllocPeak();
+  unsigned long ops = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long round = 0; round < rounds; round++) {
+    ops += burst(queue, frames + round % 64, depth);
+  }
+  auto end = std::chrono::steady_clock::now();
+  AllocStats after = allocStats();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return { ops / seconds, after.peakBytes - before.liveBytes, after.allocations - before.allocations };
+}
+
+int main(int argc, char** argv) {
+  unsigned long rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  static const int DEPTHS[] = { 4, 16, 32 };
+  static Frame frames[64 + 32];
+  for (uint32_t i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+    frames[i] = makeFrame(i);
+  }
+
+  printf("%-6s %-10s %14s %12s %12s\n", "depth", "queue", "ops/s", "peak heap", "allocs");
+  for (int depth : DEPTHS) {
+    Queue<Frame> list;
+    Result listResult = run(list, frames, depth, rounds);
+
+    // allocated here so the queue itself is not counted as heap
+    static RingQueue<Frame, 32> ring;
+    Result ringResult = run(ring, frames, depth, rounds);
+
+    printf("%-6d %-10s %14.0f %12zu %12zu\n", depth, "Queue", listResult.opsPerSecond,
+           listResult.peakBytes, listResult.allocations);
+    printf("%-6d %-10s %14.0f %12zu %12zu\n", depth, "RingQueue", ringResult.opsPerSecond,
+           ringResult.peakBytes, ringResult.allocations);
+
+    if (ringResult.allocations != 0) {
+      fprintf(stderr, "RingQueue allocated %zu times\n", ringResult.allocations);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include <catch2/catch.hpp>
+
+#include <RingQueue.h>
+
+#include <string.h>
+
+struct Item {
+  uint32_t key;
+  uint32_t payload;
+
+  bool operator==(const Item& other) const {
+    return key == other.key;
+  }
+};
+
+uint32_t ringQueueHash(const Item& item) {
+  return ringQueueHashBytes(&item.key, sizeof(item.key));
+}
+
+// every key in one bucket, so lookups fall through to the scan
+struct Colliding {
+  uint32_t key;
+
+  bool operator==(const Colliding& other) const {
+    return key == other.key;
+  }
+};
+
+uint32_t ringQueueHash(const Colliding&) {
+  return 7;
+}
+
+static Item item(uint32_t key, uint32_t payload = 0) {
+  return Item{ key, payload };
+}
+
+TEST_CASE("elements come out in order across the wraparound", "[RingQueue]") {
+  RingQueue<Item, 4> queue;
+
+  // move the head around the ring several times
+  for (uint32_t round = 0; round < 10; round++) {
+    REQUIRE(queue.addToLast(item(round * 3 + 0)));
+    REQUIRE(queue.addToLast(item(round * 3 + 1)));
+    REQUIRE(queue.addToLast(item(round * 3 + 2)));
+    REQUIRE(queue.count == 3);
+    for (uint32_t i = 0; i < 3; i++) {
+      REQUIRE(queue.front().key == round * 3 + i);
+      queue.removeFromFirst();
+    }
+    REQUIRE(queue.isEmpty());
+  }
+}
+
+TEST_CASE("a full queue refuses until a slot is freed", "[RingQueue]") {
+  RingQueue<Item, 3> queue;
+  REQUIRE(queue.addToLast(item(1)));
+  REQUIRE(queue.addToLast(item(2)));
+  REQUIRE(queue.addToFirst(item(0)));
+  REQUIRE(queue.isFull());
+  REQUIRE(queue.freeSlots() == 0);
+  REQUIRE_FALSE(queue.addToLast(item(3)));
+  REQUIRE_FALSE(queue.addToFirst(item(3)));
+  REQUIRE(queue.reserveLast() == NULL);
+
+  queue.removeFromFirst();
+  REQUIRE(queue.addToLast(item(3)));
+  REQUIRE(queue.at(0).key == 1);
+  REQUIRE(queue.at(1).key == 2);
+  REQUIRE(queue.at(2).key == 3);
+}
+
+TEST_CASE("addToFirst wraps the head backwards", "[RingQueue]") {
+  RingQueue<Item, 4> queue;
+  REQUIRE(queue.addToFirst(item(2)));
+  REQUIRE(queue.addToFirst(item(1)));
+  REQUIRE(queue.addToLast(item(3)));
+  REQUIRE(queue.addToFirst(item(0)));
+  for (uint32_t i = 0; i < 4; i++) {
+    REQUIRE(queue.front().key == i);
+    queue.removeFromFirst();
+  }
+}
+
+TEST_CASE("the UNIQUE filter drops elements already queued", "[RingQueue]") {
+  RingQueue<Item, 8> queue;
+  REQUIRE(queue.addToLast(item(5, 1)));
+  // same key, equality decides, not the payload
+  REQUIRE_FALSE(queue.addToLast(item(5, 2)));
+  REQUIRE_FALSE(queue.addToFirst(item(5, 3)));
+  REQUIRE(queue.count == 1);
+  REQUIRE(queue.front().payload == 1);
+
+  // once dequeued the key may come again
+  queue.removeFromFirst();
+  REQUIRE(queue.addToLast(item(5, 4)));
+  REQUIRE(queue.front().payload == 4);
+
+  // clear() empties the filter as well
+  queue.clear();
+  REQUIRE(queue.addToLast(item(5, 5)));
+}
+
+TEST_CASE("colliding hashes still compare the elements", "[RingQueue]") {
+  RingQueue<Colliding, 4> queue;
+  REQUIRE(queue.addToLast(Colliding{ 1 }));
+  REQUIRE(queue.addToLast(Colliding{ 2 }));
+  REQUIRE_FALSE(queue.addToLast(Colliding{ 1 }));
+  queue.removeFromFirst();
+  REQUIRE(queue.addToLast(Colliding{ 1 }));
+  REQUIRE_FALSE(queue.addToLast(Colliding{ 2 }));
+  REQUIRE(queue.count == 2);
+}
+
+TEST_CASE("a queue without UNIQUE keeps repeats", "[RingQueue]") {
+  RingQueue<Item, 4, false> queue;
+  REQUIRE(queue.addToLast(item(9)));
+  REQUIRE(queue.addToLast(item(9)));
+  REQUIRE(queue.addToFirst(item(9)));
+  REQUIRE(queue.count == 3);
+}
+
+TEST_CASE("reserveLast and commitLast fill the tail in place", "[RingQueue]") {
+  RingQueue<Item, 4> queue;
+  REQUIRE(queue.addToLast(item(1)));
+
+  Item* slot = queue.reserveLast();
+  REQUIRE(slot != NULL);
+  slot->key = 2;
+  slot->payload = 20;
+  // not queued until committed
+  REQUIRE(queue.count == 1);
+  REQUIRE(queue.commitLast());
+  REQUIRE(queue.count == 2);
+  REQUIRE(queue.at(1).payload == 20);
+
+  // a duplicate written into the slot is not committed
+  slot = queue.reserveLast();
+  slot->key = 1;
+  REQUIRE_FALSE(queue.commitLast());
+  REQUIRE(queue.count == 2);
+
+  // an abandoned reservation is overwritten by the next add
+  slot = queue.reserveLast();
+  slot->key = 77;
+  REQUIRE(queue.addToLast(item(3)));
+  REQUIRE(queue.at(2).key == 3);
+  REQUIRE(queue.addToLast(item(77)));
+}
+
+TEST_CASE("reserveLast follows the tail across the wraparound", "[RingQueue]") {
+  RingQueue<Item, 3> queue;
+  for (uint32_t key = 0; key < 10; key++) {
+    Item* slot = queue.reserveLast();
+    REQUIRE(slot != NULL);
+    *slot = item(key);
+    REQUIRE(queue.commitLast());
+    if (queue.count == 2) {
+      REQUIRE(queue.front().key == key - 1);
+      queue.removeFromFirst();
+    }
+  }
+}
+
+TEST_CASE("removeIfMatches takes out the first match and keeps the order", "[RingQueue]") {
+  RingQueue<Item, 5> queue;
+  // start off the first slot so the shift crosses the end of the array
+  queue.addToLast(item(100));
+  queue.addToLast(item(101));
+  queue.addToLast(item(102));
+  queue.removeFromFirst();
+  queue.removeFromFirst();
+  queue.removeFromFirst();
+  for (uint32_t key = 0; key < 5; key++) {
+    queue.addToLast(item(key, key % 2));
+  }
+
+  REQUIRE(queue.removeIfMatches([](const Item& entry) { return entry.payload == 1; }));
+  REQUIRE(queue.count == 4);
+  uint32_t expected[] = { 0, 2, 3, 4 };
+  for (size_t i = 0; i < 4; i++) {
+    REQUIRE(queue.at(i).key == expected[i]);
+  }
+
+  REQUIRE_FALSE(queue.removeIfMatches([](const Item& entry) { return entry.key == 42; }));
+
+  // the removed key left the filter, the others are still in it
+  REQUIRE(queue.addToLast(item(1)));
+  REQUIRE_FALSE(queue.addToLast(item(3)));
+
+  // removing the tail and the head
+  REQUIRE(queue.removeIfMatches([](const Item& entry) { return entry.key == 1; }));
+  REQUIRE(queue.removeIfMatches([](const Item& entry) { return entry.key == 0; }));
+  REQUIRE(queue.count == 3);
+  REQUIRE(queue.front().key == 2);
+  REQUIRE(queue.at(2).key == 4);
+}
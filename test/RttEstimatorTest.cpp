@@ -0,0 +1,87 @@
+#include <catch2/catch.hpp>
+
+#include <RttEstimator.h>
+
+#include <algorithm>
+
+TEST_CASE("the timeout starts out at the initial RTO", "[RttEstimator]") {
+  RttEstimator rtt;
+  REQUIRE(rtt.rto() == RTT_INITIAL_RTO);
+  REQUIRE(rtt.getSamples() == 0);
+}
+
+TEST_CASE("SRTT and RTTVAR follow the samples with gains 1/8 and 1/4", "[RttEstimator]") {
+  RttEstimator rtt;
+  // the first sample sets SRTT and half of it as RTTVAR
+  rtt.addSample(800);
+  REQUIRE(rtt.getSrtt() == 800);
+  REQUIRE(rtt.getRttvar() == 400);
+  REQUIRE(rtt.rto() == 800 + 4 * 400);
+
+  rtt.addSample(1200);
+  REQUIRE(rtt.getRttvar() == (3 * 400 + 400) / 4);
+  REQUIRE(rtt.getSrtt() == (7 * 800 + 1200) / 8);
+  REQUIRE(rtt.rto() == 850 + 4 * 400);
+
+  rtt.addSample(850);
+  REQUIRE(rtt.getRttvar() == (3 * 400 + 0) / 4);
+  REQUIRE(rtt.getSrtt() == 850);
+  REQUIRE(rtt.getSamples() == 3);
+}
+
+TEST_CASE("a steady link brings the timeout down to its round trip", "[RttEstimator]") {
+  RttEstimator rtt;
+  for (int i = 0; i < 100; i++) {
+    rtt.addSample(2000);
+  }
+  REQUIRE(rtt.getSrtt() == 2000);
+  REQUIRE(rtt.rto() < 2100);
+
+  // a jittery one keeps a margin above its mean
+  RttEstimator jittery;
+  for (int i = 0; i < 100; i++) {
+    jittery.addSample(i % 2 == 0 ? 1500 : 2500);
+  }
+  REQUIRE(jittery.getSrtt() > 1800);
+  REQUIRE(jittery.getSrtt() < 2200);
+  REQUIRE(jittery.rto() > 3500);
+}
+
+TEST_CASE("the timeout stays within its bounds", "[RttEstimator]") {
+  RttEstimator fast;
+  for (int i = 0; i < 20; i++) {
+    fast.addSample(40);
+  }
+  REQUIRE(fast.rto() == RTT_MIN_RTO);
+
+  RttEstimator slow;
+  slow.addSample(20000);
+  REQUIRE(slow.rto() == RTT_MAX_RTO);
+}
+
+TEST_CASE("timeouts double the RTO until the next sample", "[RttEstimator]") {
+  RttEstimator rtt;
+  rtt.addSample(600);
+  uint32_t base = rtt.rto();
+  REQUIRE(base == 1800);
+
+  for (int i = 1; i <= RTT_MAX_BACKOFF; i++) {
+    rtt.backoff();
+    REQUIRE(rtt.rto() == std::min<uint32_t>(base << i, RTT_MAX_RTO));
+  }
+  // no further than RTT_MAX_BACKOFF doublings
+  rtt.backoff();
+  REQUIRE(rtt.rto() == std::min<uint32_t>(base << RTT_MAX_BACKOFF, RTT_MAX_RTO));
+  REQUIRE(rtt.getTimeouts() == RTT_MAX_BACKOFF + 1);
+
+  // the link answers again
+  rtt.addSample(600);
+  REQUIRE(rtt.rto() < base);
+  REQUIRE(rtt.getTimeouts() == RTT_MAX_BACKOFF + 1);
+
+  SECTION("before the first sample as well") {
+    RttEstimator fresh;
+    fresh.backoff();
+    REQUIRE(fresh.rto() == 2 * RTT_INITIAL_RTO);
+  }
+}
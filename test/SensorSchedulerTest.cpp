@@ -0,0 +1,209 @@
+#include <catch2/catch.hpp>
+
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include <SensorScheduler.h>
+
+#include <vector>
+
+static const unsigned long LOOP_TIME = 5;  // ms the rest of the loop keeps the MCU awake
+
+// the sketch's loop without the radio: take what is due, then sleep until the
+// next action. Returns when readings were taken, adds the ms spent awake.
+static std::vector<unsigned long> run(SensorScheduler& scheduler, unsigned long until, unsigned long& awake) {
+  std::vector<unsigned long> taken;
+  while (millis() < until) {
+    unsigned long now = millis();
+    if (scheduler.poll(now) == true) {
+      taken.push_back(now);
+    }
+    mockAdvanceMillis(LOOP_TIME);
+    awake += LOOP_TIME;
+    now = millis();
+    unsigned long wait = scheduler.wait(now);
+    if (wait >= SENSOR_MIN_SLEEP) {
+      scheduler.lightSleep(wait, -1);
+    }
+  }
+  return taken;
+}
+
+TEST_CASE("single shot is picked above its break-even interval", "[SensorScheduler]") {
+  // 90 mC per shot over the 14.85 mA periodic mode costs above idle
+  unsigned long breakEven = (unsigned long)(SCD4X_SINGLE_SHOT_CHARGE / (SCD4X_PERIODIC_CURRENT_MA - SCD4X_IDLE_CURRENT_MA) * 1000.0f);
+  REQUIRE(breakEven == 6060);
+  REQUIRE(sensorModeFor(SCD4X_PERIODIC_INTERVAL) == SENSOR_PERIODIC);
+  REQUIRE(sensorModeFor(breakEven) == SENSOR_PERIODIC);
+  REQUIRE(sensorModeFor(breakEven + 1) == SENSOR_SINGLE_SHOT);
+  REQUIRE(sensorModeFor(60000) == SENSOR_SINGLE_SHOT);
+}
+
+TEST_CASE("the interval is raised to what the mode delivers", "[SensorScheduler]") {
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+  scheduler.begin(sensor, SENSOR_SINGLE_SHOT, 1000, 0);
+  REQUIRE(scheduler.getInterval() == SCD4X_SINGLE_SHOT_TIME);
+  scheduler.begin(sensor, SENSOR_LOW_POWER, 10000, millis());
+  REQUIRE(scheduler.getInterval() == SCD4X_LOW_POWER_INTERVAL);
+  scheduler.begin(sensor, SENSOR_PERIODIC, 12000, millis());
+  REQUIRE(scheduler.getInterval() == 12000);
+}
+
+TEST_CASE("single shot readings stay on the grid with the MCU asleep in between", "[SensorScheduler]") {
+  const unsigned long interval = 60000;
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+  REQUIRE(scheduler.begin(sensor, SENSOR_SINGLE_SHOT, interval, 0));
+  // begin() waited for the sensor to stop
+  unsigned long started = millis();
+  REQUIRE(started == SCD4X_STOP_TIME);
+
+  unsigned long awake = 0;
+  std::vector<unsigned long> taken = run(scheduler, started + 10 * interval, awake);
+  REQUIRE(taken.size() == 10);
+  for (size_t i = 0; i < taken.size(); i++) {
+    // a shot started SCD4X_SINGLE_SHOT_TIME ahead, the sample is read on the grid
+    REQUIRE(taken[i] >= started + SCD4X_SINGLE_SHOT_TIME + i * interval);
+    REQUIRE(taken[i] < started + SCD4X_SINGLE_SHOT_TIME + i * interval + SENSOR_MIN_SLEEP);
+  }
+  REQUIRE(scheduler.getReadings() == 10);
+
+  unsigned long now = millis();
+  float elapsed = now - started;
+  // the loop's own time is all the MCU is awake for, to the float's precision
+  REQUIRE(scheduler.mcuDutyCycle(now) == Approx(awake / elapsed).margin(0.00001));
+  REQUIRE(scheduler.mcuDutyCycle(now) < 0.01f);
+  // one shot per reading, each measuring for SCD4X_SINGLE_SHOT_TIME
+  REQUIRE(scheduler.sensorDutyCycle(now) == Approx(10 * SCD4X_SINGLE_SHOT_TIME / elapsed));
+  REQUIRE(scheduler.sensorCurrent(now) == Approx(SCD4X_IDLE_CURRENT_MA + 10 * SCD4X_SINGLE_SHOT_CHARGE * 1000.0f / elapsed));
+}
+
+TEST_CASE("the periodic modes are read once per interval", "[SensorScheduler]") {
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+  scheduler.begin(sensor, SENSOR_LOW_POWER, 60000, 0);
+  unsigned long started = millis();
+
+  unsigned long awake = 0;
+  std::vector<unsigned long> taken = run(scheduler, started + 300000, awake);
+  // the first sample takes a whole cadence, then one per interval
+  REQUIRE(taken.size() == 5);
+  REQUIRE(taken[0] == started + SCD4X_LOW_POWER_INTERVAL);
+  for (size_t i = 1; i < taken.size(); i++) {
+    REQUIRE(taken[i] == taken[0] + i * 60000);
+  }
+  unsigned long now = millis();
+  REQUIRE(scheduler.sensorDutyCycle(now) == 1.0f);
+  REQUIRE(scheduler.sensorCurrent(now) == SCD4X_LOW_POWER_CURRENT_MA);
+}
+
+TEST_CASE("a reading waits for the sensor's sample", "[SensorScheduler]") {
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+  scheduler.begin(sensor, SENSOR_PERIODIC, 10000, 0);
+  unsigned long due = millis() + SCD4X_PERIODIC_INTERVAL;
+  sensor.dataReady = false;
+
+  SECTION("checked every SENSOR_READY_POLL until it is there") {
+    REQUIRE(scheduler.poll(due) == false);
+    REQUIRE(scheduler.wait(due) == SENSOR_READY_POLL);
+    REQUIRE(scheduler.poll(due + SENSOR_READY_POLL) == false);
+    sensor.dataReady = true;
+    REQUIRE(scheduler.poll(due + 2 * SENSOR_READY_POLL) == true);
+    // the grid does not move with the late sample
+    REQUIRE(scheduler.untilReading(due + 2 * SENSOR_READY_POLL) == 10000 - 2 * SENSOR_READY_POLL);
+  }
+
+  SECTION("given up on after a whole interval") {
+    unsigned long now = due;
+    while (now < due + 10000) {
+      REQUIRE(scheduler.poll(now) == false);
+      now += scheduler.wait(now);
+    }
+    REQUIRE(scheduler.poll(now) == false);
+    REQUIRE(scheduler.getReadings() == 0);
+    // the next try is the next reading on the grid
+    REQUIRE(scheduler.untilReading(now) == 10000);
+  }
+}
+
+TEST_CASE("readings missed while busy are skipped", "[SensorScheduler]") {
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+  scheduler.begin(sensor, SENSOR_PERIODIC, 10000, 0);
+  unsigned long first = millis() + SCD4X_PERIODIC_INTERVAL;
+  REQUIRE(scheduler.poll(first + 25000) == true);
+  REQUIRE(scheduler.untilReading(first + 25000) == 5000);
+  REQUIRE(scheduler.getReadings() == 1);
+}
+
+TEST_CASE("a sensor action shortly after a radio wake moves onto it", "[SensorScheduler]") {
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+
+  SECTION("the start of a single shot") {
+    scheduler.begin(sensor, SENSOR_SINGLE_SHOT, 60000, 0);
+    unsigned long now = millis();
+    scheduler.poll(now);
+    unsigned long sampled = now + SCD4X_SINGLE_SHOT_TIME;
+    REQUIRE(scheduler.poll(sampled) == true);
+    unsigned long trigger = sampled + scheduler.wait(sampled);
+
+    // too far ahead, or after the action
+    scheduler.alignTo(trigger - SENSOR_ALIGN_SLACK - 1);
+    REQUIRE(sampled + scheduler.wait(sampled) == trigger);
+    scheduler.alignTo(trigger + 100);
+    REQUIRE(sampled + scheduler.wait(sampled) == trigger);
+
+    scheduler.alignTo(trigger - SENSOR_ALIGN_SLACK);
+    REQUIRE(sampled + scheduler.wait(sampled) == trigger - SENSOR_ALIGN_SLACK);
+
+    // a shot under way is not done any sooner
+    now = trigger - SENSOR_ALIGN_SLACK;
+    REQUIRE(scheduler.poll(now) == false);
+    unsigned long ready = now + scheduler.wait(now);
+    scheduler.alignTo(ready - 100);
+    REQUIRE(now + scheduler.wait(now) == ready);
+  }
+
+  SECTION("a periodic sample only when the sensor measures more often than it is read") {
+    scheduler.begin(sensor, SENSOR_PERIODIC, SCD4X_PERIODIC_INTERVAL, 0);
+    unsigned long now = millis();
+    unsigned long due = now + scheduler.wait(now);
+    scheduler.alignTo(due - 1000);
+    REQUIRE(now + scheduler.wait(now) == due);
+
+    scheduler.begin(sensor, SENSOR_PERIODIC, 2 * SCD4X_PERIODIC_INTERVAL, millis());
+    now = millis();
+    due = now + scheduler.wait(now);
+    scheduler.alignTo(due - 1000);
+    REQUIRE(now + scheduler.wait(now) == due - 1000);
+  }
+}
+
+TEST_CASE("the time actually slept is counted", "[SensorScheduler]") {
+  SensirionI2CScd4x sensor;
+  SensorScheduler scheduler;
+  mockSetMillis(0);
+  scheduler.begin(sensor, SENSOR_SINGLE_SHOT, 60000, 0);
+  unsigned long started = millis();
+
+  // too short to be worth it
+  REQUIRE(scheduler.lightSleep(SENSOR_MIN_SLEEP - 1, -1) == 0);
+  REQUIRE(millis() == started);
+
+  REQUIRE(scheduler.lightSleep(1000, -1) == 1000);
+  // a packet wakes the MCU early
+  mockWakeAfter(300);
+  REQUIRE(scheduler.lightSleep(1000, 4) == 300);
+  mockAdvanceMillis(700);
+
+  REQUIRE(millis() == started + 2000);
+  REQUIRE(scheduler.mcuDutyCycle(millis()) == Approx(0.35f));
+}
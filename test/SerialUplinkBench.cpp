@@ -0,0 +1,76 @@
+// Frames/s and bytes/s the host gets through UplinkDecoder, on a stream of
+// full reading frames with the odd stats and log frame in between, as the
+// master sends them. Usage: SerialUplinkBench [frames]
+
+#include <SerialUplink.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+// a recorded stream of the given number of frames
+static std::vector<uint8_t> makeStream(unsigned long frames) {
+  std::vector<uint8_t> stream;
+  UplinkEncoder encoder;
+  uint8_t frame[UPLINK_MAX_FRAME];
+  for (unsigned long n = 0; n < frames; n++) {
+    size_t length;
+    if (n % 20 == 19) {
+      length = encodeUplinkLog(n, 2, n * 100, "parent lost, rediscovering", frame);
+    } else if (n % 20 == 9) {
+      LoraStatsRecord record = {};
+      record.MACaddr[5] = n;
+      record.uptime = n;
+      encoder.addStats(record, 0);
+      length = encoder.finish(frame);
+    } else {
+      for (int i = 0; i < UPLINK_MAX_READINGS; i++) {
+        UplinkReading reading = {};
+        reading.protocol = UPLINK_PROTOCOL_LORA;
+        reading.origin[5] = i;
+        reading.seq = n;
+        reading.receivedAt = n * 100 + i;
+        reading.c02Data = 400 + i;
+        reading.temperatureData = 27.5f;
+        reading.humidityData = 60.0f;
+        encoder.addReading(reading, 0);
+      }
+      length = encoder.finish(frame);
+    }
+    stream.insert(stream.end(), frame, frame + length);
+  }
+  return stream;
+}
+
+int main(int argc, char** argv) {
+  unsigned long frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  std::vector<uint8_t> stream = makeStream(frames);
+
+  UplinkDecoder decoder;
+  unsigned long readings = 0;
+  UplinkReading reading;
+  auto start = std::chrono::steady_clock::now();
+  for (uint8_t byte : stream) {
+    if (decoder.push(byte) == false || decoder.type() != UPLINK_READINGS) {
+      continue;
+    }
+    for (int i = 0; i < decoder.count(); i++) {
+      decoder.reading(i, &reading);
+      readings++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+
+  printf("%lu frames, %lu readings, %zu bytes in %.3f s\n", frames, readings, stream.size(), seconds);
+  printf("%.0f frames/s, %.0f readings/s, %.1f MB/s\n", frames / seconds, readings / seconds,
+         stream.size() / seconds / 1e6);
+
+  if (decoder.getFrames() != frames) {
+    fprintf(stderr, "decoded %u of %lu frames\n", decoder.getFrames(), frames);
+    return 1;
+  }
+  return 0;
+}
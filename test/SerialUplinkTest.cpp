@@ -0,0 +1,227 @@
+#include <catch2/catch.hpp>
+
+#include <SerialUplink.h>
+
+#include <string.h>
+
+static const uint8_t ORIGIN[MAC_ADDR_LENGTH] = { 0x24, 0x6F, 0x28, 0x0A, 0x0B, 0x0C };
+
+static UplinkReading makeReading(uint8_t id) {
+  UplinkReading reading = {};
+  reading.protocol = id % 2 == 0 ? UPLINK_PROTOCOL_LORA : UPLINK_PROTOCOL_ESPNOW;
+  memcpy(reading.origin, ORIGIN, MAC_ADDR_LENGTH);
+  reading.origin[5] = id;
+  reading.seq = 1000 + id;
+  reading.receivedAt = 0x01020300 + id;
+  reading.c02Data = 400 + id;
+  reading.temperatureData = -3.25f;
+  reading.humidityData = 61.5f;
+  return reading;
+}
+
+// feeds a frame to the decoder, true if its last byte completed a valid frame
+static bool pushFrame(UplinkDecoder& decoder, const uint8_t* frame, size_t length) {
+  bool valid = false;
+  for (size_t i = 0; i < length; i++) {
+    valid = decoder.push(frame[i]);
+    if (i + 1 < length) {
+      REQUIRE(valid == false);
+    }
+  }
+  return valid;
+}
+
+// frames a payload with its header, for payloads the encoder would not build
+static size_t rawFrame(uint8_t type, uint8_t count, size_t length, uint8_t* frame) {
+  uint8_t payload[UPLINK_MAX_FRAME];
+  memset(payload, 'x', sizeof(payload));
+  payload[0] = (UPLINK_FRAME_VERSION << 4) | type;
+  payload[1] = 7;
+  payload[2] = 0;
+  payload[3] = count;
+  return uplinkFrame(payload, length, frame);
+}
+
+TEST_CASE("a full frame of readings round trips", "[SerialUplink]") {
+  UplinkEncoder encoder;
+  for (int i = 0; i < UPLINK_MAX_READINGS; i++) {
+    REQUIRE(encoder.isDue(0, 200) == false);
+    REQUIRE(encoder.addReading(makeReading(i), 0));
+  }
+  REQUIRE(encoder.isDue(0, 200));
+  REQUIRE(encoder.addReading(makeReading(99), 0) == false);
+
+  uint8_t frame[UPLINK_MAX_FRAME];
+  size_t length = encoder.finish(frame);
+  REQUIRE(length <= UPLINK_MAX_FRAME);
+  REQUIRE(memchr(frame, 0, length - 1) == NULL);
+  REQUIRE(frame[length - 1] == 0);
+  REQUIRE(encoder.isEmpty());
+
+  UplinkDecoder decoder;
+  REQUIRE(pushFrame(decoder, frame, length));
+  REQUIRE(decoder.type() == UPLINK_READINGS);
+  REQUIRE(decoder.seq() == 0);
+  REQUIRE(decoder.count() == UPLINK_MAX_READINGS);
+  for (int i = 0; i < UPLINK_MAX_READINGS; i++) {
+    UplinkReading reading;
+    REQUIRE(decoder.reading(i, &reading));
+    UplinkReading sent = makeReading(i);
+    REQUIRE(reading.protocol == sent.protocol);
+    REQUIRE(memcmp(reading.origin, sent.origin, MAC_ADDR_LENGTH) == 0);
+    REQUIRE(reading.seq == sent.seq);
+    REQUIRE(reading.receivedAt == sent.receivedAt);
+    REQUIRE(reading.c02Data == sent.c02Data);
+    REQUIRE(reading.temperatureData == Approx(-3.25f));
+    REQUIRE(reading.humidityData == Approx(61.5f));
+  }
+
+  // only the records the frame holds
+  UplinkReading reading;
+  LoraStatsRecord record;
+  UplinkLog log;
+  REQUIRE(decoder.reading(UPLINK_MAX_READINGS, &reading) == false);
+  REQUIRE(decoder.reading(-1, &reading) == false);
+  REQUIRE(decoder.stats(0, &record) == false);
+  REQUIRE(decoder.log(&log) == false);
+  REQUIRE(decoder.getFrames() == 1);
+}
+
+TEST_CASE("stats records round trip and frames count up", "[SerialUplink]") {
+  UplinkEncoder encoder;
+  LoraStatsRecord sent = {};
+  memcpy(sent.MACaddr, ORIGIN, MAC_ADDR_LENGTH);
+  sent.uptime = 86400;
+  sent.txTime = 123456;
+  sent.rxTime = 0;  // zero bytes are COBS encoded
+  sent.readings = 0xFFFF;
+  sent.charge = 0xDEADBEEF;
+  REQUIRE(encoder.addStats(sent, 10));
+  // a frame holds a single type
+  REQUIRE(encoder.addReading(makeReading(1), 10) == false);
+  REQUIRE(encoder.isDue(209, 200) == false);
+  REQUIRE(encoder.isDue(210, 200));
+
+  UplinkDecoder decoder;
+  uint8_t frame[UPLINK_MAX_FRAME];
+  REQUIRE(pushFrame(decoder, frame, encoder.finish(frame)));
+  REQUIRE(encoder.addStats(sent, 20));
+  REQUIRE(pushFrame(decoder, frame, encoder.finish(frame)));
+  REQUIRE(decoder.type() == UPLINK_STATS);
+  REQUIRE(decoder.seq() == 1);
+
+  LoraStatsRecord record;
+  REQUIRE(decoder.stats(0, &record));
+  REQUIRE(memcmp(record.MACaddr, ORIGIN, MAC_ADDR_LENGTH) == 0);
+  REQUIRE(record.uptime == 86400);
+  REQUIRE(record.txTime == 123456);
+  REQUIRE(record.rxTime == 0);
+  REQUIRE(record.readings == 0xFFFF);
+  REQUIRE(record.charge == 0xDEADBEEF);
+  REQUIRE(decoder.stats(1, &record) == false);
+}
+
+TEST_CASE("log text round trips and is cut to the payload", "[SerialUplink]") {
+  UplinkDecoder decoder;
+  UplinkLog log;
+  uint8_t frame[UPLINK_MAX_FRAME];
+
+  REQUIRE(pushFrame(decoder, frame, encodeUplinkLog(3, 2, 5000, "parent lost", frame)));
+  REQUIRE(decoder.type() == UPLINK_LOG);
+  REQUIRE(decoder.log(&log));
+  REQUIRE(log.level == 2);
+  REQUIRE(log.time == 5000);
+  REQUIRE(strcmp(log.text, "parent lost") == 0);
+
+  char text[UPLINK_MAX_LOG_TEXT + 20];
+  memset(text, 'a', sizeof(text) - 1);
+  text[sizeof(text) - 1] = '\0';
+  size_t length = encodeUplinkLog(4, 1, 6000, text, frame);
+  REQUIRE(length == UPLINK_MAX_FRAME);
+  REQUIRE(pushFrame(decoder, frame, length));
+  REQUIRE(decoder.log(&log));
+  REQUIRE(strlen(log.text) == UPLINK_MAX_LOG_TEXT);
+  REQUIRE(decoder.reading(0, NULL) == false);
+}
+
+TEST_CASE("payloads past the maximum are framing errors", "[SerialUplink]") {
+  UplinkDecoder decoder;
+  uint8_t frame[UPLINK_MAX_FRAME + 1];
+
+  // one text byte more than UPLINK_MAX_LOG_TEXT would overrun UplinkLog.text
+  size_t length = rawFrame(UPLINK_LOG, 1, UPLINK_MAX_PAYLOAD + 1, frame);
+  REQUIRE(length == UPLINK_MAX_FRAME + 1);
+  REQUIRE(pushFrame(decoder, frame, length) == false);
+  REQUIRE(decoder.getFramingErrors() == 1);
+  UplinkLog log;
+  REQUIRE(decoder.log(&log) == false);
+
+  // the next good frame still decodes
+  length = rawFrame(UPLINK_LOG, 1, UPLINK_MAX_PAYLOAD, frame);
+  REQUIRE(pushFrame(decoder, frame, length));
+  REQUIRE(decoder.log(&log));
+  REQUIRE(strlen(log.text) == UPLINK_MAX_LOG_TEXT);
+  REQUIRE(decoder.getFrames() == 1);
+}
+
+TEST_CASE("records that do not match the count are framing errors", "[SerialUplink]") {
+  UplinkDecoder decoder;
+  uint8_t frame[UPLINK_MAX_FRAME];
+
+  size_t length = rawFrame(UPLINK_READINGS, 2, UPLINK_HEADER_LENGTH + UPLINK_READING_LENGTH, frame);
+  REQUIRE(pushFrame(decoder, frame, length) == false);
+  length = rawFrame(UPLINK_STATS, 1, UPLINK_HEADER_LENGTH + UPLINK_STATS_LENGTH - 1, frame);
+  REQUIRE(pushFrame(decoder, frame, length) == false);
+  length = rawFrame(UPLINK_LOG, 1, UPLINK_HEADER_LENGTH + UPLINK_LOG_HEADER_LENGTH - 1, frame);
+  REQUIRE(pushFrame(decoder, frame, length) == false);
+  length = rawFrame(UPLINK_LOG, 2, UPLINK_HEADER_LENGTH + UPLINK_LOG_HEADER_LENGTH, frame);
+  REQUIRE(pushFrame(decoder, frame, length) == false);
+  length = rawFrame(9, 0, UPLINK_HEADER_LENGTH, frame);
+  REQUIRE(pushFrame(decoder, frame, length) == false);
+  REQUIRE(decoder.getFramingErrors() == 5);
+  REQUIRE(decoder.getCrcErrors() == 0);
+  REQUIRE(decoder.getFrames() == 0);
+}
+
+TEST_CASE("the decoder resynchronises after noise", "[SerialUplink]") {
+  UplinkEncoder encoder;
+  REQUIRE(encoder.addReading(makeReading(5), 0));
+  uint8_t frame[UPLINK_MAX_FRAME];
+  size_t length = encoder.finish(frame);
+  UplinkDecoder decoder;
+
+  SECTION("a corrupted byte fails the CRC") {
+    frame[length / 2] ^= 0x10;
+    REQUIRE(pushFrame(decoder, frame, length) == false);
+    REQUIRE(decoder.getCrcErrors() == 1);
+    frame[length / 2] ^= 0x10;
+  }
+
+  SECTION("a frame cut short by a reset") {
+    for (size_t i = 0; i < length / 2; i++) {
+      REQUIRE(decoder.push(frame[i]) == false);
+    }
+    REQUIRE(decoder.push(0) == false);
+    REQUIRE(decoder.getCrcErrors() + decoder.getFramingErrors() == 1);
+  }
+
+  SECTION("a run of noise longer than any frame") {
+    for (int i = 0; i < 3 * UPLINK_MAX_FRAME; i++) {
+      REQUIRE(decoder.push(0x5A) == false);
+    }
+    REQUIRE(decoder.push(0) == false);
+    REQUIRE(decoder.getFramingErrors() == 1);
+  }
+
+  SECTION("lone delimiters") {
+    REQUIRE(decoder.push(0) == false);
+    REQUIRE(decoder.push(0) == false);
+    REQUIRE(decoder.getCrcErrors() + decoder.getFramingErrors() == 0);
+  }
+
+  REQUIRE(pushFrame(decoder, frame, length));
+  UplinkReading reading;
+  REQUIRE(decoder.reading(0, &reading));
+  REQUIRE(reading.seq == 1005);
+  REQUIRE(decoder.getFrames() == 1);
+}
@@ -0,0 +1,286 @@
+#include <catch2/catch.hpp>
+
+#include <TimeSeriesBuffer.h>
+
+#include <math.h>
+#include <random>
+#include <vector>
+
+typedef std::vector<TimeSeriesSample> Trace;
+
+// an SCD4x indoor trace at a 5 s interval: a few ms of jitter, slow drift
+// with sensor noise on top, a seq that wraps and skips now and then
+static Trace indoorTrace(size_t length) {
+  std::mt19937 random(1);
+  std::normal_distribution<float> noise(0, 1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  Trace trace;
+  uint32_t time = 123456;
+  float c02 = 600, temperature = 24, humidity = 55;
+  for (size_t i = 0; i < length; i++) {
+    time += 5000 + (int)(uniform(random) * 4) - 1;
+    c02 += 0.9f * sinf(i / 300.0f) + noise(random) * 2;
+    temperature += noise(random) * 0.003f;
+    humidity += noise(random) * 0.01f;
+    uint16_t seq = 65500 + i + (i % 97 == 0);
+    trace.push_back({ time, seq, roundf(c02 + noise(random) * 5), temperature + noise(random) * 0.02f,
+                      humidity + noise(random) * 0.08f });
+  }
+  return trace;
+}
+
+// the random values a node sends without a sensor
+static Trace randomTrace(size_t length) {
+  std::mt19937 random(2);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  Trace trace;
+  uint32_t time = 0;
+  for (size_t i = 0; i < length; i++) {
+    time += 5000 + (int)(uniform(random) * 4);
+    trace.push_back({ time, (uint16_t)i, 100 + uniform(random) * 900, uniform(random) * 40,
+                      90 + uniform(random) * 560 });
+  }
+  return trace;
+}
+
+// a sample as it comes back, in the fixed point it is stored in
+static void requireStored(const TimeSeriesSample& sample, const TimeSeriesSample& sent) {
+  REQUIRE(sample.time == sent.time);
+  REQUIRE(sample.seq == sent.seq);
+  REQUIRE(sample.c02Data == roundf(sent.c02Data));
+  REQUIRE(sample.temperatureData == Approx(roundf(sent.temperatureData * 100) / 100).margin(1e-3));
+  REQUIRE(sample.humidityData == Approx(roundf(sent.humidityData * 100) / 100).margin(1e-3));
+}
+
+// fills the buffer as far as it goes without dropping, returns the samples stored
+static size_t fill(TimeSeriesBuffer& buffer, const Trace& trace) {
+  size_t stored = 0;
+  while (stored < trace.size() && buffer.bytesUsed() + TS_MAX_SAMPLE_BITS / 8 < TS_BLOCK_SIZE * TS_BLOCK_COUNT) {
+    buffer.append(trace[stored++]);
+  }
+  return stored;
+}
+
+// where spilled blocks go, FlashBacklog on a node
+static std::vector<std::vector<uint8_t>> spilled;
+static std::vector<uint16_t> spilledSamples;
+static bool spillAccepts = true;
+
+static bool spillBlock(const uint8_t* block, uint16_t samples) {
+  if (spillAccepts == false) {
+    return false;
+  }
+  spilled.push_back(std::vector<uint8_t>(block, block + TS_BLOCK_SIZE));
+  spilledSamples.push_back(samples);
+  return true;
+}
+
+// the samples of every spilled block, oldest first
+static Trace replaySpilled() {
+  Trace replayed;
+  for (size_t i = 0; i < spilled.size(); i++) {
+    TimeSeriesBlockReader reader;
+    reader.begin(spilled[i].data(), spilledSamples[i]);
+    TimeSeriesSample sample;
+    while (reader.next(&sample)) {
+      replayed.push_back(sample);
+    }
+    REQUIRE(reader.remaining() == 0);
+  }
+  return replayed;
+}
+
+static void resetSpill() {
+  spilled.clear();
+  spilledSamples.clear();
+  spillAccepts = true;
+}
+
+// large enough for the stack of a test case otherwise
+static TimeSeriesBuffer buffer;
+
+TEST_CASE("an indoor trace round trips at a fifth of its size", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  uint32_t droppedBefore = buffer.getDropped();
+  Trace trace = indoorTrace(2000);
+  size_t stored = fill(buffer, trace);
+  REQUIRE(buffer.count() == stored);
+
+  // the 5.0x of the header, against a 20 byte LoraReading
+  double bytesPerSample = (double)buffer.bytesUsed() / stored;
+  REQUIRE(bytesPerSample < 4.2);
+  REQUIRE(stored > 950);
+
+  TimeSeriesSample sample;
+  for (size_t i = 0; i < stored; i++) {
+    REQUIRE(buffer.pop(&sample));
+    requireStored(sample, trace[i]);
+  }
+  REQUIRE(buffer.pop(&sample) == false);
+  REQUIRE(buffer.isEmpty());
+  REQUIRE(buffer.bytesUsed() == 0);
+  REQUIRE(buffer.getDropped() == droppedBefore);
+}
+
+TEST_CASE("random values round trip at 2.5x", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  Trace trace = randomTrace(1000);
+  size_t stored = fill(buffer, trace);
+
+  double bytesPerSample = (double)buffer.bytesUsed() / stored;
+  REQUIRE(bytesPerSample < 8.5);
+
+  TimeSeriesSample sample;
+  for (size_t i = 0; i < stored; i++) {
+    REQUIRE(buffer.pop(&sample));
+    requireStored(sample, trace[i]);
+  }
+  REQUIRE(buffer.isEmpty());
+}
+
+TEST_CASE("jumps and out of range values are kept or clamped", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  Trace trace = {
+    { 0xFFFFF000, 10, 400, 21.5f, 50 },
+    { 0x00000100, 11, 400, 21.5f, 50 },   // time wraps
+    { 0x80000000, 5000, 70000, -400, -1 },  // seq jumps, values past their range
+    { 0x80000001, 4999, 0, 400, 700 },
+  };
+  for (const TimeSeriesSample& sample : trace) {
+    buffer.append(sample);
+  }
+
+  TimeSeriesSample sample;
+  REQUIRE(buffer.pop(&sample));
+  requireStored(sample, trace[0]);
+  REQUIRE(buffer.pop(&sample));
+  requireStored(sample, trace[1]);
+  REQUIRE(buffer.pop(&sample));
+  REQUIRE(sample.time == 0x80000000);
+  REQUIRE(sample.seq == 5000);
+  REQUIRE(sample.c02Data == 0xFFFF);
+  REQUIRE(sample.temperatureData == Approx(INT16_MIN / 100.0f));
+  REQUIRE(sample.humidityData == 0);
+  REQUIRE(buffer.pop(&sample));
+  REQUIRE(sample.seq == 4999);
+  REQUIRE(sample.temperatureData == Approx(INT16_MAX / 100.0f));
+  REQUIRE(sample.humidityData == Approx(655.35f));
+  REQUIRE(buffer.isEmpty());
+}
+
+TEST_CASE("a full buffer drops its oldest block", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  buffer.setSpill(NULL);
+  uint32_t droppedBefore = buffer.getDropped();
+  Trace trace = indoorTrace(5000);
+  for (const TimeSeriesSample& sample : trace) {
+    buffer.append(sample);
+  }
+  REQUIRE(buffer.bytesUsed() <= TS_BLOCK_SIZE * TS_BLOCK_COUNT);
+  uint32_t dropped = buffer.getDropped() - droppedBefore;
+  REQUIRE(dropped > 0);
+  REQUIRE(buffer.count() + dropped == trace.size());
+
+  // the most recent history, in order
+  TimeSeriesSample sample;
+  for (size_t i = dropped; i < trace.size(); i++) {
+    REQUIRE(buffer.pop(&sample));
+    requireStored(sample, trace[i]);
+  }
+  REQUIRE(buffer.isEmpty());
+}
+
+TEST_CASE("samples read while appending come out once and in order", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  buffer.setSpill(NULL);
+  Trace trace = indoorTrace(20000);
+  std::mt19937 random(3);
+  size_t written = 0;
+  size_t read = 0;
+  size_t popped = 0;
+  uint32_t droppedBefore = buffer.getDropped();
+  TimeSeriesSample sample;
+  while (written < trace.size() || buffer.isEmpty() == false) {
+    if (written < trace.size() && random() % 100 < 55) {
+      buffer.append(trace[written++]);
+    } else if (buffer.pop(&sample)) {
+      // dropped blocks leave a gap, never a repeat
+      while (read < written && trace[read].time != sample.time) {
+        read++;
+      }
+      REQUIRE(read < written);
+      requireStored(sample, trace[read++]);
+      popped++;
+    }
+  }
+  REQUIRE(buffer.getDropped() - droppedBefore > 0);
+  REQUIRE(popped + buffer.getDropped() - droppedBefore == trace.size());
+}
+
+TEST_CASE("full blocks spill instead of being dropped", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  resetSpill();
+  buffer.setSpill(spillBlock);
+  uint32_t droppedBefore = buffer.getDropped();
+  Trace trace = indoorTrace(5000);
+  for (const TimeSeriesSample& sample : trace) {
+    buffer.append(sample);
+  }
+  REQUIRE(spilled.size() > 0);
+  REQUIRE(buffer.getDropped() == droppedBefore);
+
+  // spilled and held together are the whole trace
+  Trace replayed = replaySpilled();
+  TimeSeriesSample sample;
+  while (buffer.pop(&sample)) {
+    replayed.push_back(sample);
+  }
+  REQUIRE(replayed.size() == trace.size());
+  for (size_t i = 0; i < trace.size(); i++) {
+    requireStored(replayed[i], trace[i]);
+  }
+
+  SECTION("a spill target that refuses loses the block") {
+    resetSpill();
+    spillAccepts = false;
+    for (size_t i = 0; i < 2000; i++) {
+      buffer.append(trace[i]);
+    }
+    REQUIRE(buffer.getDropped() - droppedBefore + buffer.count() == 2000);
+  }
+  buffer.setSpill(NULL);
+}
+
+TEST_CASE("spillAll hands over the unread rest after a partial read", "[TimeSeriesBuffer]") {
+  buffer.clear();
+  resetSpill();
+  buffer.setSpill(spillBlock);
+  uint32_t droppedBefore = buffer.getDropped();
+  Trace trace = indoorTrace(600);
+  for (const TimeSeriesSample& sample : trace) {
+    buffer.append(sample);
+  }
+
+  // part way into the oldest block
+  size_t popped = GENERATE(0, 1, 17, 200, 599);
+  TimeSeriesSample sample;
+  for (size_t i = 0; i < popped; i++) {
+    REQUIRE(buffer.pop(&sample));
+  }
+  buffer.spillAll();
+  REQUIRE(buffer.isEmpty());
+  REQUIRE(buffer.bytesUsed() == 0);
+  REQUIRE(buffer.getDropped() == droppedBefore);
+
+  Trace replayed = replaySpilled();
+  REQUIRE(replayed.size() == trace.size() - popped);
+  for (size_t i = 0; i < replayed.size(); i++) {
+    requireStored(replayed[i], trace[popped + i]);
+  }
+
+  // the buffer starts afresh
+  buffer.append(trace[0]);
+  REQUIRE(buffer.pop(&sample));
+  requireStored(sample, trace[0]);
+  buffer.setSpill(NULL);
+}
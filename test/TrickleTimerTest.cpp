@@ -0,0 +1,151 @@
+#include <catch2/catch.hpp>
+
+#include <Arduino.h>
+#include <TrickleTimer.h>
+
+#include <vector>
+
+static const unsigned long IMIN = 1000;
+static const uint8_t DOUBLINGS = 3;
+static const unsigned long IMAX = IMIN << DOUBLINGS;
+
+// polls every ms in [from, to), returns when poll() said the broadcast is due
+static std::vector<unsigned long> run(TrickleTimer& timer, unsigned long from, unsigned long to) {
+  std::vector<unsigned long> fired;
+  for (unsigned long now = from; now < to; now++) {
+    if (timer.poll(now) == true) {
+      fired.push_back(now);
+    }
+  }
+  return fired;
+}
+
+TEST_CASE("the interval doubles up to Imax with one broadcast in the second half of each", "[TrickleTimer]") {
+  uint32_t seed = GENERATE(1, 2, 3, 4, 5, 6, 7, 8);
+  mockSeedRandom(seed);
+  TrickleTimer timer(IMIN, DOUBLINGS, TRICKLE_NO_SUPPRESSION);
+  timer.start(0);
+  REQUIRE(timer.getInterval() == IMIN);
+
+  std::vector<unsigned long> starts;
+  std::vector<unsigned long> lengths;
+  unsigned long start = 0;
+  unsigned long length = IMIN;
+  while (start < 20 * IMAX) {
+    starts.push_back(start);
+    lengths.push_back(length);
+    start += length;
+    length = std::min(length * 2, IMAX);
+  }
+
+  std::vector<unsigned long> fired = run(timer, 0, starts.back());
+  REQUIRE(fired.size() == starts.size() - 1);
+  for (size_t i = 0; i < fired.size(); i++) {
+    // t is drawn from [I/2, I)
+    REQUIRE(fired[i] >= starts[i] + lengths[i] / 2);
+    REQUIRE(fired[i] < starts[i] + lengths[i]);
+  }
+  REQUIRE(timer.getInterval() == IMAX);
+  REQUIRE(timer.getTransmitted() == fired.size());
+}
+
+TEST_CASE("t is spread over the whole second half", "[TrickleTimer]") {
+  mockSeedRandom(11);
+  int early = 0;
+  int late = 0;
+  for (int i = 0; i < 200; i++) {
+    TrickleTimer timer(IMIN, DOUBLINGS, TRICKLE_NO_SUPPRESSION);
+    timer.start(0);
+    std::vector<unsigned long> fired = run(timer, 0, IMIN);
+    REQUIRE(fired.size() == 1);
+    if (fired[0] < IMIN * 3 / 4) {
+      early++;
+    } else {
+      late++;
+    }
+  }
+  REQUIRE(early > 70);
+  REQUIRE(late > 70);
+}
+
+TEST_CASE("k consistent broadcasts heard suppress ours for the interval", "[TrickleTimer]") {
+  mockSeedRandom(3);
+  TrickleTimer timer(IMIN, DOUBLINGS, 2);
+  timer.start(0);
+
+  // one neighbour is not enough, the poll at the end of the interval starts the next
+  timer.hearConsistent();
+  REQUIRE(run(timer, 0, IMIN + 1).size() == 1);
+
+  // two are, in this interval only
+  timer.hearConsistent();
+  timer.hearConsistent();
+  REQUIRE(run(timer, IMIN + 1, 3 * IMIN + 1).empty());
+  REQUIRE(timer.getSuppressed() == 1);
+  REQUIRE(run(timer, 3 * IMIN + 1, 7 * IMIN + 1).size() == 1);
+
+  // suppression does not hold back the doubling
+  REQUIRE(timer.getInterval() == IMAX);
+  REQUIRE(timer.getTransmitted() == 2);
+}
+
+TEST_CASE("an inconsistency goes back to Imin", "[TrickleTimer]") {
+  mockSeedRandom(4);
+  TrickleTimer timer(IMIN, DOUBLINGS, 1);
+  timer.start(0);
+  run(timer, 0, 30 * IMIN);
+  REQUIRE(timer.getInterval() == IMAX);
+
+  unsigned long now = 30 * IMIN;
+  timer.hearInconsistent(now);
+  REQUIRE(timer.getInterval() == IMIN);
+  REQUIRE(timer.wait(now) >= IMIN / 2);
+  REQUIRE(timer.wait(now) < IMIN);
+  std::vector<unsigned long> fired = run(timer, now, now + IMIN);
+  REQUIRE(fired.size() == 1);
+  REQUIRE(fired[0] >= now + IMIN / 2);
+
+  SECTION("at Imin the interval goes on") {
+    TrickleTimer fresh(IMIN, DOUBLINGS, 1);
+    fresh.start(0);
+    unsigned long due = fresh.wait(0);
+    fresh.hearInconsistent(IMIN / 4);
+    REQUIRE(fresh.wait(IMIN / 4) == due - IMIN / 4);
+  }
+
+  SECTION("a stopped timer stays stopped") {
+    timer.stop();
+    timer.hearInconsistent(now + IMIN);
+    REQUIRE(timer.isRunning() == false);
+    REQUIRE(timer.poll(now + 2 * IMIN) == false);
+  }
+}
+
+TEST_CASE("a request is answered within Imin without resetting the interval", "[TrickleTimer]") {
+  mockSeedRandom(5);
+  TrickleTimer timer(IMIN, DOUBLINGS, 1);
+  timer.start(0);
+  run(timer, 0, 15 * IMIN + 1);
+  REQUIRE(timer.getInterval() == IMAX);
+  // just after the start of an Imax interval
+  unsigned long now = 15 * IMIN + 1;
+  REQUIRE(timer.wait(now) >= IMAX / 2 - 1);
+
+  SECTION("answered once") {
+    timer.answer(now);
+    std::vector<unsigned long> fired = run(timer, now, now + IMIN);
+    REQUIRE(fired.size() == 1);
+    REQUIRE(fired[0] >= now + IMIN / 2);
+    // it stands in for the broadcast of the interval
+    REQUIRE(run(timer, now + IMIN, 15 * IMIN + IMAX).empty());
+    REQUIRE(timer.getInterval() == IMAX);
+  }
+
+  SECTION("left out once k others answered") {
+    timer.answer(now);
+    timer.hearConsistent();
+    REQUIRE(run(timer, now, now + IMIN).empty());
+    REQUIRE(timer.getSuppressed() == 1);
+    REQUIRE(timer.getInterval() == IMAX);
+  }
+}
@@ -0,0 +1,72 @@
+/** Uplink Gateway Bindings
+ *  C entry points over UplinkDecoder, loaded by Master_Node/connector.py
+ *  with ctypes, so the host decodes the master's frames with the same
+ *  code the tests and benchmarks cover instead of a second decoder in
+ *  Python.
+ *
+ *  A decoder is handed out as an opaque pointer and freed by the caller.
+ *  The record accessors read the frame the last push completed.
+ */
+
+#include "SerialUplink.h"
+
+extern "C" {
+
+// sizes of the structs connector.py lays out itself, to check it against
+void uplinkLayout(size_t* sizes) {
+  sizes[0] = sizeof(UplinkReading);
+  sizes[1] = sizeof(LoraStatsRecord);
+  sizes[2] = sizeof(UplinkLog);
+}
+
+UplinkDecoder* uplinkDecoderNew() {
+  return new UplinkDecoder();
+}
+
+void uplinkDecoderFree(UplinkDecoder* decoder) {
+  delete decoder;
+}
+
+// feeds bytes up to the end of the first valid frame, returns how many were taken
+size_t uplinkDecoderPush(UplinkDecoder* decoder, const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (decoder->push(data[i]) == true) {
+      return i + 1;
+    }
+  }
+  return length;
+}
+
+int uplinkDecoderType(const UplinkDecoder* decoder) {
+  return decoder->type();
+}
+
+uint16_t uplinkDecoderSeq(const UplinkDecoder* decoder) {
+  return decoder->seq();
+}
+
+int uplinkDecoderCount(const UplinkDecoder* decoder) {
+  return decoder->count();
+}
+
+bool uplinkDecoderReading(const UplinkDecoder* decoder, int i, UplinkReading* reading) {
+  return decoder->reading(i, reading);
+}
+
+bool uplinkDecoderStats(const UplinkDecoder* decoder, int i, LoraStatsRecord* record) {
+  return decoder->stats(i, record);
+}
+
+bool uplinkDecoderLog(const UplinkDecoder* decoder, UplinkLog* log) {
+  return decoder->log(log);
+}
+
+uint32_t uplinkDecoderFrames(const UplinkDecoder* decoder) {
+  return decoder->getFrames();
+}
+
+uint32_t uplinkDecoderErrors(const UplinkDecoder* decoder) {
+  return decoder->getCrcErrors() + decoder->getFramingErrors();
+}
+
+}  // extern "C"
@@ -0,0 +1,153 @@
+/** Arduino
+ *  Host stand-in for the parts of the ESP32 Arduino core and FreeRTOS the
+ *  modules use, so they build and run in the host tests unchanged.
+ *
+ *  Time only moves when a test sets or advances it, delay() included, and
+ *  esp_random() draws from a seeded generator, so every run is repeatable.
+ *  Serial output is dropped unless the host asks for the frames written.
+ */
+
+#ifndef MOCK_ARDUINO_H
+#define MOCK_ARDUINO_H
+
+#define ARDUINO 10819
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "WString.h"
+
+using std::min;
+using std::max;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 1
+#define OUTPUT 3
+#define HEX 16
+#define DEC 10
+
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+uint32_t esp_random();
+int digitalRead(uint8_t pin);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+
+// host only: move the clock and reseed esp_random()
+void mockSetMillis(unsigned long now);
+void mockAdvanceMillis(unsigned long ms);
+void mockSeedRandom(uint32_t seed);
+
+// host only: the level digitalRead() returns for a pin, digitalWrite() sets it too
+void mockSetPin(uint8_t pin, int level);
+
+class HardwareSerial {
+public:
+  void begin(unsigned long) {}
+  void flush() {}
+  int available() {
+    return 0;
+  }
+  int read() {
+    return -1;
+  }
+  size_t write(uint8_t) {
+    return 1;
+  }
+  size_t write(const uint8_t* data, size_t length) {
+    if (output != NULL) {
+      output(data, length);
+    }
+    return length;
+  }
+  void setTxBufferSize(size_t) {}
+  size_t printf(const char*, ...) __attribute__((format(printf, 2, 3))) {
+    return 0;
+  }
+  template<typename T>
+  size_t print(const T&, int = DEC) {
+    return 0;
+  }
+  template<typename T>
+  size_t println(const T&, int = DEC) {
+    return 0;
+  }
+  size_t println() {
+    return 0;
+  }
+
+  // host only: gets the buffers written, NULL drops them
+  void (*output)(const uint8_t* data, size_t length) = NULL;
+};
+
+extern HardwareSerial Serial;
+
+// FreeRTOS, tasks are never started and locks are always free on the host
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) (ms)
+
+inline BaseType_t xTaskCreate(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*) {
+  return pdFAIL;
+}
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*,
+                                          BaseType_t) {
+  return pdFAIL;
+}
+inline void vTaskDelete(TaskHandle_t) {}
+// without tasks nobody waits for a notification, the host runs the task bodies itself
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) {
+  return 0;
+}
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+inline void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return NULL;
+}
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) {
+  return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) {
+  return pdTRUE;
+}
+
+class EspClass {
+public:
+  // host only: how often the sketch gave up and asked for a restart
+  void restart() {
+    restarts++;
+  }
+  uint32_t restarts = 0;
+};
+
+extern EspClass ESP;
+
+inline char* dtostrf(double value, signed char width, unsigned char precision, char* buffer) {
+  sprintf(buffer, "%*.*f", width, precision, value);
+  return buffer;
+}
+
+#endif  // MOCK_ARDUINO_H
@@ -0,0 +1,163 @@
+#include "FS.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs {
+
+File::Handle::~Handle() {
+  if (mode[0] != 'r' && owner->operate() == true) {
+    file = fopen(path.c_str(), mode[0] == 'w' ? "wb" : "ab");
+    if (file != NULL) {
+      fwrite(pending.data(), 1, pending.size(), file);
+    }
+  }
+  if (file != NULL) {
+    fclose(file);
+  }
+  if (dir != NULL) {
+    closedir(dir);
+  }
+}
+
+size_t File::write(const uint8_t* data, size_t length) {
+  if (handle == NULL || handle->mode[0] == 'r') {
+    return 0;
+  }
+  FS* owner = handle->owner;
+  if (owner->capacity > 0 && owner->bytesUsed() + handle->pending.size() + length > owner->capacity) {
+    return 0;
+  }
+  handle->pending.append((const char*)data, length);
+  return length;
+}
+
+size_t File::read(uint8_t* data, size_t length) {
+  if (handle == NULL || handle->file == NULL) {
+    return 0;
+  }
+  return fread(data, 1, length, handle->file);
+}
+
+bool File::seek(uint32_t position) {
+  return handle != NULL && handle->file != NULL && fseek(handle->file, position, SEEK_SET) == 0;
+}
+
+size_t File::size() const {
+  struct stat status;
+  if (handle == NULL || stat(handle->path.c_str(), &status) != 0) {
+    return 0;
+  }
+  return status.st_size;
+}
+
+const char* File::name() const {
+  return handle != NULL ? handle->name.c_str() : "";
+}
+
+void File::close() {
+  handle.reset();
+}
+
+File File::openNextFile() {
+  File next;
+  if (handle == NULL || handle->dir == NULL) {
+    return next;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(handle->dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    next.handle = std::make_shared<Handle>();
+    next.handle->path = handle->path + "/" + entry->d_name;
+    next.handle->name = handle->name + "/" + entry->d_name;
+    next.handle->file = fopen(next.handle->path.c_str(), "rb");
+    return next;
+  }
+  return next;
+}
+
+File FS::open(const char* path, const char* mode) {
+  File opened;
+  std::string full = root + path;
+  struct stat status;
+  if (mode[0] == 'r' && stat(full.c_str(), &status) == 0 && S_ISDIR(status.st_mode)) {
+    DIR* dir = opendir(full.c_str());
+    if (dir != NULL) {
+      opened.handle = std::make_shared<File::Handle>();
+      opened.handle->dir = dir;
+    }
+  } else if (mode[0] == 'r') {
+    FILE* file = fopen(full.c_str(), "rb");
+    if (file != NULL) {
+      opened.handle = std::make_shared<File::Handle>();
+      opened.handle->file = file;
+    }
+  } else {
+    // the file is written on close, it only needs a directory to go to
+    std::string parent = full.substr(0, full.rfind('/'));
+    if (stat(parent.c_str(), &status) == 0 && S_ISDIR(status.st_mode)) {
+      opened.handle = std::make_shared<File::Handle>();
+      opened.handle->mode = mode;
+    }
+  }
+  if (opened) {
+    opened.handle->path = full;
+    opened.handle->name = path;
+    opened.handle->owner = this;
+  }
+  return opened;
+}
+
+bool FS::exists(const char* path) {
+  struct stat status;
+  return stat((root + path).c_str(), &status) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+  return operate() == true && ::mkdir((root + path).c_str(), 0755) == 0;
+}
+
+bool FS::remove(const char* path) {
+  return operate() == true && unlink((root + path).c_str()) == 0;
+}
+
+// counts down to the power cut, false once it has happened
+bool FS::operate() {
+  if (powerLeft == 0) {
+    return false;
+  }
+  if (powerLeft > 0) {
+    powerLeft--;
+  }
+  return true;
+}
+
+static size_t directoryBytes(const std::string& path) {
+  size_t bytes = 0;
+  DIR* dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return 0;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    std::string child = path + "/" + entry->d_name;
+    struct stat status;
+    if (stat(child.c_str(), &status) == 0) {
+      bytes += S_ISDIR(status.st_mode) ? directoryBytes(child) : status.st_size;
+    }
+  }
+  closedir(dir);
+  return bytes;
+}
+
+size_t FS::bytesUsed() const {
+  return directoryBytes(root.empty() ? "." : root);
+}
+
+}  // namespace fs
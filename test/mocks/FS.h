@@ -0,0 +1,117 @@
+/** FS
+ *  Host stand-in for the Arduino FS API, backed by a directory on the host
+ *  so what a module writes outlives the object that wrote it, the way
+ *  flash outlives a reboot. A test mounts a fresh directory for each case.
+ *
+ *  Like LittleFS, what is written to a file is committed when it is
+ *  closed, as a whole: a file opened for writing keeps its old contents
+ *  until then. Tests can limit the capacity, so writes fail once flash is
+ *  full, and cut the power after a number of commits, removes and
+ *  mkdirs, so everything after that point is lost as if the board died.
+ */
+
+#ifndef MOCK_FS_H
+#define MOCK_FS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+class FS;
+
+class File {
+public:
+  File() {}
+
+  operator bool() const {
+    return handle != NULL;
+  }
+
+  size_t write(const uint8_t* data, size_t length);
+  size_t read(uint8_t* data, size_t length);
+  bool seek(uint32_t position);
+  size_t size() const;
+  const char* name() const;
+  void close();
+  File openNextFile();
+
+private:
+  friend class FS;
+
+  struct Handle {
+    std::string path;  // on the host
+    std::string name;  // as the module named it
+    FILE* file = NULL;
+    DIR* dir = NULL;
+    FS* owner = NULL;
+    const char* mode = FILE_READ;
+    std::string pending;  // written, committed on close
+    ~Handle();
+  };
+
+  std::shared_ptr<Handle> handle;
+};
+
+class FS {
+public:
+  // files live under root on the host
+  explicit FS(const std::string& root = "") : root(root) {}
+
+  File open(const char* path, const char* mode = FILE_READ);
+  bool exists(const char* path);
+  bool mkdir(const char* path);
+  bool remove(const char* path);
+
+  // host only: move the filesystem to another directory
+  void mount(const std::string& directory) {
+    root = directory;
+  }
+
+  // host only: fail writes that would take more than this many bytes in
+  // all, 0 for no limit
+  void setCapacity(size_t bytes) {
+    capacity = bytes;
+  }
+
+  // host only: allow this many more commits, removes and mkdirs, then lose
+  // every later one until powerOn()
+  void cutPowerAfter(unsigned long operations) {
+    powerLeft = operations;
+  }
+
+  void powerOn() {
+    powerLeft = -1;
+  }
+
+  bool isPowered() const {
+    return powerLeft != 0;
+  }
+
+  // host only: bytes in the files under root
+  size_t bytesUsed() const;
+
+private:
+  friend class File;
+
+  std::string root;
+  size_t capacity = 0;
+  long powerLeft = -1;  // operations until the power is cut, -1 for never
+
+  bool operate();
+};
+
+}  // namespace fs
+
+using fs::FS;
+using fs::File;
+
+#endif  // MOCK_FS_H
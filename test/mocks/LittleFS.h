@@ -0,0 +1,15 @@
+#ifndef MOCK_LITTLEFS_H
+#define MOCK_LITTLEFS_H
+
+#include "FS.h"
+
+class LittleFSFS : public fs::FS {
+public:
+  bool begin(bool /* formatOnFail */ = false) {
+    return true;
+  }
+};
+
+extern LittleFSFS LittleFS;
+
+#endif  // MOCK_LITTLEFS_H
@@ -0,0 +1,226 @@
+// globals of the host stand-ins, one translation unit for all of them
+#include "Arduino.h"
+#include "WiFi.h"
+#include "Wire.h"
+#include "SPI.h"
+#include "LittleFS.h"
+#include "SensirionI2CScd4x.h"
+#include "esp_sleep.h"
+#include "esp_now.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+TwoWire Wire;
+SPIClass SPI;
+LittleFSFS LittleFS;
+
+static unsigned long clockMs = 0;
+static uint32_t randomState = 1;
+static int pinLevels[64] = {};
+static uint64_t sleepTimerUs = 0;
+static unsigned long pinWakeMs = 0;
+
+// the ESP-NOW driver: its peer list and TX queue, empty while not initialised
+static bool espNowStarted = false;
+static esp_now_recv_cb_t espNowReceiveCallback = NULL;
+static esp_now_send_cb_t espNowSendCallback = NULL;
+static uint8_t espNowPeers[ESP_NOW_MAX_TOTAL_PEER_NUM][ESP_NOW_ETH_ALEN];
+static int espNowPeerCount = 0;
+static MockEspNowFrame espNowQueue[MOCK_ESPNOW_TX_QUEUE];
+static int espNowQueueHead = 0;
+static int espNowQueueCount = 0;
+
+unsigned long millis() {
+  return clockMs;
+}
+
+unsigned long micros() {
+  return clockMs * 1000;
+}
+
+void delay(unsigned long ms) {
+  clockMs += ms;
+}
+
+// xorshift32, only has to be repeatable
+uint32_t esp_random() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < 64 ? pinLevels[pin] : LOW;
+}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  mockSetPin(pin, level);
+}
+
+void mockSetMillis(unsigned long now) {
+  clockMs = now;
+}
+
+void mockAdvanceMillis(unsigned long ms) {
+  clockMs += ms;
+}
+
+void mockSeedRandom(uint32_t seed) {
+  randomState = seed != 0 ? seed : 1;
+}
+
+void mockSetPin(uint8_t pin, int level) {
+  if (pin < 64) {
+    pinLevels[pin] = level;
+  }
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us) {
+  sleepTimerUs = us;
+  return 0;
+}
+
+esp_err_t esp_light_sleep_start() {
+  unsigned long ms = (unsigned long)(sleepTimerUs / 1000);
+  if (pinWakeMs > 0 && pinWakeMs < ms) {
+    ms = pinWakeMs;
+  }
+  pinWakeMs = 0;
+  clockMs += ms;
+  return 0;
+}
+
+void mockWakeAfter(unsigned long ms) {
+  pinWakeMs = ms;
+}
+
+void errorToString(uint16_t error, char* message, size_t length) {
+  snprintf(message, length, "error %u", error);
+}
+
+static int findEspNowPeer(const uint8_t* peerAddr) {
+  for (int i = 0; i < espNowPeerCount; i++) {
+    if (memcmp(espNowPeers[i], peerAddr, ESP_NOW_ETH_ALEN) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+esp_err_t esp_now_init() {
+  espNowStarted = true;
+  return ESP_OK;
+}
+
+// the driver forgets its peers and drops what it had not sent yet
+esp_err_t esp_now_deinit() {
+  espNowStarted = false;
+  espNowPeerCount = 0;
+  espNowQueueCount = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t callback) {
+  if (espNowStarted == false) {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  espNowReceiveCallback = callback;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_recv_cb() {
+  espNowReceiveCallback = NULL;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t callback) {
+  if (espNowStarted == false) {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  espNowSendCallback = callback;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_send_cb() {
+  espNowSendCallback = NULL;
+  return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer) {
+  if (espNowStarted == false) {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  if (findEspNowPeer(peer->peer_addr) >= 0) {
+    return ESP_ERR_ESPNOW_EXIST;
+  }
+  if (espNowPeerCount == ESP_NOW_MAX_TOTAL_PEER_NUM) {
+    return ESP_ERR_ESPNOW_FULL;
+  }
+  memcpy(espNowPeers[espNowPeerCount++], peer->peer_addr, ESP_NOW_ETH_ALEN);
+  return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t* peerAddr) {
+  int i = findEspNowPeer(peerAddr);
+  if (i < 0) {
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+  }
+  memcpy(espNowPeers[i], espNowPeers[--espNowPeerCount], ESP_NOW_ETH_ALEN);
+  return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t* peerAddr) {
+  return findEspNowPeer(peerAddr) >= 0;
+}
+
+esp_err_t esp_now_send(const uint8_t* peerAddr, const uint8_t* data, size_t length) {
+  if (espNowStarted == false) {
+    return ESP_ERR_ESPNOW_NOT_INIT;
+  }
+  if (peerAddr == NULL || length == 0 || length > ESP_NOW_MAX_DATA_LEN) {
+    return ESP_ERR_ESPNOW_ARG;
+  }
+  if (findEspNowPeer(peerAddr) < 0) {
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+  }
+  if (espNowQueueCount == MOCK_ESPNOW_TX_QUEUE) {
+    return ESP_ERR_ESPNOW_NO_MEM;
+  }
+  MockEspNowFrame& frame = espNowQueue[(espNowQueueHead + espNowQueueCount++) % MOCK_ESPNOW_TX_QUEUE];
+  memcpy(frame.peerAddr, peerAddr, ESP_NOW_ETH_ALEN);
+  memcpy(frame.data, data, length);
+  frame.length = length;
+  return ESP_OK;
+}
+
+const MockEspNowFrame* mockEspNowPending() {
+  return espNowQueueCount > 0 ? &espNowQueue[espNowQueueHead] : NULL;
+}
+
+int mockEspNowQueued() {
+  return espNowQueueCount;
+}
+
+void mockEspNowSendDone(esp_now_send_status_t status) {
+  if (espNowQueueCount == 0) {
+    return;
+  }
+  // the callback may queue the next frame, the slot is free by then
+  uint8_t peerAddr[ESP_NOW_ETH_ALEN];
+  memcpy(peerAddr, espNowQueue[espNowQueueHead].peerAddr, ESP_NOW_ETH_ALEN);
+  espNowQueueHead = (espNowQueueHead + 1) % MOCK_ESPNOW_TX_QUEUE;
+  espNowQueueCount--;
+  if (espNowSendCallback != NULL) {
+    espNowSendCallback(peerAddr, status);
+  }
+}
+
+void mockEspNowReceive(const uint8_t* macAddr, const uint8_t* data, int dataLen) {
+  if (espNowStarted == true && espNowReceiveCallback != NULL) {
+    espNowReceiveCallback(macAddr, data, dataLen);
+  }
+}
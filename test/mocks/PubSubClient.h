@@ -0,0 +1,7 @@
+// included by the ESP-NOW stack, nothing of the MQTT client is used on the host
+#ifndef MOCK_PUBSUBCLIENT_H
+#define MOCK_PUBSUBCLIENT_H
+
+class PubSubClient {};
+
+#endif  // MOCK_PUBSUBCLIENT_H
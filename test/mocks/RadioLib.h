@@ -0,0 +1,137 @@
+/** RadioLib
+ *  Host stand-in for the SX1280 driver. A test puts frames on air with
+ *  mockReceive(), which raises DIO1 like a real arrival, and ends the frame
+ *  being sent with mockTransmitDone(). The last frame sent is kept for
+ *  the test to decode, with the millis() it started at. Nothing here
+ *  touches the heap.
+ */
+
+#ifndef MOCK_RADIOLIB_H
+#define MOCK_RADIOLIB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "Arduino.h"
+
+#define RADIOLIB_ERR_NONE 0
+#define RADIOLIB_ERR_PACKET_TOO_LONG -4
+#define RADIOLIB_ERR_CRC_MISMATCH -7
+#define RADIOLIB_ERR_INVALID_BANDWIDTH -8
+#define RADIOLIB_ERR_INVALID_SPREADING_FACTOR -9
+#define RADIOLIB_ERR_INVALID_CODING_RATE -10
+#define RADIOLIB_ERR_INVALID_FREQUENCY -12
+#define RADIOLIB_ERR_INVALID_OUTPUT_POWER -13
+
+#define MOCK_RADIO_MAX_LENGTH 255
+
+class Module {
+public:
+  Module(int, int, int, int) {}
+};
+
+class SX1280 {
+public:
+  SX1280(Module*) {}
+
+  int begin() {
+    return RADIOLIB_ERR_NONE;
+  }
+  void setRfSwitchPins(int, int) {}
+  int setOutputPower(int8_t) {
+    return RADIOLIB_ERR_NONE;
+  }
+  int setFrequency(float) {
+    return RADIOLIB_ERR_NONE;
+  }
+  int setBandwidth(float) {
+    return RADIOLIB_ERR_NONE;
+  }
+  int setSpreadingFactor(uint8_t sf) {
+    if (sf < 5 || sf > 12) {
+      return RADIOLIB_ERR_INVALID_SPREADING_FACTOR;
+    }
+    spreadingFactor = sf;
+    return RADIOLIB_ERR_NONE;
+  }
+  int setCodingRate(uint8_t) {
+    return RADIOLIB_ERR_NONE;
+  }
+  void setDio1Action(void (*action)(void)) {
+    dio1 = action;
+  }
+
+  int startTransmit(const uint8_t* data, size_t length) {
+    if (length > MOCK_RADIO_MAX_LENGTH) {
+      return RADIOLIB_ERR_PACKET_TOO_LONG;
+    }
+    memcpy(sent, data, length);
+    sentLength = length;
+    sentCount++;
+    sentTime = millis();
+    transmitting = true;
+    return RADIOLIB_ERR_NONE;
+  }
+  int startTransmit(const char* text) {
+    return startTransmit((const uint8_t*)text, strlen(text));
+  }
+  int startReceive() {
+    transmitting = false;
+    return RADIOLIB_ERR_NONE;
+  }
+  int sleep() {
+    return RADIOLIB_ERR_NONE;
+  }
+
+  size_t getPacketLength() {
+    return receivedLength;
+  }
+  int readData(uint8_t* data, size_t length) {
+    memcpy(data, received, length < receivedLength ? length : receivedLength);
+    return receiveState;
+  }
+  float getSNR() {
+    return snr;
+  }
+  float getRSSI() {
+    return rssi;
+  }
+
+  // host only: a frame arrives, DIO1 is raised
+  void mockReceive(const uint8_t* data, size_t length, float frameSnr = 10.0f, float frameRssi = -60.0f,
+                   int state = RADIOLIB_ERR_NONE) {
+    memcpy(received, data, length);
+    receivedLength = length;
+    snr = frameSnr;
+    rssi = frameRssi;
+    receiveState = state;
+    if (dio1 != NULL) {
+      dio1();
+    }
+  }
+
+  // host only: the frame being sent is out, DIO1 is raised
+  void mockTransmitDone() {
+    if (dio1 != NULL) {
+      dio1();
+    }
+  }
+
+  uint8_t sent[MOCK_RADIO_MAX_LENGTH];
+  size_t sentLength = 0;
+  uint32_t sentCount = 0;
+  unsigned long sentTime = 0;
+  bool transmitting = false;
+  uint8_t spreadingFactor = 0;
+
+private:
+  void (*dio1)(void) = NULL;
+  uint8_t received[MOCK_RADIO_MAX_LENGTH];
+  size_t receivedLength = 0;
+  float snr = 0.0f;
+  float rssi = 0.0f;
+  int receiveState = RADIOLIB_ERR_NONE;
+};
+
+#endif  // MOCK_RADIOLIB_H
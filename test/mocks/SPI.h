@@ -0,0 +1,16 @@
+#ifndef MOCK_SPI_H
+#define MOCK_SPI_H
+
+#define FSPI 0
+#define HSPI 1
+
+class SPIClass {
+public:
+  SPIClass() {}
+  explicit SPIClass(int) {}
+  void begin(int, int, int) {}
+};
+
+extern SPIClass SPI;
+
+#endif  // MOCK_SPI_H
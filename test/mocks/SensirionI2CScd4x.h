@@ -0,0 +1,44 @@
+// an SCD4x with a sample ready unless a test says otherwise, of the values a test sets
+#ifndef MOCK_SENSIRION_I2C_SCD4X_H
+#define MOCK_SENSIRION_I2C_SCD4X_H
+
+#include <stdint.h>
+#include "Arduino.h"
+#include "Wire.h"
+
+class SensirionI2CScd4x {
+public:
+  void begin(TwoWire&) {}
+  uint16_t startPeriodicMeasurement() {
+    return 0;
+  }
+  uint16_t startLowPowerPeriodicMeasurement() {
+    return 0;
+  }
+  uint16_t stopPeriodicMeasurement() {
+    return 0;
+  }
+  uint16_t getSerialNumber(uint16_t& serial0, uint16_t& serial1, uint16_t& serial2) {
+    serial0 = serial1 = serial2 = 0;
+    return 0;
+  }
+  uint16_t getDataReadyFlag(bool& ready) {
+    ready = dataReady;
+    return 0;
+  }
+  uint16_t readMeasurement(uint16_t& co2, float& temperature, float& humidity) {
+    co2 = this->co2;
+    temperature = this->temperature;
+    humidity = this->humidity;
+    return 0;
+  }
+
+  bool dataReady = true;
+  uint16_t co2 = 420;
+  float temperature = 27.5f;
+  float humidity = 65.0f;
+};
+
+void errorToString(uint16_t error, char* message, size_t length);
+
+#endif  // MOCK_SENSIRION_I2C_SCD4X_H
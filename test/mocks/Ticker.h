@@ -0,0 +1,14 @@
+// the master's LED blinker, the host never calls it back
+#ifndef MOCK_TICKER_H
+#define MOCK_TICKER_H
+
+#include <stdint.h>
+
+class Ticker {
+public:
+  template<typename Callback>
+  void attach_ms(uint32_t, Callback) {}
+  void detach() {}
+};
+
+#endif  // MOCK_TICKER_H
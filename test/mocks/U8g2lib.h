@@ -0,0 +1,37 @@
+// the master's OLED, the host has no display so nothing is drawn
+#ifndef MOCK_U8G2LIB_H
+#define MOCK_U8G2LIB_H
+
+#include <stdint.h>
+
+#define U8G2_R0 0
+#define U8X8_PIN_NONE 255
+
+// fonts are only handed back to setFont()
+static const uint8_t u8g2_font_inb19_mr[1] = {};
+static const uint8_t u8g2_font_inb19_mf[1] = {};
+static const uint8_t u8g2_font_fur11_tf[1] = {};
+
+class U8G2_SSD1306_128X64_NONAME_F_HW_I2C {
+public:
+  U8G2_SSD1306_128X64_NONAME_F_HW_I2C(int, uint8_t) {}
+  bool begin() {
+    return true;
+  }
+  void clearBuffer() {}
+  void sendBuffer() {}
+  void firstPage() {}
+  uint8_t nextPage() {
+    return 0;
+  }
+  void setFlipMode(uint8_t) {}
+  void setFontMode(uint8_t) {}
+  void setDrawColor(uint8_t) {}
+  void setFontDirection(uint8_t) {}
+  void setFont(const uint8_t*) {}
+  void drawStr(int, int, const char*) {}
+  void drawHLine(int, int, int) {}
+  void drawVLine(int, int, int) {}
+};
+
+#endif  // MOCK_U8G2LIB_H
@@ -0,0 +1,63 @@
+// Arduino String over std::string, only what the modules call
+#ifndef MOCK_WSTRING_H
+#define MOCK_WSTRING_H
+
+#include <string>
+
+class String {
+public:
+  String() {}
+  String(const char* text) : text(text) {}
+  String(const std::string& text) : text(text) {}
+  explicit String(int value) : text(std::to_string(value)) {}
+  explicit String(unsigned int value) : text(std::to_string(value)) {}
+  explicit String(long value) : text(std::to_string(value)) {}
+  explicit String(unsigned long value) : text(std::to_string(value)) {}
+
+  const char* c_str() const {
+    return text.c_str();
+  }
+  unsigned int length() const {
+    return text.size();
+  }
+  char charAt(unsigned int index) const {
+    return index < text.size() ? text[index] : 0;
+  }
+  char operator[](unsigned int index) const {
+    return charAt(index);
+  }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t at = text.find(c, from);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  String substring(unsigned int from) const {
+    return from < text.size() ? String(text.substr(from)) : String();
+  }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < to && from < text.size() ? String(text.substr(from, to - from)) : String();
+  }
+  long toInt() const {
+    return strtol(text.c_str(), NULL, 10);
+  }
+  float toFloat() const {
+    return strtof(text.c_str(), NULL);
+  }
+  String& operator+=(const String& other) {
+    text += other.text;
+    return *this;
+  }
+  friend String operator+(const String& a, const String& b) {
+    return String(a.text + b.text);
+  }
+  friend bool operator==(const String& a, const String& b) {
+    return a.text == b.text;
+  }
+  friend bool operator!=(const String& a, const String& b) {
+    return a.text != b.text;
+  }
+
+private:
+  std::string text;
+};
+
+#endif  // MOCK_WSTRING_H
@@ -0,0 +1,23 @@
+#ifndef MOCK_WIFI_H
+#define MOCK_WIFI_H
+
+#include "Arduino.h"
+
+#define WIFI_STA 1
+#define WIFI_AP_STA 3
+
+class WiFiClass {
+public:
+  void mode(int) {}
+  void disconnect() {}
+  String macAddress() {
+    return String(address);
+  }
+
+  // host only: the address macAddress() reports
+  char address[18] = "24:6f:28:00:00:01";
+};
+
+extern WiFiClass WiFi;
+
+#endif  // MOCK_WIFI_H
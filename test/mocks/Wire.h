@@ -0,0 +1,21 @@
+#ifndef MOCK_WIRE_H
+#define MOCK_WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class TwoWire {
+public:
+  void begin(int, int) {}
+  void beginTransmission(uint8_t) {}
+  size_t write(uint8_t) {
+    return 1;
+  }
+  uint8_t endTransmission() {
+    return 0;
+  }
+};
+
+extern TwoWire Wire;
+
+#endif  // MOCK_WIRE_H
@@ -0,0 +1,83 @@
+/** esp_now
+ *  Host stand-in for the ESP-NOW driver. esp_now_send() queues a frame in
+ *  the driver's TX queue, from where the host takes it on air: it reads
+ *  the frame with mockEspNowPending() and ends it with mockEspNowSendDone(),
+ *  which calls the send callback as the Wi-Fi task would. mockEspNowReceive()
+ *  calls the receive callback. The peer list is kept, a send to a peer
+ *  never added fails as it does on the board. Nothing here touches the heap.
+ */
+
+#ifndef MOCK_ESP_NOW_H
+#define MOCK_ESP_NOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_KEY_LEN 16
+#define ESP_NOW_MAX_DATA_LEN 250
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+
+#define ESP_ERR_ESPNOW_BASE 0x3000
+#define ESP_ERR_ESPNOW_NOT_INIT (ESP_ERR_ESPNOW_BASE + 1)
+#define ESP_ERR_ESPNOW_ARG (ESP_ERR_ESPNOW_BASE + 2)
+#define ESP_ERR_ESPNOW_NO_MEM (ESP_ERR_ESPNOW_BASE + 3)
+#define ESP_ERR_ESPNOW_FULL (ESP_ERR_ESPNOW_BASE + 4)
+#define ESP_ERR_ESPNOW_NOT_FOUND (ESP_ERR_ESPNOW_BASE + 5)
+#define ESP_ERR_ESPNOW_INTERNAL (ESP_ERR_ESPNOW_BASE + 6)
+#define ESP_ERR_ESPNOW_EXIST (ESP_ERR_ESPNOW_BASE + 7)
+#define ESP_ERR_ESPNOW_IF (ESP_ERR_ESPNOW_BASE + 8)
+
+// frames the driver holds before esp_now_send() runs out of buffers
+#define MOCK_ESPNOW_TX_QUEUE 32
+
+typedef enum {
+  ESP_NOW_SEND_SUCCESS = 0,
+  ESP_NOW_SEND_FAIL,
+} esp_now_send_status_t;
+
+typedef struct esp_now_peer_info {
+  uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+  uint8_t lmk[ESP_NOW_KEY_LEN];
+  uint8_t channel;
+  int ifidx;
+  bool encrypt;
+  void* priv;
+} esp_now_peer_info_t;
+
+typedef void (*esp_now_recv_cb_t)(const uint8_t* macAddr, const uint8_t* data, int dataLen);
+typedef void (*esp_now_send_cb_t)(const uint8_t* macAddr, esp_now_send_status_t status);
+
+esp_err_t esp_now_init();
+esp_err_t esp_now_deinit();
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t callback);
+esp_err_t esp_now_unregister_recv_cb();
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t callback);
+esp_err_t esp_now_unregister_send_cb();
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer);
+esp_err_t esp_now_del_peer(const uint8_t* peerAddr);
+bool esp_now_is_peer_exist(const uint8_t* peerAddr);
+esp_err_t esp_now_send(const uint8_t* peerAddr, const uint8_t* data, size_t length);
+
+// host only: a frame in the TX queue
+typedef struct MockEspNowFrame {
+  uint8_t peerAddr[ESP_NOW_ETH_ALEN];
+  uint8_t data[ESP_NOW_MAX_DATA_LEN];
+  size_t length;
+} MockEspNowFrame;
+
+// host only: the frame that goes on air next, NULL while the queue is empty
+const MockEspNowFrame* mockEspNowPending();
+
+// host only: frames in the TX queue, the pending one included
+int mockEspNowQueued();
+
+// host only: the pending frame is out, the send callback gets its status
+void mockEspNowSendDone(esp_now_send_status_t status);
+
+// host only: a frame arrives, the receive callback gets it
+void mockEspNowReceive(const uint8_t* macAddr, const uint8_t* data, int dataLen);
+
+#endif  // MOCK_ESP_NOW_H
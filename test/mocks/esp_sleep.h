@@ -0,0 +1,32 @@
+#ifndef MOCK_ESP_SLEEP_H
+#define MOCK_ESP_SLEEP_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+  ESP_SLEEP_WAKEUP_TIMER = 4,
+  ESP_SLEEP_WAKEUP_GPIO = 7,
+} esp_sleep_source_t;
+
+// a light sleep moves the clock until the timer, or until the wake a test set
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us);
+esp_err_t esp_light_sleep_start();
+
+inline esp_err_t esp_sleep_enable_gpio_wakeup() {
+  return 0;
+}
+inline esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t) {
+  return 0;
+}
+inline esp_sleep_source_t esp_sleep_get_wakeup_cause() {
+  return ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+inline void esp_deep_sleep_start() {}
+
+// host only: the next light sleep is woken by a pin after ms, if its timer is later
+void mockWakeAfter(unsigned long ms);
+
+#endif  // MOCK_ESP_SLEEP_H